@@ -0,0 +1,123 @@
+#include "bounce.h"
+#include "wave.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+Bounce::Bounce() :
+    m_fdSource(-1),
+    m_fdMix(-1),
+    m_lNextBlock(0),
+    m_lDone(0),
+    m_bError(false),
+    m_nProgress(0),
+    m_dSeconds(0)
+{
+}
+
+bool Bounce::Run(int fdSource, off_t offStart, unsigned int nChannels, long lFrames, unsigned int nSampleRate,
+    TakeStore* pTakes, const std::vector<Track>& vTracks, const std::string& sFilename)
+{
+    timespec tsStart, tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+    m_nProgress = 0;
+    if(fdSource < 0 || 0 == nChannels || vTracks.size() < nChannels)
+        return false;
+    m_fdMix = open(sFilename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(m_fdMix < 0)
+        return false;
+    m_fdSource = fdSource;
+    m_offStart = offStart;
+    m_nChannels = nChannels;
+    m_lFrames = lFrames;
+    m_pTakes = pTakes;
+    m_vTracks = vTracks;
+    m_lNextBlock = 0;
+    m_lDone = 0;
+    m_bError = false;
+    posix_fadvise(m_fdSource, m_offStart, lFrames * nChannels * sizeof(float), POSIX_FADV_SEQUENTIAL);
+    WriteWaveHeader(m_fdMix, lFrames * 2 * sizeof(float), 2, nSampleRate);
+
+    //Each thread reads, mixes and writes whole blocks so reading, mixing and writing overlap across threads
+    unsigned int nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nThreads < 1)
+        nThreads = 1;
+    if(nThreads > BOUNCE_MAX_THREADS)
+        nThreads = BOUNCE_MAX_THREADS;
+    std::vector<pthread_t> vThreads;
+    for(unsigned int i = 1; i < nThreads; ++i)
+    {
+        pthread_t thread;
+        if(0 == pthread_create(&thread, NULL, WorkerThread, this))
+            vThreads.push_back(thread);
+    }
+    Work();
+    for(std::vector<pthread_t>::iterator it = vThreads.begin(); it != vThreads.end(); ++it)
+        pthread_join(*it, NULL);
+
+    fdatasync(m_fdMix);
+    close(m_fdMix);
+    m_fdMix = -1;
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    m_dSeconds = tsEnd.tv_sec - tsStart.tv_sec + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+    m_nProgress = 100;
+    return !m_bError;
+}
+
+void* Bounce::WorkerThread(void* pArgs)
+{
+    ((Bounce*)pArgs)->Work();
+    return NULL;
+}
+
+void Bounce::Work()
+{
+    size_t nFrameSize = m_nChannels * sizeof(float);
+    std::vector<float> vBlock(BOUNCE_BLOCK_FRAMES * m_nChannels);
+    std::vector<float> vMix(BOUNCE_BLOCK_FRAMES * 2);
+    while(!m_bError)
+    {
+        long lFrame = m_lNextBlock++ * BOUNCE_BLOCK_FRAMES;
+        if(lFrame >= m_lFrames)
+            break;
+        long lCount = m_lFrames - lFrame;
+        if(lCount > BOUNCE_BLOCK_FRAMES)
+            lCount = BOUNCE_BLOCK_FRAMES;
+
+        //Read same data as the disk stream would
+        size_t nSize = lCount * nFrameSize;
+        ssize_t nRead = pread(m_fdSource, &vBlock[0], nSize, m_offStart + lFrame * nFrameSize);
+        size_t nValid = nRead > 0 ? nRead : 0;
+        if(nValid < nSize)
+            memset((char*)&vBlock[0] + nValid, 0, nSize - nValid);
+        if(m_pTakes)
+            m_pTakes->Overlay(&vBlock[0], m_nChannels, lFrame, lCount);
+
+        //Mix each track to the outputs it is connected to
+        const float* pFrame = &vBlock[0];
+        for(long nFrame = 0; nFrame < lCount; ++nFrame)
+        {
+            float fLeft = 0;
+            float fRight = 0;
+            for(unsigned int nChan = 0; nChan < m_nChannels; ++nChan)
+            {
+                float fValue = m_vTracks[nChan].Mix(pFrame[nChan]);
+                if(!m_vTracks[nChan].bMuteA)
+                    fLeft += fValue;
+                if(!m_vTracks[nChan].bMuteB)
+                    fRight += fValue;
+            }
+            vMix[nFrame * 2] = fLeft;
+            vMix[nFrame * 2 + 1] = fRight;
+            pFrame += m_nChannels;
+        }
+
+        size_t nMixSize = lCount * 2 * sizeof(float);
+        if(pwrite(m_fdMix, &vMix[0], nMixSize, 44 + lFrame * 2 * sizeof(float)) != (ssize_t)nMixSize)
+            m_bError = true;
+        m_lDone += lCount;
+        m_nProgress = 100 * m_lDone / m_lFrames;
+    }
+}
@@ -0,0 +1,62 @@
+/** Class rendering the stereo monitor mix to a WAVE file faster than real time
+*   Block ranges of the project are read, mixed and written by a pool of threads
+*   Each track is mixed using the same gain and routing as the live monitor path
+*/
+#pragma once
+
+#include "takestore.h"
+#include "track.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+static const unsigned int BOUNCE_BLOCK_FRAMES   = 65536; //Quantity of frames processed by a thread at a time
+static const unsigned int BOUNCE_MAX_THREADS    = 4; //Maximum quantity of threads
+
+class Bounce
+{
+    public:
+        Bounce();
+
+        /** @brief  Render stereo mix
+        *   @param  fdSource File descriptor of project WAVE file
+        *   @param  offStart Offset of start of data in project WAVE file
+        *   @param  nChannels Quantity of interleaved channels in project WAVE file
+        *   @param  lFrames Quantity of frames to render
+        *   @param  nSampleRate Samples per second
+        *   @param  pTakes Pointer to take store overlaid on project data
+        *   @param  vTracks Copy of tracks providing gain and routing
+        *   @param  sFilename Path of WAVE file to create
+        *   @return <i>bool</i> True on success
+        *   @note   Blocks until complete - progress is available from GetProgress
+        */
+        bool Run(int fdSource, off_t offStart, unsigned int nChannels, long lFrames, unsigned int nSampleRate,
+            TakeStore* pTakes, const std::vector<Track>& vTracks, const std::string& sFilename);
+
+        /** @brief  Get progress of current render
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress() { return m_nProgress; }
+
+        /** @brief  Get duration of last render
+        *   @return <i>double</i> Seconds taken to render
+        */
+        double GetSeconds() { return m_dSeconds; }
+
+    private:
+        static void* WorkerThread(void* pArgs);
+        void Work();
+
+        int m_fdSource; //File descriptor of project WAVE file
+        int m_fdMix; //File descriptor of mix WAVE file
+        off_t m_offStart; //Offset of start of data in project WAVE file
+        unsigned int m_nChannels; //Quantity of interleaved channels
+        long m_lFrames; //Quantity of frames to render
+        TakeStore* m_pTakes; //Take store
+        std::vector<Track> m_vTracks; //Tracks providing gain and routing
+        std::atomic<long> m_lNextBlock; //Index of next block to render
+        std::atomic<long> m_lDone; //Quantity of frames rendered
+        std::atomic<bool> m_bError; //True if a read or write failed
+        std::atomic<int> m_nProgress; //Percentage complete
+        double m_dSeconds; //Duration of last render
+};
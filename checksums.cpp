@@ -0,0 +1,252 @@
+#include "checksums.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <vector>
+
+//xxHash64 primes (Y. Collet)
+static const uint64_t XXH_PRIME1 = 11400714785074694791ULL;
+static const uint64_t XXH_PRIME2 = 14029467366897019727ULL;
+static const uint64_t XXH_PRIME3 = 1609587929392839161ULL;
+static const uint64_t XXH_PRIME4 = 9650029242287828579ULL;
+static const uint64_t XXH_PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t Rotate(uint64_t lValue, unsigned int nBits)
+{
+    return (lValue << nBits) | (lValue >> (64 - nBits));
+}
+
+static inline uint64_t Read64(const unsigned char* pData)
+{
+    uint64_t lValue;
+    memcpy(&lValue, pData, sizeof(lValue)); //Little-endian hosts only, as WAVE data
+    return lValue;
+}
+
+static inline uint32_t Read32(const unsigned char* pData)
+{
+    uint32_t nValue;
+    memcpy(&nValue, pData, sizeof(nValue));
+    return nValue;
+}
+
+static inline uint64_t Round(uint64_t lAcc, uint64_t lInput)
+{
+    lAcc += lInput * XXH_PRIME2;
+    return Rotate(lAcc, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t Merge(uint64_t lAcc, uint64_t lValue)
+{
+    lAcc ^= Round(0, lValue);
+    return lAcc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+/** Add whole 32 byte stripes to accumulators */
+static void Stripes(uint64_t* plAcc, const unsigned char* pData, size_t nStripes)
+{
+    uint64_t lAcc0 = plAcc[0], lAcc1 = plAcc[1], lAcc2 = plAcc[2], lAcc3 = plAcc[3];
+    for(size_t i = 0; i < nStripes; ++i, pData += 32)
+    {
+        lAcc0 = Round(lAcc0, Read64(pData));
+        lAcc1 = Round(lAcc1, Read64(pData + 8));
+        lAcc2 = Round(lAcc2, Read64(pData + 16));
+        lAcc3 = Round(lAcc3, Read64(pData + 24));
+    }
+    plAcc[0] = lAcc0;
+    plAcc[1] = lAcc1;
+    plAcc[2] = lAcc2;
+    plAcc[3] = lAcc3;
+}
+
+BlockChecksums::BlockChecksums() :
+    m_fd(-1),
+    m_nChannels(0)
+{
+}
+
+BlockChecksums::~BlockChecksums()
+{
+    Close();
+}
+
+bool BlockChecksums::Open(const std::string& sFilename, unsigned int nChannels, bool bCreate)
+{
+    Close();
+    if(0 == nChannels)
+        return false;
+    int fd = open(sFilename.c_str(), O_RDWR | (bCreate ? O_CREAT : 0), 0644);
+    if(fd < 0)
+        return false;
+    //Header is magic, quantity of tracks and frames per block
+    char acHeader[CHECKSUM_HEADER_SIZE];
+    bool bValid = pread(fd, acHeader, sizeof(acHeader), 0) == (ssize_t)sizeof(acHeader) && 0 == memcmp(acHeader, CHECKSUM_MAGIC, 8);
+    uint32_t anFormat[2] = {nChannels, CHECKSUM_BLOCK_FRAMES};
+    if(bValid && 0 != memcmp(acHeader + 8, anFormat, sizeof(anFormat)))
+        bValid = false;
+    if(!bValid)
+    {
+        memcpy(acHeader, CHECKSUM_MAGIC, 8);
+        memcpy(acHeader + 8, anFormat, sizeof(anFormat));
+        if(!bCreate || ftruncate(fd, 0) || pwrite(fd, acHeader, sizeof(acHeader), 0) != (ssize_t)sizeof(acHeader))
+        {
+            close(fd);
+            return false;
+        }
+    }
+    m_fd = fd;
+    m_nChannels = nChannels;
+    return true;
+}
+
+void BlockChecksums::Close()
+{
+    if(m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+}
+
+void BlockChecksums::Sync()
+{
+    if(m_fd >= 0)
+        fdatasync(m_fd);
+}
+
+bool BlockChecksums::Read(long lBlock, unsigned int* pnFrames, uint64_t* plHashes)
+{
+    //Entry is quantity of frames hashed followed by hash of each track - unwritten entries read as zero frames
+    *pnFrames = 0;
+    if(m_fd < 0 || lBlock < 0)
+        return false;
+    size_t nSize = (m_nChannels + 1) * sizeof(uint64_t);
+    std::vector<uint64_t> vEntry(m_nChannels + 1);
+    if(pread(m_fd, &vEntry[0], nSize, CHECKSUM_HEADER_SIZE + lBlock * nSize) != (ssize_t)nSize || 0 == vEntry[0] || vEntry[0] > CHECKSUM_BLOCK_FRAMES)
+        return false;
+    *pnFrames = vEntry[0];
+    memcpy(plHashes, &vEntry[1], m_nChannels * sizeof(uint64_t));
+    return true;
+}
+
+bool BlockChecksums::Write(long lBlock, unsigned int nFrames, const uint64_t* plHashes)
+{
+    if(m_fd < 0 || lBlock < 0)
+        return false;
+    size_t nSize = (m_nChannels + 1) * sizeof(uint64_t);
+    std::vector<uint64_t> vEntry(m_nChannels + 1);
+    vEntry[0] = nFrames;
+    memcpy(&vEntry[1], plHashes, m_nChannels * sizeof(uint64_t));
+    return pwrite(m_fd, &vEntry[0], nSize, CHECKSUM_HEADER_SIZE + lBlock * nSize) == (ssize_t)nSize;
+}
+
+bool BlockChecksums::Store(long lBlock, const float* pFrames, unsigned int nFrames)
+{
+    std::vector<uint64_t> vHashes(m_nChannels);
+    HashTracks(pFrames, m_nChannels, nFrames, &vHashes[0]);
+    return Write(lBlock, nFrames, &vHashes[0]);
+}
+
+void BlockChecksums::HashTracks(const float* pFrames, unsigned int nChannels, unsigned int nFrames, uint64_t* plHashes)
+{
+    if(1 == nChannels)
+    {
+        ChecksumState state;
+        Begin(state);
+        Update(state, pFrames, nFrames * sizeof(float));
+        plHashes[0] = Digest(state);
+        return;
+    }
+    //Each track is de-interleaved a slice at a time so it is hashed exactly as a mono file of the same samples
+    float afSlice[CHECKSUM_SLICE_FRAMES];
+    for(unsigned int nTrack = 0; nTrack < nChannels; ++nTrack)
+    {
+        ChecksumState state;
+        Begin(state);
+        for(unsigned int nFrame = 0; nFrame < nFrames; nFrame += CHECKSUM_SLICE_FRAMES)
+        {
+            unsigned int nCount = nFrames - nFrame < CHECKSUM_SLICE_FRAMES ? nFrames - nFrame : CHECKSUM_SLICE_FRAMES;
+            const float* pSrc = pFrames + nFrame * nChannels + nTrack;
+            for(unsigned int i = 0; i < nCount; ++i)
+                afSlice[i] = pSrc[i * nChannels];
+            Update(state, afSlice, nCount * sizeof(float));
+        }
+        plHashes[nTrack] = Digest(state);
+    }
+}
+
+void BlockChecksums::Begin(ChecksumState& state)
+{
+    state.alAcc[0] = XXH_PRIME1 + XXH_PRIME2;
+    state.alAcc[1] = XXH_PRIME2;
+    state.alAcc[2] = 0;
+    state.alAcc[3] = -XXH_PRIME1;
+    state.lLength = 0;
+    state.nBuffered = 0;
+}
+
+void BlockChecksums::Update(ChecksumState& state, const void* pData, size_t nSize)
+{
+    const unsigned char* pBytes = (const unsigned char*)pData;
+    state.lLength += nSize;
+    if(state.nBuffered)
+    {
+        //Complete stripe left by previous update
+        size_t nCopy = 32 - state.nBuffered < nSize ? 32 - state.nBuffered : nSize;
+        memcpy(state.acBuffer + state.nBuffered, pBytes, nCopy);
+        state.nBuffered += nCopy;
+        pBytes += nCopy;
+        nSize -= nCopy;
+        if(state.nBuffered < 32)
+            return;
+        Stripes(state.alAcc, state.acBuffer, 1);
+        state.nBuffered = 0;
+    }
+    Stripes(state.alAcc, pBytes, nSize / 32);
+    state.nBuffered = nSize % 32;
+    memcpy(state.acBuffer, pBytes + nSize - state.nBuffered, state.nBuffered);
+}
+
+uint64_t BlockChecksums::Digest(const ChecksumState& state)
+{
+    uint64_t lHash;
+    if(state.lLength >= 32)
+    {
+        const uint64_t* plAcc = state.alAcc;
+        lHash = Rotate(plAcc[0], 1) + Rotate(plAcc[1], 7) + Rotate(plAcc[2], 12) + Rotate(plAcc[3], 18);
+        for(unsigned int i = 0; i < 4; ++i)
+            lHash = Merge(lHash, plAcc[i]);
+    }
+    else
+        lHash = XXH_PRIME5;
+    lHash += state.lLength;
+
+    //Remaining bytes
+    const unsigned char* pBytes = state.acBuffer;
+    unsigned int nLeft = state.nBuffered;
+    for(; nLeft >= 8; nLeft -= 8, pBytes += 8)
+        lHash = Rotate(lHash ^ Round(0, Read64(pBytes)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    if(nLeft >= 4)
+    {
+        lHash = Rotate(lHash ^ (Read32(pBytes) * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+        nLeft -= 4;
+        pBytes += 4;
+    }
+    for(; nLeft; --nLeft, ++pBytes)
+        lHash = Rotate(lHash ^ (*pBytes * XXH_PRIME5), 11) * XXH_PRIME1;
+
+    //Avalanche
+    lHash ^= lHash >> 33;
+    lHash *= XXH_PRIME2;
+    lHash ^= lHash >> 29;
+    lHash *= XXH_PRIME3;
+    lHash ^= lHash >> 32;
+    return lHash;
+}
+
+std::string BlockChecksums::GetFilename(const std::string& sData)
+{
+    size_t nDot = sData.rfind('.');
+    size_t nSlash = sData.rfind('/');
+    if(std::string::npos == nDot || (std::string::npos != nSlash && nDot < nSlash))
+        return sData + ".sums";
+    return sData.substr(0, nDot) + ".sums";
+}
@@ -0,0 +1,116 @@
+/** Class holding a checksum index of a project or take file - one xxHash64 per track per block of frames
+*   The index is a sidecar file beside the data it describes, named with extension .sums
+*   Each block has a fixed position in the index so entries are written in place as blocks are written, in any order
+*   Hashes are streamed so a block may be hashed in pieces as it is captured
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+static const unsigned int CHECKSUM_BLOCK_FRAMES = 65536; //Quantity of frames covered by each checksum
+static const unsigned int CHECKSUM_SLICE_FRAMES = 1024; //Quantity of frames of a track de-interleaved at a time when hashing interleaved data
+static const unsigned int CHECKSUM_HEADER_SIZE  = 16; //Quantity of bytes before first entry of index file
+static const char CHECKSUM_MAGIC[]              = "MJSUMS01"; //Identifies index file
+
+/** Structure holding state of a streamed xxHash64 **/
+struct ChecksumState
+{
+    uint64_t alAcc[4]; //Accumulator of each 8 byte lane of 32 byte stripes
+    uint64_t lLength; //Quantity of bytes hashed
+    unsigned char acBuffer[32]; //Bytes not yet forming a whole stripe
+    unsigned int nBuffered; //Quantity of bytes in buffer
+};
+
+class BlockChecksums
+{
+    public:
+        BlockChecksums();
+        ~BlockChecksums();
+
+        /** @brief  Open an index file
+        *   @param  sFilename Path of index file
+        *   @param  nChannels Quantity of tracks in data file
+        *   @param  bCreate True to create file if it does not exist and to start a new index if it describes a different quantity of tracks
+        *   @return <i>bool</i> True on success
+        */
+        bool Open(const std::string& sFilename, unsigned int nChannels, bool bCreate);
+
+        /** @brief  Close index file
+        */
+        void Close();
+
+        /** @brief  Flush index to storage, e.g. once the data it describes is flushed
+        */
+        void Sync();
+
+        /** @brief  Check whether an index file is open
+        */
+        bool IsOpen() { return m_fd >= 0; }
+
+        /** @brief  Get quantity of tracks described by each entry
+        */
+        unsigned int GetChannels() { return m_nChannels; }
+
+        /** @brief  Read entry of a block
+        *   @param  lBlock Index of block
+        *   @param  pnFrames Pointer to populate with quantity of frames hashed - 0 if block has no entry
+        *   @param  plHashes Pointer to array to populate with hash of each track
+        *   @return <i>bool</i> True if block has an entry
+        *   @note   Thread safe
+        */
+        bool Read(long lBlock, unsigned int* pnFrames, uint64_t* plHashes);
+
+        /** @brief  Write entry of a block
+        *   @param  lBlock Index of block
+        *   @param  nFrames Quantity of frames hashed
+        *   @param  plHashes Pointer to hash of each track
+        *   @return <i>bool</i> True on success
+        *   @note   Thread safe
+        */
+        bool Write(long lBlock, unsigned int nFrames, const uint64_t* plHashes);
+
+        /** @brief  Hash each track of an interleaved block and write its entry
+        *   @param  lBlock Index of block
+        *   @param  pFrames Interleaved samples of block
+        *   @param  nFrames Quantity of frames
+        *   @return <i>bool</i> True on success
+        */
+        bool Store(long lBlock, const float* pFrames, unsigned int nFrames);
+
+        /** @brief  Hash each track of interleaved samples
+        *   @param  pFrames Interleaved samples
+        *   @param  nChannels Quantity of interleaved channels
+        *   @param  nFrames Quantity of frames
+        *   @param  plHashes Pointer to array to populate with hash of each track
+        */
+        static void HashTracks(const float* pFrames, unsigned int nChannels, unsigned int nFrames, uint64_t* plHashes);
+
+        /** @brief  Start a streamed hash
+        *   @param  state State to reset
+        */
+        static void Begin(ChecksumState& state);
+
+        /** @brief  Add data to a streamed hash
+        *   @param  state State of hash
+        *   @param  pData Pointer to data
+        *   @param  nSize Quantity of bytes
+        */
+        static void Update(ChecksumState& state, const void* pData, size_t nSize);
+
+        /** @brief  Get hash of data added since Begin
+        *   @param  state State of hash - unchanged so more data may be added
+        *   @return <i>uint64_t</i> xxHash64 of data with seed 0
+        */
+        static uint64_t Digest(const ChecksumState& state);
+
+        /** @brief  Get index filename of a data file
+        *   @param  sData Path of data file
+        *   @return <i>std::string</i> Path with extension replaced by .sums
+        */
+        static std::string GetFilename(const std::string& sData);
+
+    private:
+        int m_fd; //File descriptor of index file or -1 if not open
+        unsigned int m_nChannels; //Quantity of hashes in each entry
+};
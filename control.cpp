@@ -0,0 +1,239 @@
+#include "control.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static const char* TOPIC_NAMES[] = {"transport", "position", "meters", "jobs", "disk"};
+
+ControlServer::ControlServer() :
+    m_fdListen(-1)
+{
+}
+
+ControlServer::~ControlServer()
+{
+    Close();
+}
+
+bool ControlServer::Open(const std::string& sPath)
+{
+    Close();
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(sPath.size() >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, sPath.c_str());
+    m_fdListen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(m_fdListen < 0)
+        return false;
+    unlink(sPath.c_str()); //Remove stale socket left by previous instance
+    if(bind(m_fdListen, (sockaddr*)&addr, sizeof(addr)) || listen(m_fdListen, 4))
+    {
+        close(m_fdListen);
+        m_fdListen = -1;
+        return false;
+    }
+    m_sPath = sPath;
+    return true;
+}
+
+void ControlServer::Close()
+{
+    for(std::vector<ControlClient>::iterator it = m_vClients.begin(); it != m_vClients.end(); ++it)
+        close(it->fd);
+    m_vClients.clear();
+    if(m_fdListen >= 0)
+    {
+        close(m_fdListen);
+        unlink(m_sPath.c_str());
+    }
+    m_fdListen = -1;
+}
+
+bool ControlServer::Poll(ControlHandler pHandler, int nTimeout, int fdWake)
+{
+    //Negative descriptors are ignored by poll so it sleeps when not listening
+    pollfd afds[CONTROL_MAX_CLIENTS + 2];
+    afds[0].fd = m_fdListen;
+    afds[0].events = POLLIN;
+    afds[0].revents = 0;
+    unsigned int nFds = 1;
+    for(std::vector<ControlClient>::iterator it = m_vClients.begin(); it != m_vClients.end(); ++it)
+    {
+        afds[nFds].fd = it->fd;
+        afds[nFds].events = (it->bClosed ? 0 : POLLIN) | (it->sOutput.empty() ? 0 : POLLOUT);
+        ++nFds;
+    }
+    afds[nFds].fd = fdWake;
+    afds[nFds].events = POLLIN;
+    afds[nFds].revents = 0;
+    if(poll(afds, nFds + 1, nTimeout) <= 0)
+        return false;
+    bool bWake = 0 != (afds[nFds].revents & POLLIN);
+
+    //Service existing clients, removing any that disconnect or have finished and been answered
+    for(unsigned int nFd = nFds - 1; nFd > 0; --nFd)
+    {
+        if(!afds[nFd].revents)
+            continue;
+        ControlClient& client = m_vClients[nFd - 1];
+        bool bKeep = true;
+        if(afds[nFd].revents & POLLOUT)
+            bKeep = Flush(client);
+        if(bKeep && (afds[nFd].revents & ~POLLOUT))
+            bKeep = Receive(client, pHandler);
+        if(!bKeep || (client.bClosed && client.sOutput.empty()))
+        {
+            close(client.fd);
+            m_vClients.erase(m_vClients.begin() + nFd - 1);
+        }
+    }
+
+    if(afds[0].revents & POLLIN)
+    {
+        int fd;
+        while((fd = accept4(m_fdListen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            if(m_vClients.size() >= CONTROL_MAX_CLIENTS)
+            {
+                close(fd);
+                continue;
+            }
+            ControlClient client;
+            client.fd = fd;
+            client.nTopics = 0;
+            client.bClosed = false;
+            m_vClients.push_back(client);
+        }
+    }
+    return bWake;
+}
+
+bool ControlServer::Receive(ControlClient& client, ControlHandler pHandler)
+{
+    char pBuffer[1024];
+    ssize_t nRead;
+    while((nRead = recv(client.fd, pBuffer, sizeof(pBuffer), 0)) > 0)
+        client.sInput.append(pBuffer, nRead);
+    if(nRead < 0 && EAGAIN != errno && EWOULDBLOCK != errno)
+        return false; //Failed
+    if(0 == nRead)
+        client.bClosed = true; //Client has finished sending, e.g. shut down its side after a batch - answer commands received before it
+
+    //Perform each complete command and respond to whole batch with a single write
+    std::string sResponse;
+    size_t nEnd;
+    while((nEnd = client.sInput.find('\n')) != std::string::npos)
+    {
+        std::string sLine = client.sInput.substr(0, nEnd);
+        client.sInput.erase(0, nEnd + 1);
+        size_t nStart = 0;
+        while(nStart <= sLine.size())
+        {
+            size_t nSeparator = sLine.find(';', nStart);
+            if(std::string::npos == nSeparator)
+                nSeparator = sLine.size();
+            std::string sCommand = sLine.substr(nStart, nSeparator - nStart);
+            nStart = nSeparator + 1;
+            //Trim white space including carriage return
+            size_t nFirst = sCommand.find_first_not_of(" \t\r");
+            if(std::string::npos == nFirst)
+                continue;
+            sCommand = sCommand.substr(nFirst, sCommand.find_last_not_of(" \t\r") - nFirst + 1);
+            if(0 == sCommand.compare(0, 10, "subscribe "))
+                sResponse += Subscribe(client, sCommand.substr(10), true);
+            else if(0 == sCommand.compare(0, 12, "unsubscribe "))
+                sResponse += Subscribe(client, sCommand.substr(12), false);
+            else
+                sResponse += pHandler(sCommand);
+            sResponse += "\n";
+        }
+    }
+    if(!client.bClosed && client.sInput.size() > CONTROL_MAX_LINE)
+        return false; //Not a well behaved client
+    return sResponse.empty() || Send(client, sResponse);
+}
+
+std::string ControlServer::Subscribe(ControlClient& client, const std::string& sCommand, bool bSubscribe)
+{
+    unsigned int nTopics = 0;
+    char sTopic[32];
+    const char* pArgs = sCommand.c_str();
+    int nUsed;
+    while(1 == sscanf(pArgs, "%31s%n", sTopic, &nUsed))
+    {
+        pArgs += nUsed;
+        unsigned int nTopic = 0;
+        for(unsigned int i = 0; i < sizeof(TOPIC_NAMES) / sizeof(TOPIC_NAMES[0]); ++i)
+            if(0 == strcmp(sTopic, TOPIC_NAMES[i]))
+                nTopic = 1 << i;
+        if(0 == strcmp(sTopic, "all"))
+            nTopic = CONTROL_ALL;
+        if(0 == nTopic)
+            return std::string("error unknown topic ") + sTopic;
+        nTopics |= nTopic;
+    }
+    if(bSubscribe)
+        client.nTopics |= nTopics;
+    else
+        client.nTopics &= ~nTopics;
+    return "ok";
+}
+
+bool ControlServer::Send(ControlClient& client, const std::string& sData)
+{
+    //Never block main loop - data the socket does not accept is queued so lines are never split or lost
+    if(client.sOutput.empty())
+    {
+        ssize_t nSent = send(client.fd, sData.c_str(), sData.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(nSent < 0)
+        {
+            if(EAGAIN != errno && EWOULDBLOCK != errno)
+                return false;
+            nSent = 0;
+        }
+        if((size_t)nSent == sData.size())
+            return true;
+        client.sOutput.append(sData, nSent, std::string::npos);
+    }
+    else
+        client.sOutput.append(sData);
+    if(client.sOutput.size() > CONTROL_MAX_OUTPUT)
+    {
+        //Client cannot keep up so disconnect it - poll reports hang up and it is removed
+        shutdown(client.fd, SHUT_RDWR);
+        client.sOutput.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ControlServer::Flush(ControlClient& client)
+{
+    ssize_t nSent = send(client.fd, client.sOutput.c_str(), client.sOutput.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(nSent < 0)
+        return EAGAIN == errno || EWOULDBLOCK == errno;
+    client.sOutput.erase(0, nSent);
+    return true;
+}
+
+void ControlServer::Notify(unsigned int nTopic, const std::string& sEvent)
+{
+    std::string sLine = sEvent + "\n";
+    for(std::vector<ControlClient>::iterator it = m_vClients.begin(); it != m_vClients.end(); ++it)
+        if(it->nTopics & nTopic)
+            Send(*it, sLine);
+}
+
+bool ControlServer::IsSubscribed(unsigned int nTopic)
+{
+    for(std::vector<ControlClient>::iterator it = m_vClients.begin(); it != m_vClients.end(); ++it)
+        if(it->nTopics & nTopic)
+            return true;
+    return false;
+}
@@ -0,0 +1,83 @@
+/** Class providing a local control protocol over a UNIX domain stream socket
+*   Clients send text commands, one per line or several separated by ';'
+*   Each command receives a single line response, responses to a batch of commands being sent together
+*   Clients may subscribe to topics to receive events pushed as they occur
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+
+static const unsigned int CONTROL_TRANSPORT = 1; //Transport state and record enable changes
+static const unsigned int CONTROL_POSITION  = 2; //Playhead position whilst rolling
+static const unsigned int CONTROL_METERS    = 4; //Peak level of each track
+static const unsigned int CONTROL_JOBS      = 8; //Background job progress and completion
+static const unsigned int CONTROL_DISK      = 16; //Disk stream buffer depth changes and corrupt data found
+static const unsigned int CONTROL_ALL       = 31;
+static const unsigned int CONTROL_MAX_LINE  = 4096; //Maximum length of a command line
+static const unsigned int CONTROL_MAX_CLIENTS = 16; //Maximum quantity of connected clients
+static const unsigned int CONTROL_MAX_OUTPUT = 1048576; //Maximum bytes queued for a client before it is disconnected
+
+/** @brief  Function performing a command
+*   @param  sCommand Command with arguments separated by spaces
+*   @return <i>std::string</i> Response line without line ending, starting "ok" or "error"
+*/
+typedef std::string (*ControlHandler)(const std::string& sCommand);
+
+/** Structure representing a connected client **/
+struct ControlClient
+{
+    int fd; //Socket file descriptor
+    std::string sInput; //Received data not yet processed
+    std::string sOutput; //Data not yet accepted by socket, sent when it is writable
+    unsigned int nTopics; //Bitmask of subscribed topics
+    bool bClosed; //True once client has finished sending - removed when output is sent
+};
+
+class ControlServer
+{
+    public:
+        ControlServer();
+        ~ControlServer();
+
+        /** @brief  Start listening for connections
+        *   @param  sPath Path of socket
+        *   @return <i>bool</i> True on success
+        */
+        bool Open(const std::string& sPath);
+
+        /** @brief  Disconnect clients, stop listening and remove socket
+        */
+        void Close();
+
+        /** @brief  Wait for activity then accept connections and perform received commands
+        *   @param  pHandler Function performing each command other than subscribe and unsubscribe
+        *   @param  nTimeout Maximum time to wait in milliseconds
+        *   @param  fdWake Additional descriptor which ends wait when readable or -1 for none
+        *   @return <i>bool</i> True if additional descriptor is readable - caller reads it
+        *   @note   Replaces sleep in main loop so commands are handled as soon as they arrive
+        */
+        bool Poll(ControlHandler pHandler, int nTimeout, int fdWake = -1);
+
+        /** @brief  Push an event to subscribed clients
+        *   @param  nTopic Topic of event
+        *   @param  sEvent Event line without line ending
+        */
+        void Notify(unsigned int nTopic, const std::string& sEvent);
+
+        /** @brief  Check whether any client is subscribed to a topic
+        *   @param  nTopic Topic
+        *   @return <i>bool</i> True if subscribed - avoids building events nobody will receive
+        */
+        bool IsSubscribed(unsigned int nTopic);
+
+    private:
+        bool Receive(ControlClient& client, ControlHandler pHandler);
+        std::string Subscribe(ControlClient& client, const std::string& sCommand, bool bSubscribe);
+        bool Send(ControlClient& client, const std::string& sData);
+        bool Flush(ControlClient& client);
+
+        int m_fdListen; //Listening socket
+        std::string m_sPath; //Path of socket
+        std::vector<ControlClient> m_vClients; //Connected clients
+};
@@ -0,0 +1,1245 @@
+#include "diskstream.h"
+#include "storageshim.h"
+#include "trace.h"
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+//Read-ahead chunk states
+static const int CHUNK_FREE         = 0; //Available to disk thread
+static const int CHUNK_PENDING      = 1; //Read in progress
+static const int CHUNK_READY        = 2; //Data available to audio thread
+//Write-behind chunk states
+static const int CAPTURE_EMPTY      = 0; //No buffer - audio thread treats as full
+static const int CAPTURE_FREE       = 1; //Available to audio thread
+static const int CAPTURE_FILLING    = 2; //Audio thread is adding samples
+static const int CAPTURE_FULL       = 3; //Waiting for disk thread
+static const int CAPTURE_WRITING    = 4; //Appending to take files
+static const int CAPTURE_WRITTEN    = 5; //Spool only - in take files, waiting for older spool chunks before entering take store
+
+static const int STREAM_POLL_MS     = 20; //Maximum time disk thread sleeps without being signalled
+
+static uint64_t Mask(unsigned int nBits)
+{
+    return nBits >= 64 ? ~0ull : (1ull << nBits) - 1;
+}
+
+static void AcquireMemory(void* pBuffer, size_t nSize)
+{
+    //Make buffer resident before it is used so that neither thread waits for paging
+    if(mlock(pBuffer, nSize))
+        memset(pBuffer, 0, nSize); //Not permitted to lock so fault pages in
+}
+
+static void ReleaseMemory(void* pBuffer, size_t nSize)
+{
+    munlock(pBuffer, nSize);
+    madvise(pBuffer, nSize, MADV_DONTNEED);
+}
+
+static long GetElapsedMs(const timespec& tsFrom, const timespec& tsTo)
+{
+    return (tsTo.tv_sec - tsFrom.tv_sec) * 1000 + (tsTo.tv_nsec - tsFrom.tv_nsec) / 1000000;
+}
+
+DiskStream::DiskStream() :
+    m_bOpen(false),
+    m_bInRt(false),
+    m_bRunning(false),
+    m_nEpoch(0),
+    m_lLocateFrame(0),
+    m_lRequiredFrames(0),
+    m_nPrimedEpoch(~0u),
+    m_nUnderruns(0),
+    m_nOverruns(0),
+    m_nReadMargin(~0u),
+    m_nCaptureMargin(~0u),
+    m_lKbRead(0),
+    m_lKbWritten(0),
+    m_lSyscalls(0),
+    m_nReadDepth(0),
+    m_nCaptureDepth(0),
+    m_nReadLatency(0),
+    m_nWriteLatency(0),
+    m_nDepthChanges(0),
+    m_nSpoolUsed(0),
+    m_nSpoolDrainMs(0),
+    m_fd(-1),
+    m_nChannels(0),
+    m_nEncoding(WAVE_FLOAT),
+    m_nFileFrameSize(0),
+    m_fdNotify(-1),
+    m_bUring(false),
+    m_bAllowUring(true),
+    m_pChunkMemory(NULL),
+    m_pCaptureSamples(NULL),
+    m_nMemoryLimit(STREAM_MEMORY_LIMIT),
+    m_nMaxChunks(0),
+    m_nMaxCaptures(0),
+    m_pTakes(NULL),
+    m_nFileRate(0),
+    m_nDeviceRate(0),
+    m_nResampleQuality(RESAMPLE_MEDIUM),
+    m_bResample(false),
+    m_pShim(NULL),
+    m_dSpeed(1),
+    m_nSpoolMinutes(0),
+    m_nSpoolSlots(0),
+    m_pSpool(NULL),
+    m_pSpoolSamples(NULL),
+    m_pResampleIn(NULL),
+    m_pCaptureIn(NULL),
+    m_pCaptureOut(NULL),
+    m_pCaptureA(NULL),
+    m_pCaptureB(NULL)
+{
+    for(unsigned int i = 0; i < STREAM_CHUNKS; ++i)
+        m_aChunks[i].nState = CHUNK_FREE;
+    for(unsigned int i = 0; i < CAPTURE_CHUNKS; ++i)
+        m_aCapture[i].nState = CAPTURE_EMPTY;
+}
+
+DiskStream::~DiskStream()
+{
+    Close();
+}
+
+bool DiskStream::Open(int fd, off_t offStart, unsigned int nChannels, long lFrames, TakeStore* pTakes, int nEncoding)
+{
+    Close();
+    if(fd < 0 || 0 == nChannels || !pTakes || nEncoding < WAVE_FLOAT || nEncoding > WAVE_PCM32)
+        return false;
+    m_pTakes = pTakes;
+    m_pTakes->SetShim(m_pShim);
+    m_ioEngine.SetShim(m_pShim);
+    m_dSpeed = m_pShim ? m_pShim->GetSpeed() : 1;
+    m_fd = fd;
+    m_offStart = offStart;
+    m_nChannels = nChannels;
+    m_nFrameSize = nChannels * sizeof(float);
+    m_nEncoding = nEncoding;
+    m_nFileFrameSize = nChannels * WAVE_SAMPLE_BYTES[nEncoding];
+    m_lFileFrames = lFrames;
+    m_lRequiredFrames = lFrames;
+
+    //Memory limit sets deepest buffering allowed - write-behind needs little so may use up to a quarter
+    size_t nChunkSize = STREAM_CHUNK_FRAMES * m_nFrameSize;
+    size_t nCaptureSize = CAPTURE_CHUNK_FRAMES * 2 * sizeof(float);
+    size_t nLimit = (size_t)m_nMemoryLimit << 20;
+    m_nMaxCaptures = nLimit / 4 / nCaptureSize;
+    if(m_nMaxCaptures < CAPTURE_MIN_CHUNKS)
+        m_nMaxCaptures = CAPTURE_MIN_CHUNKS;
+    if(m_nMaxCaptures > CAPTURE_CHUNKS)
+        m_nMaxCaptures = CAPTURE_CHUNKS;
+    nLimit = nLimit > m_nMaxCaptures * nCaptureSize ? nLimit - m_nMaxCaptures * nCaptureSize : 0;
+    m_nMaxChunks = nLimit / nChunkSize;
+    if(m_nMaxChunks < STREAM_MIN_CHUNKS)
+        m_nMaxChunks = STREAM_MIN_CHUNKS;
+    if(m_nMaxChunks > STREAM_CHUNKS)
+        m_nMaxChunks = STREAM_CHUNKS;
+
+    //Page aligned buffers may be registered with the kernel - only those beyond current depth are released
+    if(posix_memalign((void**)&m_pChunkMemory, 4096, nChunkSize * m_nMaxChunks)
+        || posix_memalign((void**)&m_pCaptureSamples, 4096, nCaptureSize * m_nMaxCaptures))
+    {
+        Close();
+        return false;
+    }
+    m_nReadDepth = STREAM_START_CHUNKS < m_nMaxChunks ? STREAM_START_CHUNKS : m_nMaxChunks;
+    m_nCaptureDepth = CAPTURE_START_CHUNKS < m_nMaxCaptures ? CAPTURE_START_CHUNKS : m_nMaxCaptures;
+    for(unsigned int i = 0; i < m_nMaxChunks; ++i)
+    {
+        if(i < m_nReadDepth)
+            AcquireMemory(m_pChunkMemory + i * nChunkSize, nChunkSize);
+        else
+            ReleaseMemory(m_pChunkMemory + i * nChunkSize, nChunkSize);
+    }
+    for(unsigned int i = 0; i < m_nMaxCaptures; ++i)
+    {
+        if(i < m_nCaptureDepth)
+            AcquireMemory(m_pCaptureSamples + i * CAPTURE_CHUNK_FRAMES * 2, nCaptureSize);
+        else
+            ReleaseMemory(m_pCaptureSamples + i * CAPTURE_CHUNK_FRAMES * 2, nCaptureSize);
+    }
+    m_lChunkFree = Mask(m_nReadDepth);
+    m_lChunkHeld = 0;
+    m_nChunksHeld = 0;
+    m_nReclaim = 0;
+    m_lCaptureFree = Mask(m_nCaptureDepth);
+    m_lCaptureHeld = 0;
+    m_nProvision = 0;
+    m_nDepthChanges = 0;
+    m_nReadLatency = 0;
+    m_nWriteLatency = 0;
+
+    //Least depths are always in use so only their buffers are registered (registration keeps pages resident)
+    std::vector<iovec> vBuffers;
+    for(unsigned int i = 0; i < STREAM_MIN_CHUNKS; ++i)
+    {
+        iovec iov = {m_pChunkMemory + i * nChunkSize, nChunkSize};
+        vBuffers.push_back(iov);
+    }
+    for(unsigned int i = 0; i < CAPTURE_MIN_CHUNKS; ++i)
+    {
+        iovec iov = {m_pCaptureSamples + i * CAPTURE_CHUNK_FRAMES * 2, nCaptureSize};
+        vBuffers.push_back(iov);
+    }
+    for(unsigned int i = 0; i < STREAM_CHUNKS; ++i)
+    {
+        StreamChunk* pChunk = &m_aChunks[i];
+        pChunk->nState = CHUNK_FREE;
+        pChunk->pData = NULL;
+        pChunk->nBuffer = -1;
+        pChunk->request.pData = pChunk;
+    }
+    for(unsigned int i = 0; i < CAPTURE_CHUNKS; ++i)
+    {
+        CaptureChunk* pChunk = &m_aCapture[i];
+        pChunk->nState = CAPTURE_EMPTY;
+        pChunk->pA = NULL;
+        pChunk->pB = NULL;
+        pChunk->nBuffer = -1;
+        pChunk->requestA.pData = pChunk->requestB.pData = pChunk;
+    }
+    ProvisionCaptures();
+
+    //Spool is written in place of write-behind buffers so captured audio waits in memory, not in the audio thread's buffers, for slow storage
+    if(m_nSpoolMinutes)
+    {
+        unsigned int nRate = m_nFileRate ? m_nFileRate : 44100;
+        unsigned int nSlots = AllocateSpool(((unsigned long)m_nSpoolMinutes * 60 * nRate + CAPTURE_CHUNK_FRAMES - 1) / CAPTURE_CHUNK_FRAMES);
+        if(nSlots)
+        {
+            m_pSpool = new CaptureChunk[nSlots];
+            for(unsigned int i = 0; i < nSlots; ++i)
+            {
+                CaptureChunk* pChunk = &m_pSpool[i];
+                pChunk->nState = CAPTURE_FREE;
+                pChunk->pA = m_pSpoolSamples + i * CAPTURE_CHUNK_FRAMES * 2;
+                pChunk->pB = pChunk->pA + CAPTURE_CHUNK_FRAMES;
+                pChunk->nBuffer = -1;
+                pChunk->requestA.pData = pChunk->requestB.pData = pChunk;
+                pChunk->requestA.nBuffer = pChunk->requestB.nBuffer = -1;
+            }
+            m_nSpoolSlots = nSlots;
+        }
+    }
+    m_nSpoolIn = 0;
+    m_nSpoolFlush = 0;
+    m_nSpoolRetire = 0;
+    m_nSpoolUsed = 0;
+    m_nSpoolDrainMs = 0;
+    m_lSpoolRetired = 0;
+    m_dSpoolRate = 0;
+
+    //Convert between file and interface sample rates in audio thread
+    m_bResample = false;
+    if(m_nFileRate && m_nDeviceRate && m_nFileRate != m_nDeviceRate)
+    {
+        unsigned int nMaxCapture = (unsigned long)RESAMPLE_SLICE * m_nFileRate / m_nDeviceRate + 2;
+        m_bResample = m_resamplePlay.Init(m_nFileRate, m_nDeviceRate, nChannels, m_nResampleQuality, RESAMPLE_SLICE)
+            && m_resampleCapture.Init(m_nDeviceRate, m_nFileRate, 2, m_nResampleQuality, nMaxCapture);
+        if(m_bResample)
+        {
+            m_pResampleIn = new float[m_resamplePlay.GetMaxInput() * nChannels]();
+            m_pCaptureIn = new float[RESAMPLE_SLICE * 2]();
+            m_pCaptureOut = new float[nMaxCapture * 2]();
+            m_pCaptureA = new float[nMaxCapture]();
+            m_pCaptureB = new float[nMaxCapture]();
+        }
+    }
+
+    m_fdNotify = eventfd(0, EFD_NONBLOCK);
+    if(!m_ioEngine.Init(STREAM_QUEUE_DEPTH, vBuffers, m_fdNotify, m_bAllowUring))
+    {
+        Close();
+        return false;
+    }
+    m_bUring = m_ioEngine.IsUring();
+    m_lKbRead = 0;
+    m_lKbWritten = 0;
+    m_lSyscalls = 0;
+
+    m_nPlayChunk = 0;
+    m_nReadFill = 0;
+    m_nCaptureFill = 0;
+    m_bCaptureEnded = true;
+    m_nCaptureFlush = 0;
+    m_nTake = 0;
+    m_nTakeTrackA = -1;
+    m_nTakeTrackB = -1;
+    m_lTakeStart = 0;
+    m_lTakeEnd = 0;
+    m_lPlayFrame = 0;
+    m_lFillFrame = 0;
+    m_nPlayEpoch = m_nFillEpoch = m_nEpoch;
+    m_nPrimedEpoch = m_nEpoch - 1;
+    m_nFilledChunks = 0;
+    m_bPlayCued = false;
+    m_lLocateFrame = 0;
+    m_bDrain = false;
+    clock_gettime(CLOCK_MONOTONIC, &m_tsAdapt);
+    m_tsReadShrink.tv_sec = m_tsCaptureShrink.tv_sec = 0;
+
+    m_bRunning = true;
+    if(pthread_create(&m_thread, NULL, ThreadProc, this))
+    {
+        m_bRunning = false;
+        Close();
+        return false;
+    }
+    m_bOpen = true;
+    return true;
+}
+
+void DiskStream::Close()
+{
+    //Wait for audio thread to leave buffers before releasing them
+    m_bOpen = false;
+    while(m_bInRt)
+        usleep(100);
+    if(m_bRunning)
+    {
+        m_bRunning = false;
+        Signal();
+        pthread_join(m_thread, NULL);
+    }
+    m_ioEngine.Close();
+    if(m_fdNotify >= 0)
+        close(m_fdNotify);
+    m_fdNotify = -1;
+    free(m_pChunkMemory);
+    m_pChunkMemory = NULL;
+    free(m_pCaptureSamples);
+    m_pCaptureSamples = NULL;
+    m_nSpoolSlots = 0;
+    m_nSpoolUsed = 0;
+    delete[] m_pSpool;
+    m_pSpool = NULL;
+    free(m_pSpoolSamples);
+    m_pSpoolSamples = NULL;
+    m_bResample = false;
+    m_resamplePlay.Free();
+    m_resampleCapture.Free();
+    delete[] m_pResampleIn;
+    m_pResampleIn = NULL;
+    delete[] m_pCaptureIn;
+    m_pCaptureIn = NULL;
+    delete[] m_pCaptureOut;
+    m_pCaptureOut = NULL;
+    delete[] m_pCaptureA;
+    m_pCaptureA = NULL;
+    delete[] m_pCaptureB;
+    m_pCaptureB = NULL;
+    m_fd = -1;
+}
+
+void DiskStream::SetResample(unsigned int nFileRate, unsigned int nDeviceRate, int nQuality)
+{
+    m_nFileRate = nFileRate;
+    m_nDeviceRate = nDeviceRate;
+    m_nResampleQuality = nQuality;
+}
+
+long DiskStream::GetCaptureOffset(unsigned int nLatency)
+{
+    if(!m_bResample)
+        return nLatency;
+    //Interface latency is in interface frames and each conversion delays audio by its filter latency
+    double dOffset = (double)nLatency * m_nFileRate / m_nDeviceRate;
+    dOffset += m_resamplePlay.GetLatency();
+    dOffset += m_resampleCapture.GetLatency() * m_nFileRate / m_nDeviceRate;
+    return (long)(dOffset + 0.5);
+}
+
+void DiskStream::Locate(long lFrame)
+{
+    m_lLocateFrame = lFrame;
+    ++m_nEpoch;
+    Signal();
+}
+
+bool DiskStream::Cue()
+{
+    m_bInRt = true;
+    bool bReady = m_bOpen && CueChunks();
+    m_bInRt = false;
+    return bReady;
+}
+
+bool DiskStream::CueChunks()
+{
+    unsigned int nEpoch = m_nEpoch;
+    if(nEpoch != m_nPlayEpoch)
+    {
+        m_nPlayEpoch = nEpoch;
+        m_lPlayFrame = m_lLocateFrame;
+        m_bPlayCued = false;
+        if(m_bResample)
+            m_resamplePlay.Reset();
+    }
+    bool bReady = false;
+    bool bSignal = false;
+    while(true)
+    {
+        StreamChunk* pChunk = &m_aChunks[m_nPlayChunk];
+        if(CHUNK_READY != pChunk->nState.load(std::memory_order_acquire))
+            break;
+        if((int)(pChunk->nEpoch - m_nPlayEpoch) > 0)
+            break; //Data for a locate the audio thread has not yet seen
+        if(pChunk->nEpoch != m_nPlayEpoch || pChunk->lFrame + (long)pChunk->nFrames <= m_lPlayFrame)
+        {
+            //Stale data
+            pChunk->nState.store(CHUNK_FREE, std::memory_order_release);
+            m_nPlayChunk = (m_nPlayChunk + 1) % STREAM_CHUNKS;
+            bSignal = true;
+            continue;
+        }
+        bReady = (pChunk->lFrame <= m_lPlayFrame);
+        if(bReady)
+            m_bPlayCued = true;
+        break;
+    }
+    if(bSignal)
+        Signal();
+    return bReady;
+}
+
+unsigned int DiskStream::Read(float* pBuffer, unsigned int nFrames)
+{
+    m_bInRt = true;
+    if(!m_bOpen)
+    {
+        m_bInRt = false;
+        memset(pBuffer, 0, nFrames * m_nChannels * sizeof(float));
+        return nFrames;
+    }
+    unsigned int nConsumed = 0;
+    if(m_bResample)
+    {
+        //Read file frames required for each slice then convert to interface rate
+        for(unsigned int nDone = 0; nDone < nFrames; )
+        {
+            unsigned int nCount = nFrames - nDone;
+            if(nCount > RESAMPLE_SLICE)
+                nCount = RESAMPLE_SLICE;
+            unsigned int nInput = m_resamplePlay.GetInputFrames(nCount);
+            ReadFrames(m_pResampleIn, nInput);
+            m_resamplePlay.Process(m_pResampleIn, nInput, pBuffer + nDone * m_nChannels, nCount);
+            nConsumed += nInput;
+            nDone += nCount;
+        }
+    }
+    else
+    {
+        ReadFrames(pBuffer, nFrames);
+        nConsumed = nFrames;
+    }
+    m_bInRt = false;
+    return nConsumed;
+}
+
+unsigned int DiskStream::ReadFrames(float* pBuffer, unsigned int nFrames)
+{
+    if(!CueChunks())
+    {
+        memset(pBuffer, 0, nFrames * m_nFrameSize);
+        if(m_bPlayCued)
+        {
+            ++m_nUnderruns; //Not counted whilst waiting for data after locate
+            m_nReadMargin = 0;
+        }
+        m_lPlayFrame += nFrames;
+        return 0;
+    }
+    unsigned int nDone = 0;
+    bool bSignal = false;
+    while(nDone < nFrames)
+    {
+        StreamChunk* pChunk = &m_aChunks[m_nPlayChunk];
+        if(CHUNK_READY != pChunk->nState.load(std::memory_order_acquire) || pChunk->nEpoch != m_nPlayEpoch || pChunk->lFrame > m_lPlayFrame)
+            break;
+        unsigned int nOffset = m_lPlayFrame - pChunk->lFrame;
+        if(nOffset < pChunk->nFrames)
+        {
+            unsigned int nCount = pChunk->nFrames - nOffset;
+            if(nCount > nFrames - nDone)
+                nCount = nFrames - nDone;
+            memcpy(pBuffer + nDone * m_nChannels, pChunk->pData + nOffset * m_nFrameSize, nCount * m_nFrameSize);
+            nDone += nCount;
+            m_lPlayFrame += nCount;
+            nOffset += nCount;
+        }
+        if(nOffset >= pChunk->nFrames)
+        {
+            pChunk->nState.store(CHUNK_FREE, std::memory_order_release);
+            m_nPlayChunk = (m_nPlayChunk + 1) % STREAM_CHUNKS;
+            bSignal = true;
+        }
+    }
+    if(nDone < nFrames)
+    {
+        //Disk has not kept up so play silence and keep timeline moving
+        memset(pBuffer + nDone * m_nChannels, 0, (nFrames - nDone) * m_nFrameSize);
+        m_lPlayFrame += nFrames - nDone;
+        ++m_nUnderruns;
+        m_nReadMargin = 0;
+    }
+    MeasureReadMargin();
+    if(bSignal)
+        Signal();
+    return nDone;
+}
+
+void DiskStream::MeasureReadMargin()
+{
+    //Read-ahead only reaches its working level once primed so lower levels whilst starting are not a shortage
+    if(m_nPrimedEpoch != m_nPlayEpoch)
+        return;
+    unsigned int nReady = GetReadyFrames();
+    if(nReady < m_nReadMargin)
+        m_nReadMargin = nReady;
+}
+
+unsigned int DiskStream::GetReadyFrames()
+{
+    unsigned int nReady = 0;
+    for(unsigned int i = 0; i < STREAM_CHUNKS; ++i)
+    {
+        StreamChunk* pChunk = &m_aChunks[(m_nPlayChunk + i) % STREAM_CHUNKS];
+        if(CHUNK_READY != pChunk->nState.load(std::memory_order_acquire) || pChunk->nEpoch != m_nPlayEpoch || pChunk->lFrame > m_lPlayFrame + nReady)
+            break;
+        nReady = pChunk->lFrame + pChunk->nFrames - m_lPlayFrame;
+    }
+    return nReady;
+}
+
+void DiskStream::MeasureCaptureMargin()
+{
+    unsigned int nFree = 0;
+    for(unsigned int i = 0; i < CAPTURE_CHUNKS; ++i)
+    {
+        CaptureChunk* pChunk = &m_aCapture[i];
+        int nState = pChunk->nState.load(std::memory_order_acquire);
+        if(CAPTURE_FREE == nState)
+            nFree += CAPTURE_CHUNK_FRAMES;
+        else if(CAPTURE_FILLING == nState)
+            nFree += CAPTURE_CHUNK_FRAMES - pChunk->nFrames;
+    }
+    if(nFree < m_nCaptureMargin)
+        m_nCaptureMargin = nFree;
+}
+
+bool DiskStream::Capture(long lFrame, unsigned int nFrames, const float* pInA, int nTrackA, const float* pInB, int nTrackB)
+{
+    m_bInRt = true;
+    if(!m_bOpen)
+    {
+        m_bInRt = false;
+        return false;
+    }
+    if(!m_bResample)
+    {
+        bool bResult = CaptureFrames(lFrame, nFrames, pInA, nTrackA, pInB, nTrackB);
+        m_bInRt = false;
+        return bResult;
+    }
+    if(m_bCaptureEnded)
+    {
+        //Start of take so position is taken from caller then follows converted frames to avoid rounding discontinuities
+        m_resampleCapture.Reset();
+        m_lCaptureFrame = lFrame;
+    }
+    bool bResult = true;
+    for(unsigned int nDone = 0; nDone < nFrames; )
+    {
+        unsigned int nCount = nFrames - nDone;
+        if(nCount > RESAMPLE_SLICE)
+            nCount = RESAMPLE_SLICE;
+        for(unsigned int i = 0; i < nCount; ++i)
+        {
+            m_pCaptureIn[i * 2] = nTrackA >= 0 ? pInA[nDone + i] : 0;
+            m_pCaptureIn[i * 2 + 1] = nTrackB >= 0 ? pInB[nDone + i] : 0;
+        }
+        unsigned int nOutput = m_resampleCapture.GetOutputFrames(nCount);
+        m_resampleCapture.Process(m_pCaptureIn, nCount, m_pCaptureOut, nOutput);
+        for(unsigned int i = 0; i < nOutput; ++i)
+        {
+            m_pCaptureA[i] = m_pCaptureOut[i * 2];
+            m_pCaptureB[i] = m_pCaptureOut[i * 2 + 1];
+        }
+        if(nOutput && !CaptureFrames(m_lCaptureFrame, nOutput, m_pCaptureA, nTrackA, m_pCaptureB, nTrackB))
+            bResult = false;
+        m_lCaptureFrame += nOutput;
+        nDone += nCount;
+    }
+    m_bInRt = false;
+    return bResult;
+}
+
+bool DiskStream::CaptureFrames(long lFrame, unsigned int nFrames, const float* pInA, int nTrackA, const float* pInB, int nTrackB)
+{
+    bool bSignal = false;
+    bool bResult = true;
+    unsigned int nDone = 0;
+    while(nDone < nFrames)
+    {
+        CaptureChunk* pChunk = &m_aCapture[m_nCaptureFill];
+        int nState = pChunk->nState.load(std::memory_order_acquire);
+        if(CAPTURE_FILLING == nState)
+        {
+            if(pChunk->lFrame + (long)pChunk->nFrames != lFrame + (long)nDone || pChunk->nTrackA != nTrackA || pChunk->nTrackB != nTrackB)
+            {
+                //Discontinuity so start a new chunk
+                pChunk->nState.store(CAPTURE_FULL, std::memory_order_release);
+                m_nCaptureFill = (m_nCaptureFill + 1) % CAPTURE_CHUNKS;
+                bSignal = true;
+                continue;
+            }
+        }
+        else if(CAPTURE_FREE == nState)
+        {
+            pChunk->lFrame = lFrame + nDone;
+            pChunk->nFrames = 0;
+            pChunk->nTrackA = nTrackA;
+            pChunk->nTrackB = nTrackB;
+            pChunk->bNewTake = m_bCaptureEnded;
+            m_bCaptureEnded = false;
+            pChunk->nState.store(CAPTURE_FILLING, std::memory_order_relaxed);
+        }
+        else
+        {
+            //Disk has not kept up so captured audio is lost
+            ++m_nOverruns;
+            m_nCaptureMargin = 0;
+            bResult = false;
+            break;
+        }
+        unsigned int nCount = CAPTURE_CHUNK_FRAMES - pChunk->nFrames;
+        if(nCount > nFrames - nDone)
+            nCount = nFrames - nDone;
+        if(nTrackA >= 0)
+            memcpy(pChunk->pA + pChunk->nFrames, pInA + nDone, nCount * sizeof(float));
+        if(nTrackB >= 0)
+            memcpy(pChunk->pB + pChunk->nFrames, pInB + nDone, nCount * sizeof(float));
+        pChunk->nFrames += nCount;
+        nDone += nCount;
+        if(CAPTURE_CHUNK_FRAMES == pChunk->nFrames)
+        {
+            pChunk->nState.store(CAPTURE_FULL, std::memory_order_release);
+            m_nCaptureFill = (m_nCaptureFill + 1) % CAPTURE_CHUNKS;
+            bSignal = true;
+        }
+    }
+    if(bResult)
+        MeasureCaptureMargin();
+    if(bSignal)
+        Signal();
+    return bResult;
+}
+
+void DiskStream::EndCapture()
+{
+    m_bInRt = true;
+    if(m_bOpen)
+    {
+        m_bCaptureEnded = true;
+        CaptureChunk* pChunk = &m_aCapture[m_nCaptureFill];
+        if(CAPTURE_FILLING == pChunk->nState.load(std::memory_order_relaxed))
+        {
+            pChunk->nState.store(CAPTURE_FULL, std::memory_order_release);
+            m_nCaptureFill = (m_nCaptureFill + 1) % CAPTURE_CHUNKS;
+            Signal();
+        }
+    }
+    m_bInRt = false;
+}
+
+void DiskStream::Sync()
+{
+    while(m_bRunning && IsCapturePending())
+        usleep(1000);
+    if(m_pTakes)
+        m_pTakes->FinishChecksums(); //Protect end of takes
+}
+
+void DiskStream::SetLength(long lFrames)
+{
+    if(lFrames > m_lRequiredFrames)
+        m_lRequiredFrames = lFrames;
+}
+
+void DiskStream::Signal()
+{
+    if(m_fdNotify < 0)
+        return;
+    uint64_t nSignal = 1;
+    ssize_t nWritten = write(m_fdNotify, &nSignal, sizeof(nSignal));
+    (void)nWritten;
+}
+
+void* DiskStream::ThreadProc(void* pArgs)
+{
+    ((DiskStream*)pArgs)->Run();
+    return NULL;
+}
+
+void DiskStream::Run()
+{
+    TraceThread("disk");
+    pollfd pfd = {m_fdNotify, POLLIN, 0};
+    while(m_bRunning)
+    {
+        Service();
+        if(poll(&pfd, 1, STREAM_POLL_MS) > 0)
+        {
+            uint64_t nSignal;
+            ssize_t nRead = read(m_fdNotify, &nSignal, sizeof(nSignal));
+            (void)nRead;
+        }
+    }
+    //Closing so complete outstanding captured audio (partially filled chunk is written too)
+    CaptureChunk* pChunk = &m_aCapture[m_nCaptureFill];
+    if(CAPTURE_FILLING == pChunk->nState)
+        pChunk->nState = CAPTURE_FULL;
+    while(Service())
+        poll(&pfd, 1, 1);
+}
+
+bool DiskStream::Service()
+{
+    TraceScope trace("service");
+    //Collect completed requests
+    IoRequest* apDone[STREAM_QUEUE_DEPTH];
+    unsigned int nDone;
+    while((nDone = m_ioEngine.Reap(apDone, STREAM_QUEUE_DEPTH)))
+        for(unsigned int i = 0; i < nDone; ++i)
+            Complete(apDone[i]);
+
+    //Extend file if recording beyond end
+    long lRequired = m_lRequiredFrames;
+    if(lRequired > m_lFileFrames)
+    {
+        if(0 == ftruncate(m_fd, m_offStart + lRequired * m_nFrameSize))
+            m_lFileFrames = lRequired;
+    }
+
+    //Restart read-ahead from new position after locate
+    unsigned int nEpoch = m_nEpoch;
+    if(nEpoch != m_nFillEpoch)
+    {
+        m_nFillEpoch = nEpoch;
+        m_lFillFrame = m_lLocateFrame;
+        m_bDrain = true;
+        m_nFilledChunks = 0;
+    }
+
+    Adapt();
+    if(m_nSpoolSlots)
+        SpoolCaptures();
+    ProvisionCaptures();
+    SubmitCaptures();
+    if(m_bDrain && !IsCapturePending(false))
+        m_bDrain = false; //Spooled audio need not be written first as it is overlaid on read-ahead
+    if(!m_bDrain && m_bRunning)
+        SubmitReads();
+    m_ioEngine.Flush();
+
+    m_lKbRead = m_ioEngine.GetBytesRead() / 1024;
+    m_lKbWritten = m_ioEngine.GetBytesWritten() / 1024;
+    m_lSyscalls = m_ioEngine.GetSyscalls();
+    return m_ioEngine.GetInFlight() || IsCapturePending();
+}
+
+void DiskStream::SubmitReads()
+{
+    ReclaimChunks();
+    while(m_ioEngine.GetInFlight() < m_ioEngine.GetDepth())
+    {
+        StreamChunk* pChunk = &m_aChunks[m_nReadFill];
+        if(CHUNK_FREE != pChunk->nState.load(std::memory_order_acquire) || pChunk->nBuffer >= 0 || !m_lChunkFree)
+            return; //Read-ahead is full
+        unsigned int nBuffer = __builtin_ctzll(m_lChunkFree);
+        m_lChunkFree &= ~(1ull << nBuffer);
+        m_lChunkHeld |= 1ull << nBuffer;
+        ++m_nChunksHeld;
+        pChunk->nBuffer = nBuffer;
+        pChunk->pData = m_pChunkMemory + nBuffer * STREAM_CHUNK_FRAMES * m_nFrameSize;
+        pChunk->request.nBuffer = nBuffer < STREAM_MIN_CHUNKS ? (int)nBuffer : -1;
+        pChunk->nEpoch = m_nFillEpoch;
+        pChunk->lFrame = m_lFillFrame;
+        pChunk->nFrames = STREAM_CHUNK_FRAMES;
+        if(m_lFillFrame >= m_lFileFrames)
+        {
+            //Beyond end of file so no need to read
+            memset(pChunk->pData, 0, STREAM_CHUNK_FRAMES * m_nFrameSize);
+            TraceBegin("overlay");
+            m_pTakes->Overlay((float*)pChunk->pData, m_nChannels, pChunk->lFrame, pChunk->nFrames);
+            OverlaySpool((float*)pChunk->pData, pChunk->lFrame, pChunk->nFrames);
+            TraceEnd("overlay");
+            pChunk->nState.store(CHUNK_READY, std::memory_order_release);
+            Filled(pChunk);
+        }
+        else
+        {
+            long lFrames = m_lFileFrames - m_lFillFrame;
+            if(lFrames > STREAM_CHUNK_FRAMES)
+                lFrames = STREAM_CHUNK_FRAMES;
+            //Samples narrower than float are read into end of buffer and expanded in place
+            IoRequest* pRequest = &pChunk->request;
+            pRequest->nFd = m_fd;
+            pRequest->nOp = IO_READ;
+            pRequest->pBuffer = pChunk->pData + STREAM_CHUNK_FRAMES * (m_nFrameSize - m_nFileFrameSize);
+            pRequest->nSize = lFrames * m_nFileFrameSize;
+            pRequest->offPos = m_offStart + m_lFillFrame * m_nFileFrameSize;
+            pChunk->nState.store(CHUNK_PENDING, std::memory_order_relaxed);
+            m_ioEngine.Submit(pRequest);
+        }
+        m_lFillFrame += STREAM_CHUNK_FRAMES;
+        m_nReadFill = (m_nReadFill + 1) % STREAM_CHUNKS;
+    }
+}
+
+void DiskStream::SubmitCaptures()
+{
+    //Spool is written in place of write-behind ring when in use - leaving half the queue for reads so a long flush does not hold up playback
+    CaptureChunk* pRing = m_nSpoolSlots ? m_pSpool : m_aCapture;
+    unsigned int nRing = m_nSpoolSlots ? m_nSpoolSlots : CAPTURE_CHUNKS;
+    unsigned int& nFlush = m_nSpoolSlots ? m_nSpoolFlush : m_nCaptureFlush;
+    unsigned int nDepth = m_nSpoolSlots ? m_ioEngine.GetDepth() / 2 : m_ioEngine.GetDepth();
+    while(m_ioEngine.GetInFlight() + 2 <= nDepth)
+    {
+        CaptureChunk* pChunk = &pRing[nFlush];
+        if(CAPTURE_FULL != pChunk->nState.load(std::memory_order_acquire))
+            return;
+        //Append to current take if contiguous otherwise start a new take
+        if(0 == m_nTake || pChunk->bNewTake || pChunk->lFrame != m_lTakeEnd || pChunk->nTrackA != m_nTakeTrackA || pChunk->nTrackB != m_nTakeTrackB)
+        {
+            m_nTake = m_pTakes->BeginTake();
+            m_lTakeStart = pChunk->lFrame;
+            m_nTakeTrackA = pChunk->nTrackA;
+            m_nTakeTrackB = pChunk->nTrackB;
+        }
+        pChunk->nTake = m_nTake;
+        pChunk->lOffset = pChunk->lFrame - m_lTakeStart;
+        m_lTakeEnd = pChunk->lFrame + pChunk->nFrames;
+        pChunk->nPending = 0;
+        pChunk->requestA.nResult = pChunk->requestB.nResult = 0;
+        pChunk->nState.store(CAPTURE_WRITING, std::memory_order_relaxed);
+        if(pChunk->nTrackA >= 0)
+        {
+            IoRequest* pRequest = &pChunk->requestA;
+            pRequest->nFd = m_pTakes->GetFile(m_nTake, pChunk->nTrackA);
+            pRequest->nOp = IO_WRITE;
+            pRequest->pBuffer = (char*)pChunk->pA;
+            pRequest->nSize = pChunk->nFrames * sizeof(float);
+            pRequest->offPos = pChunk->lOffset * sizeof(float);
+            if(pRequest->nFd >= 0 && m_ioEngine.Submit(pRequest))
+            {
+                ++pChunk->nPending;
+                m_pTakes->AddChecksum(m_nTake, pChunk->nTrackA, pChunk->lOffset, pChunk->pA, pChunk->nFrames); //Hashed here rather than in audio callback
+            }
+        }
+        if(pChunk->nTrackB >= 0)
+        {
+            IoRequest* pRequest = &pChunk->requestB;
+            pRequest->nFd = m_pTakes->GetFile(m_nTake, pChunk->nTrackB);
+            pRequest->nOp = IO_WRITE;
+            pRequest->pBuffer = (char*)pChunk->pB;
+            pRequest->nSize = pChunk->nFrames * sizeof(float);
+            pRequest->offPos = pChunk->lOffset * sizeof(float);
+            if(pRequest->nFd >= 0 && m_ioEngine.Submit(pRequest))
+            {
+                ++pChunk->nPending;
+                m_pTakes->AddChecksum(m_nTake, pChunk->nTrackB, pChunk->lOffset, pChunk->pB, pChunk->nFrames);
+            }
+        }
+        if(0 == pChunk->nPending)
+            FinishCapture(pChunk); //Failed to open take file so audio is lost
+        nFlush = (nFlush + 1) % nRing;
+    }
+}
+
+unsigned int DiskStream::AllocateSpool(unsigned int nSlots)
+{
+    //Leave most available memory to the rest of the system so a long spool never forces paging
+    size_t nSlotSize = CAPTURE_CHUNK_FRAMES * 2 * sizeof(float);
+    unsigned int nRate = m_nFileRate ? m_nFileRate : 44100;
+    unsigned int nMinSlots = (SPOOL_MIN_SECONDS * nRate + CAPTURE_CHUNK_FRAMES - 1) / CAPTURE_CHUNK_FRAMES;
+    long lPages = sysconf(_SC_AVPHYS_PAGES);
+    long lPageSize = sysconf(_SC_PAGESIZE);
+    if(lPages > 0 && lPageSize > 0)
+        nSlots = std::min(nSlots, (unsigned int)(SPOOL_MEMORY_SHARE * lPages * lPageSize / nSlotSize));
+    nSlots = std::max(nSlots, nMinSlots);
+    //Locking faults every page in so no clearing is needed - halve spool until it fits within memory lock limit
+    while(true)
+    {
+        if(0 == posix_memalign((void**)&m_pSpoolSamples, 4096, nSlots * nSlotSize))
+        {
+            if(0 == mlock(m_pSpoolSamples, nSlots * nSlotSize))
+                return nSlots;
+            if(nSlots <= nMinSlots)
+            {
+                memset(m_pSpoolSamples, 0, nSlots * nSlotSize); //Not permitted to lock so fault pages in
+                return nSlots;
+            }
+            free(m_pSpoolSamples);
+        }
+        m_pSpoolSamples = NULL;
+        if(nSlots <= nMinSlots)
+            return 0; //Not enough memory so write directly
+        nSlots = std::max(nSlots / 2, nMinSlots);
+    }
+}
+
+void DiskStream::SpoolCaptures()
+{
+    //Copy captured audio to spool at once so write-behind buffers never wait for storage
+    while(true)
+    {
+        CaptureChunk* pChunk = &m_aCapture[m_nCaptureFlush];
+        if(CAPTURE_FULL != pChunk->nState.load(std::memory_order_acquire))
+            return;
+        CaptureChunk* pSlot = &m_pSpool[m_nSpoolIn];
+        if(CAPTURE_FREE != pSlot->nState.load(std::memory_order_relaxed))
+            return; //Spool full so write-behind fills and then captured audio is lost
+        pSlot->lFrame = pChunk->lFrame;
+        pSlot->nFrames = pChunk->nFrames;
+        pSlot->nTrackA = pChunk->nTrackA;
+        pSlot->nTrackB = pChunk->nTrackB;
+        pSlot->bNewTake = pChunk->bNewTake;
+        if(pChunk->nTrackA >= 0)
+            memcpy(pSlot->pA, pChunk->pA, pChunk->nFrames * sizeof(float));
+        if(pChunk->nTrackB >= 0)
+            memcpy(pSlot->pB, pChunk->pB, pChunk->nFrames * sizeof(float));
+        pSlot->nState.store(CAPTURE_FULL, std::memory_order_relaxed);
+        ++m_nSpoolUsed; //Counted before chunk is released so Sync always sees audio in one or the other
+        ReleaseCapture(pChunk);
+        m_nCaptureFlush = (m_nCaptureFlush + 1) % CAPTURE_CHUNKS;
+        m_nSpoolIn = (m_nSpoolIn + 1) % m_nSpoolSlots;
+    }
+}
+
+void DiskStream::FinishCapture(CaptureChunk* pChunk)
+{
+    if(pChunk < m_aCapture || pChunk >= m_aCapture + CAPTURE_CHUNKS)
+    {
+        //Spool writes may complete out of order but enter take store in order so overlay of older spooled audio never hides a newer take
+        pChunk->nState.store(CAPTURE_WRITTEN, std::memory_order_relaxed);
+        RetireSpool();
+        return;
+    }
+    AddExtents(pChunk);
+    ReleaseCapture(pChunk);
+}
+
+void DiskStream::AddExtents(CaptureChunk* pChunk)
+{
+    TakeExtent extent;
+    extent.nTake = pChunk->nTake;
+    extent.lStart = pChunk->lFrame;
+    extent.lFrames = pChunk->nFrames;
+    extent.lOffset = pChunk->lOffset;
+    if(pChunk->nTrackA >= 0 && pChunk->requestA.nResult > 0)
+    {
+        extent.nTrack = pChunk->nTrackA;
+        m_pTakes->AddExtent(extent);
+    }
+    if(pChunk->nTrackB >= 0 && pChunk->requestB.nResult > 0)
+    {
+        extent.nTrack = pChunk->nTrackB;
+        m_pTakes->AddExtent(extent);
+    }
+}
+
+void DiskStream::RetireSpool()
+{
+    while(m_nSpoolUsed)
+    {
+        CaptureChunk* pChunk = &m_pSpool[m_nSpoolRetire];
+        if(CAPTURE_WRITTEN != pChunk->nState.load(std::memory_order_relaxed))
+            return;
+        AddExtents(pChunk);
+        m_lSpoolRetired += pChunk->nFrames;
+        pChunk->nState.store(CAPTURE_FREE, std::memory_order_relaxed);
+        m_nSpoolRetire = (m_nSpoolRetire + 1) % m_nSpoolSlots;
+        --m_nSpoolUsed; //Counted after extents are added so Sync returns only once audio is in take store
+    }
+}
+
+void DiskStream::OverlaySpool(float* pFrames, long lFrame, unsigned int nFrames)
+{
+    //Spooled audio is newer than take store so is applied after it, oldest first
+    unsigned int nUsed = m_nSpoolUsed;
+    long lEnd = lFrame + nFrames;
+    for(unsigned int i = 0; i < nUsed; ++i)
+    {
+        CaptureChunk* pChunk = &m_pSpool[(m_nSpoolRetire + i) % m_nSpoolSlots];
+        long lStart = std::max(pChunk->lFrame, lFrame);
+        long lStop = std::min(pChunk->lFrame + (long)pChunk->nFrames, lEnd);
+        if(lStart >= lStop)
+            continue;
+        float* pDest = pFrames + (lStart - lFrame) * m_nChannels;
+        unsigned int nOffset = lStart - pChunk->lFrame;
+        unsigned int nCount = lStop - lStart;
+        if(pChunk->nTrackA >= 0 && pChunk->nTrackA < (int)m_nChannels)
+            for(unsigned int j = 0; j < nCount; ++j)
+                pDest[j * m_nChannels + pChunk->nTrackA] = pChunk->pA[nOffset + j];
+        if(pChunk->nTrackB >= 0 && pChunk->nTrackB < (int)m_nChannels)
+            for(unsigned int j = 0; j < nCount; ++j)
+                pDest[j * m_nChannels + pChunk->nTrackB] = pChunk->pB[nOffset + j];
+    }
+}
+
+void DiskStream::Filled(StreamChunk* pChunk)
+{
+    if(pChunk->nEpoch != m_nFillEpoch)
+        return;
+    //Primed once read-ahead is full or reaches end of file
+    if(++m_nFilledChunks >= m_nReadDepth || pChunk->lFrame + (long)pChunk->nFrames >= m_lFileFrames)
+        m_nPrimedEpoch = pChunk->nEpoch;
+}
+
+void DiskStream::Prefetch(long lFrame, long lFrames)
+{
+    if(lFrame < 0)
+    {
+        lFrames += lFrame;
+        lFrame = 0;
+    }
+    if(m_fd < 0 || lFrames <= 0)
+        return;
+    posix_fadvise(m_fd, m_offStart + lFrame * m_nFileFrameSize, lFrames * m_nFileFrameSize, POSIX_FADV_WILLNEED);
+    if(m_pTakes)
+        m_pTakes->Prefetch(lFrame, lFrames);
+}
+
+void DiskStream::Complete(IoRequest* pRequest)
+{
+    if(pRequest >= &m_aChunks[0].request && pRequest <= &m_aChunks[STREAM_CHUNKS - 1].request)
+    {
+        StreamChunk* pChunk = (StreamChunk*)pRequest->pData;
+        size_t nValid = pRequest->nResult > 0 ? pRequest->nResult : 0;
+        if(WAVE_FLOAT != m_nEncoding)
+        {
+            TraceScope trace("convert");
+            size_t nFrames = nValid / m_nFileFrameSize;
+            ConvertToFloat(pRequest->pBuffer, (float*)pChunk->pData, nFrames * m_nChannels, m_nEncoding);
+            nValid = nFrames * m_nFrameSize;
+        }
+        size_t nSize = pChunk->nFrames * m_nFrameSize;
+        if(nValid < nSize)
+            memset(pChunk->pData + nValid, 0, nSize - nValid); //Short read at end of file
+        TraceBegin("overlay");
+        m_pTakes->Overlay((float*)pChunk->pData, m_nChannels, pChunk->lFrame, pChunk->nFrames);
+        OverlaySpool((float*)pChunk->pData, pChunk->lFrame, pChunk->nFrames);
+        TraceEnd("overlay");
+        pChunk->nState.store(CHUNK_READY, std::memory_order_release);
+        Filled(pChunk);
+        return;
+    }
+
+    //Take file write complete so add frames to extent map once all tracks are written
+    CaptureChunk* pChunk = (CaptureChunk*)pRequest->pData;
+    if(--pChunk->nPending)
+        return;
+    FinishCapture(pChunk);
+}
+
+void DiskStream::ReclaimChunks()
+{
+    //Audio thread releases chunks in order so buffers are returned from oldest chunk until one still in use
+    size_t nChunkSize = STREAM_CHUNK_FRAMES * m_nFrameSize;
+    while(m_nChunksHeld)
+    {
+        StreamChunk* pChunk = &m_aChunks[m_nReclaim];
+        if(CHUNK_FREE != pChunk->nState.load(std::memory_order_acquire))
+            return;
+        uint64_t lBit = 1ull << pChunk->nBuffer;
+        m_lChunkHeld &= ~lBit;
+        if(pChunk->nBuffer < (int)m_nReadDepth)
+            m_lChunkFree |= lBit;
+        else
+            ReleaseMemory(pChunk->pData, nChunkSize); //Depth reduced whilst buffer was in use
+        pChunk->nBuffer = -1;
+        pChunk->pData = NULL;
+        m_nReclaim = (m_nReclaim + 1) % STREAM_CHUNKS;
+        --m_nChunksHeld;
+    }
+}
+
+void DiskStream::ProvisionCaptures()
+{
+    //Give buffers to empty chunks ahead of audio thread in the order it fills them
+    while(m_lCaptureFree)
+    {
+        CaptureChunk* pChunk = &m_aCapture[m_nProvision];
+        if(CAPTURE_EMPTY != pChunk->nState.load(std::memory_order_acquire))
+            return;
+        unsigned int nBuffer = __builtin_ctzll(m_lCaptureFree);
+        m_lCaptureFree &= ~(1ull << nBuffer);
+        m_lCaptureHeld |= 1ull << nBuffer;
+        pChunk->nBuffer = nBuffer;
+        pChunk->pA = m_pCaptureSamples + nBuffer * CAPTURE_CHUNK_FRAMES * 2;
+        pChunk->pB = pChunk->pA + CAPTURE_CHUNK_FRAMES;
+        pChunk->requestA.nBuffer = pChunk->requestB.nBuffer = nBuffer < CAPTURE_MIN_CHUNKS ? (int)(STREAM_MIN_CHUNKS + nBuffer) : -1;
+        pChunk->nState.store(CAPTURE_FREE, std::memory_order_release);
+        m_nProvision = (m_nProvision + 1) % CAPTURE_CHUNKS;
+    }
+}
+
+void DiskStream::ReleaseCapture(CaptureChunk* pChunk)
+{
+    uint64_t lBit = 1ull << pChunk->nBuffer;
+    m_lCaptureHeld &= ~lBit;
+    if(pChunk->nBuffer < (int)m_nCaptureDepth)
+        m_lCaptureFree |= lBit;
+    else
+        ReleaseMemory(pChunk->pA, CAPTURE_CHUNK_FRAMES * 2 * sizeof(float)); //Depth reduced whilst buffer was in use
+    pChunk->nBuffer = -1;
+    pChunk->pA = NULL;
+    pChunk->pB = NULL;
+    pChunk->nState.store(CAPTURE_EMPTY, std::memory_order_release);
+}
+
+void DiskStream::Adapt()
+{
+    timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    if(GetElapsedMs(m_tsAdapt, tsNow) * m_dSpeed < STREAM_ADAPT_MS)
+        return;
+    MeasureDrain(GetElapsedMs(m_tsAdapt, tsNow));
+    m_tsAdapt = tsNow;
+    unsigned int nTarget = GetTargetDepth(IO_READ, STREAM_CHUNK_FRAMES, STREAM_MIN_CHUNKS, m_nMaxChunks);
+    if(nTarget)
+        SetReadDepth(NextDepth(m_nReadDepth, nTarget, m_tsReadShrink, m_nReadShrinkTo, tsNow));
+    nTarget = GetTargetDepth(IO_WRITE, CAPTURE_CHUNK_FRAMES, CAPTURE_MIN_CHUNKS, m_nMaxCaptures);
+    if(nTarget)
+        SetCaptureDepth(NextDepth(m_nCaptureDepth, nTarget, m_tsCaptureShrink, m_nCaptureShrinkTo, tsNow));
+}
+
+void DiskStream::MeasureDrain(long lMs)
+{
+    if(0 == m_nSpoolSlots || lMs <= 0)
+        return;
+    //Rate is smoothed over a few seconds and falls towards zero whilst storage stalls
+    double dRate = m_lSpoolRetired * 1000.0 / lMs;
+    m_lSpoolRetired = 0;
+    if(0 == m_nSpoolUsed && 0 == dRate)
+        return; //Nothing to write so nothing learnt about storage
+    m_dSpoolRate = m_dSpoolRate ? 0.75 * m_dSpoolRate + 0.25 * dRate : dRate;
+    if(m_dSpoolRate < 1)
+        m_nSpoolDrainMs = ~0u;
+    else
+        m_nSpoolDrainMs = std::min(GetSpoolFrames() * 1000.0 / m_dSpoolRate, (double)(~0u - 1));
+}
+
+unsigned int DiskStream::GetTargetDepth(int nOp, unsigned int nChunkFrames, unsigned int nMin, unsigned int nMax)
+{
+    LatencyHistogram& latency = m_ioEngine.GetLatency(nOp);
+    if(latency.GetCount() < STREAM_MIN_SAMPLES)
+        return 0; //Not yet measured so keep current depth
+    double dLatency = latency.GetPercentile(STREAM_PERCENTILE);
+    dLatency *= m_dSpeed;
+    if(IO_READ == nOp)
+        m_nReadLatency = dLatency * 1e6;
+    else
+        m_nWriteLatency = dLatency * 1e6;
+    //Chunk being played or captured does not count towards margin
+    unsigned int nRate = m_nFileRate ? m_nFileRate : 44100;
+    unsigned int nDepth = ceil(STREAM_SAFETY * dLatency * nRate / nChunkFrames) + 1;
+    if(nDepth < nMin)
+        nDepth = nMin;
+    if(nDepth > nMax)
+        nDepth = nMax;
+    return nDepth;
+}
+
+unsigned int DiskStream::NextDepth(unsigned int nDepth, unsigned int nTarget, timespec& tsShrink, unsigned int& nShrinkTo, const timespec& tsNow)
+{
+    //Grow at once but only shrink once storage has been faster for a while, to the deepest target seen meanwhile
+    if(nTarget >= nDepth)
+    {
+        tsShrink.tv_sec = 0;
+        return nTarget;
+    }
+    if(0 == tsShrink.tv_sec)
+    {
+        tsShrink = tsNow;
+        nShrinkTo = nTarget;
+        return nDepth;
+    }
+    if(nTarget > nShrinkTo)
+        nShrinkTo = nTarget;
+    if(GetElapsedMs(tsShrink, tsNow) * m_dSpeed < STREAM_SHRINK_MS)
+        return nDepth;
+    tsShrink.tv_sec = 0;
+    return nShrinkTo;
+}
+
+void DiskStream::SetReadDepth(unsigned int nDepth)
+{
+    if(nDepth == m_nReadDepth)
+        return;
+    size_t nChunkSize = STREAM_CHUNK_FRAMES * m_nFrameSize;
+    for(unsigned int i = m_nReadDepth; i < nDepth; ++i)
+    {
+        //Buffer still held from before depth was reduced is already resident
+        if(m_lChunkHeld & (1ull << i))
+            continue;
+        AcquireMemory(m_pChunkMemory + i * nChunkSize, nChunkSize);
+        m_lChunkFree |= 1ull << i;
+    }
+    for(unsigned int i = nDepth; i < m_nReadDepth; ++i)
+    {
+        //Buffers in use are released when reclaimed
+        if(0 == (m_lChunkFree & (1ull << i)))
+            continue;
+        m_lChunkFree &= ~(1ull << i);
+        ReleaseMemory(m_pChunkMemory + i * nChunkSize, nChunkSize);
+    }
+    m_nReadDepth = nDepth;
+    ++m_nDepthChanges;
+}
+
+void DiskStream::SetCaptureDepth(unsigned int nDepth)
+{
+    if(nDepth == m_nCaptureDepth)
+        return;
+    size_t nCaptureSize = CAPTURE_CHUNK_FRAMES * 2 * sizeof(float);
+    for(unsigned int i = m_nCaptureDepth; i < nDepth; ++i)
+    {
+        if(m_lCaptureHeld & (1ull << i))
+            continue;
+        AcquireMemory(m_pCaptureSamples + i * CAPTURE_CHUNK_FRAMES * 2, nCaptureSize);
+        m_lCaptureFree |= 1ull << i;
+    }
+    for(unsigned int i = nDepth; i < m_nCaptureDepth; ++i)
+    {
+        if(0 == (m_lCaptureFree & (1ull << i)))
+            continue;
+        m_lCaptureFree &= ~(1ull << i);
+        ReleaseMemory(m_pCaptureSamples + i * CAPTURE_CHUNK_FRAMES * 2, nCaptureSize);
+    }
+    m_nCaptureDepth = nDepth;
+    ++m_nDepthChanges;
+}
+
+bool DiskStream::IsCapturePending(bool bSpool)
+{
+    for(unsigned int i = 0; i < CAPTURE_CHUNKS; ++i)
+    {
+        int nState = m_aCapture[i].nState.load(std::memory_order_acquire);
+        if(nState >= CAPTURE_FULL)
+            return true;
+    }
+    //Spool is checked after write-behind because audio is counted in spool before leaving write-behind
+    return bSpool && m_nSpoolUsed;
+}
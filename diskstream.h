@@ -0,0 +1,420 @@
+/** Class providing read-ahead and write-behind streaming of an interleaved WAVE data region
+*   Audio thread consumes playback data and queues captured audio without blocking
+*   A disk thread keeps several read and write requests in flight using IoEngine
+*   Captured audio is appended to take files and read-ahead data is overlaid with takes
+*   Read-ahead and write-behind depth follow measured storage service times, within a memory limit
+*   Buffers are taken from pools by the disk thread so memory beyond the current depth is released
+*   Files with integer samples are converted to float by the disk thread as each chunk is read
+*   An optional record-to-RAM spool holds minutes of captured audio so recording survives storage that stalls
+*/
+#pragma once
+
+#include "ioengine.h"
+#include "resampler.h"
+#include "takestore.h"
+#include "wave.h"
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+
+static const unsigned int STREAM_CHUNK_FRAMES   = 4096; //Quantity of frames in each read-ahead chunk
+static const unsigned int STREAM_CHUNKS         = 64; //Maximum quantity of read-ahead chunks (at most 64)
+static const unsigned int STREAM_MIN_CHUNKS     = 4; //Least quantity of read-ahead chunks
+static const unsigned int STREAM_START_CHUNKS   = 16; //Quantity of read-ahead chunks until storage has been measured
+static const unsigned int CAPTURE_CHUNK_FRAMES  = 4096; //Quantity of frames in each write-behind chunk
+static const unsigned int CAPTURE_CHUNKS        = 64; //Maximum quantity of write-behind chunks (at most 64)
+static const unsigned int CAPTURE_MIN_CHUNKS    = 4; //Least quantity of write-behind chunks
+static const unsigned int CAPTURE_START_CHUNKS  = 16; //Quantity of write-behind chunks until storage has been measured
+static const unsigned int STREAM_MEMORY_LIMIT   = 16; //Default maximum MB of read-ahead and write-behind buffers
+static const double STREAM_PERCENTILE           = 0.999; //Fraction of requests whose service time buffering must cover
+static const double STREAM_SAFETY               = 2; //Buffered audio is this multiple of percentile service time
+static const unsigned int STREAM_MIN_SAMPLES    = 32; //Quantity of requests measured before depth is adapted
+static const unsigned int STREAM_ADAPT_MS       = 500; //Interval between depth adjustments
+static const unsigned int STREAM_SHRINK_MS      = 10000; //Time depth must exceed target before it is reduced
+static const unsigned int STREAM_QUEUE_DEPTH    = 16; //Maximum quantity of I/O requests in flight
+static const unsigned int RESAMPLE_SLICE        = 1024; //Maximum quantity of frames converted at a time
+static const unsigned int SPOOL_MAX_MINUTES     = 60; //Longest record-to-RAM spool
+static const double SPOOL_MEMORY_SHARE          = 0.5; //Largest fraction of available memory used by record-to-RAM spool
+static const unsigned int SPOOL_MIN_SECONDS     = 10; //Shortest record-to-RAM spool - used unlocked if even this may not be locked
+
+/** Structure representing a block of read-ahead data **/
+struct StreamChunk
+{
+    std::atomic<int> nState; //CHUNK_FREE | CHUNK_PENDING | CHUNK_READY
+    unsigned int nEpoch; //Locate epoch this data belongs to
+    long lFrame; //Position of first frame
+    unsigned int nFrames; //Quantity of frames
+    char* pData; //Interleaved sample data
+    int nBuffer; //Index of read-ahead buffer held or -1 if none
+    IoRequest request; //I/O request used to fill chunk
+};
+
+/** Structure representing a block of captured audio waiting to be written **/
+struct CaptureChunk
+{
+    std::atomic<int> nState; //CAPTURE_EMPTY | CAPTURE_FREE | CAPTURE_FILLING | CAPTURE_FULL | CAPTURE_WRITING | CAPTURE_WRITTEN
+    long lFrame; //Position of first frame
+    unsigned int nFrames; //Quantity of frames captured
+    int nTrackA; //Index of track recording A input or -1
+    int nTrackB; //Index of track recording B input or -1
+    bool bNewTake; //True if this is the first chunk of a take
+    float* pA; //Captured A input samples
+    float* pB; //Captured B input samples
+    int nBuffer; //Index of write-behind buffer held or -1 if none
+    unsigned int nTake; //Take this chunk is appended to
+    long lOffset; //Position of first frame within take
+    unsigned int nPending; //Quantity of writes in progress
+    IoRequest requestA; //I/O request used to write A input samples to take file
+    IoRequest requestB; //I/O request used to write B input samples to take file
+};
+
+class DiskStream
+{
+    public:
+        DiskStream();
+        ~DiskStream();
+
+        /** @brief  Start streaming a file
+        *   @param  fd File descriptor of open WAVE file
+        *   @param  offStart Offset of start of data in file
+        *   @param  nChannels Quantity of interleaved channels
+        *   @param  lFrames Quantity of frames in file
+        *   @param  pTakes Pointer to take store used for capture and overlaid on playback
+        *   @param  nEncoding Sample encoding of file [WAVE_FLOAT | WAVE_PCM16 | WAVE_PCM24 | WAVE_PCM32]
+        *   @return <i>bool</i> True on success
+        */
+        bool Open(int fd, off_t offStart, unsigned int nChannels, long lFrames, TakeStore* pTakes, int nEncoding = WAVE_FLOAT);
+
+        /** @brief  Write outstanding captured audio, stop disk thread and release buffers
+        */
+        void Close();
+
+        /** @brief  Set sample rates used by subsequent Open, converting between them if they differ
+        *   @param  nFileRate Sample rate of file
+        *   @param  nDeviceRate Sample rate of audio interface
+        *   @param  nQuality Conversion quality [RESAMPLE_FAST | RESAMPLE_MEDIUM | RESAMPLE_BEST]
+        */
+        void SetResample(unsigned int nFileRate, unsigned int nDeviceRate, int nQuality);
+
+        /** @brief  Check whether sample rate conversion is in use
+        */
+        bool IsResampling() { return m_bResample; }
+
+        /** @brief  Get quantity of file frames per audio interface frame
+        *   @return <i>double</i> Ratio of file to interface sample rate - 1 if not converting
+        */
+        double GetRatio() { return m_bResample ? (double)m_nFileRate / m_nDeviceRate : 1.0; }
+
+        /** @brief  Get offset between playhead and audio being captured
+        *   @param  nLatency Round trip latency of audio interface in interface frames
+        *   @return <i>long</i> Offset in file frames including conversion delay
+        */
+        long GetCaptureOffset(unsigned int nLatency);
+
+        /** @brief  Move read-ahead to new position
+        *   @param  lFrame Position of playhead in frames relative to start
+        *   @note   Call from non-realtime thread
+        */
+        void Locate(long lFrame);
+
+        /** @brief  Discard stale read-ahead and check whether playback data is available
+        *   @return <i>bool</i> True if data is available at playhead
+        *   @note   Call from audio thread
+        */
+        bool Cue();
+
+        /** @brief  Get next period of playback data
+        *   @param  pBuffer Buffer to populate with interleaved samples
+        *   @param  nFrames Quantity of frames to read at audio interface sample rate
+        *   @return <i>unsigned int</i> Quantity of file frames consumed - differs from nFrames when resampling
+        *   @note   Call from audio thread - frames not available from disk are silenced
+        */
+        unsigned int Read(float* pBuffer, unsigned int nFrames);
+
+        /** @brief  Queue captured audio to be written to file
+        *   @param  lFrame Position of first frame in file frames
+        *   @param  nFrames Quantity of frames at audio interface sample rate
+        *   @param  pInA Pointer to A input samples
+        *   @param  nTrackA Index of track to record A input or -1 for none
+        *   @param  pInB Pointer to B input samples
+        *   @param  nTrackB Index of track to record B input or -1 for none
+        *   @return <i>bool</i> False if write-behind buffer is full and audio was lost
+        *   @note   Call from audio thread
+        */
+        bool Capture(long lFrame, unsigned int nFrames, const float* pInA, int nTrackA, const float* pInB, int nTrackB);
+
+        /** @brief  Release partially filled capture buffer to disk thread, e.g. when recording stops
+        *   @note   Call from audio thread
+        */
+        void EndCapture();
+
+        /** @brief  Wait for captured audio to be written to take files
+        *   @note   Call from non-realtime thread after recording stops - waits for record-to-RAM spool to drain
+        */
+        void Sync();
+
+        /** @brief  Request file be extended
+        *   @param  lFrames Minimum quantity of frames in file
+        *   @note   May be called from audio thread
+        */
+        void SetLength(long lFrames);
+
+        /** @brief  Issue asynchronous operating system readahead for a range of the file and its takes
+        *   @param  lFrame Position of first frame
+        *   @param  lFrames Quantity of frames
+        *   @note   Does not block
+        */
+        void Prefetch(long lFrame, long lFrames);
+
+        /** @brief  Check whether read-ahead since last locate is full so playback may start without waiting for disk
+        */
+        bool IsPrimed() { return m_nPrimedEpoch == m_nEpoch; }
+
+        /** @brief  Get quantity of periods played with missing data
+        */
+        unsigned int GetUnderruns() { return m_nUnderruns; }
+
+        /** @brief  Get quantity of periods of captured audio lost due to full write-behind buffer
+        */
+        unsigned int GetOverruns() { return m_nOverruns; }
+
+        /** @brief  Get read-ahead available at playhead
+        *   @return <i>unsigned int</i> Quantity of frames that may be read without underrun
+        *   @note   Call from audio thread
+        */
+        unsigned int GetReadyFrames();
+
+        /** @brief  Get least read-ahead available to audio thread since errors were cleared
+        *   @return <i>unsigned int</i> Quantity of file frames ready beyond playhead - measured once read-ahead is primed after each locate
+        */
+        unsigned int GetReadMargin() { return m_nReadMargin; }
+
+        /** @brief  Get least write-behind space available to audio thread since errors were cleared
+        *   @return <i>unsigned int</i> Quantity of file frames that could be captured before audio is lost
+        */
+        unsigned int GetCaptureMargin() { return m_nCaptureMargin; }
+
+        /** @brief  Reset underrun and overrun counts and buffer margins
+        */
+        void ClearErrors() { m_nUnderruns = 0; m_nOverruns = 0; m_nReadMargin = ~0u; m_nCaptureMargin = ~0u; }
+
+        /** @brief  Set maximum memory used by read-ahead and write-behind buffers
+        *   @param  nMegabytes Quantity of MB
+        *   @note   Takes effect on next Open - the least depths are always allowed
+        */
+        void SetMemoryLimit(unsigned int nMegabytes) { m_nMemoryLimit = nMegabytes; }
+
+        /** @brief  Get quantity of read-ahead chunks disk thread keeps filled
+        */
+        unsigned int GetReadDepth() { return m_nReadDepth; }
+
+        /** @brief  Get quantity of write-behind chunks available to audio thread
+        */
+        unsigned int GetCaptureDepth() { return m_nCaptureDepth; }
+
+        /** @brief  Get measured read service time that read-ahead depth covers
+        *   @return <i>unsigned int</i> Percentile service time in microseconds or 0 if not yet measured
+        */
+        unsigned int GetReadLatency() { return m_nReadLatency; }
+
+        /** @brief  Get measured write service time that write-behind depth covers
+        *   @return <i>unsigned int</i> Percentile service time in microseconds or 0 if not yet measured
+        */
+        unsigned int GetWriteLatency() { return m_nWriteLatency; }
+
+        /** @brief  Get quantity of times read-ahead or write-behind depth has changed since Open
+        */
+        unsigned int GetDepthChanges() { return m_nDepthChanges; }
+
+        /** @brief  Get memory currently used by read-ahead and write-behind buffers
+        *   @return <i>unsigned long</i> Quantity of KB
+        */
+        unsigned long GetBufferKb() { return ((unsigned long)m_nReadDepth * m_nFrameSize * STREAM_CHUNK_FRAMES + (unsigned long)m_nCaptureDepth * CAPTURE_CHUNK_FRAMES * 2 * sizeof(float)) / 1024; }
+
+        /** @brief  Set length of record-to-RAM spool
+        *   @param  nMinutes Minutes of captured audio held in memory whilst it is written to take files or 0 to write from write-behind buffers
+        *   @note   Takes effect on next Open - spool memory is allocated and locked when file is opened
+        *   @note   Spool is limited to SPOOL_MEMORY_SHARE of available memory and halved until it may be locked - GetSpoolCapacity gives the length used
+        */
+        void SetSpool(unsigned int nMinutes) { m_nSpoolMinutes = nMinutes < SPOOL_MAX_MINUTES ? nMinutes : SPOOL_MAX_MINUTES; }
+
+        /** @brief  Get length of record-to-RAM spool requested for next Open
+        *   @return <i>unsigned int</i> Quantity of minutes or 0 if disabled
+        */
+        unsigned int GetSpoolMinutes() { return m_nSpoolMinutes; }
+
+        /** @brief  Check whether captured audio passes through record-to-RAM spool
+        */
+        bool IsSpooling() { return m_nSpoolSlots > 0; }
+
+        /** @brief  Get quantity of captured frames in spool not yet written to take files
+        */
+        unsigned long GetSpoolFrames() { return (unsigned long)m_nSpoolUsed * CAPTURE_CHUNK_FRAMES; }
+
+        /** @brief  Get quantity of frames spool can hold, which may be less than requested by SetSpool if memory is short
+        */
+        unsigned long GetSpoolCapacity() { return (unsigned long)m_nSpoolSlots * CAPTURE_CHUNK_FRAMES; }
+
+        /** @brief  Get estimated time to write spooled audio at measured write rate
+        *   @return <i>unsigned int</i> Milliseconds, 0 if spool is empty or ~0 if storage is not accepting writes
+        */
+        unsigned int GetSpoolDrainMs() { return m_nSpoolUsed ? (unsigned int)m_nSpoolDrainMs : 0; }
+
+        /** @brief  Pass I/O through a simulated storage device, e.g. for soak tests
+        *   @param  pShim Pointer to shim or NULL to access storage directly
+        *   @note   Takes effect on next Open
+        */
+        void SetShim(StorageShim* pShim) { m_pShim = pShim; }
+
+        /** @brief  Allow io_uring to be used for I/O, e.g. to compare it with the thread pool
+        *   @param  bAllow False to use thread pool even when io_uring is available
+        *   @note   Takes effect on next Open
+        */
+        void SetUring(bool bAllow) { m_bAllowUring = bAllow; }
+
+        /** @brief  Check whether io_uring is used for I/O
+        */
+        bool IsUring() { return m_bUring; }
+
+        /** @brief  Get quantity of KB read since file opened
+        */
+        unsigned long GetKbRead() { return m_lKbRead; }
+
+        /** @brief  Get quantity of KB written since file opened
+        */
+        unsigned long GetKbWritten() { return m_lKbWritten; }
+
+        /** @brief  Get quantity of system calls used to perform I/O since file opened
+        */
+        unsigned long GetSyscalls() { return m_lSyscalls; }
+
+    private:
+        static void* ThreadProc(void* pArgs);
+        void Run();
+        bool CueChunks();
+        unsigned int ReadFrames(float* pBuffer, unsigned int nFrames);
+        bool CaptureFrames(long lFrame, unsigned int nFrames, const float* pInA, int nTrackA, const float* pInB, int nTrackB);
+        bool Service();
+        void SubmitReads();
+        void SubmitCaptures();
+        unsigned int AllocateSpool(unsigned int nSlots);
+        void SpoolCaptures();
+        void FinishCapture(CaptureChunk* pChunk);
+        void AddExtents(CaptureChunk* pChunk);
+        void RetireSpool();
+        void OverlaySpool(float* pFrames, long lFrame, unsigned int nFrames);
+        void MeasureDrain(long lMs);
+        void Complete(IoRequest* pRequest);
+        void Filled(StreamChunk* pChunk);
+        void ReclaimChunks();
+        void ProvisionCaptures();
+        void ReleaseCapture(CaptureChunk* pChunk);
+        void Adapt();
+        unsigned int GetTargetDepth(int nOp, unsigned int nChunkFrames, unsigned int nMin, unsigned int nMax);
+        unsigned int NextDepth(unsigned int nDepth, unsigned int nTarget, timespec& tsShrink, unsigned int& nShrinkTo, const timespec& tsNow);
+        void SetReadDepth(unsigned int nDepth);
+        void SetCaptureDepth(unsigned int nDepth);
+        void Signal();
+        void MeasureReadMargin();
+        void MeasureCaptureMargin();
+        bool IsCapturePending(bool bSpool = true);
+
+        //Shared
+        std::atomic<bool> m_bOpen; //True whilst streaming
+        std::atomic<bool> m_bInRt; //True whilst audio thread is accessing buffers
+        std::atomic<bool> m_bRunning; //True whilst disk thread should run
+        std::atomic<unsigned int> m_nEpoch; //Incremented on each locate
+        std::atomic<long> m_lLocateFrame; //Position requested by last locate
+        std::atomic<long> m_lRequiredFrames; //Minimum length of file requested
+        std::atomic<unsigned int> m_nPrimedEpoch; //Epoch for which read-ahead has been filled
+        std::atomic<unsigned int> m_nUnderruns; //Quantity of periods with missing playback data
+        std::atomic<unsigned int> m_nOverruns; //Quantity of periods with lost capture data
+        std::atomic<unsigned int> m_nReadMargin; //Least read-ahead frames seen by audio thread
+        std::atomic<unsigned int> m_nCaptureMargin; //Least free write-behind frames seen by audio thread
+        std::atomic<unsigned long> m_lKbRead; //Statistics published by disk thread
+        std::atomic<unsigned long> m_lKbWritten;
+        std::atomic<unsigned long> m_lSyscalls;
+        std::atomic<unsigned int> m_nReadDepth; //Quantity of read-ahead buffers in use
+        std::atomic<unsigned int> m_nCaptureDepth; //Quantity of write-behind buffers in use
+        std::atomic<unsigned int> m_nReadLatency; //Percentile read service time in microseconds
+        std::atomic<unsigned int> m_nWriteLatency; //Percentile write service time in microseconds
+        std::atomic<unsigned int> m_nDepthChanges; //Quantity of depth changes since open
+        std::atomic<unsigned int> m_nSpoolUsed; //Quantity of spool chunks holding audio not yet in take store
+        std::atomic<unsigned int> m_nSpoolDrainMs; //Estimated time to write spooled audio
+        StreamChunk m_aChunks[STREAM_CHUNKS]; //Read-ahead ring
+        CaptureChunk m_aCapture[CAPTURE_CHUNKS]; //Write-behind ring
+        int m_fd; //File descriptor of WAVE file
+        off_t m_offStart; //Offset of start of data
+        unsigned int m_nChannels; //Quantity of interleaved channels
+        unsigned int m_nFrameSize; //Quantity of bytes in each frame of read-ahead
+        int m_nEncoding; //Sample encoding of file
+        unsigned int m_nFileFrameSize; //Quantity of bytes in each frame of file
+        int m_fdNotify; //eventfd used to wake disk thread
+        bool m_bUring; //True if io_uring in use
+        bool m_bAllowUring; //False to use thread pool for next open
+        char* m_pChunkMemory; //Read-ahead buffers - only those in use are resident
+        float* m_pCaptureSamples; //Captured mono samples (write-behind buffers) - only those in use are resident
+        unsigned int m_nMemoryLimit; //Maximum MB of buffers
+        unsigned int m_nMaxChunks; //Quantity of read-ahead buffers allowed by memory limit
+        unsigned int m_nMaxCaptures; //Quantity of write-behind buffers allowed by memory limit
+        TakeStore* m_pTakes; //Take store
+        pthread_t m_thread; //Disk thread
+        unsigned int m_nFileRate; //Sample rate of file
+        unsigned int m_nDeviceRate; //Sample rate of audio interface
+        int m_nResampleQuality; //Sample rate conversion quality
+        bool m_bResample; //True if converting sample rate
+        StorageShim* m_pShim; //Simulated storage device or NULL for none
+        double m_dSpeed; //Quantity of audio seconds per real second - faster than real time when simulating storage
+        unsigned int m_nSpoolMinutes; //Length of spool requested for next open
+        unsigned int m_nSpoolSlots; //Quantity of chunks in spool or 0 if not spooling
+        CaptureChunk* m_pSpool; //Spool ring
+        float* m_pSpoolSamples; //Spooled mono samples - locked
+
+        //Audio thread
+        unsigned int m_nPlayChunk; //Index of chunk being played
+        unsigned int m_nPlayEpoch; //Epoch of data being played
+        long m_lPlayFrame; //Position of next frame to play
+        bool m_bPlayCued; //True once data has been available since last locate
+        unsigned int m_nCaptureFill; //Index of capture chunk being filled
+        bool m_bCaptureEnded; //True if next captured audio starts a new take
+        Resampler m_resamplePlay; //Converts playback from file rate to interface rate
+        Resampler m_resampleCapture; //Converts captured audio from interface rate to file rate
+        float* m_pResampleIn; //Playback data at file rate
+        float* m_pCaptureIn; //Captured audio at interface rate, A and B interleaved
+        float* m_pCaptureOut; //Captured audio at file rate, A and B interleaved
+        float* m_pCaptureA; //Captured A input at file rate
+        float* m_pCaptureB; //Captured B input at file rate
+        long m_lCaptureFrame; //Position of next converted captured frame
+
+        //Disk thread
+        IoEngine m_ioEngine; //Asynchronous I/O engine
+        unsigned int m_nReadFill; //Index of next chunk to fill
+        unsigned int m_nFillEpoch; //Epoch of data being read
+        long m_lFillFrame; //Position of next frame to read
+        long m_lFileFrames; //Quantity of frames in file
+        unsigned int m_nCaptureFlush; //Index of next capture chunk to write
+        unsigned int m_nTake; //Current take or 0 if none
+        long m_lTakeStart; //Position of first frame of current take
+        long m_lTakeEnd; //Position after last frame of current take
+        int m_nTakeTrackA; //Index of track recording A input in current take
+        int m_nTakeTrackB; //Index of track recording B input in current take
+        bool m_bDrain; //True to complete capture writes before reading after locate
+        unsigned int m_nFilledChunks; //Quantity of chunks filled since locate
+        uint64_t m_lChunkFree; //Bitmap of read-ahead buffers available to fill
+        uint64_t m_lChunkHeld; //Bitmap of read-ahead buffers held by chunks
+        unsigned int m_nReclaim; //Index of oldest chunk that may hold a buffer
+        unsigned int m_nChunksHeld; //Quantity of chunks holding a buffer
+        uint64_t m_lCaptureFree; //Bitmap of write-behind buffers available to provision
+        uint64_t m_lCaptureHeld; //Bitmap of write-behind buffers held by chunks
+        unsigned int m_nProvision; //Index of next capture chunk to be given a buffer
+        timespec m_tsAdapt; //Time of last depth adjustment
+        timespec m_tsReadShrink; //Time read-ahead target first fell below depth or zero
+        timespec m_tsCaptureShrink; //Time write-behind target first fell below depth or zero
+        unsigned int m_nReadShrinkTo; //Highest read-ahead target since it fell below depth
+        unsigned int m_nCaptureShrinkTo; //Highest write-behind target since it fell below depth
+        unsigned int m_nSpoolIn; //Index of next spool chunk to fill
+        unsigned int m_nSpoolFlush; //Index of next spool chunk to write
+        unsigned int m_nSpoolRetire; //Index of oldest spool chunk holding audio
+        unsigned long m_lSpoolRetired; //Quantity of spooled frames added to take store since drain rate was measured
+        double m_dSpoolRate; //Smoothed frames per second added to take store from spool
+};
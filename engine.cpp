@@ -0,0 +1,1883 @@
+#include "engine.h"
+#include "trace.h"
+#include "track.h"
+#include "wave.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace std;
+
+/** Move checksum index of a new file into place beside project file, removing project index if new file has none */
+static void ReplaceChecksums(const string& sSource, const string& sDest)
+{
+    string sIndex = BlockChecksums::GetFilename(sDest);
+    if(rename(BlockChecksums::GetFilename(sSource).c_str(), sIndex.c_str()))
+        unlink(sIndex.c_str()); //Index of old file would report every changed block as corrupt
+}
+
+Engine::Engine() :
+    m_pJackClient(NULL),
+    m_pDeadClient(NULL),
+    m_bConnectionsChanged(false),
+    m_bConnectionsSaved(false),
+    m_pPortInputA(NULL),
+    m_pPortInputB(NULL),
+    m_pPortPlaybackA(NULL),
+    m_pPortPlaybackB(NULL),
+    m_pPortMidi(NULL),
+    m_nCaptureLatency(0),
+    m_nPlaybackLatency(0),
+    m_nRecordOffset(0),
+    m_nCalibratedLatency(0),
+    m_nCalibratedRate(0),
+    m_bPrefaulted(false),
+    m_bServerShutdown(false),
+    m_lProcessCount(0),
+    m_bSuspendAudio(false),
+    m_bAudioSuspended(false),
+    m_sPath(PROJECT_PATH), //!@todo replace this absolute path
+    m_fdWave(-1),
+    m_offStartOfData(0),
+    m_offEndOfData(0),
+    m_nFrameSize(0),
+    m_nEncoding(WAVE_FLOAT),
+    m_bForeign(false),
+    m_nSamplerate(DEFAULT_SAMPLERATE),
+    m_nResampleQuality(RESAMPLE_MEDIUM),
+    m_nParallelTracks(PARALLEL_TRACKS),
+    m_nBufferMemory(STREAM_MEMORY_LIMIT),
+    m_nSpoolMinutes(0),
+    m_bStemSkipSilent(false),
+    m_bStemTrim(false),
+    m_nTransport(TC_STOPPED),
+    m_lLastFrame(0),
+    m_lHeadPos(0),
+    m_lSyncLocate(-1),
+    m_bRecordEnabled(false),
+    m_nRecA(-1),
+    m_nRecB(-1),
+    m_bAutoPunch(false),
+    m_lPunchIn(0),
+    m_lPunchOut(0),
+    m_nPreRoll(PRE_ROLL),
+    m_nPostRoll(POST_ROLL),
+    m_nPunchFade(PUNCH_FADE),
+    m_nInputMonitor(MONITOR_OFF),
+    m_lHistoryStart(0),
+    m_lHistoryEnd(0),
+    m_bChanged(false),
+    m_pReadBuffer(NULL),
+    m_pSilence(NULL),
+    m_pProbe(NULL),
+    m_nJob(JOB_NONE),
+    m_bJobResult(false)
+{
+    m_afMonitorFade[0] = m_afMonitorFade[1] = 0;
+    m_apPunchHistory[0] = m_apPunchHistory[1] = NULL;
+    m_apPunchInput[0] = m_apPunchInput[1] = NULL;
+    AllocateRtBuffers();
+}
+
+Engine::~Engine()
+{
+    Disconnect();
+    CloseProject();
+}
+
+bool Engine::Connect(const char* pName)
+{
+    //Open a client connection to the JACK server
+    jack_status_t nStatus;
+    const char** as_ports; //array of pointers to c-strings used to hold list of port names
+    ReleaseClient(); //Client of a server that has shut down cannot be reused
+    if(m_pJackClient.load())
+        return true; //Already connected
+    m_bServerShutdown = false;
+    m_lProcessCount = 0;
+    //Client is only published once active so a partially configured client is never reported as connected
+    jack_client_t* pClient = jack_client_open(pName, JackNoStartServer, &nStatus, NULL);
+    if(!pClient)
+        return false;
+    if(!IsOpen())
+        m_nSamplerate = jack_get_sample_rate(pClient); //!@todo Is it useful to get samplerate here? Should we (attempt to) set Jack samplerate after opening file?
+
+    //Assign Jack callback handler functions, passing this engine to each
+    jack_set_process_callback(pClient, OnJackProcess, this);
+    jack_set_sync_callback(pClient, OnJackSync, this); //!@todo Does not handled STOP from Jack transport
+    jack_on_shutdown(pClient, OnJackShutdown, this);
+    jack_set_latency_callback(pClient, OnJackLatency, this);
+    jack_set_buffer_size_callback(pClient, OnJackBufferChange, this);
+    jack_set_port_connect_callback(pClient, OnJackPortConnect, this);
+
+    //Create capture ports
+    m_pPortInputA = jack_port_register(pClient, "Input A", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    m_pPortInputB = jack_port_register(pClient, "Input B", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    if(!m_pPortInputA || !m_pPortInputB)
+    {
+        cerr << "Error - cannot register Jack ports" << endl;
+        AbandonClient(pClient);
+        return false;
+    }
+    //Create MIDI control port
+    m_pPortMidi = jack_port_register(pClient, "MIDI In", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+    //Find playback ports (expect 2)
+    as_ports = jack_get_ports(pClient, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsInput);
+    if(as_ports == NULL)
+    {
+        cerr << "No physical playback as_ports" << endl;
+        AbandonClient(pClient);
+        return false;
+    }
+    int nPort = 0;
+    while(as_ports[++nPort])
+        ;
+    if(nPort < 2)
+    {
+        fprintf(stderr, "Error - insufficient playback ports - require 2, found %d", nPort);
+        free(as_ports);
+        AbandonClient(pClient);
+        return false;
+    }
+    //!@todo Handle different playback port configuration, e.g. when monitor ports are not first two
+    m_pPortPlaybackA = jack_port_by_name(pClient, as_ports[0]);
+    m_pPortPlaybackB = jack_port_by_name(pClient, as_ports[1]);
+    free(as_ports);
+
+    //Start mixing workers at JACK's priority, leaving one core for the JACK thread
+    if(0 == m_workerPool.GetWorkers())
+    {
+        long lCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int nPriority = jack_client_real_time_priority(pClient);
+        if(lCpus > 1)
+            m_workerPool.Start(lCpus - 1, nPriority > 0 ? nPriority : 0);
+    }
+
+    //Rejoining after server restart so recreate ports of open project before audio runs
+    CreateJackSources(pClient);
+    m_bPrefaulted = false; //Process callback runs in a new thread
+
+    if(jack_activate(pClient))
+    {
+        fprintf(stderr, "Error - cannot activate Jack client\n");
+        AbandonClient(pClient);
+        return false;
+    }
+    m_pJackClient = pClient;
+    if(m_bServerShutdown)
+    {
+        //Server shut down before client was published so shutdown callback could not hand it to ReleaseClient
+        if(m_pJackClient.exchange(NULL) == pClient)
+            AbandonClient(pClient);
+        return false;
+    }
+
+    if(m_bConnectionsSaved)
+    {
+        //Server has restarted so connect ports as they were, including any made by other JACK clients
+        RestoreConnections(pClient);
+        return true;
+    }
+    //Connect capture ports
+    as_ports = jack_get_ports(pClient, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsOutput);
+    if(as_ports == NULL)
+        fprintf(stderr, "Error - no physical capture ports available\n");
+    else
+    {
+        nPort = 0;
+        while(as_ports[++nPort])
+            ; //!@todo There must be a better way to deduce quantity of ports
+        if(nPort < 2)
+            fprintf(stderr, "Error - insufficient capture ports - require 2, found %d", nPort);
+        else
+        {
+            if(jack_connect(pClient, as_ports[0], jack_port_name(m_pPortInputA)))
+                fprintf (stderr, "Cannot connect input port A\n");
+            if(jack_connect(pClient, as_ports[1], jack_port_name(m_pPortInputB)))
+                fprintf (stderr, "Cannot connect input port B\n");
+        }
+        free(as_ports);
+    }
+
+    //Connect all hardware MIDI inputs to MIDI control port
+    as_ports = jack_get_ports(pClient, NULL, JACK_DEFAULT_MIDI_TYPE, JackPortIsPhysical | JackPortIsOutput);
+    if(as_ports && m_pPortMidi)
+    {
+        for(nPort = 0; as_ports[nPort]; ++nPort)
+            jack_connect(pClient, as_ports[nPort], jack_port_name(m_pPortMidi));
+    }
+    free(as_ports);
+
+    //Connect track ports of open project to playback
+    for(unsigned int nTrack = 0; nTrack < m_vTracks.size(); ++nTrack)
+        ConnectPlayback(nTrack, GetRouting(nTrack));
+    return true;
+}
+
+void Engine::Disconnect()
+{
+    ReleaseClient();
+    jack_client_t* pClient = m_pJackClient.exchange(NULL);
+    if(pClient)
+        AbandonClient(pClient);
+    m_workerPool.Stop();
+}
+
+int Engine::OnJackProcess(jack_nframes_t nFrames, void* pArgs)
+{
+    ((Engine*)pArgs)->Process(nFrames);
+    return 0;
+}
+
+void Engine::Process(jack_nframes_t nFrames)
+{
+    m_lProcessCount.fetch_add(1, std::memory_order_relaxed);
+    if(!m_bPrefaulted)
+    {
+        PrefaultStack(); //First callback so touch stack before it is needed
+        TraceThread("audio");
+        m_bPrefaulted = true;
+    }
+    if(nFrames > RT_MAX_PERIOD)
+        return; //Buffers are not large enough
+    if(m_bSuspendAudio.load(std::memory_order_acquire))
+    {
+        //Main thread is replacing tracks - silence their outputs once, whilst they are still valid, then leave them alone
+        if(!m_bAudioSuspended.load(std::memory_order_relaxed))
+        {
+            for(unsigned int nChan = 0; nChan < m_vTracks.size(); ++nChan)
+                if(m_vTracks[nChan]->pSourcePort)
+                    memset(jack_port_get_buffer(m_vTracks[nChan]->pSourcePort, nFrames), 0, nFrames * sizeof(jack_default_audio_sample_t));
+            m_bAudioSuspended.store(true, std::memory_order_release);
+        }
+        return;
+    }
+    RtEnter();
+    TraceScope trace("process");
+
+    //Get each buffer once per period
+    const float* pInA = (const float*)jack_port_get_buffer(m_pPortInputA, nFrames);
+    const float* pInB = (const float*)jack_port_get_buffer(m_pPortInputB, nFrames);
+    unsigned int nChannels = m_vTracks.size();
+    float* apOut[MAX_TRACKS + 1];
+    for(unsigned int nChan = 0; nChan < nChannels; ++nChan)
+        apOut[nChan] = m_vTracks[nChan]->pSourcePort ? (float*)jack_port_get_buffer(m_vTracks[nChan]->pSourcePort, nFrames) : NULL;
+
+    //Apply each MIDI control event at its frame, processing audio up to the event before applying it
+    jack_nframes_t nDone = 0;
+    void* pMidiBuffer = m_pPortMidi ? jack_port_get_buffer(m_pPortMidi, nFrames) : NULL;
+    uint32_t nEvents = pMidiBuffer ? jack_midi_get_event_count(pMidiBuffer) : 0;
+    for(uint32_t nEvent = 0; nEvent < nEvents; ++nEvent)
+    {
+        jack_midi_event_t event;
+        if(0 == jack_midi_event_get(&event, pMidiBuffer, nEvent))
+            ProcessMidiEvent(event, pInA, pInB, apOut, nFrames, &nDone);
+    }
+    if(nDone < nFrames)
+        ProcessFrames(pInA, pInB, apOut, nFrames, nDone, nFrames - nDone);
+    RtLeave();
+}
+
+bool Engine::Render(jack_nframes_t nFrames, const float* pInA, const float* pInB, float* const* ppOut, const jack_midi_event_t* pEvents, uint32_t nEvents)
+{
+    if(nFrames > RT_MAX_PERIOD || !m_pReadBuffer)
+        return false;
+    RtEnter();
+    TraceScope trace("render");
+    if(!pInA)
+        pInA = m_pSilence;
+    if(!pInB)
+        pInB = m_pSilence;
+    bool bPlayed = false;
+    jack_nframes_t nDone = 0;
+    for(uint32_t nEvent = 0; nEvent < nEvents; ++nEvent)
+        bPlayed |= ProcessMidiEvent(pEvents[nEvent], pInA, pInB, ppOut, nFrames, &nDone);
+    if(nDone < nFrames)
+        bPlayed |= ProcessFrames(pInA, pInB, ppOut, nFrames, nDone, nFrames - nDone);
+    RtLeave();
+    return bPlayed;
+}
+
+bool Engine::ProcessMidiEvent(const jack_midi_event_t& event, const float* pInA, const float* pInB, float* const* ppOut, jack_nframes_t nPeriod, jack_nframes_t* pDone)
+{
+    MidiAction action;
+    if(!m_midiMap.Lookup(event.buffer, event.size, &action))
+        return false;
+    bool bPlayed = false;
+    if(event.time > *pDone && event.time < nPeriod)
+    {
+        bPlayed = ProcessFrames(pInA, pInB, ppOut, nPeriod, *pDone, event.time - *pDone);
+        *pDone = event.time;
+    }
+    HandleMidi(action);
+    return bPlayed;
+}
+
+unsigned int Engine::StartWorkers(unsigned int nWorkers)
+{
+    m_workerPool.Stop();
+    return nWorkers ? m_workerPool.Start(nWorkers, 0) : 0;
+}
+
+bool Engine::ProcessFrames(const float* pInA, const float* pInB, float* const* ppOut, jack_nframes_t nPeriod, jack_nframes_t nOffset, jack_nframes_t nFrames)
+{
+    //!@todo Optimse process code
+    if(TC_STOPPED == m_nTransport)
+    {
+        m_diskStream.Cue(); //Release stale read-ahead so that disk thread can prefetch from new position
+        SilenceOutputs(ppOut, nOffset, nFrames);
+        MonitorInputs(pInA, pInB, ppOut, nOffset, nFrames, TC_STOPPED, m_lHeadPos);
+        if(m_latencyProbe.IsRunning())
+            PlayProbe(pInA, pInB, ppOut, nOffset, nFrames);
+        return false; //Not rolling so don't process any audio
+    }
+    else if(TC_STOPPING == m_nTransport)
+    {
+        //Transport stop requested so silence all channels then set transport to stop
+        //Already faded out last sample (see code below)
+        SilenceOutputs(ppOut, nOffset, nFrames);
+        MonitorInputs(pInA, pInB, ppOut, nOffset, nFrames, TC_STOPPED, m_lHeadPos);
+        m_diskStream.EndCapture();
+        jack_client_t* pClient = m_pJackClient;
+        if(pClient)
+            jack_transport_stop(pClient);
+        m_nTransport = TC_STOPPED;
+        if(m_lSyncLocate >= 0 && m_lSyncLocate != m_lHeadPos)
+        {
+            m_lHeadPos = m_lSyncLocate;
+            m_diskStream.Locate(m_lHeadPos);
+        }
+        m_lSyncLocate = -1;
+        return false;
+    }
+    if(TC_START == m_nTransport && !m_diskStream.Cue())
+    {
+        SilenceOutputs(ppOut, nOffset, nFrames);
+        MonitorInputs(pInA, pInB, ppOut, nOffset, nFrames, TC_STOPPED, m_lHeadPos);
+        return false; //Wait for read-ahead to reach playhead before starting
+    }
+    if(!m_bRecordEnabled && m_lHeadPos > m_lLastFrame - (2 * nPeriod))
+        m_nTransport = TC_STOP; //Fade out penultimate frame and don't play last frame (which may be too short to fade)
+    //Rolling so get read-ahead data - disk thread fills the buffer so there is no file access in this callback
+    TraceBegin("read");
+    unsigned int nFileFrames = m_diskStream.Read(m_pReadBuffer, nFrames); //Differs from nFrames when converting sample rate
+    if(m_bAutoPunch && m_bRecordEnabled)
+        StorePunchHistory(m_lHeadPos, nFrames, nFileFrames);
+    TraceEnd("read");
+    //Insert effects shape what is heard - punch history must hold audio as recorded
+    unsigned int nChannels = m_vTracks.size();
+    TraceBegin("inserts");
+    m_inserts.Process(m_pReadBuffer, nChannels, nFrames);
+    TraceEnd("inserts");
+    //Gain-adjust each track to its output buffer, split across worker threads when there are enough tracks
+    jack_default_audio_sample_t* apOut[MAX_TRACKS + 1];
+    for(unsigned int nChan = 0; nChan < nChannels; ++nChan)
+        apOut[nChan] = ppOut[nChan] ? ppOut[nChan] + nOffset : NULL;
+    MixContext context = {m_pReadBuffer, apOut, m_vTracks.data(), nChannels, nFrames, m_nTransport};
+    TraceBegin("mix");
+    if(nChannels >= m_nParallelTracks)
+        m_workerPool.Run(MixTracks, &context, nChannels);
+    else
+        MixTracks(&context, 0, nChannels);
+    TraceEnd("mix");
+    TraceBegin("monitor");
+    MonitorInputs(pInA, pInB, ppOut, nOffset, nFrames, context.nTransport, m_lHeadPos);
+    TraceEnd("monitor");
+    long lPeriodStart = m_lHeadPos; //Input of this period is aligned with what was played in it
+    m_lHeadPos += nFileFrames;
+    if(TC_STOP == m_nTransport)
+        m_nTransport = TC_STOPPING;
+    if(TC_START == m_nTransport)
+    {
+        m_nTransport = TC_ROLLING;
+        jack_client_t* pClient = m_pJackClient;
+        if(pClient)
+            jack_transport_start(pClient);
+    }
+
+    //Past end of file so either stop if we are playing or extend file if we are recording
+    if(m_lHeadPos >= m_lLastFrame)
+    {
+        if(m_bRecordEnabled)
+        {
+            //Recording so extend file - disk thread grows file (hole is populated with null (silent) data)
+            m_lLastFrame = m_lHeadPos;
+            m_offEndOfData = m_offStartOfData + m_lLastFrame * m_nFrameSize;
+            if(!m_bForeign)
+                m_diskStream.SetLength(m_lLastFrame); //Foreign file is not written - frames beyond its data play as silence
+        }
+        else
+            m_nTransport = TC_STOPPING; //Not recording so request stop
+    }
+    //Stop after post-roll once punch-out crossfade has been recorded
+    if(m_bAutoPunch && m_bRecordEnabled && TC_ROLLING == m_nTransport)
+    {
+        long lStop = m_lPunchOut + (long)m_nPostRoll * m_nSamplerate / 1000;
+        long lRecorded = m_lPunchOut + (long)m_nPunchFade * m_nSamplerate / 1000 + m_diskStream.GetCaptureOffset(m_nRecordOffset) + nPeriod;
+        if(m_lHeadPos >= lStop && m_lHeadPos >= lRecorded)
+        {
+            m_nTransport = TC_STOP;
+            m_bChanged = true;
+        }
+    }
+
+    TraceBegin("record");
+    Record(lPeriodStart, pInA + nOffset, pInB + nOffset, nFrames);
+    TraceEnd("record");
+    return true;
+}
+
+void Engine::SilenceOutputs(float* const* ppOut, jack_nframes_t nOffset, jack_nframes_t nFrames)
+{
+    for(unsigned int nChan = 0; nChan < m_vTracks.size(); ++nChan)
+    {
+        if(ppOut[nChan])
+            memset(ppOut[nChan] + nOffset, 0, nFrames * sizeof(jack_default_audio_sample_t));
+    }
+}
+
+void Engine::PlayProbe(const float* pInA, const float* pInB, float* const* ppOut, jack_nframes_t nOffset, jack_nframes_t nFrames)
+{
+    //Probe replaces monitor mix, shared between tracks so that a monitor output fed by every track carries it at probe level
+    m_latencyProbe.Process(pInA + nOffset, pInB + nOffset, m_pProbe, nFrames);
+    unsigned int nChannels = m_vTracks.size();
+    float fScale = nChannels ? 1.0f / nChannels : 0;
+    for(unsigned int nChan = 0; nChan < nChannels; ++nChan)
+    {
+        if(!ppOut[nChan])
+            continue;
+        float* pOut = ppOut[nChan] + nOffset;
+        for(jack_nframes_t nFrame = 0; nFrame < nFrames; ++nFrame)
+            pOut[nFrame] = m_pProbe[nFrame] * fScale;
+    }
+}
+
+void Engine::MonitorInputs(const float* pInA, const float* pInB, float* const* ppOut, jack_nframes_t nOffset, jack_nframes_t nFrames, int nTransport, long lFrame)
+{
+    if(MONITOR_OFF == m_nInputMonitor)
+    {
+        m_afMonitorFade[0] = m_afMonitorFade[1] = 0; //Fade in input when monitoring is enabled
+        return;
+    }
+    bool bRolling = (TC_STOPPED != nTransport);
+    double dRatio = m_diskStream.GetRatio();
+    long lFade = (long)m_nPunchFade * m_nSamplerate / 1000;
+    float fStep = lFade ? dRatio / lFade : 1; //Change of input proportion each frame when switching
+    long lRecordOffset = m_diskStream.GetCaptureOffset(m_nRecordOffset);
+    unsigned int nChannels = m_vTracks.size();
+    const float* apIn[2] = {pInA + nOffset, pInB + nOffset};
+    int anTrack[2] = {m_nRecA, m_nRecB};
+    for(unsigned int nInput = 0; nInput < 2; ++nInput)
+    {
+        int nTrack = anTrack[nInput];
+        if(nTrack < 0 || nTrack >= (int)nChannels)
+        {
+            m_afMonitorFade[nInput] = 0;
+            continue;
+        }
+        if(1 == nInput && nTrack == m_nRecA)
+            continue; //Both inputs armed on same track so already mixed with A
+        bool bBoth = (0 == nInput && nTrack == m_nRecB);
+        jack_default_audio_sample_t* pOut = ppOut[nTrack];
+        if(!pOut)
+            continue;
+        pOut += nOffset;
+        Track* pTrack = m_vTracks[nTrack];
+        float fFade = m_afMonitorFade[nInput];
+        float fPeak = 0;
+        for(jack_nframes_t nFrame = 0; nFrame < nFrames; ++nFrame)
+        {
+            //Auto mode plays track until captured audio reaches punch-in so performer hears what is recorded
+            float fTarget = 1;
+            if(bRolling && MONITOR_AUTO == m_nInputMonitor)
+            {
+                if(!m_bRecordEnabled)
+                    fTarget = 0;
+                else if(m_bAutoPunch)
+                    fTarget = GetPunchFade(lFrame + nFrame * dRatio - lRecordOffset);
+            }
+            if(fFade < fTarget)
+                fFade = (fFade + fStep < fTarget) ? fFade + fStep : fTarget;
+            else if(fFade > fTarget)
+                fFade = (fFade - fStep > fTarget) ? fFade - fStep : fTarget;
+            float fInput = bBoth ? apIn[0][nFrame] + apIn[1][nFrame] : apIn[nInput][nFrame];
+            float fValue = pTrack->Gain(fInput);
+            if(fFade < 1)
+            {
+                //Equal-power crossfade with track playback
+                float fPlay = 0;
+                if(bRolling)
+                {
+                    fPlay = pTrack->Gain(m_pReadBuffer[nFrame * nChannels + nTrack]);
+                    if(TC_STOP == nTransport)
+                        fPlay = (nFrames - nFrame) * fPlay / nFrames;
+                    else if(TC_START == nTransport)
+                        fPlay = nFrame * fPlay / nFrames;
+                }
+                fValue = sinf(fFade * M_PI_2) * fValue + cosf(fFade * M_PI_2) * fPlay;
+            }
+            pOut[nFrame] = fValue;
+            if(fabsf(fValue) > fPeak)
+                fPeak = fabsf(fValue);
+        }
+        m_afMonitorFade[nInput] = fFade;
+        if(bBoth)
+            m_afMonitorFade[1] = fFade;
+        pTrack->peak.Raise(fPeak);
+    }
+}
+
+void Engine::HandleMidi(const MidiAction& action)
+{
+    if(m_fdWave <= 0)
+        return;
+    bool bPressed = (action.nValue >= 64);
+    int nTrack = action.nParam - 1; //Tracks are numbered from 1 as shown in user interface
+    bool bValidTrack = (nTrack >= 0 && nTrack < (int)m_vTracks.size());
+    switch(action.nAction)
+    {
+        case MIDI_PLAYSTOP:
+            if(!bPressed)
+                break;
+            if(TC_ROLLING == m_nTransport)
+                StopFromMidi();
+            else
+                StartFromMidi();
+            break;
+        case MIDI_PLAY:
+            if(bPressed)
+                StartFromMidi();
+            break;
+        case MIDI_STOP:
+            if(bPressed)
+                StopFromMidi();
+            break;
+        case MIDI_RECORD:
+            if(bPressed)
+                SetRecordEnable(!m_bRecordEnabled);
+            break;
+        case MIDI_PUNCH:
+            SetRecordEnable(bPressed);
+            break;
+        case MIDI_ARM_A:
+            if(bPressed && bValidTrack)
+                ArmTrack(PORT_A, m_nRecA == nTrack ? -1 : nTrack);
+            break;
+        case MIDI_ARM_B:
+            if(bPressed && bValidTrack)
+                ArmTrack(PORT_B, m_nRecB == nTrack ? -1 : nTrack);
+            break;
+        case MIDI_LOCATE:
+        {
+            if(!bPressed || (m_bRecordEnabled && TC_ROLLING == m_nTransport))
+                break; //Don't allow shuttling when recording
+            long lFrame = (long)action.nParam * m_nSamplerate;
+            m_lHeadPos = lFrame > m_lLastFrame ? m_lLastFrame : lFrame < 0 ? 0 : lFrame;
+            m_diskStream.Locate(m_lHeadPos);
+            jack_client_t* pClient = m_pJackClient;
+            if(pClient)
+                jack_transport_locate(pClient, m_lHeadPos);
+            break;
+        }
+        case MIDI_GAIN:
+            if(bValidTrack)
+                m_vTracks[nTrack]->nMonMix = action.nValue * 100 / 127;
+            break;
+    }
+    m_bChanged = true;
+}
+
+void Engine::StartFromMidi()
+{
+    if(TC_STOPPED != m_nTransport || IsJobExclusive())
+        return;
+    //Only locate when returning to zero or pre-roll so that read-ahead already cued at playhead starts playback at this frame
+    long lStart = GetStartPosition();
+    if(lStart != m_lHeadPos)
+    {
+        m_lHeadPos = lStart;
+        m_diskStream.Locate(lStart);
+        jack_client_t* pClient = m_pJackClient;
+        if(pClient)
+            jack_transport_locate(pClient, lStart);
+    }
+    m_nTransport = TC_START;
+}
+
+void Engine::StopFromMidi()
+{
+    if(TC_ROLLING != m_nTransport)
+        return;
+    m_nTransport = TC_STOP;
+    SetRecordEnable(false);
+}
+
+void Engine::MixTracks(void* pContext, unsigned int nFirst, unsigned int nEnd)
+{
+    MixContext* pMix = (MixContext*)pContext;
+    unsigned int nChannels = pMix->nChannels;
+    unsigned int nFrames = pMix->nFrames;
+    //Iterate through each track, adding gain-adjusted value to output buffer for each frame
+    for(unsigned int nChan = nFirst; nChan < nEnd; ++nChan)
+    {
+        jack_default_audio_sample_t* pOut = pMix->ppOut[nChan];
+        if(!pOut)
+            continue;
+        Track* pTrack = pMix->ppTracks[nChan];
+        float fPeak = 0;
+        for(unsigned int nFrame = 0; nFrame < nFrames; ++nFrame)
+        {
+            jack_default_audio_sample_t fSample = pMix->pRead[nFrame * nChannels + nChan];
+            if(TC_STOP == pMix->nTransport)
+                pOut[nFrame] = (nFrames - nFrame) * pTrack->Mix(fSample) / nFrames; //Fade out last frame to reduce click on stop
+            else if(TC_START == pMix->nTransport)
+                pOut[nFrame] = nFrame * pTrack->Mix(fSample) / nFrames; //Fade in first frame to reduce click on start
+            else
+                pOut[nFrame] = pTrack->Mix(fSample);
+            if(fabsf(pOut[nFrame]) > fPeak)
+                fPeak = fabsf(pOut[nFrame]);
+        }
+        pTrack->peak.Raise(fPeak); //Taken by main thread for meter events
+    }
+}
+
+int Engine::OnJackSync(jack_transport_state_t nState, jack_position_t* pPos, void* pArgs)
+{
+    Engine* pEngine = (Engine*)pArgs;
+    //!@todo Handle external position changes whilst rolling (JackTransportStarting at a new position)
+    switch(nState)
+    {
+        case JackTransportStarting:
+            pEngine->m_nTransport = TC_START;
+            break;
+        case JackTransportRolling:
+            pEngine->m_nTransport = TC_ROLLING;
+            break;
+        case JackTransportStopped:
+        {
+            //Stopped or relocated by JACK (perhaps by another client) - read-ahead must move with playhead as an internal locate does
+            long lFrame = (long)pPos->frame > pEngine->m_lLastFrame ? pEngine->m_lLastFrame : (long)pPos->frame;
+            if(TC_STOPPED == pEngine->m_nTransport)
+            {
+                if(lFrame != pEngine->m_lHeadPos)
+                {
+                    pEngine->m_lHeadPos = lFrame;
+                    pEngine->m_diskStream.Locate(lFrame);
+                }
+            }
+            else
+            {
+                pEngine->m_nTransport = TC_STOP;
+                pEngine->m_lSyncLocate = lFrame; //Located once faded out so fade plays from current read-ahead
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return 1; //Always ready to roll
+}
+
+void Engine::OnJackLatency(jack_latency_callback_mode_t latencyMode, void* pArgs)
+{
+    Engine* pEngine = (Engine*)pArgs;
+    jack_latency_range_t latencyRange;
+    jack_port_get_latency_range(pEngine->m_pPortInputA, latencyMode, &latencyRange);
+    if(latencyMode == JackCaptureLatency)
+        pEngine->m_nCaptureLatency = latencyRange.max;
+    else
+        pEngine->m_nPlaybackLatency = latencyRange.max;
+    pEngine->UpdateRecordOffset();
+}
+
+void Engine::UpdateRecordOffset()
+{
+    //Measured round trip includes converter and interface delays which JACK does not report
+    if(m_nCalibratedLatency && m_nCalibratedRate)
+        m_nRecordOffset = (uint64_t)m_nCalibratedLatency * GetDeviceRate() / m_nCalibratedRate;
+    else
+        m_nRecordOffset = m_nCaptureLatency + m_nPlaybackLatency;
+}
+
+void Engine::ClearCalibration()
+{
+    m_nCalibratedLatency = 0;
+    m_nCalibratedRate = 0;
+    UpdateRecordOffset();
+}
+
+void Engine::OnJackShutdown(void* pArgs)
+{
+    //Called from JACK thread so leave closing client to main thread
+    Engine* pThis = (Engine*)pArgs;
+    pThis->m_bServerShutdown = true; //Connect may not yet have published client
+    jack_client_t* pClient = pThis->m_pJackClient.exchange(NULL);
+    if(pClient)
+        pThis->m_pDeadClient = pClient; //Not if main thread is already closing it
+}
+
+void Engine::OnJackPortConnect(jack_port_id_t nPortA, jack_port_id_t nPortB, int nConnect, void* pArgs)
+{
+    //Called from JACK notification thread which must not query server so main thread reads connections
+    ((Engine*)pArgs)->m_bConnectionsChanged = true;
+}
+
+void Engine::AbandonClient(jack_client_t* pClient)
+{
+    jack_client_close(pClient);
+    m_pPortInputA = m_pPortInputB = m_pPortMidi = NULL;
+    m_vJackSourcePorts.clear();
+    for(vector<Track*>::iterator it = m_vTracks.begin(); it != m_vTracks.end(); ++it)
+        (*it)->pSourcePort = NULL;
+}
+
+void Engine::ReleaseClient()
+{
+    jack_client_t* pClient = m_pDeadClient.exchange(NULL);
+    if(!pClient)
+        return;
+    AbandonClient(pClient); //Ports were lost with server
+    if(TC_STOPPED != m_nTransport)
+    {
+        //Audio thread stopped mid-period so finish as it would on stop, keeping position and audio recorded so far
+        m_diskStream.EndCapture();
+        m_nTransport = TC_STOPPED;
+        SetRecordEnable(false);
+        UpdateLength();
+        m_bChanged = true;
+    }
+}
+
+void Engine::UpdateConnections()
+{
+    jack_client_t* pClient = m_pJackClient;
+    if(!pClient || !m_bConnectionsChanged.exchange(false))
+        return;
+    vector<jack_port_t*> vPorts(m_vJackSourcePorts);
+    vPorts.push_back(m_pPortInputA);
+    vPorts.push_back(m_pPortInputB);
+    vPorts.push_back(m_pPortMidi);
+    vector<PortConnection> vConnections;
+    for(vector<jack_port_t*>::iterator it = vPorts.begin(); it != vPorts.end(); ++it)
+    {
+        if(!*it)
+            continue;
+        const char** as_peers = jack_port_get_all_connections(pClient, *it);
+        if(!as_peers)
+            continue;
+        PortConnection connection;
+        connection.sPort = jack_port_short_name(*it);
+        connection.bOutput = 0 != (jack_port_flags(*it) & JackPortIsOutput);
+        for(unsigned int nPeer = 0; as_peers[nPeer]; ++nPeer)
+        {
+            connection.sPeer = as_peers[nPeer];
+            vConnections.push_back(connection);
+        }
+        free(as_peers);
+    }
+    if(pClient != m_pJackClient)
+        return; //Server shut down whilst reading so connections may be incomplete
+    m_vConnections.swap(vConnections);
+    m_bConnectionsSaved = true;
+}
+
+void Engine::RestoreConnections(jack_client_t* pClient)
+{
+    string sClient = jack_get_client_name(pClient);
+    for(vector<PortConnection>::iterator it = m_vConnections.begin(); it != m_vConnections.end(); ++it)
+    {
+        string sPort = sClient + ":" + it->sPort;
+        //Peers of clients that have not yet rejoined fail and are restored by those clients
+        if(it->bOutput)
+            jack_connect(pClient, sPort.c_str(), it->sPeer.c_str());
+        else
+            jack_connect(pClient, it->sPeer.c_str(), sPort.c_str());
+    }
+}
+
+int Engine::OnJackBufferChange(jack_nframes_t nFrames, void *pArgs)
+{
+    //Buffers are allocated for largest supported period so there is nothing to reallocate
+    return nFrames > RT_MAX_PERIOD ? 1 : 0;
+}
+
+void Engine::Shutdown()
+{
+    if(TC_ROLLING == m_nTransport)
+    {
+        //Currently playing so need to stop
+        StopTransport();
+        //!@todo Could use while(TC_STOPPED != m_nTransport) but may never end if Jack server is not running
+        usleep(100000); //Wait for soft stop to complete (fade out audio over one period)
+    }
+    if(JOB_RESTRUCTURE == m_nJob)
+        m_restructure.Cancel(); //Resumes when project is next loaded
+    if(JOB_IMPORT == m_nJob)
+        m_import.Cancel(); //Starts again when project is next loaded
+    if(JOB_CALIBRATE == m_nJob)
+        m_latencyProbe.Cancel();
+    if(JOB_NONE != m_nJob)
+        pthread_join(m_threadJob, NULL); //Must not close file whilst job is accessing it
+    m_snapshot.Cancel(); //Incomplete copy is removed
+    m_snapshot.Wait();
+    SaveProject();
+    Disconnect(); //Stop audio thread before releasing tracks
+    CloseProject();
+}
+
+bool Engine::StartJob(int nJob)
+{
+    if(JOB_NONE != m_nJob || TC_STOPPED != m_nTransport || m_fdWave <= 0 || m_snapshot.IsBusy())
+        return false; //Jobs modify project files so must not run whilst they are being copied
+    m_diskStream.Sync(); //Ensure all captured audio is in extent map
+    m_nJob = nJob;
+    m_scrubber.Hold(); //Scrubber is no longer idle - let it finish block it is verifying before job writes to project
+    if(pthread_create(&m_threadJob, NULL, JobThread, this))
+    {
+        m_nJob = JOB_NONE;
+        return false;
+    }
+    return true;
+}
+
+void* Engine::JobThread(void* pArgs)
+{
+    Engine* pEngine = (Engine*)pArgs;
+    TraceThread("job");
+    TraceScope trace(JOB_NAMES[pEngine->m_nJob]);
+    string sPrefix = pEngine->m_sPath + pEngine->m_sProject;
+    unsigned int nChannels = pEngine->m_vTracks.size();
+    switch(pEngine->m_nJob)
+    {
+        case JOB_COMPACT:
+            pEngine->m_bJobResult = pEngine->m_takeStore.Compact(pEngine->m_fdWave, pEngine->m_offStartOfData, nChannels,
+                pEngine->m_checksums.IsOpen() ? &pEngine->m_checksums : NULL);
+            break;
+        case JOB_BOUNCE:
+        {
+            //Snapshot track gain and routing so mix matches what is monitored when job started
+            std::vector<Track> vTracks;
+            for(unsigned int nTrack = 0; nTrack < nChannels; ++nTrack)
+                vTracks.push_back(*pEngine->m_vTracks[nTrack]);
+            pEngine->m_bJobResult = pEngine->m_bounce.Run(pEngine->m_fdWave, pEngine->m_offStartOfData, nChannels, pEngine->m_lLastFrame,
+                pEngine->m_nSamplerate, &pEngine->m_takeStore, vTracks, sPrefix + "-mix.wav");
+            break;
+        }
+        case JOB_STEMS:
+            pEngine->m_bJobResult = pEngine->m_stemExport.Run(pEngine->m_fdWave, pEngine->m_offStartOfData, nChannels, pEngine->m_lLastFrame,
+                pEngine->m_nSamplerate, &pEngine->m_takeStore, sPrefix + "-stem-", pEngine->m_bStemSkipSilent, pEngine->m_bStemTrim);
+            break;
+        case JOB_RESTRUCTURE:
+            pEngine->m_bJobResult = pEngine->m_restructure.Run(pEngine->m_fdWave, pEngine->m_offStartOfData, nChannels, pEngine->m_nSamplerate, &pEngine->m_takeStore, MAX_TRACKS);
+            break;
+        case JOB_IMPORT:
+            pEngine->m_bJobResult = pEngine->m_import.Run(pEngine->m_fdWave, pEngine->m_offStartOfData, pEngine->m_nEncoding, nChannels, pEngine->m_nSamplerate);
+            //Copy replaces project file only whilst stopped so playback and recording are not interrupted
+            while(pEngine->m_bJobResult && TC_STOPPED != pEngine->m_nTransport && !pEngine->m_import.IsCancelled())
+                usleep(IMPORT_WAIT_MS * 1000);
+            break;
+        case JOB_CALIBRATE:
+            pEngine->m_bJobResult = pEngine->Calibrate();
+            break;
+        case JOB_ANALYSE:
+            pEngine->m_bJobResult = pEngine->m_loudness.Run(pEngine->m_fdWave, pEngine->m_offStartOfData, nChannels, pEngine->m_lLastFrame,
+                pEngine->m_nSamplerate, &pEngine->m_takeStore, sPrefix + "-loudness.txt");
+            break;
+    }
+    pEngine->m_nJob = JOB_NONE;
+    return NULL;
+}
+
+int Engine::GetJobProgress()
+{
+    switch(m_nJob)
+    {
+        case JOB_COMPACT:
+            return m_takeStore.GetProgress();
+        case JOB_BOUNCE:
+            return m_bounce.GetProgress();
+        case JOB_STEMS:
+            return m_stemExport.GetProgress();
+        case JOB_RESTRUCTURE:
+            return m_restructure.GetProgress();
+        case JOB_IMPORT:
+            return m_import.GetProgress();
+        case JOB_CALIBRATE:
+            return m_latencyProbe.GetProgress();
+        case JOB_ANALYSE:
+            return m_loudness.GetProgress();
+    }
+    return 0;
+}
+
+bool Engine::Calibrate()
+{
+    unsigned int nRate = GetDeviceRate();
+    if(!m_latencyProbe.Start(nRate * PROBE_MAX_MS / 1000))
+        return false;
+    //Audio thread plays and captures probe whilst stopped - give up if it is not running
+    long lTimeout = 2000L * PROBE_REPEATS * ((1 << PROBE_ORDER) + nRate * PROBE_MAX_MS / 1000) / nRate + 1000;
+    for(long lWaited = 0; m_latencyProbe.IsRunning() && lWaited < lTimeout; lWaited += PROBE_WAIT_MS)
+        usleep(PROBE_WAIT_MS * 1000);
+    m_latencyProbe.Cancel();
+    return m_latencyProbe.Analyse();
+}
+
+bool Engine::EndJob(int nJob)
+{
+    //Refresh read-ahead which may hold data read before merge
+    pthread_join(m_threadJob, NULL);
+    if(JOB_COMPACT == nJob && m_bJobResult)
+    {
+        //Configuration must stop listing merged takes before their files are removed so an interruption never reloads missing takes
+        m_takeStore.ForgetMerged();
+        m_bJobResult = SaveProject();
+        if(m_bJobResult)
+            m_takeStore.RemoveMerged();
+    }
+    if(JOB_COMPACT == nJob)
+        SetPlayHead(m_lHeadPos);
+    if(JOB_RESTRUCTURE == nJob && m_bJobResult)
+        m_bJobResult = FinishRestructure();
+    if(JOB_IMPORT == nJob)
+    {
+        if(m_bJobResult)
+            m_bJobResult = FinishImport();
+        else
+            m_import.End(); //Continue playing from original file
+    }
+    if(JOB_CALIBRATE == nJob && m_bJobResult)
+    {
+        m_nCalibratedLatency = m_latencyProbe.GetLatency();
+        m_nCalibratedRate = GetDeviceRate();
+        UpdateRecordOffset();
+    }
+    return m_bJobResult;
+}
+
+double Engine::GetJobSeconds(int nJob)
+{
+    if(JOB_BOUNCE == nJob)
+        return m_bounce.GetSeconds();
+    if(JOB_STEMS == nJob)
+        return m_stemExport.GetSeconds();
+    if(JOB_RESTRUCTURE == nJob)
+        return m_restructure.GetSeconds();
+    if(JOB_IMPORT == nJob)
+        return m_import.GetSeconds();
+    if(JOB_ANALYSE == nJob)
+        return m_loudness.GetSeconds();
+    return 0;
+}
+
+bool Engine::AddTrack(unsigned int nPosition)
+{
+    if(nPosition > m_vTracks.size())
+        return false;
+    vector<int> vMap;
+    for(unsigned int nTrack = 0; nTrack < m_vTracks.size(); ++nTrack)
+        vMap.push_back(nTrack);
+    vMap.insert(vMap.begin() + nPosition, -1);
+    return StartRestructure(vMap);
+}
+
+bool Engine::RemoveTrack(unsigned int nTrack)
+{
+    if(nTrack >= m_vTracks.size())
+        return false;
+    vector<int> vMap;
+    for(unsigned int n = 0; n < m_vTracks.size(); ++n)
+        if(n != nTrack)
+            vMap.push_back(n);
+    return StartRestructure(vMap);
+}
+
+bool Engine::MoveTrack(unsigned int nTrack, unsigned int nPosition)
+{
+    if(nTrack >= m_vTracks.size() || nPosition >= m_vTracks.size() || nTrack == nPosition)
+        return false;
+    vector<int> vMap;
+    for(unsigned int n = 0; n < m_vTracks.size(); ++n)
+        if(n != nTrack)
+            vMap.push_back(n);
+    vMap.insert(vMap.begin() + nPosition, nTrack);
+    return StartRestructure(vMap);
+}
+
+bool Engine::StartRestructure(const vector<int>& vMap)
+{
+    if(JOB_NONE != m_nJob || TC_STOPPED != m_nTransport || m_fdWave <= 0 || m_snapshot.IsBusy() || vMap.empty() || vMap.size() > MAX_TRACKS)
+        return false;
+    m_diskStream.Sync(); //Ensure all captured audio is in extent map before it is merged
+    if(!m_restructure.Begin(m_sPath + m_sProject, vMap, m_lLastFrame))
+        return false;
+    if(StartJob(JOB_RESTRUCTURE))
+        return true;
+    m_restructure.End();
+    return false;
+}
+
+bool Engine::FinishRestructure()
+{
+    //Tracks are deleted and project reloaded so audio thread must not use them until done
+    bool bSuspended = SuspendAudio();
+    bool bResult = ReplaceTracks();
+    if(bSuspended)
+        ResumeAudio();
+    return bResult;
+}
+
+bool Engine::SuspendAudio()
+{
+    if(m_bSuspendAudio)
+        return false;
+    m_bAudioSuspended = false;
+    m_bSuspendAudio = true;
+    //Each callback runs to completion so acknowledgement shows that none is using tracks - give up if server stops calling
+    for(unsigned int nWaited = 0; IsConnected() && !m_bAudioSuspended; ++nWaited)
+    {
+        if(nWaited >= SUSPEND_TIMEOUT_MS)
+        {
+            cerr << "Audio thread did not stop within " << SUSPEND_TIMEOUT_MS << "ms" << endl;
+            break;
+        }
+        usleep(1000);
+    }
+    return true;
+}
+
+void Engine::ResumeAudio()
+{
+    m_bSuspendAudio = false;
+}
+
+bool Engine::ReplaceTracks()
+{
+    //Move track settings to their new positions and save them with the takes, which are now merged into the new file
+    vector<int> vMap = m_restructure.GetMap();
+    int nRecA = -1;
+    int nRecB = -1;
+    bool bRecordingA = false;
+    bool bRecordingB = false;
+    vector<Track*> vTracks;
+    for(unsigned int nTrack = 0; nTrack < vMap.size(); ++nTrack)
+    {
+        if(vMap[nTrack] < 0)
+        {
+            vTracks.push_back(new Track());
+            continue;
+        }
+        vTracks.push_back(new Track(*m_vTracks[vMap[nTrack]]));
+        if(vMap[nTrack] == m_nRecA)
+        {
+            nRecA = nTrack;
+            bRecordingA = vTracks.back()->bRecording;
+        }
+        if(vMap[nTrack] == m_nRecB)
+        {
+            nRecB = nTrack;
+            bRecordingB = vTracks.back()->bRecording;
+        }
+    }
+    m_nRecA = -1;
+    m_nRecB = -1;
+    m_vTracks.swap(vTracks);
+    for(vector<Track*>::iterator it = vTracks.begin(); it != vTracks.end(); ++it)
+        delete *it;
+    m_takeStore.Clear();
+    if(!SaveProject() || !m_restructure.SetState(RESTRUCTURE_SAVED))
+        return false;
+
+    //Replace project file with new file then reload project with new tracks
+    string sFilename = m_sPath + m_sProject + ".wav";
+    CloseFile();
+    if(rename(m_restructure.GetFilename().c_str(), sFilename.c_str()))
+    {
+        cerr << "Failed to replace " << sFilename << " - error " << errno << endl;
+        return false;
+    }
+    ReplaceChecksums(m_restructure.GetFilename(), sFilename);
+    m_restructure.End();
+    if(!LoadProject(m_sProject))
+        return false;
+    //Armed tracks follow their new positions
+    m_nRecA = nRecA;
+    m_nRecB = nRecB;
+    if(nRecA > -1)
+        m_vTracks[nRecA]->bRecording = bRecordingA;
+    if(nRecB > -1)
+        m_vTracks[nRecB]->bRecording = bRecordingB;
+    return true;
+}
+
+bool Engine::FinishImport()
+{
+    //Recording whilst importing may have extended project beyond copy
+    string sFilename = m_sPath + m_sProject + ".wav";
+    int fd = open(m_import.GetFilename().c_str(), O_RDWR);
+    if(fd < 0 || (m_lLastFrame > m_import.GetFrames() && ftruncate(fd, 44 + m_lLastFrame * m_nFrameSize))
+        || rename(m_import.GetFilename().c_str(), sFilename.c_str()))
+    {
+        cerr << "Failed to replace " << sFilename << " - error " << errno << endl;
+        if(fd >= 0)
+            close(fd);
+        m_import.End();
+        return false;
+    }
+    ReplaceChecksums(m_import.GetFilename(), sFilename);
+
+    //Stream from native file - takes recorded whilst importing are unaffected
+    m_diskStream.Close();
+    close(m_fdWave);
+    m_fdWave = fd;
+    m_nEncoding = WAVE_FLOAT;
+    m_offStartOfData = 44;
+    m_offEndOfData = m_offStartOfData + m_lLastFrame * m_nFrameSize;
+    bool bResult = OpenStream();
+    m_bForeign = false; //Only once old stream is closed so its disk thread never extends original file
+    m_checksums.Open(BlockChecksums::GetFilename(sFilename), m_vTracks.size(), true);
+    m_diskStream.Locate(m_lHeadPos);
+    StartScrubber();
+    return bResult;
+}
+
+bool Engine::StartTransport()
+{
+    if(TC_STOPPED != m_nTransport || IsJobExclusive())
+        return false; //Don't allow play whilst background job is running
+    m_nTransport = TC_START;
+    SetPlayHead(GetStartPosition());
+    return true;
+}
+
+long Engine::GetStartPosition()
+{
+    if(m_bAutoPunch && m_bRecordEnabled)
+    {
+        long lStart = m_lPunchIn - (long)m_nPreRoll * m_nSamplerate / 1000;
+        return lStart < 0 ? 0 : lStart;
+    }
+    //!@todo Configure whether auto return to zero when playing from end of track
+    if(!m_bRecordEnabled && m_lHeadPos >= m_lLastFrame)
+        return 0;
+    return m_lHeadPos;
+}
+
+void Engine::SetPunchIn(long lFrame)
+{
+    m_lPunchIn = lFrame;
+    if(m_lPunchOut <= m_lPunchIn)
+        SetAutoPunch(false);
+}
+
+void Engine::SetPunchOut(long lFrame)
+{
+    m_lPunchOut = lFrame;
+    if(m_lPunchOut <= m_lPunchIn)
+        SetAutoPunch(false);
+}
+
+bool Engine::SetAutoPunch(bool bEnable)
+{
+    if(bEnable && m_lPunchOut <= m_lPunchIn)
+        return false;
+    m_bAutoPunch = bEnable;
+    return true;
+}
+
+void Engine::SetInputMonitor(int nMode)
+{
+    if(nMode >= MONITOR_OFF && nMode <= MONITOR_INPUT)
+        m_nInputMonitor = nMode;
+}
+
+void Engine::StopTransport()
+{
+    if(TC_ROLLING != m_nTransport)
+        return;
+    m_nTransport = TC_STOP;
+    SetRecordEnable(false);
+    UpdateLength();
+}
+
+void Engine::SetRecordEnable(bool bEnable)
+{
+    if(m_bRecordEnabled && !bEnable)
+    {
+        if(m_nRecA > -1)
+            m_vTracks[m_nRecA]->bRecording = false;
+        if(m_nRecB > -1)
+            m_vTracks[m_nRecB]->bRecording = false;
+    }
+    m_bRecordEnabled = bEnable;
+}
+
+void Engine::ArmTrack(unsigned int nInput, int nTrack)
+{
+    int& nRec = (PORT_A == nInput) ? m_nRecA : m_nRecB;
+    if(nRec > -1)
+        m_vTracks[nRec]->bRecording = false;
+    nRec = nTrack;
+    if(nRec > -1)
+        m_vTracks[nRec]->bRecording = true;
+}
+
+void Engine::UpdateInserts()
+{
+    m_inserts.Configure(m_vTracks.data(), m_vTracks.size(), GetDeviceRate());
+}
+
+unsigned int Engine::GetRouting(unsigned int nTrack)
+{
+    return (m_vTracks[nTrack]->bMuteA ? PORT_NONE : PORT_A) | (m_vTracks[nTrack]->bMuteB ? PORT_NONE : PORT_B);
+}
+
+void Engine::SetRouting(unsigned int nTrack, unsigned int nPorts)
+{
+    m_vTracks[nTrack]->bMuteA = !(PORT_A & nPorts);
+    m_vTracks[nTrack]->bMuteB = !(PORT_B & nPorts);
+    if(m_vTracks[nTrack]->bMuteA)
+        DisconnectPlayback(nTrack, PORT_A);
+    else
+        ConnectPlayback(nTrack, PORT_A);
+    if(m_vTracks[nTrack]->bMuteB)
+        DisconnectPlayback(nTrack, PORT_B);
+    else
+        ConnectPlayback(nTrack, PORT_B);
+}
+
+bool Engine::UndoTake()
+{
+    if(TC_STOPPED != m_nTransport || IsJobExclusive())
+        return false;
+    m_diskStream.Sync();
+    if(!m_takeStore.Undo())
+        return false;
+    SetPlayHead(m_lHeadPos); //Refresh read-ahead
+    return true;
+}
+
+unsigned int Engine::GetDeviceRate()
+{
+    jack_client_t* pClient = m_pJackClient;
+    return pClient ? jack_get_sample_rate(pClient) : m_nSamplerate;
+}
+
+bool Engine::OpenFile()
+{
+    // Expect header to be 12 + 24 + 8 = 44
+    //**Open file**
+    if(m_fdWave < 0)
+    {
+        //File not open
+        string sFilename = m_sPath;
+        sFilename.append(m_sProject);
+        sFilename.append(".wav");
+        m_fdWave = open(sFilename.c_str(), O_RDWR | O_CREAT, 0644);
+        if(m_fdWave <= 0)
+        {
+            cerr << "Unable to open or create file" << sFilename << " - error " << errno << endl;
+            return false;
+        }
+
+        //**Read RIFF headers** from a single mapped read of start of file
+        WaveLayout layout;
+        bool bValid = ReadWaveLayout(m_fdWave, &layout);
+        if(!layout.bRiff)
+        {
+            //Invalid file so create a WAVE file with 4 seconds of silence
+            jack_client_t* pClient = m_pJackClient;
+            m_nSamplerate = pClient ? jack_get_sample_rate(pClient) : 0; //!@todo Handle different samplerate to project (warn and resolve?)
+            if(0 == m_nSamplerate)
+                m_nSamplerate = DEFAULT_SAMPLERATE;
+            size_t nWaveSize = m_nSamplerate * MAX_TRACKS * sizeof(jack_default_audio_sample_t) * 4;
+            WriteHeader(nWaveSize, MAX_TRACKS);
+            //Extending file leaves a hole which reads as silence without writing (or buffering) it
+            if(ftruncate(m_fdWave, 44 + nWaveSize))
+            {
+                cerr << "Unable to extend file " << sFilename << " - error " << errno << endl;
+                return false;
+            }
+            bValid = ReadWaveLayout(m_fdWave, &layout);
+        }
+        if(!bValid)
+        {
+            cerr << "Failed to get WAVE header";
+            return false;
+        }
+        if(!layout.bFormat)
+        {
+            cerr << "Too small for WAVE header" << endl;
+            return false;
+        }
+        if(WAVE_UNSUPPORTED == layout.nEncoding)
+        {
+            cerr << "Unsupported WAVE format - expect 16, 24 or 32-bit PCM or 32-bit float" << endl;
+            return false;
+        }
+
+        //Found format chunk
+        WaveHeader* pWaveHeader = (WaveHeader*)layout.acFormat;
+        if(pWaveHeader->nNumChannels > MAX_TRACKS)
+        {
+            //Realtime buffers are sized for MAX_TRACKS - !@todo offer to remove extra tracks
+            cerr << "Too many tracks - found " << pWaveHeader->nNumChannels << ", maximum " << MAX_TRACKS << endl;
+            return false;
+        }
+        for(unsigned int nTrack = 0; nTrack < pWaveHeader->nNumChannels; ++nTrack)
+            m_vTracks.push_back(new Track());
+        CreateJackSources(m_pJackClient);
+        m_nSamplerate = pWaveHeader->nSampleRate;
+        if(0 == m_nSamplerate)
+            m_nSamplerate = DEFAULT_SAMPLERATE;
+        m_nFrameSize = m_vTracks.size() * sizeof(jack_default_audio_sample_t);
+
+        //Found data chunk
+        m_nEncoding = layout.nEncoding;
+        m_offStartOfData = layout.offData;
+        m_offEndOfData = lseek(m_fdWave, 0, SEEK_END);
+        m_bForeign = (WAVE_FLOAT != m_nEncoding || 44 != m_offStartOfData);
+        if(m_bForeign)
+        {
+            //Play from file as it is, converting as it is read, until import job replaces it with a native copy
+            if(layout.nDataSize && m_offStartOfData + layout.nDataSize < m_offEndOfData)
+                m_offEndOfData = m_offStartOfData + layout.nDataSize; //Chunks after data, e.g. BWF metadata, are not audio
+            m_lLastFrame = (m_offEndOfData - m_offStartOfData) / (m_vTracks.size() * WAVE_SAMPLE_BYTES[m_nEncoding]);
+            m_offEndOfData = m_offStartOfData + m_lLastFrame * m_nFrameSize; //Measured as if native so recording extends it alike
+        }
+        else
+        {
+            m_lLastFrame = (m_offEndOfData - m_offStartOfData) / (m_nFrameSize);
+            m_checksums.Open(BlockChecksums::GetFilename(sFilename), m_vTracks.size(), true);
+        }
+        return OpenStream();
+    }
+    return false;
+}
+
+bool Engine::OpenStream()
+{
+    m_diskStream.SetResample(m_nSamplerate, GetDeviceRate(), m_nResampleQuality);
+    m_diskStream.SetMemoryLimit(m_nBufferMemory);
+    m_diskStream.SetSpool(m_nSpoolMinutes);
+    bool bResult = m_diskStream.Open(m_fdWave, m_offStartOfData, m_vTracks.size(), m_lLastFrame, &m_takeStore, m_nEncoding);
+    if(!bResult)
+        cerr << "Failed to start disk stream" << endl;
+    unsigned int nRate = m_nSamplerate ? m_nSamplerate : DEFAULT_SAMPLERATE;
+    if(bResult && m_nSpoolMinutes && m_diskStream.GetSpoolCapacity() < (unsigned long)m_diskStream.GetSpoolMinutes() * 60 * nRate)
+        cerr << "Record-to-RAM spool limited by available or lockable memory to " << m_diskStream.GetSpoolCapacity() / nRate << "s of " << m_diskStream.GetSpoolMinutes() << " minutes" << endl;
+    return bResult;
+}
+
+void Engine::CreateJackSources(jack_client_t* pClient)
+{
+    if(!pClient)
+        return;
+    //Remove existing ports so that ports of reloaded or restructured project may reuse their names
+    for(vector<jack_port_t*>::iterator it = m_vJackSourcePorts.begin(); it != m_vJackSourcePorts.end(); ++it)
+        jack_port_unregister(pClient, *it);
+    m_vJackSourcePorts.clear();
+    for(unsigned int i = 1; i <= m_vTracks.size(); ++i)
+    {
+        char sName[9];
+        memset(sName, 0, 9);
+        sprintf(sName, "Track %02u", i);
+        jack_port_t* pPort = jack_port_register(pClient, sName, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if(pPort)
+            m_vJackSourcePorts.push_back(pPort);
+        else
+            cerr << "Failed to created source port " << i << endl;
+        m_vTracks[i - 1]->pSourcePort = pPort;
+    }
+}
+
+void Engine::WriteHeader(unsigned int nWaveSize, unsigned int nChannels)
+{
+    if(m_fdWave <= 0)
+        return;
+    WriteWaveHeader(m_fdWave, nWaveSize, nChannels, m_nSamplerate);
+}
+
+void Engine::CloseProject()
+{
+    CloseFile();
+}
+
+void Engine::CloseFile()
+{
+    m_scrubber.Stop(); //Reads project and take files
+    m_diskStream.Close(); //Completes outstanding writes
+    m_takeStore.Close();
+    m_loudness.Clear(); //Measurements describe tracks of this file
+    if(m_fdWave > 0)
+    {
+        //Write RIFF chunck length - foreign file is left unchanged
+        char pBuffer[4];
+        SetLE32(pBuffer, m_offEndOfData - 8);
+        if(!m_bForeign)
+            pwrite(m_fdWave, pBuffer, 4, 4);
+        close(m_fdWave);
+    }
+    m_fdWave = -1;
+    m_checksums.Close();
+    if(TC_ROLLING == m_nTransport)
+        m_nTransport = TC_STOP; //!@todo Can we fade out after closing file?
+    for(vector<Track*>::iterator it = m_vTracks.begin(); it != m_vTracks.end(); ++it)
+        delete *it;
+    m_vTracks.clear();
+}
+
+void Engine::SetPlayHead(long lPosition)
+{
+    if(m_bRecordEnabled && TC_ROLLING == m_nTransport)
+        return; //Don't allow shuttling when recording
+    TraceScope trace("locate");
+    m_lHeadPos = lPosition;
+    if(m_lHeadPos < 0)
+        m_lHeadPos = 0;
+    if(m_lHeadPos > m_lLastFrame)
+        m_lHeadPos = m_lLastFrame;
+    m_diskStream.Locate(m_lHeadPos);
+    jack_client_t* pClient = m_pJackClient;
+    if(pClient)
+        jack_transport_locate(pClient, m_lHeadPos);
+}
+
+bool Engine::LoadProject(const string& sName)
+{
+    //Project consists of sName.wav and sName.cfg
+    //Close existing WAVE file and open new one
+    if(!m_pReadBuffer)
+        return false;
+    CloseFile();
+    m_sProject = sName;
+    //Complete replacement of project file if interrupted after project configuration was saved
+    int nRestructure = m_restructure.Resume(m_sPath + sName);
+    if(RESTRUCTURE_SAVED == nRestructure)
+    {
+        rename(m_restructure.GetFilename().c_str(), (m_sPath + sName + ".wav").c_str());
+        ReplaceChecksums(m_restructure.GetFilename(), m_sPath + sName + ".wav");
+        m_restructure.End();
+        nRestructure = RESTRUCTURE_NONE;
+    }
+    m_takeStore.Open(m_sPath + sName + ".takes/");
+    if(!OpenFile())
+        return false;
+
+    //Get configuration
+    string sConfig = m_sPath;
+    sConfig.append(sName);
+    sConfig.append(".cfg");
+    FILE *pFile = fopen(sConfig.c_str(), "r");
+    int nResampleQuality = m_nResampleQuality;
+    unsigned int nBufferMemory = STREAM_MEMORY_LIMIT;
+    unsigned int nSpoolMinutes = 0;
+    m_nCalibratedLatency = 0;
+    m_nCalibratedRate = 0;
+    m_midiMap.Clear();
+    m_bAutoPunch = false;
+    m_lPunchIn = 0;
+    m_lPunchOut = 0;
+    m_nInputMonitor = MONITOR_OFF;
+    if(pFile)
+    {
+        char pLine[256];
+        while(fgets(pLine, sizeof(pLine), pFile))
+        {
+            if(strnlen(pLine, sizeof(pLine)) < 5)
+                continue;
+            unsigned int nChannel = (pLine[0] - '0') * 10 + (pLine[1] - '0');
+            if(nChannel >= 0 && nChannel < m_vTracks.size())
+            {
+                switch(pLine[2])
+                {
+                    case 'V':
+                        m_vTracks[nChannel]->nMonMix = atoi(pLine + 4);
+                        break;
+                    case 'L':
+                        //Route  / Mute A
+                        m_vTracks[nChannel]->bMuteA = (pLine[4] != '1');
+                        break;
+                    case 'R':
+                        //Route  / Mute B
+                        m_vTracks[nChannel]->bMuteB = (pLine[4] != '1');
+                        break;
+                    case 'H':
+                        //High-pass filter
+                        m_vTracks[nChannel]->fHighPass = atof(pLine + 4);
+                        break;
+                    case 'E':
+                        //Peaking EQ
+                        sscanf(pLine + 4, "%f,%f,%f", &m_vTracks[nChannel]->fEqFrequency, &m_vTracks[nChannel]->fEqGain, &m_vTracks[nChannel]->fEqQ);
+                        break;
+                    case 'C':
+                        //Compressor
+                        sscanf(pLine + 4, "%f,%f", &m_vTracks[nChannel]->fCompThreshold, &m_vTracks[nChannel]->fCompRatio);
+                        break;
+                }
+            }
+            if(0 == strncmp(pLine, "Pos=", 4))
+                m_lHeadPos = atoi(pLine + 4); //Set transport position
+            if(0 == strncmp(pLine, "ParallelTracks=", 15))
+                m_nParallelTracks = atoi(pLine + 15);
+            if(0 == strncmp(pLine, "Resample=", 9))
+                nResampleQuality = atoi(pLine + 9);
+            if(0 == strncmp(pLine, "BufferMemory=", 13))
+                nBufferMemory = atoi(pLine + 13);
+            if(0 == strncmp(pLine, "SpoolMinutes=", 13))
+                nSpoolMinutes = atoi(pLine + 13);
+            if(0 == strncmp(pLine, "RecordLatency=", 14) && 2 != sscanf(pLine + 14, "%u,%u", &m_nCalibratedLatency, &m_nCalibratedRate))
+                m_nCalibratedLatency = m_nCalibratedRate = 0;
+            if(0 == strncmp(pLine, "StemSkipSilent=", 15))
+                m_bStemSkipSilent = (pLine[15] == '1');
+            if(0 == strncmp(pLine, "StemTrim=", 9))
+                m_bStemTrim = (pLine[9] == '1');
+            if(0 == strncmp(pLine, "PunchIn=", 8))
+                m_lPunchIn = atol(pLine + 8);
+            if(0 == strncmp(pLine, "PunchOut=", 9))
+                m_lPunchOut = atol(pLine + 9);
+            if(0 == strncmp(pLine, "AutoPunch=", 10))
+                m_bAutoPunch = (pLine[10] == '1');
+            if(0 == strncmp(pLine, "PreRoll=", 8))
+                m_nPreRoll = atoi(pLine + 8);
+            if(0 == strncmp(pLine, "PostRoll=", 9))
+                m_nPostRoll = atoi(pLine + 9);
+            if(0 == strncmp(pLine, "PunchFade=", 10))
+                m_nPunchFade = atoi(pLine + 10);
+            if(0 == strncmp(pLine, "InputMonitor=", 13))
+            {
+                for(int i = MONITOR_OFF; i <= MONITOR_INPUT; ++i)
+                    if(0 == strncmp(pLine + 13, MONITOR_NAMES[i], strlen(MONITOR_NAMES[i])))
+                        m_nInputMonitor = i;
+            }
+            if(0 == strncmp(pLine, "Midi=", 5))
+                m_midiMap.Add(pLine + 5); //MIDI control binding
+            if(0 == strncmp(pLine, "Take=", 5))
+            {
+                //Extent of a take
+                TakeExtent extent;
+                if(5 == sscanf(pLine + 5, "%u,%u,%ld,%ld,%ld", &extent.nTake, &extent.nTrack, &extent.lStart, &extent.lFrames, &extent.lOffset)
+                    && !m_takeStore.AddExtent(extent))
+                    cerr << "Missing take file " << m_takeStore.GetFilename(extent.nTake, extent.nTrack) << " - take ignored" << endl;
+            }
+        }
+        fclose(pFile);
+    }
+    //Connect every track as routed, including those of a new project which has no configuration
+    for(unsigned int nTrack = 0; nTrack < m_vTracks.size(); ++nTrack)
+        SetRouting(nTrack, GetRouting(nTrack));
+    if(m_lPunchOut <= m_lPunchIn)
+        m_bAutoPunch = false;
+    UpdateRecordOffset(); //Project's measured round trip or latency reported by JACK
+    if(nResampleQuality != m_nResampleQuality || nBufferMemory != m_nBufferMemory || nSpoolMinutes != m_nSpoolMinutes)
+    {
+        //Restart stream with project's sample rate conversion quality, buffer memory limit and spool
+        bool bReopen = nBufferMemory != m_nBufferMemory || nSpoolMinutes != m_nSpoolMinutes || m_diskStream.IsResampling();
+        m_nResampleQuality = nResampleQuality;
+        m_nBufferMemory = nBufferMemory;
+        m_nSpoolMinutes = nSpoolMinutes;
+        if(bReopen)
+            OpenStream();
+    }
+    m_inserts.Configure(m_vTracks.data(), m_vTracks.size(), GetDeviceRate(), true);
+    PrefetchProject();
+    SetPlayHead(m_lHeadPos);
+    UpdateLength();
+
+    //Continue restructure interrupted by shutdown or power loss
+    if(RESTRUCTURE_NONE != nRestructure && !m_restructure.IsValid(m_vTracks.size(), MAX_TRACKS))
+        m_restructure.End();
+    else if(RESTRUCTURE_COPIED == nRestructure)
+        return FinishRestructure();
+    else if(RESTRUCTURE_COPY == nRestructure && !StartJob(JOB_RESTRUCTURE))
+        m_restructure.End();
+
+    //Rewrite foreign file in native layout whilst project plays from it
+    if(m_bForeign)
+    {
+        m_import.Begin(m_sPath + sName, m_lLastFrame);
+        StartJob(JOB_IMPORT);
+    }
+    StartScrubber();
+    return true;
+}
+
+void Engine::StartScrubber()
+{
+    //Foreign file has no index - it is verified once import replaces it
+    if(m_fdWave <= 0 || m_bForeign)
+        return;
+    m_scrubber.Start(m_sPath + m_sProject + ".wav", m_offStartOfData, m_vTracks.size(), &m_takeStore, IsScrubIdle, this);
+}
+
+bool Engine::IsScrubIdle(void* pContext)
+{
+    //Any recording, playback, job, copy or spool flush takes priority over verification
+    Engine* pEngine = (Engine*)pContext;
+    return TC_STOPPED == pEngine->m_nTransport && JOB_NONE == pEngine->m_nJob && !pEngine->m_snapshot.IsBusy()
+        && 0 == pEngine->m_diskStream.GetSpoolFrames();
+}
+
+bool Engine::AllocateRtBuffers()
+{
+    size_t nReadSize = RT_MAX_PERIOD * MAX_TRACKS * sizeof(jack_default_audio_sample_t);
+    size_t nHistorySize = PUNCH_HISTORY * sizeof(float);
+    size_t nInputSize = RT_MAX_PERIOD * sizeof(float);
+    size_t nInsertSize = InsertChain::GetSize(MAX_TRACKS);
+    if(!m_rtArena.Reserve(nReadSize + 2 * nHistorySize + 4 * nInputSize + nInsertSize + 9 * RT_ALIGN))
+    {
+        cerr << "Failed to allocate audio buffers" << endl;
+        m_pReadBuffer = NULL;
+        return false;
+    }
+    m_pReadBuffer = (jack_default_audio_sample_t*)m_rtArena.Alloc(nReadSize);
+    for(unsigned int i = 0; i < 2; ++i)
+    {
+        m_apPunchHistory[i] = (float*)m_rtArena.Alloc(nHistorySize);
+        m_apPunchInput[i] = (float*)m_rtArena.Alloc(nInputSize);
+    }
+    m_pSilence = (float*)m_rtArena.Alloc(nInputSize);
+    m_pProbe = (float*)m_rtArena.Alloc(nInputSize);
+    m_inserts.SetMemory(m_rtArena.Alloc(nInsertSize), MAX_TRACKS);
+    return true;
+}
+
+void Engine::PrefetchProject()
+{
+    //Most likely first play is from saved playhead then home then end
+    long lSpan = PREFETCH_SECONDS * m_nSamplerate;
+    m_diskStream.Prefetch(m_lHeadPos - m_nSamplerate, lSpan + m_nSamplerate);
+    m_diskStream.Prefetch(0, lSpan);
+    m_diskStream.Prefetch(m_lLastFrame - m_nSamplerate, m_nSamplerate);
+}
+
+bool Engine::SaveProject()
+{
+    if(m_fdWave <= 0)
+        return false;
+    m_diskStream.Sync(); //Ensure all captured audio is in extent map
+    //Replace configuration atomically so that an interruption leaves either the old or the new configuration
+    string sConfig = m_sPath + m_sProject + ".cfg";
+    if(!WriteConfig(sConfig + ".tmp"))
+        return false;
+    return 0 == rename((sConfig + ".tmp").c_str(), sConfig.c_str());
+}
+
+bool Engine::SaveSnapshot(const string& sName)
+{
+    if(m_fdWave <= 0 || sName.empty() || sName == m_sProject || string::npos != sName.find('/') || m_snapshot.IsBusy() || JOB_NONE != m_nJob)
+        return false;
+    string sDest = m_sPath + sName;
+    if(0 == access((sDest + ".wav").c_str(), F_OK) || 0 == access((sDest + ".cfg").c_str(), F_OK))
+        return false; //Don't overwrite an existing project
+    m_diskStream.Sync(); //Ensure all captured audio is in extent map and take files
+    if(!WriteConfig(sDest + ".cfg.tmp"))
+        return false;
+    if(m_snapshot.Start(m_sPath + m_sProject, sDest))
+        return true;
+    unlink((sDest + ".cfg.tmp").c_str());
+    return false;
+}
+
+bool Engine::WriteConfig(const string& sFilename)
+{
+    FILE *pFile = fopen(sFilename.c_str(), "w+");
+    if(pFile)
+    {
+        char pBuffer[32];
+        fputs("# This configuration file is completely overwritten each time the project is saved\n", pFile);
+        fputs("# Do not manually edit this file whilst multijack is using this project.\n\n", pFile);
+        for(unsigned int i = 0; i < m_vTracks.size(); ++i)
+        {
+            memset(pBuffer, 0, sizeof(pBuffer));
+            sprintf(pBuffer, "%02dV=%d\n", i, m_vTracks[i]->nMonMix);
+            fputs(pBuffer, pFile);
+            memset(pBuffer, 0, sizeof(pBuffer));
+            sprintf(pBuffer, "%02dL=%s",i, m_vTracks[i]->bMuteA?"0\n":"1\n");
+            fputs(pBuffer, pFile);
+            memset(pBuffer, 0, sizeof(pBuffer));
+            sprintf(pBuffer, "%02dR=%s",i, m_vTracks[i]->bMuteB?"0\n":"1\n");
+            fputs(pBuffer, pFile);
+            //Insert effects are only saved when used
+            if(m_vTracks[i]->fHighPass > 0)
+                fprintf(pFile, "%02dH=%g\n", i, m_vTracks[i]->fHighPass);
+            if(0 != m_vTracks[i]->fEqGain)
+                fprintf(pFile, "%02dE=%g,%g,%g\n", i, m_vTracks[i]->fEqFrequency, m_vTracks[i]->fEqGain, m_vTracks[i]->fEqQ);
+            if(m_vTracks[i]->fCompRatio > 1)
+                fprintf(pFile, "%02dC=%g,%g\n", i, m_vTracks[i]->fCompThreshold, m_vTracks[i]->fCompRatio);
+        }
+        memset(pBuffer, 0, sizeof(pBuffer));
+        sprintf(pBuffer, "Pos=%ld\n", m_lHeadPos);
+        fputs(pBuffer , pFile);
+        fprintf(pFile, "Resample=%d\n", m_nResampleQuality);
+        fprintf(pFile, "ParallelTracks=%u\n", m_nParallelTracks);
+        fprintf(pFile, "BufferMemory=%u\n", m_nBufferMemory);
+        fprintf(pFile, "SpoolMinutes=%u\n", m_nSpoolMinutes);
+        if(m_nCalibratedLatency)
+            fprintf(pFile, "RecordLatency=%u,%u\n", m_nCalibratedLatency, m_nCalibratedRate);
+        fprintf(pFile, "StemSkipSilent=%d\nStemTrim=%d\n", m_bStemSkipSilent ? 1 : 0, m_bStemTrim ? 1 : 0);
+        fprintf(pFile, "PunchIn=%ld\nPunchOut=%ld\nAutoPunch=%d\n", m_lPunchIn, m_lPunchOut, m_bAutoPunch ? 1 : 0);
+        fprintf(pFile, "PreRoll=%d\nPostRoll=%d\nPunchFade=%d\n", m_nPreRoll, m_nPostRoll, m_nPunchFade);
+        fprintf(pFile, "InputMonitor=%s\n", MONITOR_NAMES[m_nInputMonitor]);
+        vector<string> vMidi = m_midiMap.GetDefinitions();
+        for(vector<string>::iterator it = vMidi.begin(); it != vMidi.end(); ++it)
+            fprintf(pFile, "Midi=%s\n", it->c_str());
+        vector<TakeExtent> vExtents = m_takeStore.GetExtents();
+        for(vector<TakeExtent>::iterator it = vExtents.begin(); it != vExtents.end(); ++it)
+            fprintf(pFile, "Take=%u,%u,%ld,%ld,%ld\n", it->nTake, it->nTrack, it->lStart, it->lFrames, it->lOffset);
+
+        //Configuration must be on storage before it replaces previous configuration
+        bool bResult = (0 == fflush(pFile)) && (0 == fsync(fileno(pFile)));
+        fclose(pFile);
+        return bResult;
+    }
+    return false;
+}
+
+void Engine::UpdateLength()
+{
+    if(0 == m_nFrameSize)
+        return;
+    m_lLastFrame = (m_offEndOfData - m_offStartOfData) / m_nFrameSize;
+}
+
+void Engine::ConnectPlayback(unsigned int nTrack, unsigned int nPorts)
+{
+    jack_client_t* pClient = m_pJackClient;
+    if(nTrack >= m_vTracks.size() || !pClient || !m_vTracks[nTrack]->pSourcePort)
+        return;
+    const char* pCharPort = jack_port_name(m_vTracks[nTrack]->pSourcePort);
+    if(PORT_NONE == nPorts)
+    {
+        jack_disconnect(pClient, pCharPort, jack_port_name(m_pPortPlaybackA));
+        jack_disconnect(pClient, pCharPort, jack_port_name(m_pPortPlaybackB));
+        return;
+    }
+    if(PORT_A & nPorts)
+        jack_connect(pClient, pCharPort, jack_port_name(m_pPortPlaybackA));
+    if(PORT_B & nPorts)
+        jack_connect(pClient, pCharPort, jack_port_name(m_pPortPlaybackB));
+}
+
+void Engine::DisconnectPlayback(unsigned int nTrack, unsigned int nPorts)
+{
+    jack_client_t* pClient = m_pJackClient;
+    if(nTrack >= m_vTracks.size() || !pClient || !m_vTracks[nTrack]->pSourcePort)
+        return;
+    const char* pCharPort = jack_port_name(m_vTracks[nTrack]->pSourcePort);
+    if(PORT_A & nPorts)
+        jack_disconnect(pClient, pCharPort, jack_port_name(m_pPortPlaybackA));
+    if(PORT_B & nPorts)
+        jack_disconnect(pClient, pCharPort, jack_port_name(m_pPortPlaybackB));
+}
+
+bool Engine::Record(long lFrame, const float* pInA, const float* pInB, jack_nframes_t nFrames)
+{
+    if(TC_ROLLING != m_nTransport || !m_bRecordEnabled)
+    {
+        m_diskStream.EndCapture(); //Not recording so release any partially captured audio to disk thread
+        return false; //Can't record if we are not rolling or not in record mode
+    }
+    if(m_fdWave <= 0)
+        return false; //WAVE file not open so nothing to record to
+    if((-1 == m_nRecA) && (-1 == m_nRecB))
+    {
+        m_diskStream.EndCapture();
+        return false; //No record channels primed
+    }
+    long lRecordOffset = m_diskStream.GetCaptureOffset(m_nRecordOffset);
+    if(lFrame < lRecordOffset)
+        return true; //Record head not past start of file
+
+    //Queue samples to be merged into file by disk thread
+    if(m_bAutoPunch)
+        return PunchRecord(lFrame - lRecordOffset, pInA, pInB, nFrames);
+    return m_diskStream.Capture(lFrame - lRecordOffset, nFrames, pInA, m_nRecA, pInB, m_nRecB);
+}
+
+bool Engine::PunchRecord(long lFrame, const float* pInA, const float* pInB, jack_nframes_t nFrames)
+{
+    //Record from fade before punch-in to fade after punch-out, positions converted from interface frames if resampling
+    double dRatio = m_diskStream.GetRatio();
+    long lFade = (long)m_nPunchFade * m_nSamplerate / 1000;
+    long lStart = m_lPunchIn - lFade;
+    long lEnd = m_lPunchOut + lFade;
+    jack_nframes_t nFirst = 0;
+    jack_nframes_t nEnd = nFrames;
+    if(lFrame < lStart)
+        nFirst = (lStart - lFrame) / dRatio + 0.999999;
+    if(lFrame + nFrames * dRatio > lEnd)
+        nEnd = lEnd > lFrame ? (lEnd - lFrame) / dRatio + 0.999999 : 0;
+    if(nFirst > nFrames)
+        nFirst = nFrames;
+    if(nEnd > nFrames)
+        nEnd = nFrames;
+    if(nFirst >= nEnd)
+    {
+        m_diskStream.EndCapture(); //Outside punch range
+        return true;
+    }
+
+    //Equal-power crossfade between existing audio and input within fade at each punch point
+    float* afA = m_apPunchInput[0];
+    float* afB = m_apPunchInput[1];
+    for(jack_nframes_t nFrame = nFirst; nFrame < nEnd; ++nFrame)
+    {
+        double dPos = lFrame + nFrame * dRatio;
+        double dFade = GetPunchFade(dPos);
+        float fIn = 1;
+        float fOld = 0;
+        if(dFade < 1)
+        {
+            fIn = sin(dFade * M_PI_2);
+            fOld = cos(dFade * M_PI_2);
+        }
+        long lPos = dPos + 0.5;
+        if(m_nRecA > -1)
+            afA[nFrame] = fIn * pInA[nFrame] + (fOld ? fOld * GetPunchHistory(0, lPos) : 0);
+        if(m_nRecB > -1)
+            afB[nFrame] = fIn * pInB[nFrame] + (fOld ? fOld * GetPunchHistory(1, lPos) : 0);
+    }
+    return m_diskStream.Capture(lFrame + (long)(nFirst * dRatio + 0.5), nEnd - nFirst, afA + nFirst, m_nRecA, afB + nFirst, m_nRecB);
+}
+
+double Engine::GetPunchFade(double dPos)
+{
+    long lFade = (long)m_nPunchFade * m_nSamplerate / 1000;
+    if(dPos >= m_lPunchIn && dPos < m_lPunchOut)
+        return 1;
+    if(lFade && dPos < m_lPunchIn && dPos >= m_lPunchIn - lFade)
+        return (dPos - m_lPunchIn + lFade) / lFade;
+    if(lFade && dPos >= m_lPunchOut && dPos < m_lPunchOut + lFade)
+        return (m_lPunchOut + lFade - dPos) / lFade;
+    return 0;
+}
+
+void Engine::StorePunchHistory(long lFrame, jack_nframes_t nFrames, unsigned int nFileFrames)
+{
+    if(lFrame != m_lHistoryEnd)
+        m_lHistoryStart = lFrame; //Discontinuity so earlier history does not precede this frame
+    double dRatio = m_diskStream.GetRatio();
+    unsigned int nChannels = m_vTracks.size();
+    for(jack_nframes_t nFrame = 0; nFrame < nFrames; ++nFrame)
+    {
+        long lIndex = (lFrame + (long)(nFrame * dRatio + 0.5)) % PUNCH_HISTORY;
+        if(m_nRecA > -1)
+            m_apPunchHistory[0][lIndex] = m_pReadBuffer[nFrame * nChannels + m_nRecA];
+        if(m_nRecB > -1)
+            m_apPunchHistory[1][lIndex] = m_pReadBuffer[nFrame * nChannels + m_nRecB];
+    }
+    m_lHistoryEnd = lFrame + nFileFrames;
+}
+
+float Engine::GetPunchHistory(unsigned int nInput, long lFrame)
+{
+    if(lFrame < m_lHistoryStart || lFrame < m_lHistoryEnd - PUNCH_HISTORY || lFrame >= m_lHistoryEnd)
+        return 0; //Not played since locate or too old
+    return m_apPunchHistory[nInput][lFrame % PUNCH_HISTORY];
+}
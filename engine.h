@@ -0,0 +1,587 @@
+/** Class providing the recorder engine - project, transport, disk streaming, recording and mixing
+*   Engine holds no global state so several engines may run in one process, e.g. for offline rendering, tests and benchmarks
+*   Connect to run from a JACK client or call Render to process periods without JACK
+*   Engine does not draw - front ends query state and are told of changes made by the audio thread by GetChanged
+*/
+#pragma once
+
+#include "bounce.h"
+#include "diskstream.h"
+#include "import.h"
+#include "inserts.h"
+#include "latencyprobe.h"
+#include "loudness.h"
+#include "midimap.h"
+#include "restructure.h"
+#include "scrubber.h"
+#include "snapshot.h"
+#include "rtarena.h"
+#include "stems.h"
+#include "takestore.h"
+#include "workerpool.h"
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <atomic>
+#include <pthread.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+class Track;
+
+static const int DEFAULT_SAMPLERATE = 44100; //Samples per second
+static const int SAMPLESIZE         = 4; //Quantity of bytes in each sample (4 for 32-bit)
+static const jack_nframes_t RT_MAX_PERIOD = 8192; //Maximum period size - realtime buffers are sized for this
+static const int MAX_TRACKS         = 16; //Quantity of mono tracks
+static const int PREFETCH_SECONDS   = 10; //Duration of audio prefetched at each likely start position when project loads
+static const unsigned int PARALLEL_TRACKS = MAX_TRACKS; //Default minimum quantity of tracks to split mixing across worker threads
+static const unsigned int SUSPEND_TIMEOUT_MS = 2000; //Maximum milliseconds to wait for audio thread to stop using tracks
+static const int PRE_ROLL           = 2000; //Default milliseconds played before punch-in
+static const int POST_ROLL          = 1000; //Default milliseconds played after punch-out
+static const int PUNCH_FADE         = 10; //Default milliseconds of crossfade at each punch point
+static const long PUNCH_HISTORY     = 65536; //Frames of played audio kept to crossfade with input - must exceed record latency
+static const char* const PROJECT_PATH = "/media/multitrack/"; //Default project path
+//Input monitor modes
+static const int MONITOR_OFF        = 0; //Armed tracks are silent
+static const int MONITOR_AUTO       = 1; //Armed tracks play input when stopped or recording and play track otherwise
+static const int MONITOR_INPUT      = 2; //Armed tracks always play input
+static const char* const MONITOR_NAMES[] = {"off", "auto", "input"}; //Names of input monitor modes used by control protocol and project
+//Transport control states
+static const int TC_STOPPED     = 0;
+static const int TC_ROLLING     = 1;
+static const int TC_STOPPING    = 2;
+static const int TC_STOP        = 3; //Request transport stop
+static const int TC_START       = 4; //Request transport start
+//Ports to connect
+static const unsigned int PORT_NONE = 0;
+static const unsigned int PORT_A    = 1;
+static const unsigned int PORT_B    = 2;
+static const unsigned int PORT_BOTH = 3;
+//Background jobs
+static const int JOB_NONE       = 0;
+static const int JOB_COMPACT    = 1; //Merge takes into WAVE file
+static const int JOB_BOUNCE     = 2; //Export stereo mix
+static const int JOB_STEMS      = 3; //Export each track to mono WAVE file
+static const int JOB_RESTRUCTURE = 4; //Add, remove or reorder tracks
+static const int JOB_IMPORT     = 5; //Rewrite WAVE file in native layout - transport and recording continue
+static const int JOB_CALIBRATE  = 6; //Measure round-trip latency through a loopback cable
+static const int JOB_ANALYSE    = 7; //Measure loudness and peaks of each track
+static const char* const JOB_NAMES[] = {"none", "compact", "mix", "stems", "tracks", "import", "calibrate", "analyse"}; //Names of jobs used by control protocol
+static const int IMPORT_WAIT_MS = 100; //Interval at which completed import checks whether transport has stopped
+
+/** Structure representing RIFF WAVE format chunk header (without id or size, i.e. 8 bytes smaller) **/
+struct WaveHeader
+{
+    uint16_t nAudioFormat; //1=PCM
+    uint16_t nNumChannels; //Number of channels in project
+    uint32_t nSampleRate; //Samples per second - expect SAMPLERATE
+    uint32_t nByteRate; //nSamplrate * nNumChannels * nBitsPerSample / 8
+    uint16_t nBlockAlign; //nNumChannels * nBitsPerSample / 8 (bytes for one sample of all chanels)
+    uint16_t nBitsPerSample; //Expect 16
+};
+
+/** Structure representing a connection of an engine port, restored when JACK server returns **/
+struct PortConnection
+{
+    std::string sPort; //Short name of engine port
+    std::string sPeer; //Full name of connected port
+    bool bOutput; //True if engine port is source of connection
+};
+
+/** Structure holding data shared by threads mixing one period **/
+struct MixContext
+{
+    const jack_default_audio_sample_t* pRead; //Interleaved samples read from file
+    jack_default_audio_sample_t* const* ppOut; //Output buffer of each track
+    Track* const* ppTracks; //Tracks providing gain and routing
+    unsigned int nChannels; //Quantity of tracks
+    jack_nframes_t nFrames; //Quantity of frames in period
+    int nTransport; //Transport status at start of period
+};
+
+class Engine
+{
+    public:
+        Engine();
+        ~Engine();
+
+        /** @brief  Connect to JACK server, registering input, MIDI and track ports and connecting to physical ports
+        *   @param  pName Name of JACK client
+        *   @return <i>bool</i> True on success
+        *   @note   Load a project after connecting to create track ports
+        *   @note   After server shuts down, call again to rejoin - open project, buffers and position are kept, track ports are created and connections are restored
+        */
+        bool Connect(const char* pName = "multijack");
+
+        /** @brief  Close JACK client and stop mixing workers
+        */
+        void Disconnect();
+
+        /** @brief  Remember connections of engine ports so they may be restored if server restarts
+        *   @note   Call from main loop - does nothing unless connections changed since last call
+        */
+        void UpdateConnections();
+
+        /** @brief  Check whether connected to JACK server
+        *   @return <i>bool</i> False if not connected or server has shut down
+        */
+        bool IsConnected() { return NULL != m_pJackClient.load(); }
+
+        /** @brief  Get quantity of JACK process callbacks since connecting, e.g. to check that audio is running
+        */
+        unsigned long GetProcessCount() { return m_lProcessCount.load(std::memory_order_relaxed); }
+
+        /** @brief  Process a period without JACK, e.g. for offline rendering, tests and benchmarks
+        *   @param  nFrames Quantity of frames - must not exceed RT_MAX_PERIOD
+        *   @param  pInA Samples from input A or NULL for silence
+        *   @param  pInB Samples from input B or NULL for silence
+        *   @param  ppOut Output buffer of each track - any may be NULL
+        *   @param  pEvents MIDI control events in order of time, each applied at its frame as Process does - NULL for none
+        *   @param  nEvents Quantity of MIDI events
+        *   @return <i>bool</i> True if audio was played
+        *   @note   Do not call whilst connected to JACK
+        */
+        bool Render(jack_nframes_t nFrames, const float* pInA, const float* pInB, float* const* ppOut, const jack_midi_event_t* pEvents = NULL, uint32_t nEvents = 0);
+
+        /** @brief  Start worker threads sharing per-track mixing, e.g. to render or benchmark without JACK
+        *   @param  nWorkers Quantity of threads in addition to caller - 0 to mix on calling thread only
+        *   @return <i>unsigned int</i> Quantity of workers started
+        *   @note   Connect starts a worker for each core but one - do not call whilst connected to JACK
+        */
+        unsigned int StartWorkers(unsigned int nWorkers);
+
+        /** @brief  Set minimum quantity of tracks to split mixing across worker threads
+        *   @param  nTracks Quantity of tracks
+        *   @note   Loading a project applies its ParallelTracks configuration
+        */
+        void SetParallelTracks(unsigned int nTracks) { m_nParallelTracks = nTracks; }
+
+        /** @brief  Set directory holding projects
+        *   @param  sPath Path including trailing slash
+        */
+        void SetPath(const std::string& sPath) { m_sPath = sPath; }
+
+        /** @brief  Get directory holding projects
+        */
+        const std::string& GetPath() { return m_sPath; }
+
+        /** @brief  Load a project, closing any open project
+        *   @param  sName Project name - project consists of sName.wav, sName.cfg and sName.takes
+        *   @return <i>bool</i> True on success
+        */
+        bool LoadProject(const std::string& sName);
+
+        /** @brief  Save the current project, replacing its configuration atomically
+        *   @return <i>bool</i> True on success
+        */
+        bool SaveProject();
+
+        /** @brief  Start saving a copy of the current project under a new name, continuing to use the current project
+        *   @param  sName Name of copy - must not be an existing project
+        *   @return <i>bool</i> True if copy started - progress and result are available from GetSnapshot
+        *   @note   Files are cloned where the filesystem supports it, otherwise copied in the background
+        */
+        bool SaveSnapshot(const std::string& sName);
+
+        /** @brief  Get project copier, e.g. for progress of SaveSnapshot
+        */
+        Snapshot& GetSnapshot() { return m_snapshot; }
+
+        /** @brief  Close project, completing outstanding writes
+        */
+        void CloseProject();
+
+        /** @brief  Stop transport, wait for background job, save and close project and disconnect from JACK
+        */
+        void Shutdown();
+
+        /** @brief  Get name of current project
+        */
+        const std::string& GetProject() { return m_sProject; }
+
+        /** @brief  Check whether a project is open
+        */
+        bool IsOpen() { return m_fdWave > 0; }
+
+        /** @brief  Get sample encoding of project WAVE file
+        *   @return <i>int</i> Encoding [WAVE_FLOAT | WAVE_PCM16 | WAVE_PCM24 | WAVE_PCM32]
+        */
+        int GetEncoding() { return m_nEncoding; }
+
+        /** @brief  Check whether project plays from a WAVE file not yet rewritten in native layout
+        */
+        bool IsForeign() { return m_bForeign; }
+
+        /** @brief  Start transport from current playhead
+        *   @return <i>bool</i> True if started - false if not stopped or a background job other than import is running
+        */
+        bool StartTransport();
+
+        /** @brief  Stop transport, ending recording
+        */
+        void StopTransport();
+
+        /** @brief  Get transport status
+        *   @return <i>int</i> Transport status [TC_STOPPED | TC_ROLLING | TC_STOPPING | TC_STOP | TC_START]
+        */
+        int GetTransport() { return m_nTransport; }
+
+        /** @brief  Move play head to new postion
+        *   @param  lPosition New position of playhead in frames relative to start
+        *   @note   Ignored whilst recording
+        */
+        void SetPlayHead(long lPosition);
+
+        /** @brief  Get position of playhead
+        *   @return <i>long</i> Quantity of frames from start
+        */
+        long GetPlayHead() { return m_lHeadPos; }
+
+        /** @brief  Get length of project
+        *   @return <i>long</i> Quantity of frames
+        */
+        long GetLength() { return m_lLastFrame; }
+
+        /** @brief  Get sample rate of project
+        */
+        unsigned int GetSampleRate() { return m_nSamplerate; }
+
+        /** @brief  Get sample rate of audio interface
+        *   @return <i>unsigned int</i> JACK sample rate or project sample rate when not connected
+        */
+        unsigned int GetDeviceRate();
+
+        /** @brief  Enable or disable record mode
+        *   @param  bEnable True to enable recording when transport rolls
+        */
+        void SetRecordEnable(bool bEnable);
+
+        /** @brief  Check whether record mode is enabled
+        */
+        bool IsRecordEnabled() { return m_bRecordEnabled; }
+
+        /** @brief  Select track to record from an input
+        *   @param  nInput Input to record [PORT_A | PORT_B]
+        *   @param  nTrack Index of track or -1 to record nothing from this input
+        */
+        void ArmTrack(unsigned int nInput, int nTrack);
+
+        /** @brief  Get track selected to record from an input
+        *   @param  nInput Input [PORT_A | PORT_B]
+        *   @return <i>int</i> Index of track or -1 if none
+        */
+        int GetArmedTrack(unsigned int nInput) { return PORT_A == nInput ? m_nRecA : m_nRecB; }
+
+        /** @brief  Get quantity of tracks in project
+        */
+        unsigned int GetTrackCount() { return m_vTracks.size(); }
+
+        /** @brief  Get a track, e.g. to adjust its monitor level
+        *   @param  nTrack Index of track
+        *   @return <i>Track*</i> Pointer to track or NULL if invalid index
+        */
+        Track* GetTrack(unsigned int nTrack) { return nTrack < m_vTracks.size() ? m_vTracks[nTrack] : NULL; }
+
+        /** @brief  Get which outputs a track is monitored on
+        *   @param  nTrack Index of track
+        *   @return <i>unsigned int</i> Monitored ports [PORT_NONE | PORT_A | PORT_B | PORT_BOTH]
+        */
+        unsigned int GetRouting(unsigned int nTrack);
+
+        /** @brief  Set which outputs a track is monitored on
+        *   @param  nTrack Index of track
+        *   @param  nPorts Ports to monitor on [PORT_NONE | PORT_A | PORT_B | PORT_BOTH]
+        */
+        void SetRouting(unsigned int nTrack, unsigned int nPorts);
+
+        /** @brief  Apply insert effect settings of tracks to monitor mix, e.g. after changing them
+        *   @note   Call from one non-realtime thread - audio thread takes new settings at its next period without locking
+        */
+        void UpdateInserts();
+
+        /** @brief  Set punch-in point, disabling automatic punch if punch-out is not after it
+        *   @param  lFrame Position of punch-in
+        */
+        void SetPunchIn(long lFrame);
+
+        /** @brief  Set punch-out point, disabling automatic punch if it is not after punch-in
+        *   @param  lFrame Position of punch-out
+        */
+        void SetPunchOut(long lFrame);
+
+        /** @brief  Get position of punch-in
+        */
+        long GetPunchIn() { return m_lPunchIn; }
+
+        /** @brief  Get position of punch-out
+        */
+        long GetPunchOut() { return m_lPunchOut; }
+
+        /** @brief  Enable or disable automatic punch-in / punch-out
+        *   @param  bEnable True to only record between punch points
+        *   @return <i>bool</i> True on success - false if punch-out is not after punch-in
+        */
+        bool SetAutoPunch(bool bEnable);
+
+        /** @brief  Check whether automatic punch-in / punch-out is enabled
+        */
+        bool IsAutoPunch() { return m_bAutoPunch; }
+
+        /** @brief  Set input monitor mode
+        *   @param  nMode Mode [MONITOR_OFF | MONITOR_AUTO | MONITOR_INPUT]
+        */
+        void SetInputMonitor(int nMode);
+
+        /** @brief  Get input monitor mode
+        *   @return <i>int</i> Mode [MONITOR_OFF | MONITOR_AUTO | MONITOR_INPUT]
+        */
+        int GetInputMonitor() { return m_nInputMonitor; }
+
+        /** @brief  Get offset applied between played and captured audio
+        *   @return <i>unsigned int</i> Round trip in interface frames - measured by calibration or reported by JACK
+        */
+        unsigned int GetRecordLatency() { return m_nRecordOffset; }
+
+        /** @brief  Get round trip reported by JACK
+        *   @return <i>unsigned int</i> Sum of capture and playback latency of input A in interface frames
+        */
+        unsigned int GetReportedLatency() { return m_nCaptureLatency + m_nPlaybackLatency; }
+
+        /** @brief  Check whether project uses a measured round trip
+        */
+        bool IsCalibrated() { return m_nCalibratedLatency > 0; }
+
+        /** @brief  Discard measured round trip so that latency reported by JACK is used
+        */
+        void ClearCalibration();
+
+        /** @brief  Get latency probe, e.g. for result of last calibration
+        */
+        LatencyProbe& GetLatencyProbe() { return m_latencyProbe; }
+
+        /** @brief  Remove last take
+        *   @return <i>bool</i> True if a take was removed - false if rolling, a job is running or there are no takes
+        */
+        bool UndoTake();
+
+        /** @brief  Get quantity of takes
+        */
+        unsigned int GetTakeCount() { return m_takeStore.GetTakeCount(); }
+
+        /** @brief  Insert a new empty track, starting a background job to restructure the WAVE file
+        *   @param  nPosition Index of new track
+        *   @return <i>bool</i> True if job started
+        */
+        bool AddTrack(unsigned int nPosition);
+
+        /** @brief  Remove a track, starting a background job to restructure the WAVE file
+        *   @param  nTrack Index of track
+        *   @return <i>bool</i> True if job started
+        */
+        bool RemoveTrack(unsigned int nTrack);
+
+        /** @brief  Move a track to a new position, starting a background job to restructure the WAVE file
+        *   @param  nTrack Index of track
+        *   @param  nPosition New index of track
+        *   @return <i>bool</i> True if job started
+        */
+        bool MoveTrack(unsigned int nTrack, unsigned int nPosition);
+
+        /** @brief  Start a background job
+        *   @param  nJob Job to start [JOB_COMPACT | JOB_BOUNCE | JOB_STEMS | JOB_RESTRUCTURE | JOB_IMPORT | JOB_CALIBRATE | JOB_ANALYSE]
+        *   @return <i>bool</i> True if job started
+        *   @note   Jobs may only run whilst transport is stopped, no snapshot is being saved and only one job may run at a time
+        */
+        bool StartJob(int nJob);
+
+        /** @brief  Get background job in progress
+        *   @return <i>int</i> Job [JOB_NONE | JOB_COMPACT | JOB_BOUNCE | JOB_STEMS | JOB_RESTRUCTURE | JOB_IMPORT | JOB_CALIBRATE | JOB_ANALYSE]
+        */
+        int GetJob() { return m_nJob; }
+
+        /** @brief  Get progress of background job in progress
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetJobProgress();
+
+        /** @brief  Join thread of finished background job, refreshing read-ahead after merging takes, reloading project after restructure, replacing file after import and applying measured latency after calibration
+        *   @param  nJob Job which has finished
+        *   @return <i>bool</i> True if job succeeded
+        */
+        bool EndJob(int nJob);
+
+        /** @brief  Get duration of last export, restructure, import or analysis
+        *   @param  nJob Job [JOB_BOUNCE | JOB_STEMS | JOB_RESTRUCTURE | JOB_IMPORT | JOB_ANALYSE]
+        *   @return <i>double</i> Seconds taken
+        */
+        double GetJobSeconds(int nJob);
+
+        /** @brief  Get quantity of stems written by last stem export
+        */
+        unsigned int GetStemCount() { return m_stemExport.GetStems(); }
+
+        /** @brief  Get loudness and peaks of a track measured by last analysis
+        *   @param  nTrack Index of track
+        *   @return <i>const LoudnessResult*</i> Pointer to measurements or NULL if not analysed since tracks last changed or analysis is running
+        */
+        const LoudnessResult* GetLoudness(unsigned int nTrack) { return JOB_ANALYSE == m_nJob ? NULL : m_loudness.GetResult(nTrack); }
+
+        /** @brief  Get disk stream, e.g. for statistics
+        */
+        DiskStream& GetDiskStream() { return m_diskStream; }
+
+        /** @brief  Get integrity scrubber, e.g. for corrupt ranges found
+        */
+        Scrubber& GetScrubber() { return m_scrubber; }
+
+        /** @brief  Check whether audio thread has changed state shown to user since last call, e.g. by MIDI control
+        *   @return <i>bool</i> True if changed
+        */
+        bool GetChanged() { return m_bChanged.exchange(false); }
+
+    private:
+        static int OnJackProcess(jack_nframes_t nFrames, void* pArgs);
+        static int OnJackSync(jack_transport_state_t nState, jack_position_t* pPos, void* pArgs);
+        static void OnJackLatency(jack_latency_callback_mode_t latencyMode, void* pArgs);
+        static void OnJackShutdown(void* pArgs);
+        static void OnJackPortConnect(jack_port_id_t nPortA, jack_port_id_t nPortB, int nConnect, void* pArgs);
+        static int OnJackBufferChange(jack_nframes_t nFrames, void* pArgs);
+        static void* JobThread(void* pArgs);
+        static void MixTracks(void* pContext, unsigned int nFirst, unsigned int nEnd);
+
+        /** Process a JACK period, splitting it at each MIDI control event */
+        void Process(jack_nframes_t nFrames);
+        /** Process part of a period - buffers point to start of period of nPeriod frames, nOffset is index of first frame */
+        bool ProcessFrames(const float* pInA, const float* pInB, float* const* ppOut, jack_nframes_t nPeriod, jack_nframes_t nOffset, jack_nframes_t nFrames);
+        /** Apply a bound MIDI event at its frame, first processing frames from *pDone up to it and advancing *pDone - returns true if audio was played */
+        bool ProcessMidiEvent(const jack_midi_event_t& event, const float* pInA, const float* pInB, float* const* ppOut, jack_nframes_t nPeriod, jack_nframes_t* pDone);
+        void SilenceOutputs(float* const* ppOut, jack_nframes_t nOffset, jack_nframes_t nFrames);
+        void PlayProbe(const float* pInA, const float* pInB, float* const* ppOut, jack_nframes_t nOffset, jack_nframes_t nFrames);
+        bool Calibrate();
+        void UpdateRecordOffset();
+        void MonitorInputs(const float* pInA, const float* pInB, float* const* ppOut, jack_nframes_t nOffset, jack_nframes_t nFrames, int nTransport, long lFrame);
+        void HandleMidi(const MidiAction& action);
+        void StartFromMidi();
+        void StopFromMidi();
+        bool Record(long lFrame, const float* pInA, const float* pInB, jack_nframes_t nFrames);
+        bool PunchRecord(long lFrame, const float* pInA, const float* pInB, jack_nframes_t nFrames);
+        void StorePunchHistory(long lFrame, jack_nframes_t nFrames, unsigned int nFileFrames);
+        float GetPunchHistory(unsigned int nInput, long lFrame);
+        double GetPunchFade(double dPos);
+        long GetStartPosition();
+        bool StartRestructure(const std::vector<int>& vMap);
+        bool FinishRestructure();
+        bool ReplaceTracks();
+        /** Stop audio thread using tracks, waiting until it acknowledges - returns false if already suspended */
+        bool SuspendAudio();
+        void ResumeAudio();
+        bool FinishImport();
+        void StartScrubber();
+        static bool IsScrubIdle(void* pContext);
+        /** Check whether background job prevents transport starting and takes changing - import only reads project file */
+        bool IsJobExclusive() { return JOB_NONE != m_nJob && JOB_IMPORT != m_nJob; }
+        bool WriteConfig(const std::string& sFilename);
+        bool AllocateRtBuffers();
+        bool OpenFile();
+        bool OpenStream();
+        void CloseFile();
+        void WriteHeader(unsigned int nWaveSize, unsigned int nChannels);
+        void PrefetchProject();
+        void UpdateLength();
+        void CreateJackSources(jack_client_t* pClient);
+        /** Close a client that is not published and forget its ports */
+        void AbandonClient(jack_client_t* pClient);
+        void ReleaseClient();
+        void RestoreConnections(jack_client_t* pClient);
+        void ConnectPlayback(unsigned int nTrack, unsigned int nPorts = PORT_BOTH);
+        void DisconnectPlayback(unsigned int nTrack, unsigned int nPorts = PORT_BOTH);
+
+        //JACK
+        std::atomic<jack_client_t*> m_pJackClient; //JACK client or NULL if not connected - cleared by shutdown callback so load once into a local before use
+        std::atomic<jack_client_t*> m_pDeadClient; //Client of server that shut down, closed by main thread
+        std::vector<PortConnection> m_vConnections; //Connections of engine ports when last changed
+        std::atomic<bool> m_bConnectionsChanged; //True when a port connection changed since connections were remembered
+        bool m_bConnectionsSaved; //True once connections have been remembered - restored instead of defaults
+        jack_port_t* m_pPortInputA;
+        jack_port_t* m_pPortInputB;
+        jack_port_t* m_pPortPlaybackA;
+        jack_port_t* m_pPortPlaybackB;
+        jack_port_t* m_pPortMidi; //MIDI control input
+        std::vector<jack_port_t*> m_vJackSourcePorts; //Source port of each track
+        jack_nframes_t m_nCaptureLatency; //Numbers of frames of capture latency
+        jack_nframes_t m_nPlaybackLatency; //Numbers of frames of playback latency
+        jack_nframes_t m_nRecordOffset; //Quantity of frames offset between record head and play head
+        jack_nframes_t m_nCalibratedLatency; //Measured round trip in frames at m_nCalibratedRate or 0 to use latency reported by JACK
+        jack_nframes_t m_nCalibratedRate; //Interface sample rate at which round trip was measured
+        bool m_bPrefaulted; //True once audio thread stack has been touched
+        std::atomic<bool> m_bServerShutdown; //Set by shutdown callback - checked by Connect when it publishes client
+        std::atomic<unsigned long> m_lProcessCount; //Quantity of process callbacks since connecting
+        std::atomic<bool> m_bSuspendAudio; //True to stop audio thread using tracks, e.g. whilst they are replaced
+        std::atomic<bool> m_bAudioSuspended; //Set by audio thread once it has seen m_bSuspendAudio and silenced outputs
+
+        //Project
+        std::string m_sPath; //Project path
+        std::string m_sProject; //Project name
+        int m_fdWave; //File descriptor of wave file
+        BlockChecksums m_checksums; //Checksum index of wave file - open only whilst wave file is native
+        off_t m_offStartOfData; //Offset of data in wave file
+        off_t m_offEndOfData; //Offset of end of data in wave file (end of file)
+        int m_nFrameSize; //Quantity of bytes in each frame once in native layout
+        int m_nEncoding; //Sample encoding of wave file [WAVE_FLOAT | WAVE_PCM16 | WAVE_PCM24 | WAVE_PCM32]
+        bool m_bForeign; //True whilst wave file is not in native layout - it is then never written
+        jack_nframes_t m_nSamplerate; //Quantity of frames per second
+        int m_nResampleQuality; //Quality of conversion when project and JACK sample rates differ [RESAMPLE_FAST | RESAMPLE_MEDIUM | RESAMPLE_BEST]
+        unsigned int m_nParallelTracks; //Minimum quantity of tracks to split mixing across worker threads
+        unsigned int m_nBufferMemory; //Maximum MB of disk stream read-ahead and write-behind buffers
+        unsigned int m_nSpoolMinutes; //Length of disk stream record-to-RAM spool or 0 if disabled
+        bool m_bStemSkipSilent; //True to not export stems of silent tracks
+        bool m_bStemTrim; //True to remove trailing silence from exported stems
+        std::vector<Track*> m_vTracks; //Pointers to tracks
+
+        //Transport and recording
+        int m_nTransport; //Transport status
+        long m_lLastFrame; //Last frame
+        long m_lHeadPos; //Quantity of frames from start of current head position
+        long m_lSyncLocate; //Position requested by JACK whilst rolling, located once stopped, or -1 if none - accessed by audio thread only
+        bool m_bRecordEnabled; //True if recording
+        int m_nRecA; //Index of track primed to record A-leg input
+        int m_nRecB; //Index of track primed to record B-leg input
+        bool m_bAutoPunch; //True to only record between punch points
+        long m_lPunchIn; //Position of punch-in
+        long m_lPunchOut; //Position of punch-out
+        int m_nPreRoll; //Milliseconds played before punch-in
+        int m_nPostRoll; //Milliseconds played after punch-out
+        int m_nPunchFade; //Milliseconds of crossfade at each punch point
+        int m_nInputMonitor; //Input monitor mode [MONITOR_OFF | MONITOR_AUTO | MONITOR_INPUT]
+        float m_afMonitorFade[2]; //Proportion of each input heard on its armed track, ramping between track and input
+        long m_lHistoryStart; //Position of first frame in punch history
+        long m_lHistoryEnd; //Position after last frame in punch history
+        std::atomic<bool> m_bChanged; //True when audio thread has changed state shown to user
+
+        //Realtime buffers
+        RtArena m_rtArena; //Locked, pre-faulted memory for buffers used by audio thread
+        jack_default_audio_sample_t* m_pReadBuffer; //Buffer to hold data read from file
+        float* m_apPunchHistory[2]; //Audio played on track armed for each input indexed by position
+        float* m_apPunchInput[2]; //Period of each input after crossfade
+        float* m_pSilence; //Period of silence used for missing inputs
+        float* m_pProbe; //Period of latency probe sequence
+
+        //Background jobs
+        std::atomic<int> m_nJob; //Background job in progress [JOB_NONE | JOB_COMPACT | JOB_BOUNCE | JOB_STEMS | JOB_RESTRUCTURE | JOB_IMPORT | JOB_CALIBRATE | JOB_ANALYSE]
+        bool m_bJobResult; //True if last background job succeeded
+        pthread_t m_threadJob; //Thread running background job
+        Bounce m_bounce; //Stereo mix exporter
+        StemExport m_stemExport; //Per-track stem exporter
+        Restructure m_restructure; //Track add / remove / reorder
+        Import m_import; //Background rewrite of foreign WAVE file in native layout
+        Snapshot m_snapshot; //Background copy of project saved under a new name
+        LatencyProbe m_latencyProbe; //Round trip measurement played and captured by audio thread
+        LoudnessAnalysis m_loudness; //Per-track loudness and peak measurement
+        Scrubber m_scrubber; //Idle-time verification of project and take files against their checksums
+
+        MidiMap m_midiMap; //Bindings of MIDI control messages to actions
+        WorkerPool m_workerPool; //Threads sharing per-track work of audio thread
+        InsertChain m_inserts; //Per-track EQ, high-pass and compressor of monitor mix
+        DiskStream m_diskStream; //Read-ahead and write-behind of WAVE data
+        TakeStore m_takeStore; //Append-only storage of recorded takes
+};
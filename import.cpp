@@ -0,0 +1,103 @@
+#include "import.h"
+#include "wave.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+Import::Import() :
+    m_lFrames(0),
+    m_bCancel(false),
+    m_nProgress(0),
+    m_dSeconds(0)
+{
+}
+
+void Import::Begin(const std::string& sPrefix, long lFrames)
+{
+    m_sPrefix = sPrefix;
+    m_lFrames = lFrames;
+    m_nProgress = 0;
+    m_bCancel = false;
+    unlink(GetFilename().c_str()); //Remove copy left by an interrupted import
+    unlink(BlockChecksums::GetFilename(GetFilename()).c_str());
+}
+
+bool Import::Run(int fdSource, off_t offStart, int nEncoding, unsigned int nChannels, unsigned int nSampleRate)
+{
+    timespec tsStart, tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+    if(fdSource < 0 || 0 == nChannels || nEncoding < WAVE_FLOAT || nEncoding > WAVE_PCM32 || m_bCancel)
+        return false;
+    m_nProgress = 0;
+    size_t nSourceFrameSize = nChannels * WAVE_SAMPLE_BYTES[nEncoding];
+    size_t nDestFrameSize = nChannels * sizeof(float);
+    int fd = open(GetFilename().c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+    //Size file first so unwritten blocks remain holes which read as silence
+    if(ftruncate(fd, 44 + m_lFrames * nDestFrameSize))
+    {
+        close(fd);
+        return false;
+    }
+    WriteWaveHeader(fd, m_lFrames * nDestFrameSize, nChannels, nSampleRate);
+    BlockChecksums checksums; //Index replaces project index with copy - not essential so failure to open it is ignored
+    checksums.Open(BlockChecksums::GetFilename(GetFilename()), nChannels, true);
+    posix_fadvise(fdSource, offStart, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<char> vSource(IMPORT_BLOCK_FRAMES * nSourceFrameSize);
+    std::vector<float> vDest(IMPORT_BLOCK_FRAMES * nChannels);
+    bool bResult = true;
+    long lCount = 0;
+    for(long lFrame = 0; lFrame < m_lFrames; lFrame += lCount)
+    {
+        if(m_bCancel)
+        {
+            bResult = false;
+            break;
+        }
+        lCount = m_lFrames - lFrame;
+        if(lCount > IMPORT_BLOCK_FRAMES)
+            lCount = IMPORT_BLOCK_FRAMES;
+
+        //Convert same data as the disk stream would
+        size_t nSize = lCount * nSourceFrameSize;
+        ssize_t nRead = pread(fdSource, &vSource[0], nSize, offStart + lFrame * nSourceFrameSize);
+        size_t nValid = nRead > 0 ? nRead : 0;
+        if(nValid < nSize)
+            memset(&vSource[0] + nValid, 0, nSize - nValid);
+        ConvertToFloat(&vSource[0], &vDest[0], lCount * nChannels, nEncoding);
+
+        //Silent blocks are left as holes
+        size_t nSamples = lCount * nChannels;
+        size_t nSample = 0;
+        while(nSample < nSamples && 0 == vDest[nSample])
+            ++nSample;
+        size_t nDestSize = lCount * nDestFrameSize;
+        if(nSample < nSamples && pwrite(fd, &vDest[0], nDestSize, 44 + lFrame * nDestFrameSize) != (ssize_t)nDestSize)
+        {
+            bResult = false;
+            break;
+        }
+        checksums.Store(lFrame / IMPORT_BLOCK_FRAMES, &vDest[0], lCount);
+        m_nProgress = 100 * (lFrame + lCount) / m_lFrames;
+    }
+    //Copy must be on storage before it replaces original file
+    if(bResult)
+        bResult = (0 == fdatasync(fd));
+    checksums.Sync();
+    close(fd);
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    m_dSeconds = tsEnd.tv_sec - tsStart.tv_sec + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+    if(bResult)
+        m_nProgress = 100;
+    return bResult;
+}
+
+void Import::End()
+{
+    unlink(GetFilename().c_str());
+    unlink(BlockChecksums::GetFilename(GetFilename()).c_str());
+}
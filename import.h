@@ -0,0 +1,74 @@
+/** Class rewriting a WAVE file which is not in the native layout - 32-bit float data after a 44 byte header - in the background
+*   The project plays from the original file, converted as it is read, whilst the native copy is written
+*   The copy replaces the original file only when complete so an interrupted import starts again when the project is next loaded
+*   The copy is sparse - blocks which are silent on every track are not written
+*/
+#pragma once
+
+#include "checksums.h"
+#include <atomic>
+#include <string>
+#include <sys/types.h>
+
+static const unsigned int IMPORT_BLOCK_FRAMES = CHECKSUM_BLOCK_FRAMES; //Quantity of frames converted at a time - one checksum entry per block
+
+class Import
+{
+    public:
+        Import();
+
+        /** @brief  Prepare to import a project file, removing any copy left by an interrupted import
+        *   @param  sPrefix Path and name of project without extension
+        *   @param  lFrames Quantity of frames in project file
+        */
+        void Begin(const std::string& sPrefix, long lFrames);
+
+        /** @brief  Write native copy of project file
+        *   @param  fdSource File descriptor of project WAVE file
+        *   @param  offStart Offset of start of data in project WAVE file
+        *   @param  nEncoding Sample encoding of project WAVE file [WAVE_FLOAT | WAVE_PCM16 | WAVE_PCM24 | WAVE_PCM32]
+        *   @param  nChannels Quantity of interleaved channels
+        *   @param  nSampleRate Samples per second
+        *   @return <i>bool</i> True if copy is complete
+        *   @note   Blocks until complete or cancelled - progress is available from GetProgress
+        */
+        bool Run(int fdSource, off_t offStart, int nEncoding, unsigned int nChannels, unsigned int nSampleRate);
+
+        /** @brief  Stop copying at next block
+        *   @note   Thread safe
+        */
+        void Cancel() { m_bCancel = true; }
+
+        /** @brief  Check whether copy has been cancelled
+        */
+        bool IsCancelled() { return m_bCancel; }
+
+        /** @brief  Remove any incomplete copy
+        */
+        void End();
+
+        /** @brief  Get path of native copy
+        */
+        std::string GetFilename() { return m_sPrefix + ".import.wav"; }
+
+        /** @brief  Get quantity of frames copied
+        */
+        long GetFrames() { return m_lFrames; }
+
+        /** @brief  Get progress of current copy
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress() { return m_nProgress; }
+
+        /** @brief  Get duration of last copy
+        *   @return <i>double</i> Seconds taken to copy
+        */
+        double GetSeconds() { return m_dSeconds; }
+
+    private:
+        std::string m_sPrefix; //Path and name of project without extension
+        long m_lFrames; //Quantity of frames in project file
+        std::atomic<bool> m_bCancel; //True to stop copying
+        std::atomic<int> m_nProgress; //Percentage complete
+        double m_dSeconds; //Duration of last copy
+};
@@ -0,0 +1,214 @@
+#include "inserts.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+static const double INSERT_HIGHPASS_Q = 0.7071; //Butterworth response
+static const InsertVector INSERT_ZERO = {0, 0, 0, 0};
+static const InsertVector INSERT_ONE = {1, 1, 1, 1};
+static const InsertVector INSERT_TINY = {1e-30f, 1e-30f, 1e-30f, 1e-30f}; //Square of smallest value kept in state - avoids slow denormal arithmetic
+
+/** Set one lane of a vector */
+static void SetLane(InsertVector& vVector, unsigned int nLane, float fValue)
+{
+    memcpy((float*)&vVector + nLane, &fValue, sizeof(float));
+}
+
+/** Get one lane of a vector */
+static float GetLane(const InsertVector& vVector, unsigned int nLane)
+{
+    float fValue;
+    memcpy(&fValue, (const float*)&vVector + nLane, sizeof(float));
+    return fValue;
+}
+
+/** Set lanes which are nearly zero to zero */
+static InsertVector Flush(InsertVector vValue)
+{
+    InsertMask mKeep = vValue * vValue > INSERT_TINY;
+    return (InsertVector)((InsertMask)vValue & mKeep);
+}
+
+InsertChain::InsertChain() :
+    m_nReady(1),
+    m_nFront(0),
+    m_nBack(2),
+    m_pState(NULL),
+    m_nMaxGroups(0)
+{
+    memset(m_aSets, 0, sizeof(m_aSets));
+}
+
+size_t InsertChain::GetSize(unsigned int nMaxTracks)
+{
+    unsigned int nGroups = (nMaxTracks + INSERT_LANES - 1) / INSERT_LANES;
+    return 3 * nGroups * sizeof(InsertCoefficients) + nGroups * sizeof(InsertState);
+}
+
+void InsertChain::SetMemory(void* pMemory, unsigned int nMaxTracks)
+{
+    m_nMaxGroups = pMemory ? (nMaxTracks + INSERT_LANES - 1) / INSERT_LANES : 0;
+    char* pNext = (char*)pMemory;
+    for(unsigned int nSet = 0; nSet < 3; ++nSet)
+    {
+        m_aSets[nSet].pGroups = (InsertCoefficients*)pNext;
+        m_aSets[nSet].nTracks = 0;
+        pNext += m_nMaxGroups * sizeof(InsertCoefficients);
+    }
+    m_pState = (InsertState*)pNext;
+}
+
+void InsertChain::Configure(Track* const* ppTracks, unsigned int nTracks, unsigned int nSampleRate, bool bReset)
+{
+    if(0 == m_nMaxGroups || 0 == nSampleRate)
+        return;
+    InsertSet& set = m_aSets[m_nBack];
+    unsigned int nGroups = (nTracks + INSERT_LANES - 1) / INSERT_LANES;
+    if(nGroups > m_nMaxGroups)
+        nGroups = m_nMaxGroups;
+    set.nTracks = nTracks < nGroups * INSERT_LANES ? nTracks : nGroups * INSERT_LANES;
+    set.abStage[0] = false;
+    set.abStage[1] = false;
+    set.bCompressor = false;
+    set.bReset = bReset;
+    double dNyquist = nSampleRate / 2.0;
+    float fAttack = 1 - exp(-1000.0 / (INSERT_ATTACK * nSampleRate));
+    float fRelease = 1 - exp(-1000.0 / (INSERT_RELEASE * nSampleRate));
+    for(unsigned int nGroup = 0; nGroup < nGroups; ++nGroup)
+    {
+        InsertCoefficients& coef = set.pGroups[nGroup];
+        for(unsigned int nLane = 0; nLane < INSERT_LANES; ++nLane)
+        {
+            unsigned int nTrack = nGroup * INSERT_LANES + nLane;
+            Track* pTrack = nTrack < set.nTracks ? ppTracks[nTrack] : NULL;
+            //Biquad coefficients from Audio EQ Cookbook (R. Bristow-Johnson), normalised so a0 = 1 - unused stages pass audio unchanged
+            for(unsigned int nStage = 0; nStage < INSERT_STAGES; ++nStage)
+            {
+                double adB[3] = {1, 0, 0};
+                double adA[3] = {1, 0, 0};
+                if(0 == nStage && pTrack && pTrack->fHighPass > 0 && pTrack->fHighPass < dNyquist)
+                {
+                    double dW = 2 * M_PI * pTrack->fHighPass / nSampleRate;
+                    double dAlpha = sin(dW) / (2 * INSERT_HIGHPASS_Q);
+                    adB[0] = (1 + cos(dW)) / 2;
+                    adB[1] = -(1 + cos(dW));
+                    adB[2] = (1 + cos(dW)) / 2;
+                    adA[0] = 1 + dAlpha;
+                    adA[1] = -2 * cos(dW);
+                    adA[2] = 1 - dAlpha;
+                    set.abStage[0] = true;
+                }
+                if(1 == nStage && pTrack && 0 != pTrack->fEqGain && pTrack->fEqFrequency > 0 && pTrack->fEqFrequency < dNyquist && pTrack->fEqQ > 0)
+                {
+                    double dW = 2 * M_PI * pTrack->fEqFrequency / nSampleRate;
+                    double dAlpha = sin(dW) / (2 * pTrack->fEqQ);
+                    double dGain = pow(10, pTrack->fEqGain / 40);
+                    adB[0] = 1 + dAlpha * dGain;
+                    adB[1] = -2 * cos(dW);
+                    adB[2] = 1 - dAlpha * dGain;
+                    adA[0] = 1 + dAlpha / dGain;
+                    adA[1] = -2 * cos(dW);
+                    adA[2] = 1 - dAlpha / dGain;
+                    set.abStage[1] = true;
+                }
+                SetLane(coef.vB0[nStage], nLane, adB[0] / adA[0]);
+                SetLane(coef.vB1[nStage], nLane, adB[1] / adA[0]);
+                SetLane(coef.vB2[nStage], nLane, adB[2] / adA[0]);
+                SetLane(coef.vA1[nStage], nLane, adA[1] / adA[0]);
+                SetLane(coef.vA2[nStage], nLane, adA[2] / adA[0]);
+            }
+            //Compressor - unused lanes have threshold that is never reached
+            bool bCompress = pTrack && pTrack->fCompRatio > 1;
+            SetLane(coef.vThreshold, nLane, bCompress ? pow(10, pTrack->fCompThreshold / 10) : FLT_MAX);
+            SetLane(coef.vSlope, nLane, bCompress ? (1 - 1 / pTrack->fCompRatio) / 2 : 0);
+            SetLane(coef.vAttack, nLane, fAttack);
+            SetLane(coef.vRelease, nLane, fRelease);
+            set.bCompressor |= bCompress;
+        }
+    }
+    //Publish set, taking back whichever set audio thread is not using
+    m_nBack = m_nReady.exchange(m_nBack | INSERT_NEW) & ~INSERT_NEW;
+}
+
+void InsertChain::Process(float* pFrames, unsigned int nChannels, unsigned int nFrames)
+{
+    if(m_nReady.load() & INSERT_NEW)
+        m_nFront = m_nReady.exchange(m_nFront) & ~INSERT_NEW; //Take most recently published set
+    InsertSet& set = m_aSets[m_nFront];
+    if(set.bReset)
+    {
+        memset(m_pState, 0, m_nMaxGroups * sizeof(InsertState));
+        for(unsigned int nGroup = 0; nGroup < m_nMaxGroups; ++nGroup)
+            m_pState[nGroup].vGain = INSERT_ONE;
+        set.bReset = false;
+    }
+    if(!set.abStage[0] && !set.abStage[1] && !set.bCompressor)
+        return; //No effects so nothing to do
+    unsigned int nTracks = set.nTracks < nChannels ? set.nTracks : nChannels;
+
+    //Each group of tracks is interleaved so one frame of a group is loaded into a vector and processed in parallel
+    for(unsigned int nFirst = 0; nFirst < nTracks; nFirst += INSERT_LANES)
+    {
+        unsigned int nLanes = nTracks - nFirst < INSERT_LANES ? nTracks - nFirst : INSERT_LANES;
+        const InsertCoefficients& coef = set.pGroups[nFirst / INSERT_LANES];
+        InsertState& state = m_pState[nFirst / INSERT_LANES];
+        InsertVector vZ1[INSERT_STAGES];
+        InsertVector vZ2[INSERT_STAGES];
+        for(unsigned int nStage = 0; nStage < INSERT_STAGES; ++nStage)
+        {
+            vZ1[nStage] = state.vZ1[nStage];
+            vZ2[nStage] = state.vZ2[nStage];
+        }
+        InsertVector vEnvelope = state.vEnvelope;
+        InsertVector vGain = state.vGain;
+        InsertVector vStep = INSERT_ZERO;
+        float* pFrame = pFrames + nFirst;
+        for(unsigned int nFrame = 0; nFrame < nFrames; ++nFrame)
+        {
+            InsertVector vX = INSERT_ZERO;
+            memcpy(&vX, pFrame, nLanes * sizeof(float));
+            //Biquad filters (transposed direct form II)
+            for(unsigned int nStage = 0; nStage < INSERT_STAGES; ++nStage)
+            {
+                if(!set.abStage[nStage])
+                    continue;
+                InsertVector vY = coef.vB0[nStage] * vX + vZ1[nStage];
+                vZ1[nStage] = coef.vB1[nStage] * vX - coef.vA1[nStage] * vY + vZ2[nStage];
+                vZ2[nStage] = coef.vB2[nStage] * vX - coef.vA2[nStage] * vY;
+                vX = vY;
+            }
+            //Compressor - envelope follows power of each sample and gain ramps towards target calculated from envelope
+            if(set.bCompressor)
+            {
+                if(0 == nFrame % INSERT_GAIN_FRAMES)
+                {
+                    InsertVector vTarget = INSERT_ONE;
+                    for(unsigned int nLane = 0; nLane < nLanes; ++nLane)
+                    {
+                        float fEnvelope = GetLane(vEnvelope, nLane);
+                        float fThreshold = GetLane(coef.vThreshold, nLane);
+                        if(fEnvelope > fThreshold)
+                            SetLane(vTarget, nLane, powf(fThreshold / fEnvelope, GetLane(coef.vSlope, nLane)));
+                    }
+                    InsertVector vFrames = {INSERT_GAIN_FRAMES, INSERT_GAIN_FRAMES, INSERT_GAIN_FRAMES, INSERT_GAIN_FRAMES};
+                    vStep = (vTarget - vGain) / vFrames;
+                }
+                InsertVector vPower = vX * vX;
+                InsertMask mRising = vPower > vEnvelope;
+                InsertVector vCoef = (InsertVector)(((InsertMask)coef.vAttack & mRising) | ((InsertMask)coef.vRelease & ~mRising));
+                vEnvelope += vCoef * (vPower - vEnvelope);
+                vGain += vStep;
+                vX *= vGain;
+            }
+            memcpy(pFrame, &vX, nLanes * sizeof(float));
+            pFrame += nChannels;
+        }
+        for(unsigned int nStage = 0; nStage < INSERT_STAGES; ++nStage)
+        {
+            state.vZ1[nStage] = Flush(vZ1[nStage]);
+            state.vZ2[nStage] = Flush(vZ2[nStage]);
+        }
+        state.vEnvelope = Flush(vEnvelope);
+        state.vGain = vGain;
+    }
+}
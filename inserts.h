@@ -0,0 +1,99 @@
+/** Class applying per-track insert effects - high-pass filter, peaking EQ and compressor - to the monitor mix
+*   State is held structure-of-arrays with one SIMD lane per track so four tracks are processed for the cost of one
+*   Settings are converted to coefficients by the user interface and passed to the audio thread through a lock-free triple buffer
+*/
+#pragma once
+
+#include "track.h"
+#include <atomic>
+#include <stddef.h>
+
+static const unsigned int INSERT_LANES      = 4; //Quantity of tracks processed together by one vector
+static const unsigned int INSERT_STAGES     = 2; //Quantity of biquad filter stages (high-pass, peaking EQ)
+static const unsigned int INSERT_GAIN_FRAMES = 32; //Quantity of frames between compressor gain calculations
+static const unsigned int INSERT_NEW        = 4; //Flag marking published set not yet taken by audio thread
+static const float INSERT_ATTACK            = 5; //Milliseconds for compressor to respond to rising level
+static const float INSERT_RELEASE           = 100; //Milliseconds for compressor to respond to falling level
+static const float INSERT_HIGHPASS          = 80; //Default high-pass cut-off frequency in Hz
+static const float INSERT_COMP_THRESHOLD    = -20; //Default compressor threshold in dBFS
+static const float INSERT_COMP_RATIO        = 4; //Default compressor ratio
+
+typedef float InsertVector __attribute__((vector_size(16))); //One lane per track - compiled to NEON or SSE
+typedef int InsertMask __attribute__((vector_size(16))); //Result of comparing vectors - all bits of lane set if true
+
+/** Structure holding coefficients of a group of tracks **/
+struct InsertCoefficients
+{
+    InsertVector vB0[INSERT_STAGES]; //Biquad feed-forward coefficients
+    InsertVector vB1[INSERT_STAGES];
+    InsertVector vB2[INSERT_STAGES];
+    InsertVector vA1[INSERT_STAGES]; //Biquad feedback coefficients
+    InsertVector vA2[INSERT_STAGES];
+    InsertVector vThreshold; //Compressor threshold as power (square of level)
+    InsertVector vSlope; //Half of (1 - 1 / ratio) - exponent applied to power ratio above threshold
+    InsertVector vAttack; //Envelope coefficient for rising level
+    InsertVector vRelease; //Envelope coefficient for falling level
+};
+
+/** Structure holding filter and compressor state of a group of tracks **/
+struct InsertState
+{
+    InsertVector vZ1[INSERT_STAGES]; //Biquad delay elements
+    InsertVector vZ2[INSERT_STAGES];
+    InsertVector vEnvelope; //Compressor envelope (power)
+    InsertVector vGain; //Compressor gain
+};
+
+/** Structure holding one published set of coefficients **/
+struct InsertSet
+{
+    InsertCoefficients* pGroups; //Coefficients of each group of tracks
+    unsigned int nTracks; //Quantity of tracks configured
+    bool abStage[INSERT_STAGES]; //True if any track uses each filter stage
+    bool bCompressor; //True if any track uses compressor
+    bool bReset; //True to clear state when audio thread starts using set
+};
+
+class InsertChain
+{
+    public:
+        InsertChain();
+
+        /** @brief  Get size of memory required
+        *   @param  nMaxTracks Maximum quantity of tracks
+        *   @return <i>size_t</i> Quantity of bytes
+        */
+        static size_t GetSize(unsigned int nMaxTracks);
+
+        /** @brief  Set memory holding coefficients and state, e.g. from realtime arena
+        *   @param  pMemory Pointer to zeroed memory of GetSize bytes aligned to 16 bytes
+        *   @param  nMaxTracks Maximum quantity of tracks
+        *   @note   Not realtime safe - audio thread must not be processing
+        */
+        void SetMemory(void* pMemory, unsigned int nMaxTracks);
+
+        /** @brief  Calculate coefficients from track settings and pass them to audio thread
+        *   @param  ppTracks Pointer to array of tracks
+        *   @param  nTracks Quantity of tracks
+        *   @param  nSampleRate Samples per second of processed audio
+        *   @param  bReset True to clear filter and compressor state, e.g. when a project loads
+        *   @note   Call from one non-realtime thread only - does not block audio thread
+        */
+        void Configure(Track* const* ppTracks, unsigned int nTracks, unsigned int nSampleRate, bool bReset = false);
+
+        /** @brief  Apply insert effects in place
+        *   @param  pFrames Interleaved samples
+        *   @param  nChannels Quantity of interleaved channels
+        *   @param  nFrames Quantity of frames
+        *   @note   Realtime safe - call from audio thread only
+        */
+        void Process(float* pFrames, unsigned int nChannels, unsigned int nFrames);
+
+    private:
+        InsertSet m_aSets[3]; //Triple buffer of coefficient sets
+        std::atomic<unsigned int> m_nReady; //Index of last published set, with INSERT_NEW set until audio thread takes it
+        unsigned int m_nFront; //Index of set used by audio thread
+        unsigned int m_nBack; //Index of set written by Configure
+        InsertState* m_pState; //State of each group of tracks
+        unsigned int m_nMaxGroups; //Quantity of groups of tracks memory is sized for
+};
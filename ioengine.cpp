@@ -0,0 +1,361 @@
+#include "ioengine.h"
+#include "storageshim.h"
+#include "trace.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+static const unsigned int IO_POOL_THREADS = 2; //Quantity of worker threads used when io_uring is unavailable
+
+static int io_uring_setup(unsigned int nEntries, io_uring_params* pParams)
+{
+    return syscall(__NR_io_uring_setup, nEntries, pParams);
+}
+
+static int io_uring_enter(int fd, unsigned int nSubmit, unsigned int nComplete, unsigned int nFlags)
+{
+    return syscall(__NR_io_uring_enter, fd, nSubmit, nComplete, nFlags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int nOpcode, const void* pArgs, unsigned int nArgs)
+{
+    return syscall(__NR_io_uring_register, fd, nOpcode, pArgs, nArgs);
+}
+
+IoEngine::IoEngine() :
+    m_nDepth(0),
+    m_nInFlight(0),
+    m_nQueued(0),
+    m_fdNotify(-1),
+    m_lSyscalls(0),
+    m_lPoolSyscalls(0),
+    m_llBytesRead(0),
+    m_llBytesWritten(0),
+    m_pShim(NULL),
+    m_fdRing(-1),
+    m_pSqRing(NULL),
+    m_pCqRing(NULL),
+    m_pSqes(NULL),
+    m_bRegistered(false),
+    m_bPoolRunning(false)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+IoEngine::~IoEngine()
+{
+    Close();
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_cond);
+}
+
+bool IoEngine::Init(unsigned int nDepth, const std::vector<iovec>& vBuffers, int fdNotify, bool bAllowUring)
+{
+    Close();
+    m_nDepth = nDepth;
+    m_fdNotify = fdNotify;
+    m_nInFlight = 0;
+    m_nQueued = 0;
+    m_lSyscalls = 0;
+    m_lPoolSyscalls = 0;
+    m_llBytesRead = 0;
+    m_llBytesWritten = 0;
+    m_aLatency[0].Reset();
+    m_aLatency[1].Reset();
+    if(bAllowUring && !m_pShim && InitUring(vBuffers))
+        return true;
+    return InitPool();
+}
+
+bool IoEngine::InitUring(const std::vector<iovec>& vBuffers)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fdRing = io_uring_setup(m_nDepth, &params);
+    if(m_fdRing < 0)
+    {
+        m_fdRing = -1;
+        return false;
+    }
+    m_nSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    m_nCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_nSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_pSqRing = mmap(NULL, m_nSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fdRing, IORING_OFF_SQ_RING);
+    m_pCqRing = mmap(NULL, m_nCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fdRing, IORING_OFF_CQ_RING);
+    m_pSqes = mmap(NULL, m_nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fdRing, IORING_OFF_SQES);
+    if(MAP_FAILED == m_pSqRing || MAP_FAILED == m_pCqRing || MAP_FAILED == m_pSqes)
+    {
+        Close();
+        return false;
+    }
+    char* pSq = (char*)m_pSqRing;
+    m_pSqHead = (unsigned int*)(pSq + params.sq_off.head);
+    m_pSqTail = (unsigned int*)(pSq + params.sq_off.tail);
+    m_pSqMask = (unsigned int*)(pSq + params.sq_off.ring_mask);
+    m_pSqArray = (unsigned int*)(pSq + params.sq_off.array);
+    char* pCq = (char*)m_pCqRing;
+    m_pCqHead = (unsigned int*)(pCq + params.cq_off.head);
+    m_pCqTail = (unsigned int*)(pCq + params.cq_off.tail);
+    m_pCqMask = (unsigned int*)(pCq + params.cq_off.ring_mask);
+    m_pCqes = pCq + params.cq_off.cqes;
+    m_nDepth = params.sq_entries < m_nDepth ? params.sq_entries : m_nDepth;
+
+    //Registered buffers avoid page mapping on each request but may exceed RLIMIT_MEMLOCK on older kernels so are optional
+    if(!vBuffers.empty() && 0 == io_uring_register(m_fdRing, IORING_REGISTER_BUFFERS, &vBuffers[0], vBuffers.size()))
+        m_bRegistered = true;
+    m_vIovecs.resize(m_nDepth);
+    if(m_fdNotify >= 0)
+        io_uring_register(m_fdRing, IORING_REGISTER_EVENTFD, &m_fdNotify, 1);
+    return true;
+}
+
+bool IoEngine::InitPool()
+{
+    m_vPending.reserve(m_nDepth);
+    m_vComplete.reserve(m_nDepth);
+    m_vQueued.reserve(m_nDepth);
+    m_bPoolRunning = true;
+    for(unsigned int i = 0; i < IO_POOL_THREADS; ++i)
+    {
+        pthread_t thread;
+        if(0 == pthread_create(&thread, NULL, PoolThread, this))
+            m_vThreads.push_back(thread);
+    }
+    return !m_vThreads.empty();
+}
+
+void IoEngine::Close()
+{
+    Flush();
+    //Wait for outstanding requests so that buffers are not written after release
+    while(m_nInFlight > m_nQueued)
+    {
+        IoRequest* apDone[16];
+        if(0 == Reap(apDone, 16))
+            usleep(1000);
+    }
+    m_nInFlight = 0;
+    m_nQueued = 0;
+    if(m_fdRing >= 0)
+    {
+        if(m_pSqes && MAP_FAILED != m_pSqes)
+            munmap(m_pSqes, m_nSqesSize);
+        if(m_pCqRing && MAP_FAILED != m_pCqRing)
+            munmap(m_pCqRing, m_nCqRingSize);
+        if(m_pSqRing && MAP_FAILED != m_pSqRing)
+            munmap(m_pSqRing, m_nSqRingSize);
+        close(m_fdRing);
+    }
+    m_fdRing = -1;
+    m_pSqRing = NULL;
+    m_pCqRing = NULL;
+    m_pSqes = NULL;
+    m_bRegistered = false;
+    if(m_bPoolRunning)
+    {
+        pthread_mutex_lock(&m_mutex);
+        m_bPoolRunning = false;
+        pthread_cond_broadcast(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+        for(std::vector<pthread_t>::iterator it = m_vThreads.begin(); it != m_vThreads.end(); ++it)
+            pthread_join(*it, NULL);
+    }
+    m_vThreads.clear();
+    m_vPending.clear();
+    m_vComplete.clear();
+    m_vQueued.clear();
+}
+
+bool IoEngine::Submit(IoRequest* pRequest)
+{
+    if(m_nInFlight >= m_nDepth)
+        return false;
+    pRequest->nDone = 0;
+    clock_gettime(CLOCK_MONOTONIC, &pRequest->tsSubmit);
+    if(m_fdRing >= 0)
+        Queue(pRequest);
+    else
+        m_vQueued.push_back(pRequest);
+    ++m_nQueued;
+    ++m_nInFlight;
+    return true;
+}
+
+void IoEngine::Queue(IoRequest* pRequest)
+{
+    //Add submission queue entry for the part of the request not yet transferred
+    unsigned int nTail = *m_pSqTail;
+    unsigned int nIndex = nTail & *m_pSqMask;
+    io_uring_sqe* pSqe = (io_uring_sqe*)m_pSqes + nIndex;
+    memset(pSqe, 0, sizeof(io_uring_sqe));
+    pSqe->fd = pRequest->nFd;
+    pSqe->off = pRequest->offPos + pRequest->nDone;
+    pSqe->user_data = (uint64_t)(uintptr_t)pRequest;
+    if(m_bRegistered && pRequest->nBuffer >= 0)
+    {
+        pSqe->opcode = (IO_WRITE == pRequest->nOp) ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        pSqe->addr = (uint64_t)(uintptr_t)(pRequest->pBuffer + pRequest->nDone);
+        pSqe->len = pRequest->nSize - pRequest->nDone;
+        pSqe->buf_index = pRequest->nBuffer;
+    }
+    else
+    {
+        //Vectored operations are supported by all io_uring kernels
+        iovec* pIovec = &m_vIovecs[nIndex % m_vIovecs.size()];
+        pIovec->iov_base = pRequest->pBuffer + pRequest->nDone;
+        pIovec->iov_len = pRequest->nSize - pRequest->nDone;
+        pSqe->opcode = (IO_WRITE == pRequest->nOp) ? IORING_OP_WRITEV : IORING_OP_READV;
+        pSqe->addr = (uint64_t)(uintptr_t)pIovec;
+        pSqe->len = 1;
+    }
+    m_pSqArray[nIndex] = nIndex;
+    __atomic_store_n(m_pSqTail, nTail + 1, __ATOMIC_RELEASE);
+}
+
+void IoEngine::Flush()
+{
+    if(0 == m_nQueued)
+        return;
+    if(m_fdRing >= 0)
+    {
+        //One system call starts all queued requests
+        int nSubmitted = io_uring_enter(m_fdRing, m_nQueued, 0, 0);
+        ++m_lSyscalls;
+        if(nSubmitted > 0)
+            m_nQueued -= nSubmitted;
+        return;
+    }
+    pthread_mutex_lock(&m_mutex);
+    m_vPending.insert(m_vPending.end(), m_vQueued.begin(), m_vQueued.end());
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+    m_vQueued.clear();
+    m_nQueued = 0;
+}
+
+unsigned int IoEngine::Reap(IoRequest** ppRequests, unsigned int nMax)
+{
+    unsigned int nCount = 0;
+    if(m_fdRing >= 0)
+    {
+        unsigned int nHead = *m_pCqHead;
+        while(nCount < nMax && nHead != __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE))
+        {
+            io_uring_cqe* pCqe = (io_uring_cqe*)m_pCqes + (nHead & *m_pCqMask);
+            IoRequest* pRequest = (IoRequest*)(uintptr_t)pCqe->user_data;
+            ++nHead;
+            if(pCqe->res > 0 && pRequest->nDone + pCqe->res < pRequest->nSize)
+            {
+                //Short transfer so continue from where it stopped - request remains in flight
+                pRequest->nDone += pCqe->res;
+                Queue(pRequest);
+                ++m_nQueued;
+                continue;
+            }
+            pRequest->nResult = (pCqe->res < 0) ? pCqe->res : pRequest->nDone + pCqe->res;
+            Account(pRequest);
+            ppRequests[nCount++] = pRequest;
+        }
+        __atomic_store_n(m_pCqHead, nHead, __ATOMIC_RELEASE);
+        if(m_nQueued)
+            Flush();
+    }
+    else
+    {
+        pthread_mutex_lock(&m_mutex);
+        while(nCount < nMax && !m_vComplete.empty())
+        {
+            IoRequest* pRequest = m_vComplete.front();
+            m_vComplete.erase(m_vComplete.begin());
+            Account(pRequest);
+            ppRequests[nCount++] = pRequest;
+        }
+        pthread_mutex_unlock(&m_mutex);
+    }
+    m_nInFlight -= nCount;
+    return nCount;
+}
+
+unsigned long IoEngine::GetSyscalls()
+{
+    if(m_fdRing >= 0)
+        return m_lSyscalls;
+    pthread_mutex_lock(&m_mutex);
+    unsigned long lSyscalls = m_lPoolSyscalls;
+    pthread_mutex_unlock(&m_mutex);
+    return lSyscalls;
+}
+
+void IoEngine::Account(IoRequest* pRequest)
+{
+    timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    GetLatency(pRequest->nOp).Add(tsNow.tv_sec - pRequest->tsSubmit.tv_sec + (tsNow.tv_nsec - pRequest->tsSubmit.tv_nsec) / 1e9);
+    if(pRequest->nResult <= 0)
+        return;
+    if(IO_WRITE == pRequest->nOp)
+        m_llBytesWritten += pRequest->nResult;
+    else
+        m_llBytesRead += pRequest->nResult;
+}
+
+void* IoEngine::PoolThread(void* pArgs)
+{
+    ((IoEngine*)pArgs)->PoolRun();
+    return NULL;
+}
+
+void IoEngine::PoolRun()
+{
+    TraceThread("io");
+    pthread_mutex_lock(&m_mutex);
+    while(m_bPoolRunning)
+    {
+        if(m_vPending.empty())
+        {
+            pthread_cond_wait(&m_cond, &m_mutex);
+            continue;
+        }
+        IoRequest* pRequest = m_vPending.front();
+        m_vPending.erase(m_vPending.begin());
+        pthread_mutex_unlock(&m_mutex);
+
+        //Continue short transfers until complete, end of file or error
+        ssize_t nResult = 0;
+        unsigned long lSyscalls = 0;
+        TraceScope trace(IO_WRITE == pRequest->nOp ? "write" : "read");
+        while(pRequest->nDone < pRequest->nSize)
+        {
+            char* pBuffer = pRequest->pBuffer + pRequest->nDone;
+            size_t nSize = pRequest->nSize - pRequest->nDone;
+            off_t offPos = pRequest->offPos + pRequest->nDone;
+            if(m_pShim)
+                nResult = m_pShim->Transfer(pRequest->nOp, pRequest->nFd, pBuffer, nSize, offPos);
+            else if(IO_WRITE == pRequest->nOp)
+                nResult = pwrite(pRequest->nFd, pBuffer, nSize, offPos);
+            else
+                nResult = pread(pRequest->nFd, pBuffer, nSize, offPos);
+            ++lSyscalls;
+            if(nResult <= 0)
+                break;
+            pRequest->nDone += nResult;
+        }
+        pRequest->nResult = (nResult < 0) ? -errno : pRequest->nDone;
+
+        pthread_mutex_lock(&m_mutex);
+        m_lPoolSyscalls += lSyscalls;
+        m_vComplete.push_back(pRequest);
+        if(m_fdNotify >= 0)
+        {
+            uint64_t nSignal = 1;
+            ssize_t nWritten = write(m_fdNotify, &nSignal, sizeof(nSignal));
+            (void)nWritten;
+        }
+    }
+    pthread_mutex_unlock(&m_mutex);
+}
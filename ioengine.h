@@ -0,0 +1,159 @@
+/** Asynchronous block I/O engine
+*   Uses io_uring when the kernel supports it, otherwise falls back to a small pool of threads performing pread / pwrite
+*   Requests are queued with Submit, passed to the kernel (or pool) with Flush and collected with Reap
+*   Completion is signalled on an optional eventfd so that the owning thread may sleep in poll()
+*   Short transfers are continued until the request completes, reaches end of file or fails
+*   Time from submission to completion of each request is counted so that buffering may be sized to the storage
+*/
+#pragma once
+
+#include "latencyhistogram.h"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+
+class StorageShim;
+
+//I/O operations
+static const int IO_READ    = 0;
+static const int IO_WRITE   = 1;
+
+/** Structure representing a single asynchronous read or write request **/
+struct IoRequest
+{
+    int nFd; //File descriptor
+    int nOp; //Operation (IO_READ | IO_WRITE)
+    char* pBuffer; //Pointer to data
+    size_t nSize; //Quantity of bytes to transfer
+    off_t offPos; //Offset within file
+    int nBuffer; //Index of registered buffer containing pBuffer or -1 if not registered
+    ssize_t nResult; //Quantity of bytes transferred or negative errno on failure
+    size_t nDone; //Quantity of bytes transferred so far (used by IoEngine)
+    timespec tsSubmit; //Time request was submitted (used by IoEngine)
+    void* pData; //Pointer to caller's context
+};
+
+class IoEngine
+{
+    public:
+        IoEngine();
+        ~IoEngine();
+
+        /** @brief  Initialise engine
+        *   @param  nDepth Maximum quantity of requests in flight
+        *   @param  vBuffers Buffers to register with the kernel (may be empty)
+        *   @param  fdNotify File descriptor of eventfd to signal on completion or -1 for none
+        *   @param  bAllowUring True to use io_uring if available, false to force thread pool
+        *   @return <i>bool</i> True on success
+        */
+        bool Init(unsigned int nDepth, const std::vector<iovec>& vBuffers, int fdNotify, bool bAllowUring = true);
+
+        /** @brief  Pass requests through a simulated storage device, e.g. for soak tests
+        *   @param  pShim Pointer to shim or NULL to access storage directly
+        *   @note   Takes effect on next Init and forces thread pool
+        */
+        void SetShim(StorageShim* pShim) { m_pShim = pShim; }
+
+        /** @brief  Wait for outstanding requests and release resources
+        */
+        void Close();
+
+        /** @brief  Queue a request
+        *   @param  pRequest Pointer to request which must remain valid until reaped
+        *   @return <i>bool</i> False if queue is full
+        *   @note   Request is not started until Flush is called
+        */
+        bool Submit(IoRequest* pRequest);
+
+        /** @brief  Start all queued requests
+        */
+        void Flush();
+
+        /** @brief  Collect completed requests without blocking
+        *   @param  ppRequests Array to populate with pointers to completed requests
+        *   @param  nMax Size of array
+        *   @return <i>unsigned int</i> Quantity of requests populated
+        */
+        unsigned int Reap(IoRequest** ppRequests, unsigned int nMax);
+
+        /** @brief  Get quantity of requests submitted but not yet reaped
+        */
+        unsigned int GetInFlight() { return m_nInFlight; }
+
+        /** @brief  Get maximum quantity of requests in flight
+        */
+        unsigned int GetDepth() { return m_nDepth; }
+
+        /** @brief  Check whether io_uring is used
+        *   @return <i>bool</i> True if io_uring, false if thread pool
+        */
+        bool IsUring() { return m_fdRing >= 0; }
+
+        /** @brief  Get quantity of system calls made to perform I/O
+        */
+        unsigned long GetSyscalls();
+
+        /** @brief  Get quantity of bytes read
+        */
+        unsigned long long GetBytesRead() { return m_llBytesRead; }
+
+        /** @brief  Get quantity of bytes written
+        */
+        unsigned long long GetBytesWritten() { return m_llBytesWritten; }
+
+        /** @brief  Get distribution of service times of completed requests since Init
+        *   @param  nOp Operation [IO_READ | IO_WRITE]
+        *   @return <i>LatencyHistogram&</i> Service times including time queued behind other requests
+        *   @note   Access from thread calling Reap
+        */
+        LatencyHistogram& GetLatency(int nOp) { return m_aLatency[IO_WRITE == nOp ? 1 : 0]; }
+
+    private:
+        bool InitUring(const std::vector<iovec>& vBuffers);
+        bool InitPool();
+        void Queue(IoRequest* pRequest);
+        static void* PoolThread(void* pArgs);
+        void PoolRun();
+        void Account(IoRequest* pRequest);
+
+        unsigned int m_nDepth; //Maximum requests in flight
+        unsigned int m_nInFlight; //Requests submitted but not reaped
+        unsigned int m_nQueued; //Requests queued but not yet flushed
+        int m_fdNotify; //eventfd to signal on completion
+        unsigned long m_lSyscalls; //Quantity of system calls (owner thread)
+        unsigned long m_lPoolSyscalls; //Quantity of system calls (pool threads - protected by mutex)
+        unsigned long long m_llBytesRead; //Quantity of bytes read
+        unsigned long long m_llBytesWritten; //Quantity of bytes written
+        LatencyHistogram m_aLatency[2]; //Service times of reads and writes
+        StorageShim* m_pShim; //Simulated storage device or NULL for none
+
+        //io_uring
+        int m_fdRing; //io_uring file descriptor or -1 if not used
+        void* m_pSqRing; //Mapped submission ring
+        void* m_pCqRing; //Mapped completion ring
+        void* m_pSqes; //Mapped submission queue entries
+        size_t m_nSqRingSize;
+        size_t m_nCqRingSize;
+        size_t m_nSqesSize;
+        unsigned int* m_pSqHead;
+        unsigned int* m_pSqTail;
+        unsigned int* m_pSqMask;
+        unsigned int* m_pSqArray;
+        unsigned int* m_pCqHead;
+        unsigned int* m_pCqTail;
+        unsigned int* m_pCqMask;
+        void* m_pCqes;
+        bool m_bRegistered; //True if buffers are registered with kernel
+        std::vector<iovec> m_vIovecs; //One iovec per request for unregistered buffers
+
+        //Thread pool
+        std::vector<pthread_t> m_vThreads; //Pool worker threads
+        pthread_mutex_t m_mutex; //Protects pool queues
+        pthread_cond_t m_cond; //Signals pool workers
+        std::vector<IoRequest*> m_vPending; //Requests queued for pool (FIFO)
+        std::vector<IoRequest*> m_vComplete; //Requests completed by pool
+        std::vector<IoRequest*> m_vQueued; //Requests queued but not flushed (pool)
+        bool m_bPoolRunning; //True whilst pool threads should run
+};
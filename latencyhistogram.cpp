@@ -0,0 +1,57 @@
+#include "latencyhistogram.h"
+#include <math.h>
+#include <string.h>
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+void LatencyHistogram::Reset()
+{
+    memset(m_anBucket, 0, sizeof(m_anBucket));
+    m_nTotal = 0;
+    m_nSinceDecay = 0;
+    m_lCount = 0;
+    m_dMax = 0;
+}
+
+void LatencyHistogram::Add(double dSeconds)
+{
+    //Four buckets per doubling of time
+    unsigned int nBucket = 0;
+    if(dSeconds > LATENCY_MIN)
+        nBucket = ceil(4 * log2(dSeconds / LATENCY_MIN));
+    if(nBucket >= LATENCY_BUCKETS)
+        nBucket = LATENCY_BUCKETS - 1;
+    ++m_anBucket[nBucket];
+    ++m_nTotal;
+    ++m_lCount;
+    if(dSeconds > m_dMax)
+        m_dMax = dSeconds;
+    if(++m_nSinceDecay < LATENCY_WINDOW)
+        return;
+    //Older samples count half as much as newer ones
+    m_nSinceDecay = 0;
+    m_nTotal = 0;
+    for(unsigned int i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        m_anBucket[i] = (m_anBucket[i] + 1) / 2; //Rare long requests are not forgotten
+        m_nTotal += m_anBucket[i];
+    }
+}
+
+double LatencyHistogram::GetPercentile(double dFraction)
+{
+    if(0 == m_nTotal)
+        return 0;
+    double dCount = dFraction * m_nTotal;
+    unsigned int nSum = 0;
+    for(unsigned int i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        nSum += m_anBucket[i];
+        if(nSum >= dCount)
+            return LATENCY_MIN * pow(2, i / 4.0);
+    }
+    return m_dMax;
+}
@@ -0,0 +1,46 @@
+/** Class holding the distribution of request service times
+*   Times are counted in quarter-octave buckets so that high percentiles can be found without storing samples
+*   Counts are halved periodically so that the distribution follows storage whose behaviour changes, e.g. as it fills or heats
+*/
+#pragma once
+
+static const unsigned int LATENCY_BUCKETS   = 96; //Quantity of buckets - covers LATENCY_MIN to over 60s
+static const double LATENCY_MIN             = 16e-6; //Upper bound of first bucket in seconds
+static const unsigned int LATENCY_WINDOW    = 4096; //Quantity of samples after which counts are halved
+
+class LatencyHistogram
+{
+    public:
+        LatencyHistogram();
+
+        /** @brief  Discard all samples
+        */
+        void Reset();
+
+        /** @brief  Count one request
+        *   @param  dSeconds Time from submission to completion
+        */
+        void Add(double dSeconds);
+
+        /** @brief  Get time within which a fraction of requests completed
+        *   @param  dFraction Fraction of requests, e.g. 0.999
+        *   @return <i>double</i> Upper bound of bucket containing percentile in seconds or 0 if no samples
+        */
+        double GetPercentile(double dFraction);
+
+        /** @brief  Get longest time counted since reset
+        *   @return <i>double</i> Time in seconds
+        */
+        double GetMax() { return m_dMax; }
+
+        /** @brief  Get quantity of requests counted since reset
+        */
+        unsigned long GetCount() { return m_lCount; }
+
+    private:
+        unsigned int m_anBucket[LATENCY_BUCKETS]; //Quantity of requests in each bucket (decayed)
+        unsigned int m_nTotal; //Sum of bucket counts
+        unsigned int m_nSinceDecay; //Quantity of samples since counts were last halved
+        unsigned long m_lCount; //Quantity of samples since reset
+        double m_dMax; //Longest time since reset
+};
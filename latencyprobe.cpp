@@ -0,0 +1,113 @@
+#include "latencyprobe.h"
+#include <math.h>
+#include <algorithm>
+
+LatencyProbe::LatencyProbe() :
+    m_nSlot(0),
+    m_lTotal(0),
+    m_lFrame(0),
+    m_bRunning(false),
+    m_lLatency(0),
+    m_nInput(0),
+    m_dRatio(0),
+    m_bInverted(false)
+{
+}
+
+bool LatencyProbe::Start(unsigned int nMaxLatency)
+{
+    if(m_bRunning)
+        return false;
+    //Galois shift register visits every non-zero state once so the sequence has a single sharp autocorrelation peak
+    unsigned int nSequence = (1 << PROBE_ORDER) - 1;
+    m_vSequence.resize(nSequence);
+    unsigned int nState = 1;
+    for(unsigned int i = 0; i < nSequence; ++i)
+    {
+        m_vSequence[i] = (nState & 1) ? PROBE_LEVEL : -PROBE_LEVEL;
+        nState = (nState >> 1) ^ ((nState & 1) ? PROBE_TAPS : 0);
+    }
+    //Each burst is followed by enough silence for it to return before the next
+    m_nSlot = nSequence + nMaxLatency;
+    for(unsigned int i = 0; i < 2; ++i)
+        m_avCapture[i].assign(m_nSlot, 0);
+    m_lTotal = (unsigned long)m_nSlot * PROBE_REPEATS;
+    m_lFrame = 0;
+    m_lLatency = 0;
+    m_dRatio = 0;
+    m_bRunning = true;
+    return true;
+}
+
+void LatencyProbe::Process(const float* pInA, const float* pInB, float* pOut, unsigned int nFrames)
+{
+    unsigned long lFrame = m_lFrame;
+    unsigned int nSequence = m_vSequence.size();
+    for(unsigned int i = 0; i < nFrames; ++i, ++lFrame)
+    {
+        if(lFrame >= m_lTotal)
+        {
+            pOut[i] = 0;
+            continue;
+        }
+        unsigned int nPos = lFrame % m_nSlot;
+        pOut[i] = nPos < nSequence ? m_vSequence[nPos] : 0;
+        m_avCapture[0][nPos] += pInA[i];
+        m_avCapture[1][nPos] += pInB[i];
+    }
+    m_lFrame = lFrame;
+    if(lFrame >= m_lTotal)
+        m_bRunning = false;
+}
+
+int LatencyProbe::GetProgress()
+{
+    return m_lTotal ? 100 * std::min((unsigned long)m_lFrame, m_lTotal) / m_lTotal : 0;
+}
+
+bool LatencyProbe::Analyse()
+{
+    if(m_bRunning || m_lFrame < m_lTotal)
+        return false;
+    //Use whichever input the loopback is connected to
+    unsigned int nSequence = m_vSequence.size();
+    m_dRatio = 0;
+    for(unsigned int nInput = 0; nInput < 2; ++nInput)
+    {
+        double dRatio;
+        bool bInverted;
+        long lLag = Correlate(&m_avCapture[nInput][0], &m_vSequence[0], nSequence, m_nSlot - nSequence, &dRatio, &bInverted);
+        if(dRatio <= m_dRatio)
+            continue;
+        m_dRatio = dRatio;
+        m_lLatency = lLag;
+        m_nInput = nInput;
+        m_bInverted = bInverted;
+    }
+    return m_dRatio >= PROBE_MIN_RATIO;
+}
+
+long LatencyProbe::Correlate(const float* pCapture, const float* pSequence, unsigned int nSequence, unsigned int nMaxLag, double* pdRatio, bool* pbInverted)
+{
+    std::vector<float> vCorrelation(nMaxLag + 1);
+    unsigned int nPeak = 0;
+    for(unsigned int nLag = 0; nLag <= nMaxLag; ++nLag)
+    {
+        const float* pIn = pCapture + nLag;
+        float fSum = 0;
+        for(unsigned int i = 0; i < nSequence; ++i)
+            fSum += pIn[i] * pSequence[i];
+        vCorrelation[nLag] = fSum;
+        if(fabsf(fSum) > fabsf(vCorrelation[nPeak]))
+            nPeak = nLag;
+    }
+    //Neighbours of peak are excluded as a band limited loopback spreads it over a few frames
+    float fNext = 0;
+    for(unsigned int nLag = 0; nLag <= nMaxLag; ++nLag)
+        if((nLag + 2 < nPeak || nLag > nPeak + 2) && fabsf(vCorrelation[nLag]) > fNext)
+            fNext = fabsf(vCorrelation[nLag]);
+    float fPeak = fabsf(vCorrelation[nPeak]);
+    *pdRatio = fNext > 0 ? fPeak / fNext : (fPeak > 0 ? 1e6 : 0);
+    *pbInverted = vCorrelation[nPeak] < 0;
+    return nPeak;
+}
@@ -0,0 +1,100 @@
+/** Class measuring round-trip latency of the audio interface through a loopback cable
+*   A maximum length sequence (MLS) is played several times and the inputs captured after each burst are averaged
+*   The average is cross-correlated with the sequence and the lag of the correlation peak is the round trip in frames
+*   This includes converter and interface delays which the latency reported by JACK omits
+*/
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+static const unsigned int PROBE_ORDER       = 12; //Sequence is 2^PROBE_ORDER - 1 frames
+static const unsigned int PROBE_TAPS        = 0xE08; //Feedback of shift register generating a maximum length sequence of PROBE_ORDER
+static const unsigned int PROBE_REPEATS     = 4; //Quantity of bursts averaged
+static const unsigned int PROBE_MAX_MS      = 500; //Longest round trip measured
+static const float PROBE_LEVEL              = 0.25f; //Amplitude of sequence (-12dBFS)
+static const double PROBE_MIN_RATIO         = 8; //Least ratio of correlation peak to next highest lag for measurement to be trusted
+static const unsigned int PROBE_WAIT_MS     = 50; //Interval at which calibration checks whether capture is complete
+
+class LatencyProbe
+{
+    public:
+        LatencyProbe();
+
+        /** @brief  Prepare sequence and capture buffers and start playing
+        *   @param  nMaxLatency Longest round trip to measure in frames
+        *   @return <i>bool</i> True if started - false if already running
+        *   @note   Call from non-realtime thread
+        */
+        bool Start(unsigned int nMaxLatency);
+
+        /** @brief  Stop playing, e.g. if audio thread is not running
+        */
+        void Cancel() { m_bRunning = false; }
+
+        /** @brief  Check whether sequence is still being played and captured
+        */
+        bool IsRunning() { return m_bRunning; }
+
+        /** @brief  Get next frames of sequence and capture inputs
+        *   @param  pInA Pointer to A input samples
+        *   @param  pInB Pointer to B input samples
+        *   @param  pOut Buffer to populate with sequence
+        *   @param  nFrames Quantity of frames
+        *   @note   Call from audio thread - does not allocate or block
+        */
+        void Process(const float* pInA, const float* pInB, float* pOut, unsigned int nFrames);
+
+        /** @brief  Get progress of capture
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress();
+
+        /** @brief  Find round trip latency from captured inputs
+        *   @return <i>bool</i> True if a loopback was found on either input
+        *   @note   Call once capture is complete
+        */
+        bool Analyse();
+
+        /** @brief  Get measured round trip
+        *   @return <i>long</i> Quantity of frames from sequence being played to it being captured
+        */
+        long GetLatency() { return m_lLatency; }
+
+        /** @brief  Get input on which loopback was found
+        *   @return <i>unsigned int</i> 0 for input A, 1 for input B
+        */
+        unsigned int GetInput() { return m_nInput; }
+
+        /** @brief  Get ratio of correlation peak to next highest lag
+        *   @return <i>double</i> Ratio - higher is a cleaner measurement
+        */
+        double GetRatio() { return m_dRatio; }
+
+        /** @brief  Check whether loopback inverts polarity
+        */
+        bool IsInverted() { return m_bInverted; }
+
+        /** @brief  Find lag at which a signal best matches a sequence
+        *   @param  pCapture Captured signal - must hold nMaxLag + nSequence frames
+        *   @param  pSequence Sequence played
+        *   @param  nSequence Quantity of frames in sequence
+        *   @param  nMaxLag Largest lag considered
+        *   @param  pdRatio Pointer to populate with ratio of peak to next highest lag
+        *   @param  pbInverted Pointer to populate with true if peak is negative
+        *   @return <i>long</i> Lag in frames
+        */
+        static long Correlate(const float* pCapture, const float* pSequence, unsigned int nSequence, unsigned int nMaxLag, double* pdRatio, bool* pbInverted);
+
+    private:
+        std::vector<float> m_vSequence; //One burst of sequence
+        std::vector<float> m_avCapture[2]; //Sum of each input over bursts, indexed by frame within burst
+        unsigned int m_nSlot; //Quantity of frames from start of one burst to start of next
+        unsigned long m_lTotal; //Quantity of frames played
+        std::atomic<unsigned long> m_lFrame; //Position within whole capture
+        std::atomic<bool> m_bRunning; //True whilst playing and capturing
+        long m_lLatency; //Measured round trip in frames
+        unsigned int m_nInput; //Input on which loopback was found
+        double m_dRatio; //Ratio of correlation peak to next highest lag
+        bool m_bInverted; //True if loopback inverts polarity
+};
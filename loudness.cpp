@@ -0,0 +1,489 @@
+#include "loudness.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+static const LoudnessVector LOUDNESS_ZERO = {0, 0, 0, 0};
+static const LoudnessVector LOUDNESS_FULL_SCALE = {1, 1, 1, 1};
+static const LoudnessVector LOUDNESS_TINY = {1e-30f, 1e-30f, 1e-30f, 1e-30f}; //Square of smallest value kept in filter state - avoids slow denormal arithmetic
+static const LoudnessMask LOUDNESS_NO_SIGN = {0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF};
+
+/** Get magnitude of each lane */
+static inline LoudnessVector Abs(LoudnessVector vValue)
+{
+    return (LoudnessVector)((LoudnessMask)vValue & LOUDNESS_NO_SIGN);
+}
+
+/** Get greater of each lane */
+static inline LoudnessVector Max(LoudnessVector vA, LoudnessVector vB)
+{
+    LoudnessMask mGreater = vA > vB;
+    return (LoudnessVector)(((LoudnessMask)vA & mGreater) | ((LoudnessMask)vB & ~mGreater));
+}
+
+/** Set lanes which are nearly zero to zero */
+static inline LoudnessVector Flush(LoudnessVector vValue)
+{
+    LoudnessMask mKeep = vValue * vValue > LOUDNESS_TINY;
+    return (LoudnessVector)((LoudnessMask)vValue & mKeep);
+}
+
+/** Set all lanes to a value */
+static inline LoudnessVector Splat(float fValue)
+{
+    LoudnessVector vValue = {fValue, fValue, fValue, fValue};
+    return vValue;
+}
+
+/** Get one lane of a vector */
+static float GetLane(const LoudnessVector& vVector, unsigned int nLane)
+{
+    float fValue;
+    memcpy(&fValue, (const float*)&vVector + nLane, sizeof(float));
+    return fValue;
+}
+
+/** Convert mean square of K-weighted samples to loudness */
+static double ToLoudness(double dEnergy)
+{
+    return dEnergy > 0 ? LOUDNESS_OFFSET + 10 * log10(dEnergy) : -HUGE_VAL;
+}
+
+/** Convert magnitude to decibels */
+static double ToDecibels(double dLevel)
+{
+    return dLevel > 0 ? 20 * log10(dLevel) : -HUGE_VAL;
+}
+
+/** Get mean energy of each block of nLength consecutive sub-blocks, advancing one sub-block at a time */
+static std::vector<double> GetBlocks(const std::vector<double>& vEnergy, unsigned int nLength)
+{
+    std::vector<double> vBlocks;
+    double dSum = 0;
+    for(size_t i = 0; i < vEnergy.size(); ++i)
+    {
+        dSum += vEnergy[i];
+        if(i >= nLength)
+            dSum -= vEnergy[i - nLength];
+        if(i + 1 >= nLength)
+            vBlocks.push_back(dSum > 0 ? dSum / nLength : 0); //Running sum may drift slightly below zero after loud passage
+    }
+    return vBlocks;
+}
+
+/** Get relative gate threshold - loudness of blocks above absolute gate offset by dGate */
+static double GetThreshold(const std::vector<double>& vBlocks, double dGate)
+{
+    double dSum = 0;
+    unsigned long lCount = 0;
+    for(size_t i = 0; i < vBlocks.size(); ++i)
+    {
+        if(ToLoudness(vBlocks[i]) > LOUDNESS_ABSOLUTE_GATE)
+        {
+            dSum += vBlocks[i];
+            ++lCount;
+        }
+    }
+    return lCount ? ToLoudness(dSum / lCount) + dGate : HUGE_VAL;
+}
+
+LoudnessAnalysis::LoudnessAnalysis() :
+    m_nChannels(0),
+    m_lFrames(0),
+    m_nSampleRate(0),
+    m_nSubBlockFrames(0),
+    m_nAnalysers(0),
+    m_fPhaseGain(1),
+    m_lBlocksRead(0),
+    m_bError(false),
+    m_nProgress(0),
+    m_dSeconds(0)
+{
+    for(unsigned int i = 0; i < LOUDNESS_BUFFERS; ++i)
+        m_apBlocks[i] = NULL;
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+
+    //Oversampling filter is a Blackman windowed sinc cut off at the original Nyquist frequency, split into one filter per output phase
+    unsigned int nTaps = LOUDNESS_OVERSAMPLE * LOUDNESS_PHASE_TAPS;
+    double dCentre = (nTaps - 1) / 2.0;
+    m_fPhaseGain = 0;
+    for(unsigned int nPhase = 0; nPhase < LOUDNESS_OVERSAMPLE; ++nPhase)
+    {
+        double adTap[LOUDNESS_PHASE_TAPS];
+        double dSum = 0;
+        for(unsigned int nTap = 0; nTap < LOUDNESS_PHASE_TAPS; ++nTap)
+        {
+            unsigned int n = nTap * LOUDNESS_OVERSAMPLE + nPhase;
+            double dX = M_PI * (n - dCentre) / LOUDNESS_OVERSAMPLE;
+            double dWindow = 0.42 - 0.5 * cos(2 * M_PI * (n + 0.5) / nTaps) + 0.08 * cos(4 * M_PI * (n + 0.5) / nTaps);
+            adTap[nTap] = dWindow * sin(dX) / dX;
+            dSum += adTap[nTap];
+        }
+        //Each phase passes steady level unchanged
+        float fGain = 0;
+        for(unsigned int nTap = 0; nTap < LOUDNESS_PHASE_TAPS; ++nTap)
+        {
+            m_aafPhase[nPhase][nTap] = adTap[nTap] / dSum;
+            fGain += fabsf(m_aafPhase[nPhase][nTap]);
+        }
+        if(fGain > m_fPhaseGain)
+            m_fPhaseGain = fGain;
+    }
+}
+
+LoudnessAnalysis::~LoudnessAnalysis()
+{
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+bool LoudnessAnalysis::Run(int fdSource, off_t offStart, unsigned int nChannels, long lFrames, unsigned int nSampleRate,
+    TakeStore* pTakes, const std::string& sReport)
+{
+    timespec tsStart, tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+    m_nProgress = 0;
+    m_vResults.clear();
+    if(fdSource < 0 || 0 == nChannels || 0 == nSampleRate)
+        return false;
+    m_nChannels = nChannels;
+    m_lFrames = lFrames;
+    m_nSampleRate = nSampleRate;
+    m_nSubBlockFrames = nSampleRate * LOUDNESS_SUBBLOCK_MS / 1000;
+    m_lBlocksRead = 0;
+    m_bError = false;
+
+    //K-weighting filter coefficients for this sample rate - pre-filter (high shelf) then RLB (high-pass) of ITU-R BS.1770
+    double dK = tan(M_PI * 1681.974450955533 / nSampleRate);
+    double dQ = 0.7071752369554196;
+    double dVh = pow(10, 3.999843853973347 / 20);
+    double dVb = pow(dVh, 0.4996667741545416);
+    double dA0 = 1 + dK / dQ + dK * dK;
+    m_afShelf[0] = (dVh + dVb * dK / dQ + dK * dK) / dA0;
+    m_afShelf[1] = 2 * (dK * dK - dVh) / dA0;
+    m_afShelf[2] = (dVh - dVb * dK / dQ + dK * dK) / dA0;
+    m_afShelf[3] = 2 * (dK * dK - 1) / dA0;
+    m_afShelf[4] = (1 - dK / dQ + dK * dK) / dA0;
+    dK = tan(M_PI * 38.13547087602444 / nSampleRate);
+    dQ = 0.5003270373238773;
+    dA0 = 1 + dK / dQ + dK * dK;
+    m_afHighPass[0] = 1;
+    m_afHighPass[1] = -2;
+    m_afHighPass[2] = 1;
+    m_afHighPass[3] = 2 * (dK * dK - 1) / dA0;
+    m_afHighPass[4] = (1 - dK / dQ + dK * dK) / dA0;
+
+    unsigned int nGroups = (nChannels + LOUDNESS_LANES - 1) / LOUDNESS_LANES;
+    m_vGroups.assign(nGroups, LoudnessGroup());
+    for(unsigned int nGroup = 0; nGroup < nGroups; ++nGroup)
+    {
+        LoudnessGroup& group = m_vGroups[nGroup];
+        memset(group.vZ1, 0, sizeof(group.vZ1));
+        memset(group.vZ2, 0, sizeof(group.vZ2));
+        memset(group.avHistory, 0, sizeof(group.avHistory));
+        memset(group.alClips, 0, sizeof(group.alClips));
+        group.vSum = LOUDNESS_ZERO;
+        group.nSubFrames = 0;
+        group.vPeak = LOUDNESS_ZERO;
+        group.vTruePeak = LOUDNESS_ZERO;
+        group.vSubBlocks.reserve(lFrames / m_nSubBlockFrames + 1);
+    }
+
+    //Start analysers, each handling a subset of groups of tracks
+    m_nAnalysers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(m_nAnalysers < 1)
+        m_nAnalysers = 1;
+    if(m_nAnalysers > LOUDNESS_MAX_THREADS)
+        m_nAnalysers = LOUDNESS_MAX_THREADS;
+    if(m_nAnalysers > nGroups)
+        m_nAnalysers = nGroups;
+    m_vBlocksAnalysed.assign(m_nAnalysers, 0);
+    for(unsigned int i = 0; i < LOUDNESS_BUFFERS; ++i)
+        m_apBlocks[i] = new float[LOUDNESS_BLOCK_FRAMES * nChannels];
+    std::vector<std::pair<LoudnessAnalysis*, unsigned int> > vArgs;
+    for(unsigned int nAnalyser = 0; nAnalyser < m_nAnalysers; ++nAnalyser)
+        vArgs.push_back(std::make_pair(this, nAnalyser));
+    std::vector<pthread_t> vThreads;
+    for(unsigned int nAnalyser = 0; nAnalyser < m_nAnalysers && !m_bError; ++nAnalyser)
+    {
+        pthread_t thread;
+        if(0 == pthread_create(&thread, NULL, AnalyserThread, &vArgs[nAnalyser]))
+            vThreads.push_back(thread);
+        else
+            m_bError = true;
+    }
+
+    //Read project once, sequentially, whilst analysers measure previous block
+    size_t nFrameSize = nChannels * sizeof(float);
+    posix_fadvise(fdSource, offStart, lFrames * nFrameSize, POSIX_FADV_SEQUENTIAL);
+    long lBlocks = (lFrames + LOUDNESS_BLOCK_FRAMES - 1) / LOUDNESS_BLOCK_FRAMES;
+    for(long lBlock = 0; lBlock < lBlocks; ++lBlock)
+    {
+        pthread_mutex_lock(&m_mutex);
+        bool bWait = true;
+        while(bWait && !m_bError)
+        {
+            //Wait for all analysers to finish with the block previously held in this buffer
+            bWait = false;
+            for(unsigned int nAnalyser = 0; nAnalyser < m_nAnalysers; ++nAnalyser)
+                if(m_vBlocksAnalysed[nAnalyser] + (long)LOUDNESS_BUFFERS <= lBlock)
+                    bWait = true;
+            if(bWait)
+                pthread_cond_wait(&m_cond, &m_mutex);
+        }
+        bool bError = m_bError;
+        pthread_mutex_unlock(&m_mutex);
+        if(bError)
+            break;
+
+        float* pBlock = m_apBlocks[lBlock % LOUDNESS_BUFFERS];
+        long lFrame = lBlock * LOUDNESS_BLOCK_FRAMES;
+        long lCount = lFrames - lFrame;
+        if(lCount > LOUDNESS_BLOCK_FRAMES)
+            lCount = LOUDNESS_BLOCK_FRAMES;
+        size_t nSize = lCount * nFrameSize;
+        ssize_t nRead = pread(fdSource, pBlock, nSize, offStart + lFrame * nFrameSize);
+        size_t nValid = nRead > 0 ? nRead : 0;
+        if(nValid < nSize)
+            memset((char*)pBlock + nValid, 0, nSize - nValid);
+        if(pTakes)
+            pTakes->Overlay(pBlock, nChannels, lFrame, lCount);
+
+        pthread_mutex_lock(&m_mutex);
+        m_lBlocksRead = lBlock + 1;
+        pthread_cond_broadcast(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+        m_nProgress = 100 * lBlock / lBlocks;
+    }
+    for(std::vector<pthread_t>::iterator it = vThreads.begin(); it != vThreads.end(); ++it)
+        pthread_join(*it, NULL);
+    for(unsigned int i = 0; i < LOUDNESS_BUFFERS; ++i)
+    {
+        delete[] m_apBlocks[i];
+        m_apBlocks[i] = NULL;
+    }
+
+    //Gate sub-block energies of each track
+    if(!m_bError)
+    {
+        m_vResults.resize(nChannels);
+        std::vector<double> vEnergy;
+        for(unsigned int nTrack = 0; nTrack < nChannels; ++nTrack)
+        {
+            const LoudnessGroup& group = m_vGroups[nTrack / LOUDNESS_LANES];
+            unsigned int nLane = nTrack % LOUDNESS_LANES;
+            vEnergy.resize(group.vSubBlocks.size());
+            for(size_t i = 0; i < vEnergy.size(); ++i)
+                vEnergy[i] = GetLane(group.vSubBlocks[i], nLane);
+            LoudnessResult& result = m_vResults[nTrack];
+            Gate(vEnergy, &result);
+            result.dSamplePeak = ToDecibels(GetLane(group.vPeak, nLane));
+            result.dTruePeak = ToDecibels(GetLane(group.vTruePeak, nLane));
+            result.lClips = group.alClips[nLane];
+        }
+        if(!WriteReport(sReport))
+            m_bError = true;
+    }
+    m_vGroups.clear();
+
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    m_dSeconds = tsEnd.tv_sec - tsStart.tv_sec + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+    m_nProgress = 100;
+    return !m_bError;
+}
+
+void* LoudnessAnalysis::AnalyserThread(void* pArgs)
+{
+    std::pair<LoudnessAnalysis*, unsigned int>* pAnalyser = (std::pair<LoudnessAnalysis*, unsigned int>*)pArgs;
+    pAnalyser->first->Analyse(pAnalyser->second);
+    return NULL;
+}
+
+void LoudnessAnalysis::Analyse(unsigned int nAnalyser)
+{
+    LoudnessVector* pBuffer = new LoudnessVector[LOUDNESS_PHASE_TAPS - 1 + LOUDNESS_BLOCK_FRAMES];
+    long lBlocks = (m_lFrames + LOUDNESS_BLOCK_FRAMES - 1) / LOUDNESS_BLOCK_FRAMES;
+    for(long lBlock = 0; lBlock < lBlocks; ++lBlock)
+    {
+        pthread_mutex_lock(&m_mutex);
+        while(m_lBlocksRead <= lBlock && !m_bError)
+            pthread_cond_wait(&m_cond, &m_mutex);
+        bool bError = m_bError;
+        pthread_mutex_unlock(&m_mutex);
+        if(bError)
+            break;
+
+        const float* pBlock = m_apBlocks[lBlock % LOUDNESS_BUFFERS];
+        long lCount = m_lFrames - lBlock * LOUDNESS_BLOCK_FRAMES;
+        if(lCount > LOUDNESS_BLOCK_FRAMES)
+            lCount = LOUDNESS_BLOCK_FRAMES;
+        for(unsigned int nGroup = nAnalyser; nGroup < m_vGroups.size(); nGroup += m_nAnalysers)
+            Measure(m_vGroups[nGroup], nGroup * LOUDNESS_LANES, pBlock, lCount, pBuffer);
+
+        pthread_mutex_lock(&m_mutex);
+        m_vBlocksAnalysed[nAnalyser] = lBlock + 1;
+        pthread_cond_broadcast(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+    }
+    delete[] pBuffer;
+}
+
+void LoudnessAnalysis::Measure(LoudnessGroup& group, unsigned int nFirst, const float* pBlock, long lCount, LoudnessVector* pBuffer)
+{
+    unsigned int nLanes = m_nChannels - nFirst < LOUDNESS_LANES ? m_nChannels - nFirst : LOUDNESS_LANES;
+    unsigned int nChannels = m_nChannels;
+
+    //Gather group into vectors after last frames of previous block, measuring sample peak and clipping
+    memcpy(pBuffer, group.avHistory, sizeof(group.avHistory));
+    LoudnessVector* pX = pBuffer + LOUDNESS_PHASE_TAPS - 1;
+    const float* pFrame = pBlock + nFirst;
+    LoudnessVector vPeak = LOUDNESS_ZERO;
+    LoudnessMask mClips = {0, 0, 0, 0};
+    for(long i = 0; i < lCount; ++i, pFrame += nChannels)
+    {
+        LoudnessVector vX = LOUDNESS_ZERO;
+        memcpy(&vX, pFrame, nLanes * sizeof(float));
+        pX[i] = vX;
+        LoudnessVector vAbs = Abs(vX);
+        vPeak = Max(vPeak, vAbs);
+        mClips -= vAbs >= LOUDNESS_FULL_SCALE; //True lanes are -1
+    }
+    for(unsigned int nLane = 0; nLane < LOUDNESS_LANES; ++nLane)
+        group.alClips[nLane] += ((int*)&mClips)[nLane];
+    group.vPeak = Max(group.vPeak, vPeak);
+    memcpy(group.avHistory, pBuffer + lCount, sizeof(group.avHistory));
+
+    //True peak - an oversampled value cannot exceed the sample peak by more than the filter gain so skip blocks which cannot raise it
+    LoudnessMask mRaise = vPeak * Splat(m_fPhaseGain) > group.vTruePeak;
+    bool bRaise = false;
+    for(unsigned int nLane = 0; nLane < nLanes; ++nLane)
+        bRaise |= 0 != ((int*)&mRaise)[nLane];
+    LoudnessVector vTruePeak = Max(group.vTruePeak, vPeak);
+    if(bRaise)
+    {
+        LoudnessVector aavPhase[LOUDNESS_OVERSAMPLE][LOUDNESS_PHASE_TAPS];
+        for(unsigned int nPhase = 0; nPhase < LOUDNESS_OVERSAMPLE; ++nPhase)
+            for(unsigned int nTap = 0; nTap < LOUDNESS_PHASE_TAPS; ++nTap)
+                aavPhase[nPhase][nTap] = Splat(m_aafPhase[nPhase][nTap]);
+        for(long i = 0; i < lCount; ++i)
+        {
+            const LoudnessVector* pIn = pX + i;
+            for(unsigned int nPhase = 0; nPhase < LOUDNESS_OVERSAMPLE; ++nPhase)
+            {
+                LoudnessVector vY = LOUDNESS_ZERO;
+                for(unsigned int nTap = 0; nTap < LOUDNESS_PHASE_TAPS; ++nTap)
+                    vY += aavPhase[nPhase][nTap] * pIn[-(long)nTap];
+                vTruePeak = Max(vTruePeak, Abs(vY));
+            }
+        }
+    }
+    group.vTruePeak = vTruePeak;
+
+    //K-weighting (transposed direct form II) and energy of each sub-block
+    LoudnessVector avB0[2] = {Splat(m_afShelf[0]), Splat(m_afHighPass[0])};
+    LoudnessVector avB1[2] = {Splat(m_afShelf[1]), Splat(m_afHighPass[1])};
+    LoudnessVector avB2[2] = {Splat(m_afShelf[2]), Splat(m_afHighPass[2])};
+    LoudnessVector avA1[2] = {Splat(m_afShelf[3]), Splat(m_afHighPass[3])};
+    LoudnessVector avA2[2] = {Splat(m_afShelf[4]), Splat(m_afHighPass[4])};
+    LoudnessVector vZ1[2] = {group.vZ1[0], group.vZ1[1]};
+    LoudnessVector vZ2[2] = {group.vZ2[0], group.vZ2[1]};
+    LoudnessVector vSum = group.vSum;
+    for(long i = 0; i < lCount;)
+    {
+        long lEnd = i + LOUDNESS_FLUSH_FRAMES;
+        if(lEnd > i + m_nSubBlockFrames - group.nSubFrames)
+            lEnd = i + m_nSubBlockFrames - group.nSubFrames;
+        if(lEnd > lCount)
+            lEnd = lCount;
+        group.nSubFrames += lEnd - i;
+        for(; i < lEnd; ++i)
+        {
+            LoudnessVector vX = pX[i];
+            for(unsigned int nStage = 0; nStage < 2; ++nStage)
+            {
+                LoudnessVector vY = avB0[nStage] * vX + vZ1[nStage];
+                vZ1[nStage] = avB1[nStage] * vX - avA1[nStage] * vY + vZ2[nStage];
+                vZ2[nStage] = avB2[nStage] * vX - avA2[nStage] * vY;
+                vX = vY;
+            }
+            vSum += vX * vX;
+        }
+        for(unsigned int nStage = 0; nStage < 2; ++nStage)
+        {
+            vZ1[nStage] = Flush(vZ1[nStage]);
+            vZ2[nStage] = Flush(vZ2[nStage]);
+        }
+        if(group.nSubFrames == m_nSubBlockFrames)
+        {
+            group.vSubBlocks.push_back(vSum / Splat(m_nSubBlockFrames));
+            vSum = LOUDNESS_ZERO;
+            group.nSubFrames = 0;
+        }
+    }
+    for(unsigned int nStage = 0; nStage < 2; ++nStage)
+    {
+        group.vZ1[nStage] = vZ1[nStage];
+        group.vZ2[nStage] = vZ2[nStage];
+    }
+    group.vSum = vSum;
+}
+
+void LoudnessAnalysis::Gate(const std::vector<double>& vEnergy, LoudnessResult* pResult)
+{
+    //Integrated loudness from overlapping momentary blocks passing absolute and relative gates
+    std::vector<double> vBlocks = GetBlocks(vEnergy, LOUDNESS_MOMENTARY);
+    double dThreshold = GetThreshold(vBlocks, LOUDNESS_RELATIVE_GATE);
+    double dSum = 0;
+    unsigned long lCount = 0;
+    for(size_t i = 0; i < vBlocks.size(); ++i)
+    {
+        double dLoudness = ToLoudness(vBlocks[i]);
+        if(dLoudness > LOUDNESS_ABSOLUTE_GATE && dLoudness > dThreshold)
+        {
+            dSum += vBlocks[i];
+            ++lCount;
+        }
+    }
+    pResult->dIntegrated = lCount ? ToLoudness(dSum / lCount) : -HUGE_VAL;
+
+    //Loudness range is spread of gated short-term loudness between low and high percentiles (EBU Tech 3342)
+    vBlocks = GetBlocks(vEnergy, LOUDNESS_SHORT_TERM);
+    dThreshold = GetThreshold(vBlocks, LOUDNESS_RANGE_GATE);
+    std::vector<double> vLoudness;
+    for(size_t i = 0; i < vBlocks.size(); ++i)
+    {
+        double dLoudness = ToLoudness(vBlocks[i]);
+        if(dLoudness > LOUDNESS_ABSOLUTE_GATE && dLoudness > dThreshold)
+            vLoudness.push_back(dLoudness);
+    }
+    pResult->dRange = 0;
+    if(vLoudness.size() > 1)
+    {
+        std::sort(vLoudness.begin(), vLoudness.end());
+        size_t nLow = (vLoudness.size() - 1) * LOUDNESS_RANGE_LOW + 0.5;
+        size_t nHigh = (vLoudness.size() - 1) * LOUDNESS_RANGE_HIGH + 0.5;
+        pResult->dRange = vLoudness[nHigh] - vLoudness[nLow];
+    }
+}
+
+bool LoudnessAnalysis::WriteReport(const std::string& sReport)
+{
+    FILE* pFile = fopen(sReport.c_str(), "w");
+    if(!pFile)
+        return false;
+    long lSeconds = m_lFrames / m_nSampleRate;
+    fprintf(pFile, "#Loudness (ITU-R BS.1770 / EBU R128) of %u tracks over %ld:%02ld:%02ld at %uHz\n", m_nChannels,
+        lSeconds / 3600, lSeconds / 60 % 60, lSeconds % 60, m_nSampleRate);
+    fprintf(pFile, "#track\tintegrated LUFS\trange LU\tsample peak dBFS\ttrue peak dBTP\tclipped samples\n");
+    for(unsigned int nTrack = 0; nTrack < m_vResults.size(); ++nTrack)
+    {
+        const LoudnessResult& result = m_vResults[nTrack];
+        fprintf(pFile, "%02u\t%.1f\t%.1f\t%.1f\t%.1f\t%lu\n", nTrack + 1, result.dIntegrated, result.dRange,
+            result.dSamplePeak, result.dTruePeak, result.lClips);
+    }
+    return 0 == fclose(pFile);
+}
@@ -0,0 +1,131 @@
+/** Class measuring loudness (ITU-R BS.1770 / EBU R128) and peaks of each track
+*   The interleaved project data is read once in large sequential blocks
+*   A pool of analyser threads measures groups of four tracks each, one track in each lane of a SIMD vector
+*   Results are written to a report beside the project and kept for display until tracks change
+*/
+#pragma once
+
+#include "takestore.h"
+#include <atomic>
+#include <math.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+static const unsigned int LOUDNESS_BLOCK_FRAMES     = 65536; //Quantity of frames read at a time
+static const unsigned int LOUDNESS_BUFFERS          = 2; //Quantity of blocks being read or analysed at a time
+static const unsigned int LOUDNESS_MAX_THREADS      = 4; //Maximum quantity of analyser threads
+static const unsigned int LOUDNESS_LANES            = 4; //Quantity of tracks analysed together by one vector
+static const unsigned int LOUDNESS_OVERSAMPLE       = 4; //Oversampling factor of true-peak measurement
+static const unsigned int LOUDNESS_PHASE_TAPS       = 12; //Quantity of taps of each phase of oversampling filter
+static const unsigned int LOUDNESS_FLUSH_FRAMES     = 64; //Quantity of frames between clearing nearly zero filter state
+static const unsigned int LOUDNESS_SUBBLOCK_MS      = 100; //Duration of energy sub-blocks - gating blocks overlap by whole sub-blocks
+static const unsigned int LOUDNESS_MOMENTARY        = 4; //Quantity of sub-blocks in a momentary (400ms) gating block
+static const unsigned int LOUDNESS_SHORT_TERM       = 30; //Quantity of sub-blocks in a short-term (3s) block used for loudness range
+static const double LOUDNESS_OFFSET                 = -0.691; //Offset of loudness from log of K-weighted energy
+static const double LOUDNESS_ABSOLUTE_GATE          = -70; //Blocks quieter than this (LUFS) are ignored
+static const double LOUDNESS_RELATIVE_GATE          = -10; //Integrated loudness ignores blocks this far (LU) below the absolute gated loudness
+static const double LOUDNESS_RANGE_GATE             = -20; //Loudness range ignores blocks this far (LU) below the absolute gated loudness
+static const double LOUDNESS_RANGE_LOW              = 0.10; //Lower percentile of short-term loudness distribution
+static const double LOUDNESS_RANGE_HIGH             = 0.95; //Upper percentile of short-term loudness distribution
+
+typedef float LoudnessVector __attribute__((vector_size(16))); //One lane per track - compiled to NEON or SSE
+typedef int LoudnessMask __attribute__((vector_size(16))); //Result of comparing vectors - all bits of lane set if true
+
+/** Structure holding measurements of one track - levels are -HUGE_VAL for silence **/
+struct LoudnessResult
+{
+    double dIntegrated; //Integrated loudness in LUFS
+    double dRange; //Loudness range in LU
+    double dSamplePeak; //Highest sample magnitude in dBFS
+    double dTruePeak; //Highest magnitude of signal reconstructed at 4 times sample rate in dBTP
+    unsigned long lClips; //Quantity of samples at or beyond full scale
+};
+
+/** Structure holding analysis state of a group of tracks **/
+struct LoudnessGroup
+{
+    LoudnessVector vZ1[2]; //K-weighting filter delay elements (shelf, high-pass)
+    LoudnessVector vZ2[2];
+    LoudnessVector vSum; //Sum of squares of K-weighted samples in current sub-block
+    unsigned int nSubFrames; //Quantity of frames in current sub-block
+    LoudnessVector vPeak; //Highest sample magnitude
+    LoudnessVector vTruePeak; //Highest oversampled magnitude
+    LoudnessVector avHistory[LOUDNESS_PHASE_TAPS - 1]; //Last frames of previous block used by oversampling filter
+    unsigned long alClips[LOUDNESS_LANES]; //Quantity of clipped samples of each lane
+    std::vector<LoudnessVector> vSubBlocks; //Mean square of each complete sub-block
+};
+
+class LoudnessAnalysis
+{
+    public:
+        LoudnessAnalysis();
+        ~LoudnessAnalysis();
+
+        /** @brief  Measure each track and write report
+        *   @param  fdSource File descriptor of project WAVE file
+        *   @param  offStart Offset of start of data in project WAVE file
+        *   @param  nChannels Quantity of interleaved channels in project WAVE file
+        *   @param  lFrames Quantity of frames to analyse
+        *   @param  nSampleRate Samples per second
+        *   @param  pTakes Pointer to take store overlaid on project data
+        *   @param  sReport Path of report file
+        *   @return <i>bool</i> True on success
+        *   @note   Blocks until complete - progress is available from GetProgress
+        */
+        bool Run(int fdSource, off_t offStart, unsigned int nChannels, long lFrames, unsigned int nSampleRate,
+            TakeStore* pTakes, const std::string& sReport);
+
+        /** @brief  Get progress of current analysis
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress() { return m_nProgress; }
+
+        /** @brief  Get duration of last analysis
+        *   @return <i>double</i> Seconds taken to analyse
+        */
+        double GetSeconds() { return m_dSeconds; }
+
+        /** @brief  Get measurements of a track from last analysis
+        *   @param  nTrack Index of track
+        *   @return <i>const LoudnessResult*</i> Pointer to measurements or NULL if track not analysed
+        *   @note   Must not be called whilst analysis runs
+        */
+        const LoudnessResult* GetResult(unsigned int nTrack) { return nTrack < m_vResults.size() ? &m_vResults[nTrack] : NULL; }
+
+        /** @brief  Discard measurements, e.g. when tracks are restructured
+        */
+        void Clear() { m_vResults.clear(); }
+
+        /** @brief  Calculate integrated loudness and loudness range from energy of sub-blocks
+        *   @param  vEnergy Mean square of K-weighted samples of each sub-block
+        *   @param  pResult Pointer to result to populate
+        */
+        static void Gate(const std::vector<double>& vEnergy, LoudnessResult* pResult);
+
+    private:
+        static void* AnalyserThread(void* pArgs);
+        void Analyse(unsigned int nAnalyser);
+        void Measure(LoudnessGroup& group, unsigned int nFirst, const float* pBlock, long lCount, LoudnessVector* pBuffer);
+        bool WriteReport(const std::string& sReport);
+
+        unsigned int m_nChannels; //Quantity of interleaved channels
+        long m_lFrames; //Quantity of frames to analyse
+        unsigned int m_nSampleRate; //Samples per second
+        unsigned int m_nSubBlockFrames; //Quantity of frames in each sub-block
+        unsigned int m_nAnalysers; //Quantity of analyser threads
+        float m_afShelf[5]; //Coefficients of K-weighting shelf filter (b0, b1, b2, a1, a2)
+        float m_afHighPass[5]; //Coefficients of K-weighting high-pass filter
+        float m_aafPhase[LOUDNESS_OVERSAMPLE][LOUDNESS_PHASE_TAPS]; //Oversampling filter coefficients of each phase
+        float m_fPhaseGain; //Greatest sum of magnitude of coefficients of a phase - most an output may exceed the input peak by
+        float* m_apBlocks[LOUDNESS_BUFFERS]; //Interleaved blocks shared by reader and analysers
+        std::vector<LoudnessGroup> m_vGroups; //State of each group of tracks
+        long m_lBlocksRead; //Quantity of blocks available to analysers
+        std::vector<long> m_vBlocksAnalysed; //Quantity of blocks analysed by each analyser
+        bool m_bError; //True if analysis failed
+        pthread_mutex_t m_mutex; //Protects block counts
+        pthread_cond_t m_cond; //Signalled when a block is read or analysed
+        std::vector<LoudnessResult> m_vResults; //Measurements of each track from last analysis
+        std::atomic<int> m_nProgress; //Percentage complete
+        double m_dSeconds; //Duration of last analysis
+};
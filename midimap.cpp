@@ -0,0 +1,93 @@
+#include "midimap.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* MESSAGE_NAMES[] = {"note", "cc", "pc"};
+static const char* ACTION_NAMES[] = {"none", "play", "stop", "playstop", "record", "punch", "arma", "armb", "locate", "gain"};
+
+MidiMap::MidiMap()
+{
+    Clear();
+}
+
+void MidiMap::Clear()
+{
+    memset(m_aBindings, 0, sizeof(m_aBindings));
+    m_vDefinitions.clear();
+}
+
+bool MidiMap::Add(const char* pDefinition)
+{
+    char sType[8];
+    char sAction[16];
+    unsigned int nChannel;
+    unsigned int nNumber;
+    int nParam = 0;
+    if(sscanf(pDefinition, "%7[^,],%u,%u,%15[^,\r\n],%d", sType, &nChannel, &nNumber, sAction, &nParam) < 4)
+        return false;
+    if(nChannel > 16 || nNumber > 127)
+        return false;
+    unsigned int nType = MIDI_TYPES;
+    for(unsigned int i = 0; i < MIDI_TYPES; ++i)
+        if(0 == strcmp(sType, MESSAGE_NAMES[i]))
+            nType = i;
+    int nAction = MIDI_NONE;
+    for(unsigned int i = 1; i < sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0]); ++i)
+        if(0 == strcmp(sAction, ACTION_NAMES[i]))
+            nAction = i;
+    if(MIDI_TYPES == nType || MIDI_NONE == nAction)
+        return false;
+
+    //Channel 0 binds message on every channel
+    for(unsigned int nChan = 0; nChan < 16; ++nChan)
+    {
+        if(nChannel && nChan != nChannel - 1)
+            continue;
+        m_aBindings[nType][nChan][nNumber].nAction = nAction;
+        m_aBindings[nType][nChan][nNumber].nParam = nParam;
+    }
+    char pBuffer[64];
+    snprintf(pBuffer, sizeof(pBuffer), "%s,%u,%u,%s,%d", sType, nChannel, nNumber, sAction, nParam);
+    m_vDefinitions.push_back(pBuffer);
+    return true;
+}
+
+bool MidiMap::Lookup(const unsigned char* pMessage, size_t nSize, MidiAction* pAction)
+{
+    if(nSize < 2)
+        return false;
+    unsigned int nType;
+    int nValue;
+    switch(pMessage[0] & 0xF0)
+    {
+        case 0x90:
+            if(nSize < 3)
+                return false;
+            nType = MIDI_NOTE;
+            nValue = pMessage[2] ? 127 : 0; //Note on with zero velocity is note off
+            break;
+        case 0x80:
+            nType = MIDI_NOTE;
+            nValue = 0;
+            break;
+        case 0xB0:
+            if(nSize < 3)
+                return false;
+            nType = MIDI_CC;
+            nValue = pMessage[2] & 0x7F;
+            break;
+        case 0xC0:
+            nType = MIDI_PROGRAM;
+            nValue = 127;
+            break;
+        default:
+            return false;
+    }
+    const Binding& binding = m_aBindings[nType][pMessage[0] & 0x0F][pMessage[1] & 0x7F];
+    if(MIDI_NONE == binding.nAction)
+        return false;
+    pAction->nAction = binding.nAction;
+    pAction->nParam = binding.nParam;
+    pAction->nValue = nValue;
+    return true;
+}
@@ -0,0 +1,77 @@
+/** Class mapping MIDI control messages to recorder actions
+*   Bindings are defined by text, e.g. "cc,1,64,playstop" or "cc,0,7,gain,3"
+*   Format is message (note | cc | pc), channel (1-16 or 0 for any), note / controller / program number, action and optional parameter
+*   Lookup uses a fixed table so is realtime safe
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+//Actions
+static const int MIDI_NONE      = 0;
+static const int MIDI_PLAY      = 1; //Start transport
+static const int MIDI_STOP      = 2; //Stop transport
+static const int MIDI_PLAYSTOP  = 3; //Toggle transport
+static const int MIDI_RECORD    = 4; //Toggle record enable
+static const int MIDI_PUNCH     = 5; //Record enable whilst note held or controller at or above 64
+static const int MIDI_ARM_A     = 6; //Toggle recording input A to track (parameter)
+static const int MIDI_ARM_B     = 7; //Toggle recording input B to track (parameter)
+static const int MIDI_LOCATE    = 8; //Move playhead to position in seconds (parameter)
+static const int MIDI_GAIN      = 9; //Set monitor level of track (parameter) from controller value
+//Message types
+static const unsigned int MIDI_NOTE     = 0;
+static const unsigned int MIDI_CC       = 1;
+static const unsigned int MIDI_PROGRAM  = 2;
+static const unsigned int MIDI_TYPES    = 3;
+
+/** Structure representing a mapped control event **/
+struct MidiAction
+{
+    int nAction; //Action to perform [MIDI_PLAY ... MIDI_GAIN]
+    int nParam; //Parameter of action
+    int nValue; //Value 0-127 - notes and program changes are 127 when pressed and 0 when released
+};
+
+class MidiMap
+{
+    public:
+        MidiMap();
+
+        /** @brief  Remove all bindings
+        */
+        void Clear();
+
+        /** @brief  Add a binding
+        *   @param  pDefinition Definition of binding, e.g. "note,10,36,playstop"
+        *   @return <i>bool</i> True on success - false if definition is invalid
+        *   @note   Not realtime safe
+        */
+        bool Add(const char* pDefinition);
+
+        /** @brief  Get definitions of all bindings, e.g. to save in project
+        *   @return <i>std::vector<std::string></i> Normalised definitions
+        */
+        std::vector<std::string> GetDefinitions() { return m_vDefinitions; }
+
+        /** @brief  Find action bound to a MIDI message
+        *   @param  pMessage MIDI message
+        *   @param  nSize Quantity of bytes in message
+        *   @param  pAction Pointer to action to populate
+        *   @return <i>bool</i> True if message is bound to an action
+        *   @note   Realtime safe
+        */
+        bool Lookup(const unsigned char* pMessage, size_t nSize, MidiAction* pAction);
+
+    private:
+        struct Binding
+        {
+            uint8_t nAction; //Action [MIDI_NONE ... MIDI_GAIN]
+            int16_t nParam; //Parameter of action
+        };
+
+        Binding m_aBindings[MIDI_TYPES][16][128]; //Bindings indexed by message type, channel and number
+        std::vector<std::string> m_vDefinitions; //Text of each binding
+};
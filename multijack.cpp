@@ -3,186 +3,101 @@
 *   2 channel output - mixdown for monitoring, select which output(s) to route each track to
 *   Single multichannel WAVE file may be imported to DAW for editing
 *   Acts like linear multitrack tape recorder
+*   This is the ncurses front end - recording, playback and projects are provided by Engine (libmultijack)
+*   Build with HEADLESS defined for an engine-only recorder controlled by its control socket without ncurses
 */
 
 ///@todo Transport navigation causes short play of audio, e.g. goto home
 
 #include "multijack.h"
+#include "trace.h"
 #include "track.h"
 #include <stdio.h>
-#include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h> //provides control of terminal - set raw mode
 #include <string>
-#include <alsa/asoundlib.h>
-#include <ncurses.h> //provides user interface
 #include <iostream>
-#include <sys/types.h> //provides lseek
+#include <time.h> //provides clock_gettime
+#include <signal.h> //provides sigaction
+#include <getopt.h> //provides getopt
+#include <sys/inotify.h> //provides inotify - watch for JACK server starting
 
 using namespace std;
 
-int OnJackProcess(jack_nframes_t nFrames, void* pArgs)
+int main(int argc, char *argv[])
 {
-    //!@todo Optimse process code
-    if(TC_STOPPED == g_nTransport)
-        return 0; //Not rolling so don't process any audio
-    else if(TC_STOPPING == g_nTransport)
+#ifdef HEADLESS
+    g_bHeadless = true; //Built without user interface
+#else
+    g_bHeadless = false;
+#endif
+    TraceThread("ui");
+    std::string sControlSocket = CONTROL_SOCKET;
+    int nOption;
+    while((nOption = getopt(argc, argv, "ds:")) != -1)
     {
-        //Transport stop requested so silence all channels then set transport to stop
-        //Already faded out last sample (see code below)
-        for(unsigned int nChan = 0; nChan < g_vTracks.size(); ++nChan)
+        switch(nOption)
         {
-            jack_default_audio_sample_t* pOut = (jack_default_audio_sample_t*)(jack_port_get_buffer(g_vJackSourcePorts[nChan], nFrames));
-            if(pOut)
-                memset(pOut, 0, nFrames * sizeof(jack_default_audio_sample_t));
-        }
-        jack_transport_stop(g_pJackClient);
-        g_nTransport = TC_STOPPED;
-        return 0;
-    }
-    if(!g_bRecordEnabled && g_lHeadPos > g_lLastFrame - (2 * nFrames))
-        g_nTransport = TC_STOP; //Fade out penultimate frame and don't play last frame (which may be too short to fade)
-    //Rolling so read from wave file
-    int nRead = read(g_fdWave, g_pReadBuffer, nFrames * g_nFrameSize); //!@todo pre-read from file outside this callback
-    if((nRead > 0))// && (g_lHeadPos <= g_lLastFrame - nFrames)) //!@todo extra code to soften stop at end of file stops end of file being reached, e.g. can't play from start again (do we want to?)
-    {
-        //Iterate through input buffer one frame at a time, adding gain-adjusted value to output buffer for each track
-        unsigned int nReadFrames = nRead / g_nFrameSize;
-        for(unsigned int nFrame = 0; nFrame < nReadFrames; ++nFrame)
-        {
-            for(unsigned int nChan = 0; nChan < g_vTracks.size(); ++nChan)
-            {
-                jack_default_audio_sample_t fSample = g_pReadBuffer[nFrame * g_vTracks.size() + nChan];
-                jack_default_audio_sample_t* pOut = (jack_default_audio_sample_t*)(jack_port_get_buffer(g_vJackSourcePorts[nChan], nReadFrames));
-                if(TC_STOP == g_nTransport)
-                    pOut[nFrame] = (nFrames - nFrame) * g_vTracks[nChan]->Mix(fSample) / nFrames; //Fade out last frame to reduce click on stop
-                else if(TC_START == g_nTransport)
-                    pOut[nFrame] = nFrame * g_vTracks[nChan]->Mix(fSample) / nFrames; //Fade in first frame to reduce click on start
-                else
-                    pOut[nFrame] = g_vTracks[nChan]->Mix(fSample);
-            }
+            case 'd':
+                //Run without user interface
+                g_bHeadless = true;
+                break;
+            case 's':
+                //Path of control socket
+                sControlSocket = optarg;
+                break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-d] [-s socket]" << endl;
+                cerr << "  -d  run without user interface, controlled by socket only" << endl;
+                cerr << "  -s  path of control socket (default " << CONTROL_SOCKET << ")" << endl;
+                return 1;
         }
-        g_lHeadPos += nReadFrames;
-    }
-    if(TC_STOP == g_nTransport)
-        g_nTransport = TC_STOPPING;
-    if(TC_START == g_nTransport)
-    {
-        g_nTransport = TC_ROLLING;
-        jack_transport_start(g_pJackClient);
     }
 
-    //Past end of file so either stop if we are playing or extend file if we are recording
-    //!@todo Extend file outside this callback
-    if(g_lHeadPos >= g_lLastFrame)
-    {
-        if(g_bRecordEnabled)
-        {
-            //Recording so extend file by one frame
-            g_lLastFrame += nFrames;
-            g_lHeadPos += nFrames;
-            g_offEndOfData = lseek(g_fdWave, nFrames * g_nFrameSize - 1, SEEK_END) + 1; //This sets end of data marker but positions write cursor one byte early
-            char pCharZero[1] = {0}; //null value to write to file
-            write(g_fdWave, pCharZero, 1); //Writes last byte to file, extending file and moving write cursor to end - hole is populated with null (silent) data
-        }
-        else
-            g_nTransport = TC_STOPPING; //Not recording so request stop
-    }
-    ShowHeadPosition();
+    g_nSelectedTrack = 0;
+    g_bRunning = true; //Main program loop flag - loop if true
+    g_nJackConnectAttempt = 0;
+    g_nJackRetry = JACK_RETRY_MIN_MS;
+    g_fdJackWatch = -1;
+    g_bReady = false;
 
-    Record(nFrames);
+    //Keep process memory resident so that audio thread does not wait for paging
+    bool bLocked = LockMemory();
 
-	return 0;
-}
+    //Stop cleanly, saving project, when terminated
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
 
-int OnJackSync(jack_transport_state_t nState, jack_position_t* pPos, void* pArgs)
-{
-    mvprintw(20,0, "OnJackSync state = %d count = %ld", nState, ++g_lDebug);
-    //!@todo Handle external transport and position changes
-    switch(nState)
+    if(!g_controlServer.Open(sControlSocket))
     {
-        case JackTransportStarting:
-            g_nTransport = TC_START;
-            break;
-        case JackTransportRolling:
-            g_nTransport = TC_ROLLING;
-            break;
-        case JackTransportStopped:
-            g_nTransport = TC_STOP;
-            g_lHeadPos = pPos->frame;
-            break;
-        default:
-            break;
+        cerr << "Failed to open control socket " << sControlSocket << endl;
+        if(g_bHeadless)
+            return 1;
     }
-    return 1; //Always ready to roll
-}
 
-void OnJackTimebase(jack_transport_state_t nState, jack_nframes_t nFrames, jack_position_t *pPos, int nNewPos, void *pArgs)
-{
-    mvprintw(20,0, "OnJackTimebase state = %d count = %ld", nState, ++g_lDebug);
-    switch(nState)
+    if(!bLocked && g_bHeadless)
+        cerr << "Failed to lock memory - audio may glitch when paging (check memlock limit)" << endl;
+
+#ifdef HEADLESS
+    g_pWindowRouting = NULL;
+#else
+    //Initialise ncurses - when run headless with -d the screen is discarded and display functions return early
+    if(g_bHeadless)
     {
-        case JackTransportStarting:
-            g_nTransport = TC_START;
-            break;
-        case JackTransportRolling:
-            g_nTransport = TC_ROLLING;
-            break;
-        case JackTransportStopped:
-            g_nTransport = TC_STOP;
-            g_lHeadPos = pPos->frame;
-            break;
-        default:
-            break;
+        FILE* pNull = fopen("/dev/null", "r+");
+        if(!pNull || !newterm("vt100", pNull, pNull))
+        {
+            cerr << "Failed to initialise screen" << endl;
+            return 1;
+        }
     }
-}
-
-void OnJackLatency(jack_latency_callback_mode_t latencyMode, void* pArgs)
-{
-    jack_latency_range_t latencyRange;
-    jack_port_get_latency_range(g_pPortInputA, latencyMode, &latencyRange);
-    if(latencyMode == JackCaptureLatency)
-        g_nCaptureLatency = latencyRange.max;
     else
-        g_nPlaybackLatency = latencyRange.max;
-    g_nRecordOffset = g_nCaptureLatency + g_nPlaybackLatency;
-}
-
-void OnJackShutdown(void* pArgs)
-{
-    //!@todo Flag Jack closed
-	g_pJackClient = NULL;
-}
-
-int OnJackBufferChange(jack_nframes_t nFrames, void *pArgs)
-{
-    delete[] g_pReadBuffer;
-    g_pReadBuffer = new jack_default_audio_sample_t[nFrames * g_vTracks.size()];
-    return 0;
-}
-
-int main(int argc, char *argv[])
-{
-    g_lDebug = 0;
-	g_nCaptureLatency = 0;
-	g_nPlaybackLatency = 0;
-    g_nTransport = TC_STOPPED;
-    g_bRecordEnabled = false;
-    g_nSelectedTrack = 0;
-    g_nRecA = -1; //Deselect A-channel recording
-    g_nRecB = -1; //Deselect B-channel recording
-    g_bRunning = true; //Main program loop flag - loop if true
-    g_fdWave = -1;
-    g_pSilence = NULL;
-    g_pReadBuffer = NULL;
-    g_sPath = "/media/multitrack/"; //!@todo replace this absolute path
-    g_pJackClient = NULL;
-    g_nJackConnectAttempt = 0;
-
-    //Initialise ncurses
-    initscr();
+        initscr();
     noecho();
     curs_set(0);
     keypad(stdscr, TRUE);
@@ -195,12 +110,19 @@ int main(int argc, char *argv[])
     attron(COLOR_PAIR(WHITE_MAGENTA));
     mvprintw(0, 0, "                                             ");
     attroff(COLOR_PAIR(WHITE_MAGENTA));
-    g_pWindowRouting = newwin(MAX_TRACKS, 40, 1, 0);
+    g_pWindowRouting = newwin(MAX_TRACKS, 48, 1, 0);
+    if(!bLocked)
+    {
+        attron(COLOR_PAIR(WHITE_RED));
+        mvprintw(20, 0, " Failed to lock memory - audio may glitch when paging (check memlock limit) ");
+        attroff(COLOR_PAIR(WHITE_RED));
+    }
     refresh();
+#endif
 
     //Set stdin to non-blocking
     termios flags;
-    if(tcgetattr(fileno(stdin), &flags) < 0)
+    if(!g_bHeadless && tcgetattr(fileno(stdin), &flags) < 0)
     {
         /* handle error */
         cerr << "Failed to get terminal attributes" << endl;
@@ -208,63 +130,96 @@ int main(int argc, char *argv[])
     flags.c_lflag &= ~ICANON; // set raw (unset canonical modes)
     flags.c_cc[VMIN] = 0; // i.e. min 1 char for blocking, 0 chars for non-blocking
     flags.c_cc[VTIME] = 0; // block if waiting for char
-    if(tcsetattr(fileno(stdin), TCSANOW, &flags) < 0)
+    if(!g_bHeadless && tcsetattr(fileno(stdin), TCSANOW, &flags) < 0)
     {
         cerr << "Failed to set terminal attributes" << endl;
         Quit(1);
     }
 
+    //Watch for JACK server creating its socket so reconnection need not wait for next attempt
+    g_fdJackWatch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(g_fdJackWatch >= 0 && inotify_add_watch(g_fdJackWatch, JACK_SERVER_DIR, IN_CREATE) < 0)
+    {
+        close(g_fdJackWatch);
+        g_fdJackWatch = -1;
+    }
+
 	/* keep running until stopped by the user */
+    unsigned int nStatusCount = 0;
 	while(g_bRunning)
     {
         HandleControl();
-        while(!g_pJackClient)
+        ShowReadyStatus();
+        NotifyControl();
+        ShowBufferStatus();
+        ShowScrubStatus();
+        if(TC_STOPPED != g_engine.GetTransport())
+            ShowHeadPosition();
+        if(g_engine.GetChanged())
+        {
+            //Audio thread has applied MIDI control or stopped after post-roll
+            ShowLength();
+            ShowMenu();
+        }
+        if(++nStatusCount >= 1000)
+        {
+            nStatusCount = 0;
+            ShowDiskStatus();
+            ShowJobStatus();
+            ShowSnapshotStatus();
+        }
+        g_engine.UpdateConnections();
+        while(!g_engine.IsConnected())
         {
-            ConnectJack(); //!@todo Not connecting to playback on startup
-            sleep(1);
+            //Server has gone so rejoin as soon as it returns, keeping project and position
+            if(!ConnectJack())
+                WaitJack(); //Status and quit commands are available whilst disconnected
             HandleControl();
             if(!g_bRunning)
                 Quit();
         }
-        usleep(1000);
+        g_controlServer.Poll(HandleCommand, 1); //Wait for commands instead of sleeping
     }
     Quit();
 }
 
+void OnSignal(int nSignal)
+{
+    g_bRunning = false;
+}
+
 void Quit(int nError)
 {
-    if(TC_ROLLING == g_nTransport)
+    g_engine.Shutdown();
+#ifndef HEADLESS
+    endwin(); //End ncurses
+#endif
+#ifdef RT_DEBUG
+    cerr << "Page faults in audio thread: " << RtGetFaults() << endl;
+#endif
+    g_controlServer.Close();
+    if(g_fdJackWatch >= 0)
     {
-        //Currently playing so need to stop
-        g_nTransport = TC_STOP;
-        g_bRecordEnabled = false;
-        if(g_nRecA > -1)
-            g_vTracks[g_nRecA]->bRecording = false;
-        if(g_nRecB > -1)
-            g_vTracks[g_nRecB]->bRecording = false;
-        UpdateLength();
-        //!@todo Could use while(TC_STOPPED != g_nTransport) but may never end if Jack server is not running
-        usleep(100000); //Wait for soft stop to complete (fade out audio over one period)
+        close(g_fdJackWatch);
     }
-    SaveProject();
-    CloseFile();
-    delete[] g_pSilence;
-    delete[] g_pReadBuffer;
-    endwin(); //End ncurses
-    if(g_pJackClient)
-        jack_client_close(g_pJackClient);
-	exit(nError);
+    exit(nError);
 }
 
 void ShowMenu()
 {
-    for(unsigned int i = 0; i < g_vTracks.size(); ++i)
+    if(g_bHeadless)
+        return;
+    TraceScope trace("menu");
+    int nRecA = g_engine.GetArmedTrack(PORT_A);
+    int nRecB = g_engine.GetArmedTrack(PORT_B);
+    for(unsigned int i = 0; i < g_engine.GetTrackCount(); ++i)
     {
+        Track* pTrack = g_engine.GetTrack(i);
         if(i == g_nSelectedTrack)
             wattron(g_pWindowRouting, COLOR_PAIR(WHITE_BLUE));
         mvwprintw(g_pWindowRouting, i, 0, "Track %02d: ", i + 1);
         wattroff(g_pWindowRouting, COLOR_PAIR(WHITE_BLUE));
-        if((int)i == g_nRecA)
+        if((int)i == nRecA)
         {
             wattron(g_pWindowRouting, COLOR_PAIR(WHITE_RED));
             wprintw(g_pWindowRouting, "REC-A ");
@@ -272,7 +227,7 @@ void ShowMenu()
         }
         else
             wprintw(g_pWindowRouting, "      ");
-        if((int)i == g_nRecB)
+        if((int)i == nRecB)
         {
             wattron(g_pWindowRouting, COLOR_PAIR(WHITE_RED));
             wprintw(g_pWindowRouting, "REC-B ");
@@ -280,7 +235,7 @@ void ShowMenu()
         }
         else
             wprintw(g_pWindowRouting, "      ");
-        if(g_vTracks[i]->bMuteA && g_vTracks[i]->bMuteB)
+        if(pTrack->bMuteA && pTrack->bMuteB)
         {
             wattron(g_pWindowRouting, COLOR_PAIR(RED_BLACK));
             wprintw(g_pWindowRouting, " MUTE   ");
@@ -289,34 +244,51 @@ void ShowMenu()
         else
         {
             char aChar[8];
-            sprintf(aChar, "% 4d %s%s", g_vTracks[i]->nMonMix, g_vTracks[i]->bMuteA?" ":"L", g_vTracks[i]->bMuteB?" ":"R");
+            sprintf(aChar, "% 4d %s%s", pTrack->nMonMix, pTrack->bMuteA?" ":"L", pTrack->bMuteB?" ":"R");
             wprintw(g_pWindowRouting, " %s ", aChar);
         }
+        //Insert effects
+        wprintw(g_pWindowRouting, "%s%s%s", pTrack->fHighPass > 0 ? "H" : " ", 0 != pTrack->fEqGain ? "E" : " ", pTrack->fCompRatio > 1 ? "C" : " ");
+        //Integrated loudness and true peak from last analysis - red if track clips
+        const LoudnessResult* pLoudness = g_engine.GetLoudness(i);
+        if(pLoudness)
+        {
+            if(pLoudness->lClips)
+                wattron(g_pWindowRouting, COLOR_PAIR(RED_BLACK));
+            wprintw(g_pWindowRouting, " %5.1f %5.1f", pLoudness->dIntegrated, pLoudness->dTruePeak);
+            wattroff(g_pWindowRouting, COLOR_PAIR(RED_BLACK));
+        }
+        else
+            wprintw(g_pWindowRouting, "            ");
     }
     wrefresh(g_pWindowRouting);
-    switch(g_nTransport)
+    mvprintw(17, 0, "Takes: %-4u", g_engine.GetTakeCount());
+    ShowPunch();
+    ShowMonitor();
+    bool bRecordEnabled = g_engine.IsRecordEnabled();
+    switch(g_engine.GetTransport())
     {
         case TC_STOPPED:
         case TC_STOPPING:
         case TC_STOP:
-            if(g_bRecordEnabled)
+            if(bRecordEnabled)
                 attron(COLOR_PAIR(WHITE_RED));
             else
                 attron(COLOR_PAIR(BLACK_GREEN));
             mvprintw(0, MENU_TC, " STOP ");
-            if(g_bRecordEnabled)
+            if(bRecordEnabled)
                 attroff(COLOR_PAIR(WHITE_RED));
             else
                 attroff(COLOR_PAIR(BLACK_GREEN));
             break;
         case TC_ROLLING:
         case TC_START:
-            if(g_bRecordEnabled)
+            if(bRecordEnabled)
                 attron(COLOR_PAIR(WHITE_RED));
             else
                 attron(COLOR_PAIR(BLACK_GREEN));
             mvprintw(0, MENU_TC, " ROLL ");
-            if(g_bRecordEnabled)
+            if(bRecordEnabled)
                 attroff(COLOR_PAIR(WHITE_RED));
             else
                 attroff(COLOR_PAIR(BLACK_GREEN));
@@ -325,19 +297,330 @@ void ShowMenu()
     refresh();
 }
 
+void ShowPunch()
+{
+    unsigned int nSamplerate = g_engine.GetSampleRate();
+    if(0 == nSamplerate)
+        return;
+    long alPunch[] = {g_engine.GetPunchIn(), g_engine.GetPunchOut()};
+    char asTime[2][16];
+    for(unsigned int i = 0; i < 2; ++i)
+    {
+        unsigned int nMinutes = alPunch[i] / nSamplerate / 60;
+        unsigned int nSeconds = (alPunch[i] - nMinutes * nSamplerate * 60) / nSamplerate;
+        unsigned int nMillis = (alPunch[i] % nSamplerate) * 1000 / nSamplerate;
+        sprintf(asTime[i], "%02u:%02u.%03u", nMinutes, nSeconds, nMillis);
+    }
+    if(g_engine.IsAutoPunch())
+        attron(COLOR_PAIR(WHITE_RED));
+    mvprintw(17, 50, "Punch %s-%s", asTime[0], asTime[1]);
+    attroff(COLOR_PAIR(WHITE_RED));
+}
+
+void ShowMonitor()
+{
+    int nInputMonitor = g_engine.GetInputMonitor();
+    if(MONITOR_OFF != nInputMonitor)
+        attron(COLOR_PAIR(WHITE_RED));
+    mvprintw(1, 50, "Input monitor: %-5s", MONITOR_NAMES[nInputMonitor]);
+    attroff(COLOR_PAIR(WHITE_RED));
+}
+
 void ShowHeadPosition()
 {
+    if(g_bHeadless)
+        return;
+    TraceScope trace("position");
+    long lHeadPos = g_engine.GetPlayHead();
+    unsigned int nSamplerate = g_engine.GetSampleRate();
     attron(COLOR_PAIR(WHITE_MAGENTA));
-    unsigned int nMinutes = g_lHeadPos / g_nSamplerate / 60;
-    unsigned int nSeconds = (g_lHeadPos - nMinutes * g_nSamplerate * 60) / g_nSamplerate;
-    unsigned int nMillis = (g_lHeadPos - (nMinutes * 60 + nSeconds) * g_nSamplerate) * 1000 / 44100;
+    unsigned int nMinutes = lHeadPos / nSamplerate / 60;
+    unsigned int nSeconds = (lHeadPos - nMinutes * nSamplerate * 60) / nSamplerate;
+    unsigned int nMillis = (lHeadPos - (nMinutes * 60 + nSeconds) * nSamplerate) * 1000 / 44100;
     mvprintw(0, MENU_HEAD, "Position: %02d:%02d.%03d/", nMinutes, nSeconds, nMillis);
     attroff(COLOR_PAIR(WHITE_MAGENTA));
 }
 
+void ShowLength()
+{
+    long lLastFrame = g_engine.GetLength();
+    unsigned int nSamplerate = g_engine.GetSampleRate();
+    attron(COLOR_PAIR(WHITE_MAGENTA));
+    unsigned int nMinutes = lLastFrame / nSamplerate / 60;
+    unsigned int nSeconds = (lLastFrame - nMinutes * nSamplerate * 60) / nSamplerate;
+    unsigned int nMillis = (lLastFrame - (nMinutes * 60 + nSeconds) * nSamplerate) * 1000 / 44100;
+    mvprintw(0, MENU_SIZE, "%02d:%02d.%03d ", nMinutes, nSeconds, nMillis);
+    attroff(COLOR_PAIR(WHITE_MAGENTA));
+}
+
+void ShowFormat()
+{
+    //Red if sample rate differs and cannot be converted, blue if converted
+    if(g_engine.GetDeviceRate() == g_engine.GetSampleRate())
+        attron(COLOR_PAIR(WHITE_MAGENTA));
+    else if(g_engine.GetDiskStream().IsResampling())
+        attron(COLOR_PAIR(WHITE_BLUE));
+    else
+        attron(COLOR_PAIR(WHITE_RED));
+    mvprintw(0, MENU_FORMAT, " % 6dHz ", g_engine.GetSampleRate());
+    attroff(COLOR_PAIR(WHITE_MAGENTA));
+}
+
+void ShowDiskStatus()
+{
+    if(g_bHeadless)
+        return;
+    TraceScope trace("disk status");
+    static unsigned long lLastKbRead = 0;
+    static unsigned long lLastKbWritten = 0;
+    static timespec tsLast = {0, 0};
+    DiskStream& diskStream = g_engine.GetDiskStream();
+    timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    double dSeconds = tsNow.tv_sec - tsLast.tv_sec + (tsNow.tv_nsec - tsLast.tv_nsec) / 1e9;
+    unsigned long lKbRead = diskStream.GetKbRead();
+    unsigned long lKbWritten = diskStream.GetKbWritten();
+    if(dSeconds <= 0 || lKbRead < lLastKbRead || lKbWritten < lLastKbWritten)
+    {
+        //First call or file reopened
+        lLastKbRead = lKbRead;
+        lLastKbWritten = lKbWritten;
+        tsLast = tsNow;
+        return;
+    }
+    double dReadRate = (lKbRead - lLastKbRead) / 1024.0 / dSeconds;
+    double dWriteRate = (lKbWritten - lLastKbWritten) / 1024.0 / dSeconds;
+    lLastKbRead = lKbRead;
+    lLastKbWritten = lKbWritten;
+    tsLast = tsNow;
+    Scrubber& scrubber = g_engine.GetScrubber();
+    unsigned int nCorrupt = scrubber.GetErrorCount();
+    move(18, 0);
+    clrtoeol();
+    if(diskStream.GetUnderruns() || diskStream.GetOverruns() || nCorrupt)
+        attron(COLOR_PAIR(WHITE_RED));
+    mvprintw(18, 0, "Disk: %s rd %.1fMB/s wr %.1fMB/s syscalls %lu xruns %u/%u", diskStream.IsUring() ? "io_uring" : "threads",
+        dReadRate, dWriteRate, diskStream.GetSyscalls(), diskStream.GetUnderruns(), diskStream.GetOverruns());
+    if(scrubber.IsRunning())
+        printw(" scrub %d%% pass %u", scrubber.GetProgress(), scrubber.GetPasses());
+    if(nCorrupt)
+        printw(" CORRUPT %u", nCorrupt);
+    attroff(COLOR_PAIR(WHITE_RED));
+    refresh();
+}
+
+void ShowBufferStatus()
+{
+    static unsigned int nChanges = 0;
+    static timespec tsLast = {0, 0};
+    DiskStream& diskStream = g_engine.GetDiskStream();
+    timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    bool bChanged = diskStream.GetDepthChanges() != nChanges;
+    if(!bChanged && tsNow.tv_sec == tsLast.tv_sec)
+        return; //Measured latency is redrawn each second
+    tsLast = tsNow;
+    nChanges = diskStream.GetDepthChanges();
+    unsigned int nRate = g_engine.GetSampleRate() ? g_engine.GetSampleRate() : 44100;
+    char pStatus[192];
+    int nLength = snprintf(pStatus, sizeof(pStatus), "read=%u (%lums p99.9 %.1fms) write=%u (%lums p99.9 %.1fms) memory=%luKB",
+        diskStream.GetReadDepth(), (unsigned long)diskStream.GetReadDepth() * STREAM_CHUNK_FRAMES * 1000 / nRate, diskStream.GetReadLatency() / 1000.0,
+        diskStream.GetCaptureDepth(), (unsigned long)diskStream.GetCaptureDepth() * CAPTURE_CHUNK_FRAMES * 1000 / nRate, diskStream.GetWriteLatency() / 1000.0,
+        diskStream.GetBufferKb());
+    if(diskStream.IsSpooling() && nLength > 0 && nLength < (int)sizeof(pStatus))
+    {
+        //Spool fill and time to write it at measured rate
+        unsigned int nDrainMs = diskStream.GetSpoolDrainMs();
+        char pDrain[16] = "stalled";
+        if(~0u != nDrainMs)
+            snprintf(pDrain, sizeof(pDrain), "%.1fs", nDrainMs / 1000.0);
+        snprintf(pStatus + nLength, sizeof(pStatus) - nLength, " spool=%lu%% of %lus (%lus drain %s)",
+            diskStream.GetSpoolFrames() * 100 / diskStream.GetSpoolCapacity(), diskStream.GetSpoolCapacity() / nRate, diskStream.GetSpoolFrames() / nRate, pDrain);
+    }
+    if(bChanged)
+    {
+        g_controlServer.Notify(CONTROL_DISK, string("event buffer ") + pStatus);
+        if(g_bHeadless)
+            cerr << "Buffer depth changed: " << pStatus << endl;
+    }
+    if(g_bHeadless)
+        return;
+    move(23, 0);
+    clrtoeol();
+    mvprintw(23, 0, "Buffer: %s", pStatus);
+    refresh();
+}
+
+void ShowScrubStatus()
+{
+    static unsigned int nReported = 0;
+    if(g_engine.GetScrubber().GetErrorCount() == nReported)
+        return;
+    std::vector<ScrubError> vErrors = g_engine.GetScrubber().GetErrors();
+    for(unsigned int i = nReported; i < vErrors.size(); ++i)
+    {
+        //Take 0 is project file
+        char pEvent[96];
+        snprintf(pEvent, sizeof(pEvent), "event corrupt track=%u start=%ld frames=%ld take=%u",
+            vErrors[i].nTrack + 1, vErrors[i].lStart, vErrors[i].lFrames, vErrors[i].nTake);
+        g_controlServer.Notify(CONTROL_DISK, pEvent);
+        if(g_bHeadless)
+            cerr << "Corrupt data found: " << pEvent + 14 << endl;
+    }
+    nReported = vErrors.size(); //Cleared or project changed when smaller
+}
+
+bool StartJob(int nJob)
+{
+    if(!g_engine.StartJob(nJob))
+        return false;
+    ShowJobStatus();
+    return true;
+}
+
+void ShowJobStatus()
+{
+    static int nShown = JOB_NONE;
+    int nJob = g_engine.GetJob();
+    int nProgress = g_engine.GetJobProgress();
+    if(JOB_COMPACT == nJob)
+        mvprintw(19, 0, "Merging takes - please wait... % 3d%%", nProgress);
+    else if(JOB_BOUNCE == nJob)
+        mvprintw(19, 0, "Exporting mix - please wait... % 3d%%", nProgress);
+    else if(JOB_STEMS == nJob)
+        mvprintw(19, 0, "Exporting stems - please wait... % 3d%%", nProgress);
+    else if(JOB_RESTRUCTURE == nJob)
+        mvprintw(19, 0, "Restructuring tracks - please wait... % 3d%%", nProgress);
+    else if(JOB_IMPORT == nJob)
+        mvprintw(19, 0, "Converting %s file in background... % 3d%%", WAVE_ENCODING_NAMES[g_engine.GetEncoding()], nProgress);
+    else if(JOB_CALIBRATE == nJob)
+        mvprintw(19, 0, "Measuring latency - connect an output to an input... % 3d%%", nProgress);
+    else if(JOB_ANALYSE == nJob)
+        mvprintw(19, 0, "Analysing loudness - please wait... % 3d%%", nProgress);
+    if(JOB_NONE != nJob)
+    {
+        nShown = nJob;
+        refresh();
+        char pEvent[64];
+        sprintf(pEvent, "event job %s %d", JOB_NAMES[nJob], nProgress);
+        g_controlServer.Notify(CONTROL_JOBS, pEvent);
+    }
+    else if(JOB_NONE != nShown)
+    {
+        //Finished so join thread and refresh read-ahead which may hold data read before merge, reloading project after restructure
+        bool bResult = g_engine.EndJob(nShown);
+        double dSeconds = g_engine.GetJobSeconds(nShown);
+        double dDuration = double(g_engine.GetLength()) / g_engine.GetSampleRate();
+        move(19, 0);
+        clrtoeol();
+        if(!bResult && JOB_CALIBRATE == nShown)
+            mvprintw(19, 0, "Latency calibration failed - no loopback found");
+        else if(!bResult)
+            mvprintw(19, 0, "%s failed", JOB_COMPACT == nShown ? "Merge takes" : JOB_RESTRUCTURE == nShown ? "Restructure" : JOB_IMPORT == nShown ? "Import" : JOB_ANALYSE == nShown ? "Analysis" : "Export");
+        else if(JOB_BOUNCE == nShown && dSeconds > 0)
+            mvprintw(19, 0, "Exported %s-mix.wav in %.1fs (%.0fx real time)", g_engine.GetProject().c_str(), dSeconds, dDuration / dSeconds);
+        else if(JOB_STEMS == nShown && dSeconds > 0)
+            mvprintw(19, 0, "Exported %u stems in %.1fs (%.0fx real time)", g_engine.GetStemCount(), dSeconds, dDuration / dSeconds);
+        else if(JOB_IMPORT == nShown && dSeconds > 0)
+            mvprintw(19, 0, "Converted to float in %.1fs (%.0fx real time)", dSeconds, dDuration / dSeconds);
+        else if(JOB_ANALYSE == nShown && dSeconds > 0)
+            mvprintw(19, 0, "Analysed loudness in %.1fs (%.0fx real time) - see %s-loudness.txt", dSeconds, dDuration / dSeconds, g_engine.GetProject().c_str());
+        else if(JOB_CALIBRATE == nShown)
+        {
+            LatencyProbe& probe = g_engine.GetLatencyProbe();
+            mvprintw(19, 0, "Round-trip latency %u frames (%.2fms) on input %c%s - JACK reports %u", g_engine.GetRecordLatency(),
+                g_engine.GetRecordLatency() * 1000.0 / g_engine.GetDeviceRate(), 'A' + probe.GetInput(), probe.IsInverted() ? " inverted" : "", g_engine.GetReportedLatency());
+        }
+        if(JOB_COMPACT == nShown)
+            ShowHeadPosition();
+        if(JOB_RESTRUCTURE == nShown && !g_bHeadless)
+        {
+            //Track list has changed
+            werase(g_pWindowRouting);
+            if(g_nSelectedTrack >= g_engine.GetTrackCount())
+                g_nSelectedTrack = g_engine.GetTrackCount() ? g_engine.GetTrackCount() - 1 : 0;
+            ShowFormat();
+            ShowLength();
+            ShowHeadPosition();
+        }
+        char pEvent[64];
+        sprintf(pEvent, "event job %s %s", JOB_NAMES[nShown], bResult ? "done" : "failed");
+        g_controlServer.Notify(CONTROL_JOBS, pEvent);
+        nShown = JOB_NONE;
+        ShowMenu();
+    }
+}
+
+bool SaveSnapshot(const std::string& sName)
+{
+    std::string sSnapshot = sName;
+    if(sSnapshot.empty())
+    {
+        char pTime[32];
+        time_t tNow = time(NULL);
+        strftime(pTime, sizeof(pTime), "-%Y%m%d-%H%M%S", localtime(&tNow));
+        sSnapshot = g_engine.GetProject() + pTime;
+    }
+    if(!g_engine.SaveSnapshot(sSnapshot))
+        return false;
+    ShowSnapshotStatus();
+    return true;
+}
+
+void ShowSnapshotStatus()
+{
+    static bool bShown = false;
+    Snapshot& snapshot = g_engine.GetSnapshot();
+    if(snapshot.IsBusy())
+    {
+        if(!g_bHeadless)
+        {
+            mvprintw(21, 0, "Saving %s - % 3d%%", snapshot.GetDest().c_str(), snapshot.GetProgress());
+            refresh();
+        }
+        bShown = true;
+    }
+    else if(bShown)
+    {
+        //Finished so release thread and report result
+        bool bResult = snapshot.Wait();
+        if(!g_bHeadless)
+        {
+            move(21, 0);
+            clrtoeol();
+            if(bResult)
+                mvprintw(21, 0, "Saved %s in %.1fs (%u files cloned, %u copied)", snapshot.GetDest().c_str(), snapshot.GetSeconds(), snapshot.GetCloned(), snapshot.GetCopied());
+            else
+                mvprintw(21, 0, "Failed to save %s", snapshot.GetDest().c_str());
+            refresh();
+        }
+        char pEvent[64];
+        sprintf(pEvent, "event snapshot %s", bResult ? "done" : "failed");
+        g_controlServer.Notify(CONTROL_JOBS, pEvent);
+        bShown = false;
+    }
+}
+
+std::string SaveTrace(const std::string& sFilename)
+{
+    std::string sFile = sFilename;
+    if(sFile.empty())
+        sFile = g_engine.GetPath() + g_engine.GetProject() + "-trace.json";
+    if(!TraceDump(sFile))
+        return "";
+    return sFile;
+}
+
 void HandleControl()
 {
+    if(g_bHeadless)
+        return;
     int nInput = getch();
+    if(ERR == nInput)
+        return; //No keypress
+    TraceScope trace("key");
+    Track* pTrack = g_engine.GetTrack(g_nSelectedTrack);
+    unsigned int nSamplerate = g_engine.GetSampleRate();
     switch(nInput)
     {
         case 'q':
@@ -351,148 +634,127 @@ void HandleControl()
             break;
         case KEY_DOWN:
             //Select next track
-            if(++g_nSelectedTrack >= g_vTracks.size())
-                g_nSelectedTrack = g_vTracks.size() - 1;
+            if(++g_nSelectedTrack >= g_engine.GetTrackCount())
+                g_nSelectedTrack = g_engine.GetTrackCount() - 1;
             break;
         case KEY_UP:
             //Select previou track
             if(g_nSelectedTrack > 0)
                 --g_nSelectedTrack;
             break;
+        case KEY_SF:
+            //Move selected track down
+            if(g_engine.MoveTrack(g_nSelectedTrack, g_nSelectedTrack + 1))
+            {
+                ++g_nSelectedTrack;
+                ShowJobStatus();
+            }
+            break;
+        case KEY_SR:
+            //Move selected track up
+            if(g_nSelectedTrack > 0 && g_engine.MoveTrack(g_nSelectedTrack, g_nSelectedTrack - 1))
+            {
+                --g_nSelectedTrack;
+                ShowJobStatus();
+            }
+            break;
+        case '+':
+            //Add track after selected track
+            if(g_engine.AddTrack(g_engine.GetTrackCount() ? g_nSelectedTrack + 1 : 0))
+                ShowJobStatus();
+            break;
+        case 'D':
+            //Delete selected track
+            if(g_engine.RemoveTrack(g_nSelectedTrack))
+                ShowJobStatus();
+            break;
         case KEY_RIGHT:
             //Increase monitor level
-            if(g_vTracks[g_nSelectedTrack]->nMonMix < 100)
-                ++g_vTracks[g_nSelectedTrack]->nMonMix;
+            if(pTrack && pTrack->nMonMix < 100)
+                ++pTrack->nMonMix;
             break;
         case KEY_LEFT:
             //Decrease monitor level
-            if(g_vTracks[g_nSelectedTrack]->nMonMix > 0)
-                --g_vTracks[g_nSelectedTrack]->nMonMix;
+            if(pTrack && pTrack->nMonMix > 0)
+                --pTrack->nMonMix;
             break;
         case KEY_SRIGHT:
             //Set monitor to full level
-            g_vTracks[g_nSelectedTrack]->nMonMix = 100;
+            if(pTrack)
+                pTrack->nMonMix = 100;
             break;
         case KEY_SLEFT:
             //Set monitor to zero level
-            g_vTracks[g_nSelectedTrack]->nMonMix = 0;
+            if(pTrack)
+                pTrack->nMonMix = 0;
             break;
-        case 'l':
-            //Toggle A-leg mute
-            if(g_vTracks[g_nSelectedTrack]->bMuteA)
+        case 'h':
+            //Toggle high-pass filter
+            if(pTrack)
             {
-                g_vTracks[g_nSelectedTrack]->bMuteA = false;
-                ConnectPlayback(g_nSelectedTrack, PORT_A);
+                pTrack->fHighPass = pTrack->fHighPass > 0 ? 0 : INSERT_HIGHPASS;
+                g_engine.UpdateInserts();
             }
-            else
+            break;
+        case 'c':
+            //Toggle compressor
+            if(pTrack)
             {
-                g_vTracks[g_nSelectedTrack]->bMuteA = true;
-                DisconnectPlayback(g_nSelectedTrack, PORT_A);
+                pTrack->fCompThreshold = INSERT_COMP_THRESHOLD;
+                pTrack->fCompRatio = pTrack->fCompRatio > 1 ? 1 : INSERT_COMP_RATIO;
+                g_engine.UpdateInserts();
             }
             break;
+        case 'l':
+            //Toggle A-leg mute
+            if(pTrack)
+                g_engine.SetRouting(g_nSelectedTrack, g_engine.GetRouting(g_nSelectedTrack) ^ PORT_A);
+            break;
         case 'r':
             //Toggle B-leg mute
-            if(g_vTracks[g_nSelectedTrack]->bMuteB)
-            {
-                g_vTracks[g_nSelectedTrack]->bMuteB = false;
-                ConnectPlayback(g_nSelectedTrack, PORT_B);
-            }
-            else
-            {
-                g_vTracks[g_nSelectedTrack]->bMuteB = true;
-                DisconnectPlayback(g_nSelectedTrack, PORT_B);
-            }
+            if(pTrack)
+                g_engine.SetRouting(g_nSelectedTrack, g_engine.GetRouting(g_nSelectedTrack) ^ PORT_B);
             break;
         case 'a':
             //Toggle record from A
-            if(g_nRecA == (int)g_nSelectedTrack)
-            {
-                g_vTracks[g_nRecA]->bRecording = false;
-                g_nRecA = -1;
-            }
-            else
-            {
-                if(g_nRecA > -1)
-                    g_vTracks[g_nRecA]->bRecording = false;
-                g_nRecA = g_nSelectedTrack;
-                g_vTracks[g_nRecA]->bRecording = true;
-            }
+            if(pTrack)
+                g_engine.ArmTrack(PORT_A, g_engine.GetArmedTrack(PORT_A) == (int)g_nSelectedTrack ? -1 : g_nSelectedTrack);
             break;
         case 'b':
             //Toggle record from B
-            if(g_nRecB == (int)g_nSelectedTrack)
-            {
-                g_vTracks[g_nRecB]->bRecording = false;
-                g_nRecB = -1;
-            }
-            else
-            {
-                if(g_nRecB > -1)
-                    g_vTracks[g_nRecB]->bRecording = false;
-                g_nRecB = g_nSelectedTrack;
-                g_vTracks[g_nRecB]->bRecording = true;
-            }
+            if(pTrack)
+                g_engine.ArmTrack(PORT_B, g_engine.GetArmedTrack(PORT_B) == (int)g_nSelectedTrack ? -1 : g_nSelectedTrack);
             break;
         case 'm':
             //Toggle monitor mute (both legs)
-            if(g_vTracks[g_nSelectedTrack]->bMuteA && g_vTracks[g_nSelectedTrack]->bMuteB)
-            {
-               g_vTracks[g_nSelectedTrack]->bMuteA = false;
-               g_vTracks[g_nSelectedTrack]->bMuteB = false;
-            }
-            else
-            {
-               g_vTracks[g_nSelectedTrack]->bMuteA = true;
-               g_vTracks[g_nSelectedTrack]->bMuteB = true;
-            }
-            ConnectPlayback(g_nSelectedTrack, g_vTracks[g_nSelectedTrack]->bMuteA?PORT_NONE:PORT_BOTH);
+            if(pTrack)
+                g_engine.SetRouting(g_nSelectedTrack, PORT_NONE == g_engine.GetRouting(g_nSelectedTrack) ? PORT_BOTH : PORT_NONE);
             break;
         case 'M':
             //Toggle all monitor mute
+            if(pTrack)
             {
-                bool bMute = !g_vTracks[g_nSelectedTrack]->bMuteA;
-                for(unsigned int i = 0; i < g_vTracks.size(); ++i)
-                {
-                    g_vTracks[i]->bMuteA = bMute;
-                    g_vTracks[i]->bMuteB = bMute;
-                    ConnectPlayback(i, bMute?PORT_NONE:PORT_BOTH);
-                }
+                bool bMute = !pTrack->bMuteA;
+                for(unsigned int i = 0; i < g_engine.GetTrackCount(); ++i)
+                    g_engine.SetRouting(i, bMute?PORT_NONE:PORT_BOTH);
             }
             break;
         case ' ':
             //Start / Stop
-            switch(g_nTransport)
+            if(TC_STOPPED == g_engine.GetTransport())
             {
-                case TC_STOPPED:
-                    //Currently stopped so need to open files and interfaces and start
-                    g_nTransport = TC_START;
-                    //!@todo Configure whether auto return to zero when playing from end of track
-                    if(!g_bRecordEnabled && g_lHeadPos >= g_lLastFrame)
-                        g_lHeadPos = 0;
-                    SetPlayHead(g_lHeadPos);
-                    break;
-                case TC_ROLLING:
-                    //Currently playing so need to stop
-                    g_nTransport = TC_STOP;
-                    g_bRecordEnabled = false;
-                    if(g_nRecA > -1)
-                        g_vTracks[g_nRecA]->bRecording = false;
-                    if(g_nRecB > -1)
-                        g_vTracks[g_nRecB]->bRecording = false;
-                    UpdateLength();
-                    break;
+                if(g_engine.StartTransport())
+                    ShowHeadPosition();
+            }
+            else
+            {
+                g_engine.StopTransport();
+                ShowLength();
             }
             break;
         case 'G':
             //Toggle record mode
-            if(g_bRecordEnabled)
-            {
-                if(g_nRecA > -1)
-                    g_vTracks[g_nRecA]->bRecording = false;
-                if(g_nRecB > -1)
-                    g_vTracks[g_nRecB]->bRecording = false;
-            }
-            g_bRecordEnabled = !g_bRecordEnabled;
+            g_engine.SetRecordEnable(!g_engine.IsRecordEnabled());
             break;
         case KEY_HOME:
             //Go to home position
@@ -500,29 +762,84 @@ void HandleControl()
             break;
         case KEY_END:
             //Go to end of track
-            SetPlayHead(g_lLastFrame);
+            SetPlayHead(g_engine.GetLength());
             break;
         case ',':
             //Back 1 seconds
-            SetPlayHead(g_lHeadPos - 1 * g_nSamplerate);
+            SetPlayHead(g_engine.GetPlayHead() - 1 * nSamplerate);
             break;
         case '.':
             //Forward 1 seconds
-            SetPlayHead(g_lHeadPos + 1 * g_nSamplerate);
+            SetPlayHead(g_engine.GetPlayHead() + 1 * nSamplerate);
             break;
         case '<':
             //Back 10 seconds
-            SetPlayHead(g_lHeadPos - 10 * g_nSamplerate);
+            SetPlayHead(g_engine.GetPlayHead() - 10 * nSamplerate);
             break;
         case '>':
             //Forward 10 seconds
-            SetPlayHead(g_lHeadPos + 10 * g_nSamplerate);
+            SetPlayHead(g_engine.GetPlayHead() + 10 * nSamplerate);
+            break;
+        case '[':
+            //Set punch-in at playhead
+            g_engine.SetPunchIn(g_engine.GetPlayHead());
+            break;
+        case ']':
+            //Set punch-out at playhead
+            g_engine.SetPunchOut(g_engine.GetPlayHead());
+            break;
+        case 'p':
+            //Toggle automatic punch-in / punch-out
+            g_engine.SetAutoPunch(!g_engine.IsAutoPunch());
+            break;
+        case 'i':
+            //Cycle input monitor mode
+            g_engine.SetInputMonitor((g_engine.GetInputMonitor() + 1) % 3);
+            break;
+        case 'u':
+            //Undo last take
+            if(g_engine.UndoTake())
+                ShowHeadPosition();
+            break;
+        case 'L':
+            //Measure round-trip latency through loopback
+            StartJob(JOB_CALIBRATE);
             break;
+        case 'A':
+            //Measure loudness and peaks of each track
+            StartJob(JOB_ANALYSE);
+            break;
+        case 'K':
+            //Merge takes into WAVE file
+            StartJob(JOB_COMPACT);
+            break;
+        case 'X':
+            //Export stereo mix
+            StartJob(JOB_BOUNCE);
+            break;
+        case 'S':
+            //Export each track to mono WAVE file
+            StartJob(JOB_STEMS);
+            break;
+        case 'V':
+            //Save a copy of project named after current time
+            SaveSnapshot("");
+            break;
+        case 'T':
+        {
+            //Save timeline trace
+            std::string sFile = SaveTrace("");
+            move(22, 0);
+            clrtoeol();
+            if(sFile.empty())
+                mvprintw(22, 0, "Failed to save trace (build with make multijack-trace)");
+            else
+                mvprintw(22, 0, "Saved trace %s", sFile.c_str());
+            break;
+        }
         case 'e':
             //Clear errors
-//            g_nUnderruns = 0;
-//            g_nOverruns = 0;
-//            g_nRecUnderruns = 0;
+            g_engine.GetDiskStream().ClearErrors();
             move(18, 0);
             clrtoeol();
             move(19, 0);
@@ -537,532 +854,446 @@ void HandleControl()
     ShowMenu();
 }
 
-bool OpenFile()
+void SetPlayHead(long lPosition)
 {
-    // Expect header to be 12 + 24 + 8 = 44
-	//**Open file**
-	if(g_fdWave < 0)
+    g_engine.SetPlayHead(lPosition);
+    ShowHeadPosition();
+}
+
+string HandleCommand(const string& sCommand)
+{
+    TraceScope trace("command");
+    char sVerb[16] = "";
+    char sArg1[32] = "";
+    char sArg2[32] = "";
+    int nArgs = sscanf(sCommand.c_str(), "%15s %31s %31s", sVerb, sArg1, sArg2);
+    char pResponse[512];
+    //Tracks are numbered from 1 as shown in user interface
+    int nTrack = atoi(sArg1) - 1;
+    int nTracks = g_engine.GetTrackCount();
+    bool bValidTrack = nArgs >= 2 && nTrack >= 0 && nTrack < nTracks;
+    int nRecA = g_engine.GetArmedTrack(PORT_A);
+    int nRecB = g_engine.GetArmedTrack(PORT_B);
+    int nTransport = g_engine.GetTransport();
+
+    if(0 == strcmp(sVerb, "status"))
+    {
+        bool bRolling = (TC_ROLLING == nTransport || TC_START == nTransport);
+        DiskStream& diskStream = g_engine.GetDiskStream();
+        snprintf(pResponse, sizeof(pResponse), "ok transport=%s record=%d position=%ld length=%ld rate=%u tracks=%u arma=%d armb=%d takes=%u job=%s ready=%d underruns=%u overruns=%u spool=%lu spoolsize=%lu latency=%u calibrated=%d punch=%d punchin=%ld punchout=%ld monitor=%s corrupt=%u",
+            bRolling ? "rolling" : "stopped", g_engine.IsRecordEnabled() ? 1 : 0, g_engine.GetPlayHead(), g_engine.GetLength(), g_engine.GetSampleRate(), nTracks,
+            nRecA + 1, nRecB + 1, g_engine.GetTakeCount(), JOB_NAMES[g_engine.GetJob()], g_bReady ? 1 : 0,
+            diskStream.GetUnderruns(), diskStream.GetOverruns(), diskStream.GetSpoolFrames(), diskStream.GetSpoolCapacity(), g_engine.GetRecordLatency(), g_engine.IsCalibrated() ? 1 : 0, g_engine.IsAutoPunch() ? 1 : 0, g_engine.GetPunchIn(), g_engine.GetPunchOut(),
+            MONITOR_NAMES[g_engine.GetInputMonitor()], g_engine.GetScrubber().GetErrorCount());
+        return pResponse;
+    }
+    if(0 == strcmp(sVerb, "quit"))
+    {
+        g_bRunning = false;
+        return "ok";
+    }
+    if(0 == strcmp(sVerb, "trace"))
+    {
+        //trace [file] - default file is named after project
+        std::string sFile = SaveTrace(nArgs < 2 ? "" : sCommand.substr(sCommand.find(sArg1)));
+        if(sFile.empty())
+            return "error tracing not built in or file not written";
+        return "ok " + sFile;
+    }
+    if(!g_engine.IsConnected() || !g_engine.IsOpen())
+        return "error not ready";
+
+    const char* pError = NULL;
+    if(0 == strcmp(sVerb, "play"))
+    {
+        if(!g_engine.StartTransport())
+            pError = "busy";
+    }
+    else if(0 == strcmp(sVerb, "stop"))
+    {
+        g_engine.StopTransport();
+        ShowLength();
+    }
+    else if(0 == strcmp(sVerb, "record"))
+    {
+        if(0 == strcmp(sArg1, "on"))
+            g_engine.SetRecordEnable(true);
+        else if(0 == strcmp(sArg1, "off"))
+            g_engine.SetRecordEnable(false);
+        else
+            pError = "usage: record on|off";
+    }
+    else if(0 == strcmp(sVerb, "arm"))
+    {
+        //arm a|b <track>|none
+        nTrack = atoi(sArg2) - 1;
+        if((strcmp(sArg1, "a") && strcmp(sArg1, "b")) || nArgs < 3)
+            pError = "usage: arm a|b <track>|none";
+        else if(0 == strcmp(sArg2, "none"))
+            g_engine.ArmTrack(0 == strcmp(sArg1, "a") ? PORT_A : PORT_B, -1);
+        else if(nTrack < 0 || nTrack >= nTracks)
+            pError = "invalid track";
+        else
+            g_engine.ArmTrack(0 == strcmp(sArg1, "a") ? PORT_A : PORT_B, nTrack);
+    }
+    else if(0 == strcmp(sVerb, "gain"))
+    {
+        int nGain = atoi(sArg2);
+        if(!bValidTrack || nArgs < 3 || nGain < 0 || nGain > 100)
+            pError = "usage: gain <track> <0-100>";
+        else
+            g_engine.GetTrack(nTrack)->nMonMix = nGain;
+    }
+    else if(0 == strcmp(sVerb, "route"))
+    {
+        unsigned int nPorts = PORT_NONE;
+        if(0 == strcmp(sArg2, "l"))
+            nPorts = PORT_A;
+        else if(0 == strcmp(sArg2, "r"))
+            nPorts = PORT_B;
+        else if(0 == strcmp(sArg2, "both"))
+            nPorts = PORT_BOTH;
+        else if(strcmp(sArg2, "none"))
+            nArgs = 0;
+        if(!bValidTrack || nArgs < 3)
+            pError = "usage: route <track> l|r|both|none";
+        else
+            g_engine.SetRouting(nTrack, nPorts);
+    }
+    else if(0 == strcmp(sVerb, "punch"))
     {
-        //File not open
-        string sFilename = g_sPath;
-        sFilename.append(g_sProject);
-        sFilename.append(".wav");
-        g_fdWave = open(sFilename.c_str(), O_RDWR | O_CREAT, 0644);
-        if(g_fdWave <= 0)
+        //punch in|out <frame> or punch on|off
+        if(0 == strcmp(sArg1, "in") && nArgs > 2)
+            g_engine.SetPunchIn(atol(sArg2));
+        else if(0 == strcmp(sArg1, "out") && nArgs > 2)
+            g_engine.SetPunchOut(atol(sArg2));
+        else if(0 == strcmp(sArg1, "on"))
         {
-            cerr << "Unable to open or create file" << sFilename << " - error " << errno << endl;
-            return false;
+            if(!g_engine.SetAutoPunch(true))
+                pError = "punch-out must be after punch-in";
         }
-
-        //**Read RIFF headers**
-        char pBuffer[12];
-        if((read(g_fdWave, pBuffer, 12) < 12) || (0 != strncmp(pBuffer, "RIFF", 4)) || (0 != strncmp(pBuffer + 8, "WAVE", 4)))
+        else if(0 == strcmp(sArg1, "off"))
+            g_engine.SetAutoPunch(false);
+        else
+            pError = "usage: punch in|out <frame> or punch on|off";
+    }
+    else if(0 == strcmp(sVerb, "monitor"))
+    {
+        //monitor off|auto|input
+        int nMode = -1;
+        for(int i = MONITOR_OFF; i <= MONITOR_INPUT; ++i)
+            if(0 == strcmp(sArg1, MONITOR_NAMES[i]))
+                nMode = i;
+        if(nMode < 0)
+            pError = "usage: monitor off|auto|input";
+        else
+            g_engine.SetInputMonitor(nMode);
+    }
+    else if(0 == strcmp(sVerb, "locate"))
+    {
+        if(nArgs < 2)
+            pError = "usage: locate <frame>";
+        else if(g_engine.IsRecordEnabled() && TC_ROLLING == nTransport)
+            pError = "recording";
+        else
+            SetPlayHead(atol(sArg1));
+    }
+    else if(0 == strcmp(sVerb, "undo"))
+    {
+        if(!g_engine.UndoTake())
+            pError = "nothing to undo";
+    }
+    else if(0 == strcmp(sVerb, "save"))
+    {
+        if(!g_engine.SaveProject())
+            pError = "save failed";
+    }
+    else if(0 == strcmp(sVerb, "snapshot"))
+    {
+        //snapshot [name] - default name is project name with current time
+        if(!SaveSnapshot(nArgs < 2 ? "" : sArg1))
+            pError = "busy or name exists";
+    }
+    else if(0 == strcmp(sVerb, "compact"))
+    {
+        if(!StartJob(JOB_COMPACT))
+            pError = "busy";
+    }
+    else if(0 == strcmp(sVerb, "calibrate"))
+    {
+        //calibrate [clear] - measure round trip through loopback or revert to latency reported by JACK
+        if(nArgs > 1 && strcmp(sArg1, "clear"))
+            pError = "usage: calibrate [clear]";
+        else if(nArgs > 1)
+            g_engine.ClearCalibration();
+        else if(!StartJob(JOB_CALIBRATE))
+            pError = "busy";
+    }
+    else if(0 == strcmp(sVerb, "scrub"))
+    {
+        //scrub [clear] - integrity scrubber progress and corrupt ranges, each track,start,frames,take (take 0 is project file)
+        Scrubber& scrubber = g_engine.GetScrubber();
+        if(nArgs > 1 && strcmp(sArg1, "clear"))
+            return "error usage: scrub [clear]";
+        if(nArgs > 1)
         {
-            //Invalid file so create a WAVE file with 4 seconds of silence
-            g_nSamplerate = jack_get_sample_rate(g_pJackClient); //!@todo Handle different samplerate to project (warn and resolve?)
-            if(0 == g_nSamplerate)
-                g_nSamplerate = DEFAULT_SAMPLERATE;
-            size_t nWaveSize = g_nSamplerate * MAX_TRACKS * sizeof(jack_default_audio_sample_t) * 4;
-            WriteHeader(nWaveSize, MAX_TRACKS);
-            unsigned char pSilentBuffer[nWaveSize];
-            memset(pSilentBuffer, 0, nWaveSize);
-            pwrite(g_fdWave, pSilentBuffer, nWaveSize, 44);
-            ftruncate(g_fdWave, 44 + nWaveSize);
-            lseek(g_fdWave, 12, SEEK_SET);
+            scrubber.ClearErrors();
+            return "ok";
         }
-
-        char pWaveBuffer[sizeof(WaveHeader)];
-        WaveHeader* pWaveHeader = (WaveHeader*)pWaveBuffer;
-
-        //Look for chuncks
-        while(read(g_fdWave, pBuffer, 8) == 8) //read ckID and cksize
+        std::vector<ScrubError> vErrors = scrubber.GetErrors();
+        snprintf(pResponse, sizeof(pResponse), "ok running=%d progress=%d passes=%u verified=%lu adopted=%lu corrupt=%u",
+            scrubber.IsRunning() ? 1 : 0, scrubber.GetProgress(), scrubber.GetPasses(), scrubber.GetVerified(), scrubber.GetAdopted(), (unsigned int)vErrors.size());
+        string sResponse = pResponse;
+        for(std::vector<ScrubError>::iterator it = vErrors.begin(); it != vErrors.end(); ++it)
         {
-            char sId[5] = {0,0,0,0,0}; //buffer for debug output only
-            strncpy(sId, pBuffer, 4); //chunk ID is first 32-bit word
-            uint32_t nSize = (uint32_t)*(pBuffer + 4); //chunk size is second 32-bit word
-
-    //        cerr << endl << "Found chunk " << sId << " of size " << nSize << endl;
-            if(0 == strncmp(pBuffer, "fmt ", 4)) //chunk ID is first 32-bit word
-            {
-                //Found format chunk
-                if(read(g_fdWave, pWaveBuffer, sizeof(pWaveBuffer)) < (int)sizeof(pWaveBuffer))
-                {
-                    cerr << "Too small for WAVE header" << endl;
-//                    CloseReplay();
-                    return false;
-                }
-                for(unsigned int nTrack = 0; nTrack < pWaveHeader->nNumChannels; ++nTrack)
-                    g_vTracks.push_back(new Track());
-                if(g_vTracks.size() > MAX_TRACKS)
-                {
-                    //!@todo handle too many tracks, e.g. ask whether to delete extra tracks
-                }
-                CreateJackSources();
-                g_nSamplerate = pWaveHeader->nSampleRate;
-                if(0 == g_nSamplerate)
-                    g_nSamplerate = DEFAULT_SAMPLERATE;
-                g_nFrameSize = g_vTracks.size() * sizeof(jack_default_audio_sample_t);
-                if(jack_get_sample_rate(g_pJackClient) != g_nSamplerate)
-                    attron(COLOR_PAIR(WHITE_RED));
-                else
-                    attron(COLOR_PAIR(WHITE_MAGENTA));
-                mvprintw(0, MENU_FORMAT, " % 6dHz ", pWaveHeader->nSampleRate);
-                attroff(COLOR_PAIR(WHITE_MAGENTA));
-                lseek(g_fdWave, nSize - sizeof(pWaveBuffer), SEEK_CUR); //ignore other parameters
-            }
-            else if(0 == strncmp(pBuffer, "data ", 4))
-            {
-                //Aligned with start of data so must have read all header
-                g_offStartOfData = lseek(g_fdWave, 0, SEEK_CUR);
-                g_offEndOfData = lseek(g_fdWave, 0, SEEK_END);
-
-                if(g_offStartOfData != 44)
-                {
-                    mvprintw(18, 0, "Importing file - please wait...");
-                    attron(COLOR_PAIR(COLOR_RED));
-                    mvprintw(19, 0, "                                    ");
-                    attroff(COLOR_PAIR(COLOR_RED));
-                    refresh();
-                    //Use minimal RIFF header - write new header, move wave data then truncate file
-                    off_t nWaveSize = g_offEndOfData - g_offStartOfData;
-                    WriteHeader(nWaveSize, g_vTracks.size());
-                    char pData[512];
-                    off_t offRead = g_offStartOfData;
-                    off_t offWrite = 44;
-                    int nRead;
-                    int nProgress = 0;
-                    while((nRead = pread(g_fdWave, pData, sizeof(pData), offRead)) > 0)
-                    {
-                        pwrite(g_fdWave, pData, nRead, offWrite);
-                        offWrite += nRead;
-                        offRead += nRead;
-                        int nProgressTemp = 100 * offRead / nWaveSize;
-                        if(nProgressTemp != nProgress)
-                        {
-                            nProgress = nProgressTemp;
-                            mvprintw(18, 32, "% 2d%%", nProgress);
-                            attron(COLOR_PAIR(COLOR_GREEN));
-                            mvprintw(19, nProgress / 2.77, " ");
-                            attroff(COLOR_PAIR(COLOR_GREEN));
-                            refresh();
-                        }
-                    }
-                    ftruncate(g_fdWave, 44 + nWaveSize);
-                    g_offStartOfData = 44;
-                    move(18, 0);
-                    clrtoeol();
-                    move(19, 0);
-                    clrtoeol();
-                    refresh();
-                }
-
-                g_offEndOfData = lseek(g_fdWave, 0, SEEK_END);
-                g_lLastFrame = (g_offEndOfData - g_offStartOfData) / (g_nFrameSize);
-                return true;
-            }
-            else
-                lseek(g_fdWave, nSize, SEEK_CUR); //Not found desired chunk so seek to next chunk
+            snprintf(pResponse, sizeof(pResponse), " %u,%ld,%ld,%u", it->nTrack + 1, it->lStart, it->lFrames, it->nTake);
+            sResponse += pResponse;
         }
-        cerr << "Failed to get WAVE header";
+        return sResponse;
     }
-    return false;
-}
-
-void CreateJackSources()
-{
-    if(!g_pJackClient)
-        return;
-    //Disconnect existing ports
-    for(vector<jack_port_t*>::iterator it = g_vJackSourcePorts.begin(); it != g_vJackSourcePorts.end(); ++it)
-        jack_port_disconnect(g_pJackClient, *it);
-    g_vJackSourcePorts.clear();
-    for(unsigned int i = 1; i <= g_vTracks.size(); ++i)
+    else if(0 == strcmp(sVerb, "analyse"))
+    {
+        if(!StartJob(JOB_ANALYSE))
+            pError = "busy";
+    }
+    else if(0 == strcmp(sVerb, "export"))
+    {
+        if(strcmp(sArg1, "mix") && strcmp(sArg1, "stems"))
+            pError = "usage: export mix|stems";
+        else if(!StartJob(0 == strcmp(sArg1, "mix") ? JOB_BOUNCE : JOB_STEMS))
+            pError = "busy";
+    }
+    else if(0 == strcmp(sVerb, "addtrack"))
     {
-        char sName[9];
-        memset(sName, 0, 9);
-        sprintf(sName, "Track %02u", i);
-        jack_port_t* pPort = jack_port_register(g_pJackClient, sName, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
-        if(pPort)
-            g_vJackSourcePorts.push_back(pPort);
+        //addtrack [position] - default is after last track
+        int nPosition = nArgs < 2 ? nTracks : atoi(sArg1) - 1;
+        if(nPosition < 0 || nPosition > nTracks)
+            pError = "usage: addtrack [position]";
+        else if(!g_engine.AddTrack(nPosition))
+            pError = "busy";
         else
-            cerr << "Failed to created source port " << i << endl;
-        g_vTracks[i - 1]->pSourcePort = pPort;
+            ShowJobStatus();
     }
-}
-
-void WriteHeader(unsigned int nWaveSize, unsigned int nChannels)
-{
-    if(g_fdWave <= 0)
-        return;
-    //Use minimal RIFF header - write new header, move wave data then truncate file
-    char pHeader[36];
-    strncpy(pHeader, "RIFF", 4);
-    SetLE32(pHeader + 4, nWaveSize + 36); //size of RIFF chunck
-    strncpy(pHeader + 8, "WAVE", 4);
-    strncpy(pHeader + 12, "fmt ", 4); //start of format chunk
-    SetLE32(pHeader + 16, 16); //size of format chunck
-    SetLE16(pHeader + 20, 3); //Audio format = IEEE float
-    SetLE16(pHeader + 22, nChannels); //Number of channels
-    SetLE32(pHeader + 24, g_nSamplerate);
-    SetLE32(pHeader + 28, g_nSamplerate * nChannels * sizeof(jack_default_audio_sample_t)); //Sample rate
-    SetLE16(pHeader + 32, nChannels * sizeof(jack_default_audio_sample_t)); //Block align == frame size
-    SetLE16(pHeader + 34, sizeof(jack_default_audio_sample_t) * 8); //Bits per sample
-    pwrite(g_fdWave, pHeader, sizeof(pHeader), 0);
-    strncpy(pHeader, "data", 4);
-    SetLE32(pHeader + 4, nWaveSize);
-    pwrite(g_fdWave, pHeader, 8, 36);
-}
-
-/** Write a 16-bit, little-endian word to a char buffer */
-void SetLE16(char* pBuffer, uint16_t nWord)
-{
-    *pBuffer = char(nWord & 0xFF);
-    *(pBuffer + 1) = char((nWord >> 8) & 0xFF);
-}
-
-/** Write a 32-bit, little-endian word to a char buffer */
-void SetLE32(char* pBuffer, uint32_t nWord)
-{
-    *pBuffer = char(nWord & 0xFF);
-    *(pBuffer + 1) = char((nWord >> 8) & 0xFF);
-    *(pBuffer + 2) = char((nWord >> 16) & 0xFF);
-    *(pBuffer + 3) = char((nWord >> 24) & 0xFF);
-}
-
-void CloseFile()
-{
-    if(g_fdWave > 0)
+    else if(0 == strcmp(sVerb, "removetrack"))
     {
-        //Write RIFF chunck length
-        char pBuffer[4];
-        SetLE32(pBuffer, g_offEndOfData - 8);
-        pwrite(g_fdWave, pBuffer, 4, 4);
-        close(g_fdWave);
+        if(!bValidTrack)
+            pError = "usage: removetrack <track>";
+        else if(!g_engine.RemoveTrack(nTrack))
+            pError = "busy";
+        else
+            ShowJobStatus();
     }
-    g_fdWave = -1;
-    if(TC_ROLLING == g_nTransport)
-        g_nTransport = TC_STOP; //!@todo Can we fade out after closing file?
-    for(vector<Track*>::iterator it = g_vTracks.begin(); it != g_vTracks.end(); ++it)
-        delete *it;
-    g_vTracks.clear();
-}
-
-void SetPlayHead(int nPosition)
-{
-    if(g_bRecordEnabled && TC_ROLLING == g_nTransport)
-        return; //Don't allow shuttling when recording
-    g_lHeadPos = nPosition;
-    if(g_lHeadPos < 0)
-        g_lHeadPos = 0;
-    if(g_lHeadPos > g_lLastFrame)
-        g_lHeadPos = g_lLastFrame;
-    if(g_fdWave > 0)
-        lseek(g_fdWave, g_offStartOfData + g_lHeadPos * g_nFrameSize, SEEK_SET);
-    jack_transport_locate(g_pJackClient, nPosition);
-    ShowHeadPosition();
-}
-
-bool LoadProject(string sName)
-{
-    //Project consists of sName.wav and sName.cfg
-    //Close existing WAVE file and open new one
-    CloseFile();
-    attron(COLOR_PAIR(WHITE_MAGENTA));
-    move(0, MENU_FORMAT);
-    clrtoeol();
-    attroff(COLOR_PAIR(WHITE_MAGENTA));
-    g_sProject = sName;
-    if(!OpenFile())
-        return false;
-    attron(COLOR_PAIR(WHITE_MAGENTA));
-    mvprintw(0, MENU_PROJECT, "Project: %s", sName.c_str());
-    attroff(COLOR_PAIR(WHITE_MAGENTA));
-
-    //Get configuration
-    string sConfig = g_sPath;
-    sConfig.append(sName);
-    sConfig.append(".cfg");
-    FILE *pFile = fopen(sConfig.c_str(), "r");
-    if(pFile)
+    else if(0 == strcmp(sVerb, "movetrack"))
+    {
+        int nPosition = atoi(sArg2) - 1;
+        if(!bValidTrack || nArgs < 3 || nPosition < 0 || nPosition >= nTracks)
+            pError = "usage: movetrack <track> <position>";
+        else if(nPosition != nTrack && !g_engine.MoveTrack(nTrack, nPosition))
+            pError = "busy";
+        else
+            ShowJobStatus();
+    }
+    else if(0 == strcmp(sVerb, "insert"))
     {
-        char pLine[256];
-        while(fgets(pLine, sizeof(pLine), pFile))
+        //insert <track> hp <hz> | eq <hz> <dB> <q> | comp <dB> <ratio> | off
+        float afValue[3] = {0, 0, 0};
+        int nValues = sscanf(sCommand.c_str(), "%*s %*s %*s %f %f %f", &afValue[0], &afValue[1], &afValue[2]);
+        Track* pTrack = g_engine.GetTrack(nTrack);
+        if(!bValidTrack || nArgs < 3)
+            pError = "usage: insert <track> hp <hz>|eq <hz> <dB> <q>|comp <dB> <ratio>|off";
+        else if(0 == strcmp(sArg2, "hp") && 1 == nValues && afValue[0] >= 0)
+            pTrack->fHighPass = afValue[0];
+        else if(0 == strcmp(sArg2, "eq") && 3 == nValues && afValue[0] > 0 && afValue[2] > 0)
         {
-            if(strnlen(pLine, sizeof(pLine)) < 5)
-                continue;
-            unsigned int nChannel = (pLine[0] - '0') * 10 + (pLine[1] - '0');
-            if(nChannel >= 0 && nChannel < g_vTracks.size())
-            {
-                switch(pLine[2])
-                {
-                    case 'V':
-                        g_vTracks[nChannel]->nMonMix = atoi(pLine + 4);
-                        break;
-                    case 'L':
-                        //Route  / Mute A
-                        g_vTracks[nChannel]->bMuteA = (pLine[4] != '1');
-                        break;
-                    case 'R':
-                        //Route  / Mute B
-                        g_vTracks[nChannel]->bMuteB = (pLine[4] != '1');
-                        break;
-                }
-                if(g_vTracks[nChannel]->bMuteA)
-                    DisconnectPlayback(nChannel, PORT_A);
-                else
-                    ConnectPlayback(nChannel, PORT_A);
-                if(g_vTracks[nChannel]->bMuteB)
-                    DisconnectPlayback(nChannel, PORT_B);
-                else
-                    ConnectPlayback(nChannel, PORT_B);
-            }
-            if(0 == strncmp(pLine, "Pos=", 4))
-                g_lHeadPos = atoi(pLine + 4); //Set transport position
+            pTrack->fEqFrequency = afValue[0];
+            pTrack->fEqGain = afValue[1];
+            pTrack->fEqQ = afValue[2];
+        }
+        else if(0 == strcmp(sArg2, "comp") && 2 == nValues && afValue[1] >= 1)
+        {
+            pTrack->fCompThreshold = afValue[0];
+            pTrack->fCompRatio = afValue[1];
+        }
+        else if(0 == strcmp(sArg2, "off"))
+        {
+            pTrack->fHighPass = 0;
+            pTrack->fEqGain = 0;
+            pTrack->fCompRatio = 1;
+        }
+        else
+            pError = "usage: insert <track> hp <hz>|eq <hz> <dB> <q>|comp <dB> <ratio>|off";
+        if(!pError)
+            g_engine.UpdateInserts();
+    }
+    else if(0 == strcmp(sVerb, "track"))
+    {
+        if(!bValidTrack)
+            return "error usage: track <track>";
+        const char* asRoute[] = {"none", "l", "r", "both"};
+        Track* pTrack = g_engine.GetTrack(nTrack);
+        snprintf(pResponse, sizeof(pResponse), "ok track=%d gain=%d route=%s arm=%s hp=%g eq=%g,%g,%g comp=%g,%g",
+            nTrack + 1, pTrack->nMonMix, asRoute[g_engine.GetRouting(nTrack)],
+            nTrack == nRecA ? "a" : nTrack == nRecB ? "b" : "none",
+            pTrack->fHighPass, pTrack->fEqFrequency, pTrack->fEqGain, pTrack->fEqQ, pTrack->fCompThreshold, pTrack->fCompRatio);
+        const LoudnessResult* pLoudness = g_engine.GetLoudness(nTrack);
+        if(pLoudness)
+        {
+            size_t nLength = strlen(pResponse);
+            snprintf(pResponse + nLength, sizeof(pResponse) - nLength, " loudness=%.1f range=%.1f peak=%.1f truepeak=%.1f clips=%lu",
+                pLoudness->dIntegrated, pLoudness->dRange, pLoudness->dSamplePeak, pLoudness->dTruePeak, pLoudness->lClips);
         }
-        fclose(pFile);
+        return pResponse;
     }
-    SetPlayHead(g_lHeadPos);
-    g_nPeriodSize = g_nFrameSize * PERIOD_SIZE; //!@todo Use Jack period size
-    //Create new silent period
-    delete[] g_pSilence;
-    g_pSilence = new char[g_nPeriodSize];
-    memset(g_pSilence, 0, g_nPeriodSize);
-    //Create new read buffer
-    delete[] g_pReadBuffer;
-    g_pReadBuffer = new jack_default_audio_sample_t[g_nPeriodSize];
-    UpdateLength();
-    return true;
+    else
+        pError = "unknown command";
+
+    if(pError)
+        return string("error ") + pError;
+    ShowMenu();
+    return "ok";
 }
 
-bool SaveProject(std::string sName)
+void NotifyControl()
 {
-    std::string sConfig = g_sPath;
-    if(sName == "")
+    static bool bRolling = false;
+    static bool bRecord = false;
+    static timespec tsLast = {0, 0};
+    char pEvent[64];
+    int nTransport = g_engine.GetTransport();
+    bool bNowRolling = (TC_ROLLING == nTransport || TC_START == nTransport);
+    if(bNowRolling != bRolling || g_engine.IsRecordEnabled() != bRecord)
     {
-        sConfig.append(g_sProject);
+        bRolling = bNowRolling;
+        bRecord = g_engine.IsRecordEnabled();
+        sprintf(pEvent, "event transport %s record=%d position=%ld", bRolling ? "rolling" : "stopped", bRecord ? 1 : 0, g_engine.GetPlayHead());
+        g_controlServer.Notify(CONTROL_TRANSPORT, pEvent);
     }
-    else
+
+    timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    if((tsNow.tv_sec - tsLast.tv_sec) * 1000 + (tsNow.tv_nsec - tsLast.tv_nsec) / 1000000 < NOTIFY_PERIOD)
+        return;
+    tsLast = tsNow;
+    if(bRolling && g_controlServer.IsSubscribed(CONTROL_POSITION))
     {
-        sConfig.append(sName);
-        string sCpCmd = "cp ";
-        sCpCmd.append(g_sPath);
-        sCpCmd.append(g_sProject);
-        sCpCmd.append(".wav");
-        sCpCmd.append(" ");
-        sCpCmd.append(g_sPath);
-        sCpCmd.append(sName);
-        sCpCmd.append(".wav");
-        system(sCpCmd.c_str());
-        g_sProject = sName;
+        sprintf(pEvent, "event position %ld", g_engine.GetPlayHead());
+        g_controlServer.Notify(CONTROL_POSITION, pEvent);
     }
-    sConfig.append(".cfg");
-    FILE *pFile = fopen(sConfig.c_str(), "w+");
-    if(pFile)
+    //Peaks are reset each period so that meters fall when level drops
+    bool bMeters = bRolling && g_controlServer.IsSubscribed(CONTROL_METERS);
+    string sMeters = "event meters";
+    for(unsigned int nTrack = 0; nTrack < g_engine.GetTrackCount(); ++nTrack)
     {
-        char pBuffer[32];
-        fputs("# This configuration file is completely overwritten each time the project is saved\n", pFile);
-        fputs("# Do not manually edit this file whilst multijack is using this project.\n\n", pFile);
-        for(unsigned int i = 0; i < g_vTracks.size(); ++i)
+        float fPeak = g_engine.GetTrack(nTrack)->peak.Take();
+        if(bMeters)
         {
-            memset(pBuffer, 0, sizeof(pBuffer));
-            sprintf(pBuffer, "%02dV=%d\n", i, g_vTracks[i]->nMonMix);
-            fputs(pBuffer, pFile);
-            memset(pBuffer, 0, sizeof(pBuffer));
-            sprintf(pBuffer, "%02dL=%s",i, g_vTracks[i]->bMuteA?"0\n":"1\n");
-            fputs(pBuffer, pFile);
-            memset(pBuffer, 0, sizeof(pBuffer));
-            sprintf(pBuffer, "%02dR=%s",i, g_vTracks[i]->bMuteB?"0\n":"1\n");
-            fputs(pBuffer, pFile);
+            sprintf(pEvent, " %.3f", fPeak);
+            sMeters += pEvent;
         }
-        memset(pBuffer, 0, sizeof(pBuffer));
-        sprintf(pBuffer, "Pos=%ld\n", g_lHeadPos);
-        fputs(pBuffer , pFile);
-
-        fclose(pFile);
-        return true;
     }
-    return false;
+    if(bMeters)
+        g_controlServer.Notify(CONTROL_METERS, sMeters);
 }
 
-void UpdateLength()
+bool LoadProject(const string& sName)
 {
-    if(0 == g_nFrameSize)
-        return;
-    g_lLastFrame = (g_offEndOfData - g_offStartOfData) / g_nFrameSize;
+    clock_gettime(CLOCK_MONOTONIC, &g_tsLoad);
+    g_bReady = false;
     attron(COLOR_PAIR(WHITE_MAGENTA));
-    unsigned int nMinutes = g_lLastFrame / g_nSamplerate / 60;
-    unsigned int nSeconds = (g_lLastFrame - nMinutes * g_nSamplerate * 60) / g_nSamplerate;
-    unsigned int nMillis = (g_lLastFrame - (nMinutes * 60 + nSeconds) * g_nSamplerate) * 1000 / 44100;
-    mvprintw(0, MENU_SIZE, "%02d:%02d.%03d ", nMinutes, nSeconds, nMillis);
+    move(0, MENU_FORMAT);
+    clrtoeol();
+    attroff(COLOR_PAIR(WHITE_MAGENTA));
+    if(!g_engine.LoadProject(sName))
+        return false;
+    ShowFormat();
+    attron(COLOR_PAIR(WHITE_MAGENTA));
+    mvprintw(0, MENU_PROJECT, "Project: %s", sName.c_str());
     attroff(COLOR_PAIR(WHITE_MAGENTA));
+    ShowHeadPosition();
+    ShowLength();
+    return true;
 }
 
-void ConnectPlayback(unsigned int nTrack, unsigned int nPorts)
+void ShowReadyStatus()
 {
-    if(nTrack >= g_vTracks.size())
+    if(g_bReady || !g_engine.IsOpen())
         return;
-    char pCharPort[19];
-    sprintf(pCharPort, "multijack:Track %02d", nTrack + 1);
-    if(PORT_NONE == nPorts)
+    if(!g_engine.GetDiskStream().IsPrimed())
     {
-        jack_disconnect(g_pJackClient, pCharPort, jack_port_name(g_pPortPlaybackA));
-        jack_disconnect(g_pJackClient, pCharPort, jack_port_name(g_pPortPlaybackB));
+        mvprintw(17, 12, "Loading...");
         return;
     }
-    if(PORT_A & nPorts)
-        jack_connect(g_pJackClient, pCharPort, jack_port_name(g_pPortPlaybackA));
-    if(PORT_B & nPorts)
-        jack_connect(g_pJackClient, pCharPort, jack_port_name(g_pPortPlaybackB));
-}
-
-void DisconnectPlayback(unsigned int nTrack, unsigned int nPorts)
-{
-    if(nTrack >= g_vTracks.size())
-        return;
-    char pCharPort[19];
-    sprintf(pCharPort, "multijack:Track %02d", nTrack + 1);
-    if(PORT_A & nPorts)
-        jack_disconnect(g_pJackClient, pCharPort, jack_port_name(g_pPortPlaybackA));
-    if(PORT_B & nPorts)
-        jack_disconnect(g_pJackClient, pCharPort, jack_port_name(g_pPortPlaybackB));
-}
-
-bool Record(jack_nframes_t nFrames)
-{
-    if(TC_ROLLING != g_nTransport)
-        return false; //Can't record if we are not rolling
-    if(!g_bRecordEnabled)
-        return false; //Don't record if we are not in record mode
-    if(g_fdWave <= 0)
-        return false; //WAVE file not open so nothing to record to
-    if((-1 == g_nRecA) && (-1 == g_nRecB))
-        return false; //No record channels primed
-    if(g_lHeadPos < g_nRecordOffset)
-        return true; //Record head not past start of file
-
-    //!@todo Move extend file code to here?
-
-    jack_default_audio_sample_t* pInA = (jack_default_audio_sample_t*)(jack_port_get_buffer(g_pPortInputA, nFrames));
-    jack_default_audio_sample_t* pInB = (jack_default_audio_sample_t*)(jack_port_get_buffer(g_pPortInputB, nFrames));
-
-    //Write samples to file
-    off_t offRewrite = g_offStartOfData + (g_lHeadPos - g_nRecordOffset) * g_nFrameSize;
-    ssize_t nRead = pread(g_fdWave, g_pReadBuffer, nFrames * g_nFrameSize, offRewrite);
-    if(nRead != nFrames * g_nFrameSize)
-        return false; //Failed to read frame of data
-    for(jack_nframes_t nFrame = 0; nFrame < nFrames; ++nFrame)
-    {
-        if(-1 != g_nRecA)
-            g_pReadBuffer[nFrame * g_vTracks.size() + g_nRecA] = pInA[nFrame];
-        if(-1 != g_nRecB)
-            g_pReadBuffer[nFrame * g_vTracks.size() + g_nRecB] = pInB[nFrame];
-    }
-    pwrite(g_fdWave, g_pReadBuffer, nRead, offRewrite);
-    return true;
+    //Report time from project load and from power on until playback data is available
+    timespec tsNow, tsBoot;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    clock_gettime(CLOCK_BOOTTIME, &tsBoot);
+    double dLoad = tsNow.tv_sec - g_tsLoad.tv_sec + (tsNow.tv_nsec - g_tsLoad.tv_nsec) / 1e9;
+    mvprintw(17, 12, "Ready in %.2fs (%.1fs after boot)", dLoad, tsBoot.tv_sec + tsBoot.tv_nsec / 1e9);
+    refresh();
+    g_bReady = true;
 }
 
 bool ConnectJack()
 {
-	//open a client connection to the JACK server
-	jack_options_t options = JackNoStartServer;
-	jack_status_t nStatus;
-	const char *pCharServerName = NULL; //Pointer to name of Jack server
-    const char** as_ports; //array of pointers to c-strings used to hold list of port names
-    if(!g_pJackClient)
-        g_pJackClient = jack_client_open("multijack", options, &nStatus, pCharServerName);
-	if(!g_pJackClient)
+    if(!g_engine.Connect("multijack"))
     {
-		if(nStatus & JackServerFailed)
+        g_engine.Disconnect(); //Release partially configured client so next attempt starts afresh
         attron(COLOR_PAIR(WHITE_RED));
         mvprintw(20, 0, " Disconnected from JACK - attempting to recover... % 3u ", ++g_nJackConnectAttempt);
         attroff(COLOR_PAIR(WHITE_RED));
         wrefresh(g_pWindowRouting);
-		return false;
-	}
-	g_nSamplerate = jack_get_sample_rate(g_pJackClient); //!@todo Is it useful to get samplerate here? Should we (attempt to) set Jack samplerate after opening file?
-
-    //Assign Jack callback handler functions
-    //Set callback to handle Jack process (something needs to be done)
-	jack_set_process_callback(g_pJackClient, OnJackProcess, 0);
-	//Set callback to handle Jack slow sync (transport) events
-	jack_set_sync_callback(g_pJackClient, OnJackSync, 0); //!@todo Does not handled STOP from Jack transport
-//    jack_set_timebase_callback(g_pJackClient, 1, OnJackTimebase, 0); //!@todo This does not work
-    //Set callback to handle Jack shutdown
-    jack_on_shutdown(g_pJackClient, OnJackShutdown, 0);
-    //Set callback to handle latency changes
-    jack_set_latency_callback(g_pJackClient, OnJackLatency, 0);
-    //Set callback to handle Jack buffer size change
-    jack_set_buffer_size_callback(g_pJackClient, OnJackBufferChange, 0);
-
-    //Create buffer to hold samples read from file
-    g_pReadBuffer = new jack_default_audio_sample_t[jack_get_buffer_size(g_pJackClient) * g_vTracks.size()];
-
-	//Create capture ports
-	g_pPortInputA = jack_port_register(g_pJackClient, "Input A", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
-	g_pPortInputB = jack_port_register(g_pJackClient, "Input B", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
-	if(!g_pPortInputA || !g_pPortInputB)
-    {
-        cerr << "Error - cannot register Jack ports" << endl;
-		return false;
-	}
-	//Find playback ports (expect 2)
-	as_ports = jack_get_ports(g_pJackClient, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsInput);
-	if(as_ports == NULL)
-    {
-		cerr << "No physical playback as_ports" << endl;
-		return false;
-	}
-	int nPort = 0;
-	while(as_ports[++nPort])
-        ;
-    if(nPort < 2)
-    {
-        fprintf(stderr, "Error - insufficient playback ports - require 2, found %d", nPort);
-        free(as_ports);
         return false;
     }
-	//!@todo Handle different playback port configuration, e.g. when monitor ports are not first two
- 	g_pPortPlaybackA = jack_port_by_name(g_pJackClient, as_ports[0]);
- 	g_pPortPlaybackB = jack_port_by_name(g_pJackClient, as_ports[1]);
-	free(as_ports);
-
-	if(jack_activate(g_pJackClient))
+    if(g_engine.IsOpen())
     {
-		fprintf(stderr, "Error - cannot activate Jack client\n");
-		return false;
-	}
-
-    LoadProject("default");
+        //Reconnected after server restart - engine kept project so only display may be stale
+        ShowFormat();
+        ShowHeadPosition();
+        ShowLength();
+    }
+    else
+        LoadProject("default");
     ShowMenu();
+    move(20, 0);
+    clrtoeol();
+    g_nJackConnectAttempt = 0;
+    g_nJackRetry = JACK_RETRY_MIN_MS;
+    return true;
+}
 
-    //Connect capture ports
-	as_ports = jack_get_ports(g_pJackClient, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsOutput);
-	if(as_ports == NULL)
-    {
-		fprintf(stderr, "Error - no physical capture ports available\n");
-		return false;
-	}
-	nPort = 0;
-	while(as_ports[++nPort])
-        ; //!@todo There must be a better way to deduce quantity of ports
-    if(nPort < 2)
-    {
-        fprintf(stderr, "Error - insufficient capture ports - require 2, found %d", nPort);
-        free(as_ports);
-        return false;
-    }
-    if(jack_connect(g_pJackClient, as_ports[0], jack_port_name(g_pPortInputA)))
+void WaitJack()
+{
+    timespec tsStart, tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+    int nInterval = g_nJackRetry;
+    g_nJackRetry = nInterval * 2 > JACK_RETRY_MAX_MS ? JACK_RETRY_MAX_MS : nInterval * 2;
+    int nWait = nInterval;
+    while(nWait > 0 && g_bRunning)
     {
-        fprintf (stderr, "Cannot connect input port A\n");
+        if(g_controlServer.Poll(HandleCommand, nWait, g_fdJackWatch) && ReadJackWatch())
+        {
+            g_nJackRetry = JACK_RETRY_MIN_MS; //Server is starting so keep retrying promptly until it accepts connections
+            return;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &tsNow);
+        nWait = nInterval - (tsNow.tv_sec - tsStart.tv_sec) * 1000 - (tsNow.tv_nsec - tsStart.tv_nsec) / 1000000;
     }
-    if(jack_connect(g_pJackClient, as_ports[1], jack_port_name(g_pPortInputB)))
+}
+
+bool ReadJackWatch()
+{
+    //Other applications also create files in shared memory so only JACK sockets count
+    char acEvents[4096] __attribute__((aligned(__alignof__(inotify_event))));
+    ssize_t nRead;
+    bool bJack = false;
+    while((nRead = read(g_fdJackWatch, acEvents, sizeof(acEvents))) > 0)
     {
-        fprintf (stderr, "Cannot connect input port B\n");
+        for(char* pEvent = acEvents; pEvent < acEvents + nRead; pEvent += sizeof(inotify_event) + ((inotify_event*)pEvent)->len)
+        {
+            inotify_event* pNotify = (inotify_event*)pEvent;
+            if(pNotify->len && 0 == strncmp(pNotify->name, "jack", 4))
+                bJack = true;
+        }
     }
-	free(as_ports);
-
-    move(20, 0);
-    clrtoeol();
-    g_nJackConnectAttempt = 0;
-	return true;
+    return bJack;
 }
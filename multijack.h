@@ -1,208 +1,157 @@
 #pragma once
-#include <jack/jack.h>
-#include <ncurses.h>
+#include "control.h"
+#include "engine.h"
+#include "screen.h"
+#include <signal.h>
 #include <string>
-#include <vector>
-
-class Track;
+#include <time.h>
 
 //Constants
-static const int DEFAULT_SAMPLERATE = 44100; //Samples per second
-static const int SAMPLESIZE         = 4; //Quantity of bytes in each sample (4 for 32-bit)
-static const int PERIOD_SIZE        = 128; //Number of frames in each period (128 samples at 441000 takes approx 3ms)
-static const int MAX_TRACKS         = 16; //Quantity of mono tracks
+static const int NOTIFY_PERIOD      = 100; //Milliseconds between position and meter events sent to control clients
+static const char* CONTROL_SOCKET   = "/tmp/multijack.sock"; //Default path of control socket
 static const int RECORD_LATENCY     = 3000; //microseconds of record latency
 static const int REPLAY_LATENCY     = 3000; //microseconds of record latency
+static const int JACK_RETRY_MIN_MS  = 10; //Milliseconds between first attempts to reconnect to JACK
+static const int JACK_RETRY_MAX_MS  = 1000; //Longest interval between attempts to reconnect to JACK
+static const char* JACK_SERVER_DIR  = "/dev/shm"; //Directory where JACK server creates its sockets - watched to reconnect as soon as it starts
 static const int MENU_HEAD          = 0; //Position of head position in menu
 static const int MENU_SIZE          = 20; //Position of file size in menu
 static const int MENU_TC            = 32; //Position of transport control in menu
 static const int MENU_FORMAT        = 39; //Position of data format in menu
 static const int MENU_PROJECT       = 49; //Position of project name in menu
-//Transport control states
-static const int TC_STOPPED     = 0;
-static const int TC_ROLLING     = 1;
-static const int TC_STOPPING    = 2;
-static const int TC_STOP        = 3; //Request transport stop
-static const int TC_START       = 4; //Request transport start
 //Colours
 static const int WHITE_RED      = 1;
 static const int BLACK_GREEN    = 2;
 static const int WHITE_BLUE     = 3;
 static const int RED_BLACK      = 4;
 static const int WHITE_MAGENTA  = 5;
-//Ports to connect
-static const unsigned int PORT_NONE = 0;
-static const unsigned int PORT_A    = 1;
-static const unsigned int PORT_B    = 2;
-static const unsigned int PORT_BOTH = 3;
-
-/** Structure representing RIFF WAVE format chunk header (without id or size, i.e. 8 bytes smaller) **/
-struct WaveHeader
-{
-    uint16_t nAudioFormat; //1=PCM
-    uint16_t nNumChannels; //Number of channels in project
-    uint32_t nSampleRate; //Samples per second - expect SAMPLERATE
-    uint32_t nByteRate; //nSamplrate * nNumChannels * nBitsPerSample / 8
-    uint16_t nBlockAlign; //nNumChannels * nBitsPerSample / 8 (bytes for one sample of all chanels)
-    uint16_t nBitsPerSample; //Expect 16
-};
 
-jack_port_t* g_pPortInputA;
-jack_port_t* g_pPortInputB;
-jack_port_t* g_pPortPlaybackA;
-jack_port_t* g_pPortPlaybackB;
-jack_client_t* g_pJackClient;
-WINDOW* g_pWindowRouting; //Pointer to ncurses window
+WINDOW* g_pWindowRouting; //Pointer to ncurses window - NULL when built HEADLESS
 
-/** @brief  Handle Jack process events
-*   @param  nFrames Quantity of frames to process
-*   @param  pArgs Pointer to a structure of arguments (not used)
+/** @brief  Shows the menu
 */
-int OnJackProcess(jack_nframes_t nFrames, void* pArgs);
+void ShowMenu();
 
-/** @brief  Handle Jack sync (transport state / position) events
-*   @param  nState Transport state (JackTransportStopped | JackTransportRolling | JackTransportLooping | JackTransportStarting)
-*   @param  pPos Pointer to position structure
-*   @param  pArgs Pointer to a structure of arguments (not used)
-*   @return <i>int</i> 0 until ready to roll
+/** @brief  Update display with current head position
 */
-int OnJackSync(jack_transport_state_t nState, jack_position_t* pPos, void* pArgs);
-
-void OnJackTimebase(jack_transport_state_t nState, jack_nframes_t nFrames, jack_position_t *pPos, int nNewPos, void *pArgs);
+void ShowHeadPosition();
 
-/** @brief  Handle Jack latency change event
-*   @param  latencyMode Latency callback mode (JackCaptureLatency | JackPlaybackLatency)
-*   @param  pArgs Pointer to a structure of arguments (not used)
+/** @brief  Update display with project length
 */
-void OnJackLatency(jack_latency_callback_mode_t latencyMode, void* pArgs);
+void ShowLength();
 
-/** @brief  Handle Jack shutdown event
-*   @param  pArgs Pointer to a structure of arguments (not used)
+/** @brief  Update display with project sample rate - red if it differs from JACK and cannot be converted, blue if converted
 */
-void OnJackShutdown(void *pArgs);
+void ShowFormat();
 
-/** @brief  Handle Jack buffer size change event
-*   @param  nFrames Size of buffer in frames
-*   @param  pArgs Pointer to a structure of arguments (not used)
+/** @brief  Update display with disk streaming statistics
 */
-int OnJackBufferChange(jack_nframes_t nframes, void *pArgs);
+void ShowDiskStatus();
 
-/** @brief  Shows the menu
+/** @brief  Update display with read-ahead and write-behind depth, reporting and logging changes made by disk thread
 */
-void ShowMenu();
+void ShowBufferStatus();
 
-/** @brief  Update display with current head position
+/** @brief  Report and log corrupt ranges newly found by integrity scrubber
 */
-void ShowHeadPosition();
+void ShowScrubStatus();
 
-/** @brief  Handle keyboard input
+/** @brief  Start a background job and show its progress
+*   @param  nJob Job to start [JOB_COMPACT | JOB_BOUNCE | JOB_STEMS]
+*   @return <i>bool</i> True if job started
 */
-void HandleControl();
+bool StartJob(int nJob);
 
-/** @brief  Opens WAVE file and reads header
+/** @brief  Update display with job progress, finishing job when complete
 */
-bool OpenFile();
+void ShowJobStatus();
 
-/** @brief  Writes a RIFF header to currently open file
-*   @param  nWaveSize Quantity of bytes in wave data
-*   @param  nChannels Quantity of tracks
+/** @brief  Start saving a copy of the project under a new name and show its progress
+*   @param  sName Name of copy or empty to name copy after project and current time
+*   @return <i>bool</i> True if copy started
 */
-void WriteHeader(unsigned int nWaveSize, unsigned int nChannels);
+bool SaveSnapshot(const std::string& sName);
 
-/** @brief  Write a 16-bit, little-endian word to a char buffer
-*   @param  pBuffer Buffer to write to
-*   @param  nWord 16-bit word to write
+/** @brief  Update display with progress of saving a copy of the project, reporting result when complete
 */
-void SetLE16(char* pBuffer, uint16_t nWord);
+void ShowSnapshotStatus();
 
-/** @brief  Write a 32-bit, little-endian word to a char buffer
-*   @param  pBuffer Buffer to write to
-*   @param  nWord 32-bit word to write
+/** @brief  Write timeline of recent audio, disk and user interface activity as Chrome trace JSON
+*   @param  sFilename Path and name of file or empty to name file after project with suffix -trace.json
+*   @return <i>string</i> Path and name of file written or empty if tracing is not built in or file could not be written
 */
-void SetLE32(char* pBuffer, uint32_t nWord);
+std::string SaveTrace(const std::string& sFilename);
 
-/** @brief  Close WAVE file
+/** @brief  Handle keyboard input
 */
-void CloseFile();
+void HandleControl();
 
-/** @brief  Move play head to new postion
-*   @param  nPosition New position of playhead in frames relative to start
+/** @brief  Perform a command received from a control client
+*   @param  sCommand Command with arguments separated by spaces
+*   @return <i>std::string</i> Response starting "ok" or "error"
 */
-void SetPlayHead(int nPosition);
+std::string HandleCommand(const std::string& sCommand);
 
-/** @brief  Load a project
-*   @param  sName Project name
-*   @return <i>bool</i> True on succuess
+/** @brief  Send transport, position and meter events to subscribed control clients
 */
-bool LoadProject(std::string sName);
+void NotifyControl();
 
-/** @brief  Save the current project
-*   @param  sName Project name
-*   @return <i>bool</i> True on succuess
+/** @brief  Handle termination signals by ending main loop
+*   @param  nSignal Signal number
 */
-bool SaveProject(std::string sName = "");
+void OnSignal(int nSignal);
 
-/** @brief  Updates the project length and updates display
+/** @brief  Update display with punch points
 */
-void UpdateLength();
+void ShowPunch();
 
-/** @brief  Removes all Jack sources and creates one per track
+/** @brief  Update display with input monitor mode
 */
-void CreateJackSources();
+void ShowMonitor();
 
-/** @brief  Connect track to playback port
-*   @param  nTrack Index of track to connect
-*   @param  nPorts Which ports to connect (PORT_NONE | PORT_A | PORT_B | PORT_BOTH)
-*   @note   Use PORT_NONE to disconnect
+/** @brief  Move play head to new postion and update display
+*   @param  lPosition New position of playhead in frames relative to start
 */
-void ConnectPlayback(unsigned int nTrack, unsigned int nPorts = PORT_BOTH);
+void SetPlayHead(long lPosition);
 
-/** @brief  Disconnect track from playback port
-*   @param  nTrack Index of track to connect
-*   @param  nPorts Which ports to disconect (PORT_A | PORT_B | PORT_BOTH)
+/** @brief  Load a project and update display
+*   @param  sName Project name
+*   @return <i>bool</i> True on succuess
 */
-void DisconnectPlayback(unsigned int nTrack, unsigned int nPorts = PORT_BOTH);
+bool LoadProject(const std::string& sName);
 
-/** @brief  Record audio to selected tracks
-*   @param  nFrames Quantity of frames to write
-*   @return <i>bool</i> True on success
+/** @brief  Update display with loading status, reporting time taken once playback data is available
 */
-bool Record(jack_nframes_t nFrames);
+void ShowReadyStatus();
 
-/** @brief  Connect to Jack server
+/** @brief  Connect to Jack server and load default project - project already open is kept
 *   @return <i>bool</i> True on success
 */
 bool ConnectJack();
 
+/** @brief  Wait before next attempt to connect to Jack server, handling commands meanwhile
+*   @note   Interval doubles after each wait and returns to shortest when a JACK socket appears
+*/
+void WaitJack();
+
+/** @brief  Read notifications of files created in JACK_SERVER_DIR
+*   @return <i>bool</i> True if a JACK socket was created
+*/
+bool ReadJackWatch();
+
 /** @brief  Quits application, cleaning up before closing
 *   @param  nError Error code to return to shell. Default = 0 (no error).
 */
 void Quit(int nError = 0);
 
 //Global variables
-jack_nframes_t g_nCaptureLatency; //Numbers of frames of capture latency
-jack_nframes_t g_nPlaybackLatency; //Numbers of frames of playback latency
-jack_nframes_t g_nSamplerate; //Quantity of frames per second
-jack_nframes_t g_nRecordOffset; //Quantity of frames offset between record head and play head
-//unsigned int g_nChannels; //Quantity of tracks
+Engine g_engine; //Recorder engine
 unsigned int g_nSelectedTrack; //Currently selected track
 unsigned int g_nJackConnectAttempt; //Quantity of connection attempts
-int g_nRecA; //Number of track primed to record A-leg input
-int g_nRecB; //Number of track primed to record B-leg input
-int g_nTransport; //Transport status
-int g_nFrameSize; //Quantity of bytes in each frame
-static int g_nPeriodSize; //Period size - size of all samples in each period (sample size x quantity of channels x PERIOD_SIZE)
-long g_lLastFrame; //Last frame
-long g_lHeadPos; //Quantity of frames from start of current head position
-bool g_bRecordEnabled; //True if recording
-bool g_bRunning; //True if application running (main loop)
-int g_fdWave; //File descriptor of wave file
-std::string g_sPath; //Project path
-std::string g_sProject; //Project name
-off_t g_offStartOfData; //Offset of data in wave file
-off_t g_offEndOfData; //Offset of end of data in wave file (end of file)
-char* g_pSilence; //Pointer to one period of silent samples
-jack_default_audio_sample_t* g_pReadBuffer; //Buffer to hold data read from file
-unsigned long g_lDebug; //Misc debug variable
-std::vector<jack_port_t*> g_vJackSourcePorts; //Vector of source ports, one per track
-std::vector<Track*> g_vTracks; //Vector of pointers to instances of tracks
+int g_nJackRetry; //Milliseconds to wait before next connection attempt
+int g_fdJackWatch; //Descriptor notified of files created in JACK_SERVER_DIR or -1
+volatile sig_atomic_t g_bRunning; //True if application running (main loop) - cleared by signal handler
+bool g_bHeadless; //True if running without user interface, controlled only by control socket - always when built HEADLESS
+bool g_bReady; //True once playback data at playhead is available after loading project
+timespec g_tsLoad; //Time project load started
+ControlServer g_controlServer; //Local control socket
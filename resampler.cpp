@@ -0,0 +1,160 @@
+#include "resampler.h"
+#include <math.h>
+#include <string.h>
+
+static const unsigned int QUALITY_TAPS[] = {8, 16, 32}; //Taps per phase for each quality
+static const double QUALITY_ROLLOFF[] = {0.80, 0.88, 0.92}; //Cutoff relative to lower Nyquist frequency for each quality
+static const double QUALITY_BETA[] = {5.0, 7.0, 9.0}; //Kaiser window shape for each quality
+
+static unsigned int Gcd(unsigned int nA, unsigned int nB)
+{
+    while(nB)
+    {
+        unsigned int nTemp = nA % nB;
+        nA = nB;
+        nB = nTemp;
+    }
+    return nA;
+}
+
+//Zeroth order modified Bessel function of the first kind used by Kaiser window
+static double BesselI0(double dX)
+{
+    double dSum = 1;
+    double dTerm = 1;
+    for(unsigned int k = 1; k < 50 && dTerm > 1e-12 * dSum; ++k)
+    {
+        double dFactor = dX / (2 * k);
+        dTerm *= dFactor * dFactor;
+        dSum += dTerm;
+    }
+    return dSum;
+}
+
+Resampler::Resampler() :
+    m_nChannels(0),
+    m_nTaps(0),
+    m_nUp(1),
+    m_nDown(1),
+    m_nMaxInput(0),
+    m_pFilter(NULL),
+    m_pWork(NULL),
+    m_nPhase(0),
+    m_nCurrent(0),
+    m_dLatency(0)
+{
+}
+
+Resampler::~Resampler()
+{
+    Free();
+}
+
+bool Resampler::Init(unsigned int nInRate, unsigned int nOutRate, unsigned int nChannels, int nQuality, unsigned int nMaxOutput)
+{
+    Free();
+    if(0 == nInRate || 0 == nOutRate || 0 == nChannels)
+        return false;
+    if(nQuality < RESAMPLE_FAST || nQuality > RESAMPLE_BEST)
+        nQuality = RESAMPLE_MEDIUM;
+    unsigned int nGcd = Gcd(nInRate, nOutRate);
+    m_nUp = nOutRate / nGcd;
+    m_nDown = nInRate / nGcd;
+    if(m_nUp > RESAMPLE_MAX_PHASES || m_nDown > m_nUp * RESAMPLE_MAX_RATIO)
+        return false;
+    m_nChannels = nChannels;
+    m_nTaps = QUALITY_TAPS[nQuality];
+    m_nMaxInput = ((unsigned long)(nMaxOutput + 2) * m_nDown) / m_nUp + 2;
+
+    //Design prototype low-pass filter at the interpolated rate then split into phases
+    unsigned int nLength = m_nTaps * m_nUp;
+    double dCentre = (nLength - 1) / 2.0;
+    double dCutoff = 0.5 * QUALITY_ROLLOFF[nQuality] / (m_nUp > m_nDown ? m_nUp : m_nDown);
+    double dBeta = QUALITY_BETA[nQuality];
+    double dWindowScale = BesselI0(dBeta);
+    m_pFilter = new float[nLength];
+    for(unsigned int nPhase = 0; nPhase < m_nUp; ++nPhase)
+    {
+        double dSum = 0;
+        double adTaps[32];
+        for(unsigned int nTap = 0; nTap < m_nTaps; ++nTap)
+        {
+            unsigned int k = nPhase + nTap * m_nUp;
+            double dX = k - dCentre;
+            double dSinc = (0 == dX) ? 1 : sin(2 * M_PI * dCutoff * dX) / (2 * M_PI * dCutoff * dX);
+            double dR = dX / (dCentre + 1);
+            double dWindow = BesselI0(dBeta * sqrt(1 - dR * dR)) / dWindowScale;
+            adTaps[nTap] = dSinc * dWindow;
+            dSum += adTaps[nTap];
+        }
+        //Normalise each phase to unity gain so there is no ripple at DC, taps reversed so input is traversed forwards
+        for(unsigned int nTap = 0; nTap < m_nTaps; ++nTap)
+            m_pFilter[nPhase * m_nTaps + m_nTaps - 1 - nTap] = adTaps[nTap] / dSum;
+    }
+    m_dLatency = dCentre / m_nUp;
+
+    m_pWork = new float[(m_nTaps + m_nMaxInput) * m_nChannels](); //Zeroed so audio thread does not fault on first use
+    Reset();
+    return true;
+}
+
+void Resampler::Free()
+{
+    delete[] m_pFilter;
+    m_pFilter = NULL;
+    delete[] m_pWork;
+    m_pWork = NULL;
+    m_nMaxInput = 0;
+}
+
+void Resampler::Reset()
+{
+    if(m_pWork)
+        memset(m_pWork, 0, m_nTaps * m_nChannels * sizeof(float));
+    m_nPhase = 0;
+    m_nCurrent = 0;
+}
+
+unsigned int Resampler::GetInputFrames(unsigned int nOutFrames)
+{
+    if(0 == nOutFrames)
+        return 0;
+    long lLast = m_nCurrent + (long)((m_nPhase + (unsigned long)(nOutFrames - 1) * m_nDown) / m_nUp);
+    return lLast < 0 ? 0 : lLast + 1;
+}
+
+unsigned int Resampler::GetOutputFrames(unsigned int nInFrames)
+{
+    long lSpan = ((long)nInFrames - m_nCurrent) * m_nUp - m_nPhase;
+    if(lSpan <= 0)
+        return 0;
+    return (lSpan + m_nDown - 1) / m_nDown;
+}
+
+void Resampler::Process(const float* pIn, unsigned int nInFrames, float* pOut, unsigned int nOutFrames)
+{
+    unsigned int nChannels = m_nChannels;
+    unsigned int nTaps = m_nTaps;
+    memcpy(m_pWork + nTaps * nChannels, pIn, nInFrames * nChannels * sizeof(float));
+    for(unsigned int nFrame = 0; nFrame < nOutFrames; ++nFrame)
+    {
+        //Multiply-accumulate across contiguous channels so compiler may vectorise inner loop
+        const float* pCoeff = m_pFilter + m_nPhase * nTaps;
+        const float* pSrc = m_pWork + (m_nCurrent + 1) * nChannels;
+        float* pDest = pOut + nFrame * nChannels;
+        memset(pDest, 0, nChannels * sizeof(float));
+        for(unsigned int nTap = 0; nTap < nTaps; ++nTap)
+        {
+            float fCoeff = pCoeff[nTap];
+            for(unsigned int nChan = 0; nChan < nChannels; ++nChan)
+                pDest[nChan] += fCoeff * pSrc[nChan];
+            pSrc += nChannels;
+        }
+        m_nPhase += m_nDown;
+        m_nCurrent += m_nPhase / m_nUp;
+        m_nPhase %= m_nUp;
+    }
+    //Keep most recent input as history for next call
+    memmove(m_pWork, m_pWork + nInFrames * nChannels, nTaps * nChannels * sizeof(float));
+    m_nCurrent -= nInFrames;
+}
@@ -0,0 +1,80 @@
+/** Class providing streaming sample rate conversion of interleaved audio
+*   Uses a rational polyphase windowed-sinc filter so conversion between common rates is exact
+*   Output position advances by a whole number of input frames so consumption is deterministic
+*/
+#pragma once
+
+static const int RESAMPLE_FAST              = 0; //8 taps per phase
+static const int RESAMPLE_MEDIUM            = 1; //16 taps per phase
+static const int RESAMPLE_BEST              = 2; //32 taps per phase
+static const unsigned int RESAMPLE_MAX_PHASES   = 1024; //Maximum interpolation factor after reducing ratio
+static const unsigned int RESAMPLE_MAX_RATIO    = 8; //Maximum decimation factor
+
+class Resampler
+{
+    public:
+        Resampler();
+        ~Resampler();
+
+        /** @brief  Configure resampler, allocating filter and buffers
+        *   @param  nInRate Input samples per second
+        *   @param  nOutRate Output samples per second
+        *   @param  nChannels Quantity of interleaved channels
+        *   @param  nQuality Filter quality [RESAMPLE_FAST | RESAMPLE_MEDIUM | RESAMPLE_BEST]
+        *   @param  nMaxOutput Maximum quantity of frames produced by each call to Process
+        *   @return <i>bool</i> True on success - false if ratio is not supported
+        *   @note   Not realtime safe
+        */
+        bool Init(unsigned int nInRate, unsigned int nOutRate, unsigned int nChannels, int nQuality, unsigned int nMaxOutput);
+
+        /** @brief  Release filter and buffers
+        */
+        void Free();
+
+        /** @brief  Clear filter history, e.g. after a discontinuity
+        */
+        void Reset();
+
+        /** @brief  Get quantity of input frames required to produce output frames
+        *   @param  nOutFrames Quantity of output frames
+        *   @return <i>unsigned int</i> Quantity of input frames to pass to Process
+        */
+        unsigned int GetInputFrames(unsigned int nOutFrames);
+
+        /** @brief  Get quantity of output frames produced from input frames
+        *   @param  nInFrames Quantity of input frames
+        *   @return <i>unsigned int</i> Quantity of output frames to request from Process
+        */
+        unsigned int GetOutputFrames(unsigned int nInFrames);
+
+        /** @brief  Convert a block of audio
+        *   @param  pIn Interleaved input samples
+        *   @param  nInFrames Quantity of input frames - must not exceed GetMaxInput
+        *   @param  pOut Buffer to populate with interleaved output samples
+        *   @param  nOutFrames Quantity of output frames - must not exceed nMaxOutput
+        *   @note   Either nInFrames must be GetInputFrames(nOutFrames) or nOutFrames must be GetOutputFrames(nInFrames)
+        *   @note   Realtime safe
+        */
+        void Process(const float* pIn, unsigned int nInFrames, float* pOut, unsigned int nOutFrames);
+
+        /** @brief  Get maximum quantity of input frames consumed by each call to Process
+        */
+        unsigned int GetMaxInput() { return m_nMaxInput; }
+
+        /** @brief  Get delay introduced by filter
+        *   @return <i>double</i> Delay in input frames
+        */
+        double GetLatency() { return m_dLatency; }
+
+    private:
+        unsigned int m_nChannels; //Quantity of interleaved channels
+        unsigned int m_nTaps; //Quantity of filter taps in each phase
+        unsigned int m_nUp; //Interpolation factor (L)
+        unsigned int m_nDown; //Decimation factor (M)
+        unsigned int m_nMaxInput; //Maximum quantity of input frames per call
+        float* m_pFilter; //Filter coefficients indexed by phase then tap (taps reversed)
+        float* m_pWork; //History followed by new input, interleaved
+        unsigned int m_nPhase; //Phase of next output frame
+        int m_nCurrent; //Index of newest input frame used by next output relative to next input
+        double m_dLatency; //Filter delay in input frames
+};
@@ -0,0 +1,249 @@
+#include "restructure.h"
+#include "wave.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+Restructure::Restructure() :
+    m_lFrames(0),
+    m_lDone(0),
+    m_nState(RESTRUCTURE_NONE),
+    m_bCancel(false),
+    m_nProgress(0),
+    m_dSeconds(0)
+{
+}
+
+bool Restructure::Begin(const std::string& sPrefix, const std::vector<int>& vMap, long lFrames)
+{
+    m_sPrefix = sPrefix;
+    m_vMap = vMap;
+    m_lFrames = lFrames;
+    m_lDone = 0;
+    m_nState = RESTRUCTURE_COPY;
+    m_nProgress = 0;
+    unlink(GetFilename().c_str()); //Remove file left by an abandoned restructure
+    unlink(BlockChecksums::GetFilename(GetFilename()).c_str());
+    return WriteJournal();
+}
+
+int Restructure::Resume(const std::string& sPrefix)
+{
+    m_sPrefix = sPrefix;
+    m_vMap.clear();
+    m_lFrames = 0;
+    m_lDone = 0;
+    m_nState = RESTRUCTURE_NONE;
+    FILE* pFile = fopen((m_sPrefix + ".restructure").c_str(), "r");
+    if(!pFile)
+        return RESTRUCTURE_NONE;
+    char pLine[1024];
+    while(fgets(pLine, sizeof(pLine), pFile))
+    {
+        if(0 == strncmp(pLine, "State=", 6))
+            m_nState = atoi(pLine + 6);
+        if(0 == strncmp(pLine, "Frames=", 7))
+            m_lFrames = atol(pLine + 7);
+        if(0 == strncmp(pLine, "Done=", 5))
+            m_lDone = atol(pLine + 5);
+        if(0 == strncmp(pLine, "Map=", 4))
+        {
+            for(char* pValue = strtok(pLine + 4, ",\n"); pValue; pValue = strtok(NULL, ",\n"))
+                m_vMap.push_back(atoi(pValue));
+        }
+    }
+    fclose(pFile);
+    if(m_nState < RESTRUCTURE_COPY || m_nState > RESTRUCTURE_SAVED || m_vMap.empty() || m_lDone > m_lFrames)
+    {
+        End(); //Unreadable journal so abandon restructure - project file is unchanged
+        return RESTRUCTURE_NONE;
+    }
+    return m_nState;
+}
+
+bool Restructure::IsValid(unsigned int nChannels, unsigned int nMaxChannels)
+{
+    if(m_vMap.empty() || m_vMap.size() > nMaxChannels)
+        return false;
+    for(std::vector<int>::iterator it = m_vMap.begin(); it != m_vMap.end(); ++it)
+        if(*it < -1 || *it >= (int)nChannels)
+            return false;
+    return true;
+}
+
+bool Restructure::Run(int fdSource, off_t offStart, unsigned int nChannels, unsigned int nSampleRate, TakeStore* pTakes, unsigned int nMaxChannels)
+{
+    timespec tsStart, tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+    m_bCancel = false;
+    if(fdSource < 0 || RESTRUCTURE_COPY != m_nState || !IsValid(nChannels, nMaxChannels))
+        return false;
+    m_nProgress = m_lFrames ? 100 * m_lDone / m_lFrames : 0;
+
+    //Find runs of adjacent tracks so that each run is copied by a single (vectorised) memory copy
+    m_vRuns.clear();
+    for(unsigned int nDest = 0; nDest < m_vMap.size(); ++nDest)
+    {
+        int nSource = m_vMap[nDest];
+        if(!m_vRuns.empty())
+        {
+            RestructureRun& run = m_vRuns.back();
+            if((nSource < 0 && run.nSource < 0) || (nSource >= 0 && run.nSource >= 0 && nSource == run.nSource + (int)run.nCount))
+            {
+                ++run.nCount;
+                continue;
+            }
+        }
+        RestructureRun run = {nDest, nSource, 1};
+        m_vRuns.push_back(run);
+    }
+
+    unsigned int nDestChannels = m_vMap.size();
+    size_t nSourceFrameSize = nChannels * sizeof(float);
+    size_t nDestFrameSize = nDestChannels * sizeof(float);
+    int fd = open(GetFilename().c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size < (off_t)(44 + m_lDone * nDestFrameSize))
+        m_lDone = 0; //New file is missing data recorded in journal so start again
+    //Discard data written after last journal update then size file so unwritten blocks remain holes which read as silence
+    if(ftruncate(fd, 44 + m_lDone * nDestFrameSize) || ftruncate(fd, 44 + m_lFrames * nDestFrameSize))
+    {
+        close(fd);
+        return false;
+    }
+    WriteWaveHeader(fd, m_lFrames * nDestFrameSize, nDestChannels, nSampleRate);
+    //Index of new file is kept with entries of blocks already copied - it is not essential so failure to open it is ignored
+    BlockChecksums checksums;
+    checksums.Open(BlockChecksums::GetFilename(GetFilename()), nDestChannels, true);
+    posix_fadvise(fdSource, offStart + m_lDone * nSourceFrameSize, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<float> vSource(RESTRUCTURE_BLOCK_FRAMES * nChannels);
+    std::vector<float> vDest(RESTRUCTURE_BLOCK_FRAMES * nDestChannels);
+    bool bResult = true;
+    unsigned int nBlocks = 0;
+    long lCount = 0;
+    for(long lFrame = m_lDone; lFrame < m_lFrames; lFrame += lCount)
+    {
+        if(m_bCancel)
+        {
+            //Record progress so far to resume from
+            fdatasync(fd);
+            checksums.Sync();
+            m_lDone = lFrame;
+            WriteJournal();
+            bResult = false;
+            break;
+        }
+        lCount = m_lFrames - lFrame;
+        if(lCount > RESTRUCTURE_BLOCK_FRAMES)
+            lCount = RESTRUCTURE_BLOCK_FRAMES;
+
+        //Read same data as the disk stream would
+        size_t nSize = lCount * nSourceFrameSize;
+        ssize_t nRead = pread(fdSource, &vSource[0], nSize, offStart + lFrame * nSourceFrameSize);
+        size_t nValid = nRead > 0 ? nRead : 0;
+        if(nValid < nSize)
+            memset((char*)&vSource[0] + nValid, 0, nSize - nValid);
+        if(pTakes)
+            pTakes->Overlay(&vSource[0], nChannels, lFrame, lCount);
+        Interleave(&vSource[0], nChannels, &vDest[0], lCount);
+
+        //Silent blocks are left as holes
+        size_t nSamples = lCount * nDestChannels;
+        size_t nSample = 0;
+        while(nSample < nSamples && 0 == vDest[nSample])
+            ++nSample;
+        size_t nDestSize = lCount * nDestFrameSize;
+        if(nSample < nSamples && pwrite(fd, &vDest[0], nDestSize, 44 + lFrame * nDestFrameSize) != (ssize_t)nDestSize)
+        {
+            bResult = false;
+            break;
+        }
+        checksums.Store(lFrame / RESTRUCTURE_BLOCK_FRAMES, &vDest[0], lCount);
+        m_nProgress = 100 * (lFrame + lCount) / m_lFrames;
+        if(0 == ++nBlocks % RESTRUCTURE_SYNC_BLOCKS)
+        {
+            //Record progress only once the data it covers is on storage
+            fdatasync(fd);
+            checksums.Sync();
+            m_lDone = lFrame + lCount;
+            WriteJournal();
+        }
+    }
+    if(bResult)
+    {
+        bResult = (0 == fdatasync(fd));
+        checksums.Sync();
+        m_lDone = m_lFrames;
+        m_nState = RESTRUCTURE_COPIED;
+        bResult = bResult && WriteJournal();
+    }
+    close(fd);
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    m_dSeconds = tsEnd.tv_sec - tsStart.tv_sec + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+    if(bResult)
+        m_nProgress = 100;
+    return bResult;
+}
+
+void Restructure::Interleave(const float* pSource, unsigned int nSourceChannels, float* pDest, unsigned int nFrames)
+{
+    unsigned int nDestChannels = m_vMap.size();
+    if(1 == m_vRuns.size() && 0 == m_vRuns[0].nSource && nSourceChannels == nDestChannels)
+    {
+        memcpy(pDest, pSource, nFrames * nDestChannels * sizeof(float)); //Same layout
+        return;
+    }
+    for(unsigned int nFrame = 0; nFrame < nFrames; ++nFrame)
+    {
+        for(std::vector<RestructureRun>::iterator it = m_vRuns.begin(); it != m_vRuns.end(); ++it)
+        {
+            if(it->nSource < 0)
+                memset(pDest + it->nDest, 0, it->nCount * sizeof(float));
+            else
+                memcpy(pDest + it->nDest, pSource + it->nSource, it->nCount * sizeof(float));
+        }
+        pSource += nSourceChannels;
+        pDest += nDestChannels;
+    }
+}
+
+bool Restructure::SetState(int nState)
+{
+    m_nState = nState;
+    return WriteJournal();
+}
+
+void Restructure::End()
+{
+    unlink((m_sPrefix + ".restructure").c_str());
+    unlink(GetFilename().c_str());
+    unlink(BlockChecksums::GetFilename(GetFilename()).c_str());
+    m_vMap.clear();
+    m_vRuns.clear();
+    m_nState = RESTRUCTURE_NONE;
+}
+
+bool Restructure::WriteJournal()
+{
+    //Replace journal atomically so that an interruption leaves either the old or the new journal
+    std::string sJournal = m_sPrefix + ".restructure";
+    std::string sTemp = sJournal + ".tmp";
+    FILE* pFile = fopen(sTemp.c_str(), "w");
+    if(!pFile)
+        return false;
+    fputs("# Restructure of project tracks in progress - do not edit\n", pFile);
+    fprintf(pFile, "State=%d\nFrames=%ld\nDone=%ld\nMap=", m_nState, m_lFrames, m_lDone);
+    for(unsigned int i = 0; i < m_vMap.size(); ++i)
+        fprintf(pFile, "%s%d", i ? "," : "", m_vMap[i]);
+    fputs("\n", pFile);
+    bool bResult = (0 == fflush(pFile)) && (0 == fsync(fileno(pFile)));
+    fclose(pFile);
+    return bResult && 0 == rename(sTemp.c_str(), sJournal.c_str());
+}
@@ -0,0 +1,115 @@
+/** Class changing the tracks of a project - adding, removing and reordering - by streaming the WAVE file once
+*   Each block is read, takes are merged and tracks are re-interleaved into a new WAVE file which replaces the project file when complete
+*   A journal records the track map and progress so that a restructure interrupted by shutdown or power loss resumes where it stopped
+*   The new file is sparse - blocks which are silent on every track are not written
+*/
+#pragma once
+
+#include "checksums.h"
+#include "takestore.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+static const unsigned int RESTRUCTURE_BLOCK_FRAMES  = CHECKSUM_BLOCK_FRAMES; //Quantity of frames copied at a time - one checksum entry per block
+static const unsigned int RESTRUCTURE_SYNC_BLOCKS   = 16; //Quantity of blocks copied between journal updates
+//Restructure states recorded in journal
+static const int RESTRUCTURE_NONE   = 0; //No restructure in progress
+static const int RESTRUCTURE_COPY   = 1; //Copying data to new file
+static const int RESTRUCTURE_COPIED = 2; //New file complete but project not yet updated
+static const int RESTRUCTURE_SAVED  = 3; //Project configuration updated but new file not yet renamed
+
+/** Structure representing a run of adjacent tracks copied together **/
+struct RestructureRun
+{
+    unsigned int nDest; //Index of first track in new file
+    int nSource; //Index of first track in project file or -1 for new (silent) tracks
+    unsigned int nCount; //Quantity of tracks
+};
+
+class Restructure
+{
+    public:
+        Restructure();
+
+        /** @brief  Start a new restructure, writing its journal
+        *   @param  sPrefix Path and name of project without extension
+        *   @param  vMap Index of project track for each track of new file or -1 for a new empty track
+        *   @param  lFrames Quantity of frames in project
+        *   @return <i>bool</i> True on success
+        */
+        bool Begin(const std::string& sPrefix, const std::vector<int>& vMap, long lFrames);
+
+        /** @brief  Read journal of an interrupted restructure
+        *   @param  sPrefix Path and name of project without extension
+        *   @return <i>int</i> State of restructure [RESTRUCTURE_NONE | RESTRUCTURE_COPY | RESTRUCTURE_COPIED | RESTRUCTURE_SAVED]
+        */
+        int Resume(const std::string& sPrefix);
+
+        /** @brief  Check whether track map is valid for project
+        *   @param  nChannels Quantity of tracks in project file
+        *   @param  nMaxChannels Maximum quantity of tracks in new file
+        *   @return <i>bool</i> True if valid
+        */
+        bool IsValid(unsigned int nChannels, unsigned int nMaxChannels);
+
+        /** @brief  Copy project to new file, continuing from last journal update
+        *   @param  fdSource File descriptor of project WAVE file
+        *   @param  offStart Offset of start of data in project WAVE file
+        *   @param  nChannels Quantity of interleaved channels in project WAVE file
+        *   @param  nSampleRate Samples per second
+        *   @param  pTakes Pointer to take store merged into new file
+        *   @param  nMaxChannels Maximum quantity of channels in new file
+        *   @return <i>bool</i> True if new file is complete
+        *   @note   Blocks until complete or cancelled - progress is available from GetProgress
+        */
+        bool Run(int fdSource, off_t offStart, unsigned int nChannels, unsigned int nSampleRate, TakeStore* pTakes, unsigned int nMaxChannels);
+
+        /** @brief  Stop copying at next block, leaving journal to resume from
+        *   @note   Thread safe
+        */
+        void Cancel() { m_bCancel = true; }
+
+        /** @brief  Record state in journal
+        *   @param  nState New state
+        *   @return <i>bool</i> True on success
+        */
+        bool SetState(int nState);
+
+        /** @brief  Remove journal and any incomplete new file
+        */
+        void End();
+
+        /** @brief  Get track map
+        *   @return <i>std::vector<int></i> Index of project track for each track of new file or -1 for a new empty track
+        */
+        const std::vector<int>& GetMap() { return m_vMap; }
+
+        /** @brief  Get path of new WAVE file
+        */
+        std::string GetFilename() { return m_sPrefix + ".restructure.wav"; }
+
+        /** @brief  Get progress of current copy
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress() { return m_nProgress; }
+
+        /** @brief  Get duration of last copy
+        *   @return <i>double</i> Seconds taken to copy
+        */
+        double GetSeconds() { return m_dSeconds; }
+
+    private:
+        bool WriteJournal();
+        void Interleave(const float* pSource, unsigned int nSourceChannels, float* pDest, unsigned int nFrames);
+
+        std::string m_sPrefix; //Path and name of project without extension
+        std::vector<int> m_vMap; //Index of project track for each track of new file or -1 for a new empty track
+        std::vector<RestructureRun> m_vRuns; //Runs of adjacent tracks copied together
+        long m_lFrames; //Quantity of frames in project
+        long m_lDone; //Quantity of frames copied and synchronised to storage
+        int m_nState; //State of restructure
+        std::atomic<bool> m_bCancel; //True to stop copying
+        std::atomic<int> m_nProgress; //Percentage complete
+        double m_dSeconds; //Duration of last copy
+};
@@ -0,0 +1,174 @@
+#include "rtarena.h"
+#include <sys/mman.h>
+#include <string.h>
+#ifdef RT_DEBUG
+#include <atomic>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+RtArena::RtArena() :
+    m_pMemory(NULL),
+    m_nSize(0),
+    m_nUsed(0),
+    m_bLocked(false)
+{
+}
+
+RtArena::~RtArena()
+{
+    Free();
+}
+
+bool RtArena::Reserve(size_t nBytes)
+{
+    m_nUsed = 0;
+    if(nBytes <= m_nSize)
+        return true;
+    Free();
+    nBytes = (nBytes + 4095) & ~(size_t)4095;
+    void* pMemory = mmap(NULL, nBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if(MAP_FAILED == pMemory)
+        return false;
+    m_pMemory = (char*)pMemory;
+    m_nSize = nBytes;
+    m_bLocked = (0 == mlock(m_pMemory, m_nSize));
+    memset(m_pMemory, 0, m_nSize); //Ensure every page is backed even if populate or lock failed
+    return true;
+}
+
+void* RtArena::Alloc(size_t nBytes)
+{
+    size_t nSize = (nBytes + RT_ALIGN - 1) & ~(RT_ALIGN - 1);
+    if(!m_pMemory || m_nUsed + nSize > m_nSize)
+        return NULL;
+    void* pBuffer = m_pMemory + m_nUsed;
+    m_nUsed += nSize;
+    memset(pBuffer, 0, nBytes);
+    return pBuffer;
+}
+
+void RtArena::Free()
+{
+    if(m_pMemory)
+        munmap(m_pMemory, m_nSize);
+    m_pMemory = NULL;
+    m_nSize = 0;
+    m_nUsed = 0;
+    m_bLocked = false;
+}
+
+bool LockMemory()
+{
+#ifdef MCL_ONFAULT
+    if(0 == mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT))
+        return true;
+#endif
+    return 0 == mlockall(MCL_CURRENT | MCL_FUTURE);
+}
+
+void __attribute__((noinline)) PrefaultStack()
+{
+    volatile char acStack[RT_STACK];
+    for(size_t i = 0; i < RT_STACK; i += 1024)
+        acStack[i] = 0;
+    (void)acStack[0]; //Read back so stores are not removed
+}
+
+#ifdef RT_DEBUG
+static thread_local bool t_bRealtime = false; //True whilst thread is running realtime code
+static thread_local long t_lFaults = 0; //Faults counted by kernel at RtEnter
+static std::atomic<unsigned long> s_lRtFaults(0); //Page faults in realtime code
+
+static long GetThreadFaults()
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+void RtEnter()
+{
+    t_lFaults = GetThreadFaults();
+    t_bRealtime = true;
+}
+
+void RtLeave()
+{
+    t_bRealtime = false;
+    s_lRtFaults += GetThreadFaults() - t_lFaults;
+}
+
+unsigned long RtGetFaults()
+{
+    return s_lRtFaults;
+}
+
+static void RtCheck(const char* pFunction)
+{
+    if(!t_bRealtime)
+        return;
+    t_bRealtime = false;
+    const char* pMessage = "Allocation from realtime thread: ";
+    write(2, pMessage, strlen(pMessage));
+    write(2, pFunction, strlen(pFunction));
+    write(2, "\n", 1);
+    abort();
+}
+
+//Replace allocator entry points to check realtime threads then call C library implementation
+extern "C"
+{
+void* __libc_malloc(size_t nSize);
+void* __libc_calloc(size_t nCount, size_t nSize);
+void* __libc_realloc(void* pBuffer, size_t nSize);
+void* __libc_memalign(size_t nAlign, size_t nSize);
+void __libc_free(void* pBuffer);
+
+void* malloc(size_t nSize)
+{
+    RtCheck("malloc");
+    return __libc_malloc(nSize);
+}
+
+void* calloc(size_t nCount, size_t nSize)
+{
+    RtCheck("calloc");
+    return __libc_calloc(nCount, nSize);
+}
+
+void* realloc(void* pBuffer, size_t nSize)
+{
+    RtCheck("realloc");
+    return __libc_realloc(pBuffer, nSize);
+}
+
+void* memalign(size_t nAlign, size_t nSize)
+{
+    RtCheck("memalign");
+    return __libc_memalign(nAlign, nSize);
+}
+
+void* aligned_alloc(size_t nAlign, size_t nSize)
+{
+    RtCheck("aligned_alloc");
+    return __libc_memalign(nAlign, nSize);
+}
+
+int posix_memalign(void** ppBuffer, size_t nAlign, size_t nSize)
+{
+    RtCheck("posix_memalign");
+    *ppBuffer = __libc_memalign(nAlign, nSize);
+    return *ppBuffer ? 0 : ENOMEM;
+}
+
+void free(void* pBuffer)
+{
+    if(pBuffer)
+        RtCheck("free");
+    __libc_free(pBuffer);
+}
+}
+#endif
@@ -0,0 +1,78 @@
+/** Class providing memory for the audio thread
+*   A single block is mapped, locked and pre-faulted up front then divided into buffers before the audio thread uses them
+*   Buffers are not freed individually - the arena is reset when buffers are reallocated, e.g. when a project loads
+*   Build with RT_DEBUG defined to abort on any allocation from a realtime thread and count its page faults
+*/
+#pragma once
+
+#include <stddef.h>
+
+static const size_t RT_ALIGN = 64; //Alignment of each buffer (cache line)
+static const size_t RT_STACK = 65536; //Bytes of realtime thread stack to pre-fault
+
+class RtArena
+{
+    public:
+        RtArena();
+        ~RtArena();
+
+        /** @brief  Ensure arena can hold a quantity of memory, discarding existing buffers
+        *   @param  nBytes Total size of buffers required
+        *   @return <i>bool</i> True on success
+        *   @note   Not realtime safe - audio thread must not be using buffers
+        */
+        bool Reserve(size_t nBytes);
+
+        /** @brief  Get a zeroed buffer from arena
+        *   @param  nBytes Size of buffer
+        *   @return <i>void*</i> Pointer to buffer or NULL if arena is exhausted
+        *   @note   Not realtime safe
+        */
+        void* Alloc(size_t nBytes);
+
+        /** @brief  Discard all buffers so that arena may be divided again
+        */
+        void Reset() { m_nUsed = 0; }
+
+        /** @brief  Release arena memory
+        */
+        void Free();
+
+        /** @brief  Check whether arena is locked in physical memory
+        */
+        bool IsLocked() { return m_bLocked; }
+
+    private:
+        char* m_pMemory; //Mapped memory
+        size_t m_nSize; //Size of mapped memory
+        size_t m_nUsed; //Quantity of bytes allocated
+        bool m_bLocked; //True if memory is locked
+};
+
+/** @brief  Lock current and future process memory so that it cannot be paged out
+*   @return <i>bool</i> True on success - fails if RLIMIT_MEMLOCK is too small
+*   @note   Future pages are locked when first touched so thread stacks are not fully committed
+*/
+bool LockMemory();
+
+/** @brief  Touch stack of calling thread so that later use does not page fault
+*/
+void PrefaultStack();
+
+#ifdef RT_DEBUG
+/** @brief  Mark calling thread as running realtime code - any allocation aborts
+*/
+void RtEnter();
+
+/** @brief  Mark calling thread as no longer running realtime code and count page faults since RtEnter
+*/
+void RtLeave();
+
+/** @brief  Get quantity of page faults in realtime code
+*/
+unsigned long RtGetFaults();
+#else
+inline void RtEnter() {}
+inline void RtLeave() {}
+inline unsigned long RtGetFaults() { return 0; }
+#endif
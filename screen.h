@@ -0,0 +1,41 @@
+/** Screen drawing used by the front end
+*   Build with HEADLESS defined for a recorder controlled only by its control socket - ncurses is then neither included nor linked
+*   and the drawing functions used by the front end are empty and compile to nothing
+*/
+#pragma once
+
+#ifndef HEADLESS
+#include <ncurses.h>
+#else
+typedef struct HeadlessWindow WINDOW; //Never created - drawing functions ignore their window
+
+static const int ERR = -1; //Returned by getch when no key is pressed - always the case without a terminal
+//Keys handled by front end - values as ncurses so switch cases remain distinct
+static const int KEY_DOWN   = 0402;
+static const int KEY_UP     = 0403;
+static const int KEY_LEFT   = 0404;
+static const int KEY_RIGHT  = 0405;
+static const int KEY_HOME   = 0406;
+static const int KEY_SF     = 0520;
+static const int KEY_SR     = 0521;
+static const int KEY_END    = 0550;
+static const int KEY_SLEFT  = 0611;
+static const int KEY_SRIGHT = 0622;
+
+inline int COLOR_PAIR(int nPair) { return nPair; }
+inline int attron(int nAttributes) { return 0; }
+inline int attroff(int nAttributes) { return 0; }
+inline int wattron(WINDOW* pWindow, int nAttributes) { return 0; }
+inline int wattroff(WINDOW* pWindow, int nAttributes) { return 0; }
+inline int move(int nRow, int nColumn) { return 0; }
+inline int printw(const char* pFormat, ...) { return 0; }
+inline int mvprintw(int nRow, int nColumn, const char* pFormat, ...) { return 0; }
+inline int wprintw(WINDOW* pWindow, const char* pFormat, ...) { return 0; }
+inline int mvwprintw(WINDOW* pWindow, int nRow, int nColumn, const char* pFormat, ...) { return 0; }
+inline int clrtoeol() { return 0; }
+inline int clear() { return 0; }
+inline int werase(WINDOW* pWindow) { return 0; }
+inline int refresh() { return 0; }
+inline int wrefresh(WINDOW* pWindow) { return 0; }
+inline int getch() { return ERR; }
+#endif
@@ -0,0 +1,424 @@
+#include "scrubber.h"
+#include "trace.h"
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+
+static const int IOPRIO_WHO_PROCESS = 1; //ioprio_set applies to a thread when given its id (0 = calling thread)
+static const int IOPRIO_CLASS_IDLE  = 3; //Only perform I/O when no other thread needs the disk
+static const int IOPRIO_CLASS_SHIFT = 13;
+
+static int ioprio_set(int nWhich, int nWho, int nPriority)
+{
+    return syscall(__NR_ioprio_set, nWhich, nWho, nPriority);
+}
+
+static int OpenDirect(const std::string& sFilename)
+{
+    //Direct reads neither use nor evict cached pages, e.g. those prefetched for playback
+    int fd = open(sFilename.c_str(), O_RDONLY | O_DIRECT);
+    if(fd < 0)
+        fd = open(sFilename.c_str(), O_RDONLY); //Filesystem does not support direct I/O
+    return fd;
+}
+
+Scrubber::Scrubber() :
+    m_offStart(0),
+    m_nChannels(0),
+    m_pTakes(NULL),
+    m_pIdle(NULL),
+    m_pContext(NULL),
+    m_pBuffer(NULL),
+    m_nBufferSize(0),
+    m_bThread(false),
+    m_bStop(false),
+    m_nProgress(0),
+    m_nPasses(0),
+    m_lVerified(0),
+    m_lAdopted(0)
+{
+    pthread_mutex_init(&m_mutexErrors, NULL);
+    pthread_mutex_init(&m_mutexBlock, NULL);
+}
+
+Scrubber::~Scrubber()
+{
+    Stop();
+    free(m_pBuffer);
+    pthread_mutex_destroy(&m_mutexErrors);
+    pthread_mutex_destroy(&m_mutexBlock);
+}
+
+bool Scrubber::Start(const std::string& sWave, off_t offStart, unsigned int nChannels, TakeStore* pTakes, ScrubIdleFunction pIdle, void* pContext)
+{
+    Stop();
+    if(0 == nChannels || !pIdle)
+        return false;
+    m_sWave = sWave;
+    m_offStart = offStart;
+    m_nChannels = nChannels;
+    m_pTakes = pTakes;
+    m_pIdle = pIdle;
+    m_pContext = pContext;
+    //Direct reads are widened to aligned boundaries at each end
+    size_t nSize = CHECKSUM_BLOCK_FRAMES * nChannels * sizeof(float) + 2 * SCRUB_ALIGN;
+    if(nSize > m_nBufferSize)
+    {
+        free(m_pBuffer);
+        m_pBuffer = NULL;
+        m_nBufferSize = 0;
+        void* pBuffer;
+        if(posix_memalign(&pBuffer, SCRUB_ALIGN, nSize))
+            return false;
+        m_pBuffer = (char*)pBuffer;
+        m_nBufferSize = nSize;
+    }
+    ClearErrors();
+    m_nProgress = 0;
+    m_nPasses = 0;
+    m_lVerified = 0;
+    m_lAdopted = 0;
+    m_bStop = false;
+    if(pthread_create(&m_thread, NULL, ScrubThread, this))
+        return false;
+    m_bThread = true;
+    return true;
+}
+
+void Scrubber::Stop()
+{
+    m_bStop = true;
+    if(m_bThread)
+        pthread_join(m_thread, NULL);
+    m_bThread = false;
+}
+
+void Scrubber::Hold()
+{
+    pthread_mutex_lock(&m_mutexBlock);
+    pthread_mutex_unlock(&m_mutexBlock);
+}
+
+std::vector<ScrubError> Scrubber::GetErrors()
+{
+    pthread_mutex_lock(&m_mutexErrors);
+    std::vector<ScrubError> vErrors = m_vErrors;
+    pthread_mutex_unlock(&m_mutexErrors);
+    return vErrors;
+}
+
+unsigned int Scrubber::GetErrorCount()
+{
+    pthread_mutex_lock(&m_mutexErrors);
+    unsigned int nCount = m_vErrors.size();
+    pthread_mutex_unlock(&m_mutexErrors);
+    return nCount;
+}
+
+void Scrubber::ClearErrors()
+{
+    pthread_mutex_lock(&m_mutexErrors);
+    m_vErrors.clear();
+    pthread_mutex_unlock(&m_mutexErrors);
+}
+
+void* Scrubber::ScrubThread(void* pArgs)
+{
+    TraceThread("scrub");
+    //Verification only uses disk when it is otherwise idle so that it never competes with streaming
+    ioprio_set(IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    ((Scrubber*)pArgs)->Run();
+    return NULL;
+}
+
+void Scrubber::Run()
+{
+    while(!m_bStop)
+    {
+        //Size of pass is measured at its start - data added during pass is verified by the next
+        long long llTotal = 0;
+        struct stat st;
+        if(0 == stat(m_sWave.c_str(), &st) && st.st_size > m_offStart)
+            llTotal += st.st_size - m_offStart;
+        std::vector<TakeExtent> vExtents = m_pTakes ? m_pTakes->GetExtents() : std::vector<TakeExtent>();
+        for(std::vector<TakeExtent>::iterator it = vExtents.begin(); it != vExtents.end(); ++it)
+            llTotal += it->lFrames * sizeof(float);
+        long long llDone = 0;
+        m_nProgress = 0;
+        if(!ScrubWave(llDone, llTotal) || !ScrubTakes(llDone, llTotal))
+            break;
+        m_nProgress = 100;
+        ++m_nPasses;
+        if(!Rest(SCRUB_REST_S))
+            break;
+    }
+}
+
+bool Scrubber::Enter()
+{
+    //Idle is checked again once block is held so a job starting meanwhile waits in Hold until block is complete
+    while(!m_bStop)
+    {
+        if(m_pIdle(m_pContext))
+        {
+            pthread_mutex_lock(&m_mutexBlock);
+            if(m_pIdle(m_pContext))
+                return true;
+            pthread_mutex_unlock(&m_mutexBlock);
+        }
+        usleep(SCRUB_WAIT_MS * 1000);
+    }
+    return false;
+}
+
+bool Scrubber::Rest(double dSeconds)
+{
+    for(double dSlept = 0; dSlept < dSeconds && !m_bStop; dSlept += SCRUB_WAIT_MS / 1000.0)
+        usleep(SCRUB_WAIT_MS * 1000);
+    return !m_bStop;
+}
+
+void Scrubber::Throttle(size_t nSize)
+{
+    Rest(double(nSize) / (SCRUB_RATE * 1024 * 1024));
+}
+
+bool Scrubber::ScrubWave(long long& llDone, long long llTotal)
+{
+    int fd = OpenDirect(m_sWave);
+    if(fd < 0)
+        return !m_bStop;
+    BlockChecksums index;
+    index.Open(BlockChecksums::GetFilename(m_sWave), m_nChannels, true);
+    size_t nFrameSize = m_nChannels * sizeof(float);
+    struct stat st;
+    long lFileFrames = (0 == fstat(fd, &st) && st.st_size > m_offStart) ? (st.st_size - m_offStart) / nFrameSize : 0;
+    std::vector<unsigned int> vBad;
+    for(long lBlock = 0; lBlock * CHECKSUM_BLOCK_FRAMES < lFileFrames && index.IsOpen(); ++lBlock)
+    {
+        if(!Enter())
+            break;
+        unsigned int nHashed;
+        bool bChecked = CheckWaveBlock(fd, index, lBlock, lFileFrames, vBad, &nHashed);
+        Leave();
+        if(!vBad.empty())
+        {
+            //Confirm failure once idle again - block may have been rewritten whilst it was read
+            if(!Enter())
+                break;
+            CheckWaveBlock(fd, index, lBlock, lFileFrames, vBad, &nHashed);
+            Leave();
+            for(std::vector<unsigned int>::iterator it = vBad.begin(); it != vBad.end(); ++it)
+            {
+                ScrubError error = {0, *it, lBlock * CHECKSUM_BLOCK_FRAMES, nHashed};
+                Report(error);
+            }
+        }
+        size_t nSize = std::min((long)CHECKSUM_BLOCK_FRAMES, lFileFrames - lBlock * CHECKSUM_BLOCK_FRAMES) * nFrameSize;
+        llDone += nSize;
+        if(llTotal)
+            m_nProgress = std::min(100LL, 100 * llDone / llTotal);
+        if(bChecked)
+            Throttle(nSize);
+    }
+    close(fd);
+    return !m_bStop;
+}
+
+bool Scrubber::ScrubTakes(long long& llDone, long long llTotal)
+{
+    if(!m_pTakes)
+        return !m_bStop;
+    //Each take file is verified up to the last frame of it in use
+    std::map<std::pair<unsigned int, unsigned int>, long> mapTakes;
+    std::vector<TakeExtent> vExtents = m_pTakes->GetExtents();
+    for(std::vector<TakeExtent>::iterator it = vExtents.begin(); it != vExtents.end(); ++it)
+    {
+        long& lEnd = mapTakes[std::make_pair(it->nTake, it->nTrack)];
+        lEnd = std::max(lEnd, it->lOffset + it->lFrames);
+    }
+    for(std::map<std::pair<unsigned int, unsigned int>, long>::iterator it = mapTakes.begin(); it != mapTakes.end() && !m_bStop; ++it)
+    {
+        unsigned int nTake = it->first.first;
+        unsigned int nTrack = it->first.second;
+        BlockChecksums index;
+        int fd = -1;
+        if(index.Open(m_pTakes->GetFilename(nTake, nTrack, ".sums"), 1, false))
+            fd = OpenDirect(m_pTakes->GetFilename(nTake, nTrack));
+        for(long lBlock = 0; fd >= 0 && lBlock * CHECKSUM_BLOCK_FRAMES < it->second; ++lBlock)
+        {
+            if(!Enter())
+                break;
+            bool bBad;
+            unsigned int nHashed;
+            bool bChecked = CheckTakeBlock(fd, index, lBlock, &bBad, &nHashed);
+            Leave();
+            if(bBad)
+            {
+                if(!Enter())
+                    break;
+                CheckTakeBlock(fd, index, lBlock, &bBad, &nHashed);
+                Leave();
+            }
+            if(bBad)
+            {
+                //Report parts of block still in extent map at their positions in project
+                long lOffset = lBlock * CHECKSUM_BLOCK_FRAMES;
+                vExtents = m_pTakes->GetExtents();
+                for(std::vector<TakeExtent>::iterator itExtent = vExtents.begin(); itExtent != vExtents.end(); ++itExtent)
+                {
+                    if(itExtent->nTake != nTake || itExtent->nTrack != nTrack)
+                        continue;
+                    long lStart = std::max(lOffset, itExtent->lOffset);
+                    long lStop = std::min(lOffset + (long)nHashed, itExtent->lOffset + itExtent->lFrames);
+                    if(lStart >= lStop)
+                        continue;
+                    ScrubError error = {nTake, nTrack, itExtent->lStart + lStart - itExtent->lOffset, lStop - lStart};
+                    Report(error);
+                }
+            }
+            long lFrames = std::min((long)CHECKSUM_BLOCK_FRAMES, it->second - lBlock * CHECKSUM_BLOCK_FRAMES);
+            llDone += lFrames * sizeof(float);
+            if(llTotal)
+                m_nProgress = std::min(100LL, 100 * llDone / llTotal);
+            if(bChecked)
+                Throttle(lFrames * sizeof(float));
+        }
+        if(fd >= 0)
+            close(fd);
+    }
+    return !m_bStop;
+}
+
+bool Scrubber::CheckWaveBlock(int fd, BlockChecksums& index, long lBlock, long lFileFrames, std::vector<unsigned int>& vBad, unsigned int* pnHashed)
+{
+    vBad.clear();
+    std::vector<uint64_t> vExpected(m_nChannels), vPrefix(m_nChannels), vAll(m_nChannels);
+    unsigned int nHashed;
+    index.Read(lBlock, &nHashed, &vExpected[0]);
+    unsigned int nAvailable = std::min((long)CHECKSUM_BLOCK_FRAMES, lFileFrames - lBlock * CHECKSUM_BLOCK_FRAMES);
+    unsigned int nFrames = std::max(nHashed, nAvailable);
+    *pnHashed = nHashed;
+    size_t nFrameSize = m_nChannels * sizeof(float);
+    const float* pFrames = ReadBlock(fd, m_offStart + lBlock * CHECKSUM_BLOCK_FRAMES * nFrameSize, nFrames * nFrameSize);
+    if(!pFrames)
+    {
+        //Unreadable block is corrupt whether or not it has an entry
+        *pnHashed = nFrames;
+        for(unsigned int nTrack = 0; nTrack < m_nChannels; ++nTrack)
+            vBad.push_back(nTrack);
+        return true;
+    }
+    if(0 == nHashed)
+    {
+        //Block written before project had an index
+        index.Store(lBlock, pFrames, nAvailable);
+        ++m_lAdopted;
+        return true;
+    }
+    HashPrefix(pFrames, m_nChannels, nHashed, nFrames, &vPrefix[0], &vAll[0]);
+    for(unsigned int nTrack = 0; nTrack < m_nChannels; ++nTrack)
+        if(vPrefix[nTrack] != vExpected[nTrack])
+            vBad.push_back(nTrack);
+    //Block at end of data extended since its entry was written, e.g. by recording beyond end of project
+    if(vBad.empty() && nAvailable > nHashed)
+        index.Write(lBlock, nAvailable, &vAll[0]);
+    ++m_lVerified;
+    return true;
+}
+
+bool Scrubber::CheckTakeBlock(int fd, BlockChecksums& index, long lBlock, bool* pbBad, unsigned int* pnHashed)
+{
+    *pbBad = false;
+    uint64_t lExpected;
+    if(!index.Read(lBlock, pnHashed, &lExpected))
+        return false; //Block not hashed, e.g. written whilst take was not contiguous
+    const float* pFrames = ReadBlock(fd, lBlock * CHECKSUM_BLOCK_FRAMES * sizeof(float), *pnHashed * sizeof(float));
+    uint64_t lHash;
+    if(pFrames)
+        BlockChecksums::HashTracks(pFrames, 1, *pnHashed, &lHash);
+    *pbBad = !pFrames || lHash != lExpected;
+    ++m_lVerified;
+    return true;
+}
+
+const float* Scrubber::ReadBlock(int fd, off_t offPos, size_t nSize)
+{
+    //Direct reads must start and end on aligned boundaries
+    bool bDirect = fcntl(fd, F_GETFL) & O_DIRECT;
+    off_t offRead = bDirect ? offPos & ~(off_t)(SCRUB_ALIGN - 1) : offPos;
+    size_t nLead = offPos - offRead;
+    size_t nRead = bDirect ? (nLead + nSize + SCRUB_ALIGN - 1) & ~(size_t)(SCRUB_ALIGN - 1) : nSize;
+    if(nRead > m_nBufferSize)
+        return NULL;
+    size_t nDone = 0;
+    while(nDone < nRead)
+    {
+        ssize_t nResult = pread(fd, m_pBuffer + nDone, nRead - nDone, offRead + nDone);
+        if(nResult < 0 && EINVAL == errno && bDirect)
+        {
+            //Filesystem accepted but cannot perform direct I/O so read through cache
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            return ReadBlock(fd, offPos, nSize);
+        }
+        if(nResult < 0)
+            return NULL; //Media error
+        if(0 == nResult)
+            break;
+        nDone += nResult;
+    }
+    //Data beyond end of file reads as silence, as it plays
+    if(nDone < nLead + nSize)
+        memset(m_pBuffer + std::max(nDone, nLead), 0, nLead + nSize - std::max(nDone, nLead));
+    return (const float*)(m_pBuffer + nLead);
+}
+
+void Scrubber::Report(const ScrubError& error)
+{
+    pthread_mutex_lock(&m_mutexErrors);
+    //Merge with an overlapping or adjacent range so repeated passes do not add duplicates
+    bool bMerged = false;
+    for(std::vector<ScrubError>::iterator it = m_vErrors.begin(); it != m_vErrors.end(); ++it)
+    {
+        if(it->nTake != error.nTake || it->nTrack != error.nTrack || error.lStart > it->lStart + it->lFrames || it->lStart > error.lStart + error.lFrames)
+            continue;
+        long lEnd = std::max(it->lStart + it->lFrames, error.lStart + error.lFrames);
+        it->lStart = std::min(it->lStart, error.lStart);
+        it->lFrames = lEnd - it->lStart;
+        bMerged = true;
+        break;
+    }
+    if(!bMerged)
+        m_vErrors.push_back(error);
+    pthread_mutex_unlock(&m_mutexErrors);
+}
+
+void Scrubber::HashPrefix(const float* pFrames, unsigned int nChannels, unsigned int nHashed, unsigned int nFrames, uint64_t* plPrefix, uint64_t* plAll)
+{
+    //Hash of first frames is compared with entry and hash of all frames replaces a partial entry, from one pass over the data
+    float afSlice[CHECKSUM_SLICE_FRAMES];
+    for(unsigned int nTrack = 0; nTrack < nChannels; ++nTrack)
+    {
+        ChecksumState state;
+        BlockChecksums::Begin(state);
+        for(unsigned int nFrame = 0; nFrame < nFrames; )
+        {
+            unsigned int nEnd = nFrame < nHashed ? nHashed : nFrames;
+            unsigned int nCount = std::min(nEnd - nFrame, CHECKSUM_SLICE_FRAMES);
+            const float* pSrc = pFrames + nFrame * nChannels + nTrack;
+            for(unsigned int i = 0; i < nCount; ++i)
+                afSlice[i] = pSrc[i * nChannels];
+            BlockChecksums::Update(state, afSlice, nCount * sizeof(float));
+            nFrame += nCount;
+            if(nFrame == nHashed)
+                plPrefix[nTrack] = BlockChecksums::Digest(state);
+        }
+        plAll[nTrack] = BlockChecksums::Digest(state);
+    }
+}
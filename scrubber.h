@@ -0,0 +1,129 @@
+/** Class verifying project and take files against their checksum indexes in the background
+*   A thread at idle I/O priority reads one block at a time whilst the engine is idle, i.e. stopped with no job running
+*   Reads bypass the page cache where the filesystem allows so the storage itself is verified rather than cached copies
+*   Blocks of the project file written before it had an index are hashed and added to the index (adopted) on first pass
+*   A block which fails is read again before it is reported so a block rewritten whilst being read is not reported
+*/
+#pragma once
+
+#include "checksums.h"
+#include "takestore.h"
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+static const unsigned int SCRUB_RATE        = 16; //Maximum megabytes per second read
+static const unsigned int SCRUB_WAIT_MS     = 100; //Interval at which scrubber checks whether engine is idle
+static const unsigned int SCRUB_REST_S      = 600; //Seconds between passes
+static const unsigned int SCRUB_ALIGN       = 4096; //Alignment of direct (uncached) reads
+
+/** Function reporting whether storage may be read without disturbing the engine
+*   @param  pContext Context passed to Start
+*   @return <i>bool</i> True if idle
+*/
+typedef bool (*ScrubIdleFunction)(void* pContext);
+
+/** Structure representing a range of a track found corrupt **/
+struct ScrubError
+{
+    unsigned int nTake; //Take number or 0 for project file
+    unsigned int nTrack; //Index of track
+    long lStart; //Position of first corrupt frame in project
+    long lFrames; //Quantity of frames
+};
+
+class Scrubber
+{
+    public:
+        Scrubber();
+        ~Scrubber();
+
+        /** @brief  Start verifying files of a project, repeating until stopped
+        *   @param  sWave Path of project WAVE file - must be 32-bit float
+        *   @param  offStart Offset of start of data in WAVE file
+        *   @param  nChannels Quantity of interleaved channels
+        *   @param  pTakes Pointer to take store whose take files are verified
+        *   @param  pIdle Function polled before each block is read
+        *   @param  pContext Context passed to idle function
+        *   @return <i>bool</i> True if started
+        *   @note   Errors found by a previous run are discarded
+        */
+        bool Start(const std::string& sWave, off_t offStart, unsigned int nChannels, TakeStore* pTakes, ScrubIdleFunction pIdle, void* pContext);
+
+        /** @brief  Stop verifying and wait for thread to finish
+        */
+        void Stop();
+
+        /** @brief  Wait for any block being verified to finish
+        *   @note   Call after idle function starts to return false and before writing files being verified
+        */
+        void Hold();
+
+        /** @brief  Check whether scrubber is running
+        */
+        bool IsRunning() { return m_bThread; }
+
+        /** @brief  Get ranges found corrupt, adjacent ranges merged
+        */
+        std::vector<ScrubError> GetErrors();
+
+        /** @brief  Get quantity of corrupt ranges found since start or last clear
+        */
+        unsigned int GetErrorCount();
+
+        /** @brief  Forget corrupt ranges, e.g. once they have been recorded again
+        */
+        void ClearErrors();
+
+        /** @brief  Get progress of current pass
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress() { return m_nProgress; }
+
+        /** @brief  Get quantity of complete passes
+        */
+        unsigned int GetPasses() { return m_nPasses; }
+
+        /** @brief  Get quantity of blocks verified since start
+        */
+        unsigned long GetVerified() { return m_lVerified; }
+
+        /** @brief  Get quantity of blocks added to project index since start
+        */
+        unsigned long GetAdopted() { return m_lAdopted; }
+
+    private:
+        static void* ScrubThread(void* pArgs);
+        void Run();
+        bool Enter();
+        void Leave() { pthread_mutex_unlock(&m_mutexBlock); }
+        bool Rest(double dSeconds);
+        bool ScrubWave(long long& llDone, long long llTotal);
+        bool ScrubTakes(long long& llDone, long long llTotal);
+        bool CheckWaveBlock(int fd, BlockChecksums& index, long lBlock, long lFileFrames, std::vector<unsigned int>& vBad, unsigned int* pnHashed);
+        bool CheckTakeBlock(int fd, BlockChecksums& index, long lBlock, bool* pbBad, unsigned int* pnHashed);
+        const float* ReadBlock(int fd, off_t offPos, size_t nSize);
+        void Report(const ScrubError& error);
+        void Throttle(size_t nSize);
+        static void HashPrefix(const float* pFrames, unsigned int nChannels, unsigned int nHashed, unsigned int nFrames, uint64_t* plPrefix, uint64_t* plAll);
+
+        std::string m_sWave; //Path of project WAVE file
+        off_t m_offStart; //Offset of start of data in WAVE file
+        unsigned int m_nChannels; //Quantity of interleaved channels
+        TakeStore* m_pTakes; //Take store whose take files are verified
+        ScrubIdleFunction m_pIdle; //Function reporting whether engine is idle
+        void* m_pContext; //Context of idle function
+        char* m_pBuffer; //Aligned buffer large enough for a block of project file
+        size_t m_nBufferSize; //Size of buffer in bytes
+        std::vector<ScrubError> m_vErrors; //Corrupt ranges found
+        pthread_mutex_t m_mutexErrors; //Protects corrupt ranges
+        pthread_mutex_t m_mutexBlock; //Held whilst a block is read, verified and its entry written
+        pthread_t m_thread; //Thread verifying files
+        bool m_bThread; //True if thread has not been joined
+        std::atomic<bool> m_bStop; //True to stop verifying
+        std::atomic<int> m_nProgress; //Percentage of current pass complete
+        std::atomic<unsigned int> m_nPasses; //Quantity of complete passes
+        std::atomic<unsigned long> m_lVerified; //Quantity of blocks verified
+        std::atomic<unsigned long> m_lAdopted; //Quantity of blocks adopted
+};
@@ -0,0 +1,242 @@
+#include "snapshot.h"
+#include "trace.h"
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+static const int IOPRIO_WHO_PROCESS = 1; //ioprio_set applies to a thread when given its id (0 = calling thread)
+static const int IOPRIO_CLASS_IDLE  = 3; //Only perform I/O when no other thread needs the disk
+static const int IOPRIO_CLASS_SHIFT = 13;
+
+static int ioprio_set(int nWhich, int nWho, int nPriority)
+{
+    return syscall(__NR_ioprio_set, nWhich, nWho, nPriority);
+}
+
+static ssize_t CopyFileRange(int fdIn, off_t* pOffIn, int fdOut, off_t* pOffOut, size_t nSize)
+{
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, fdIn, pOffIn, fdOut, pOffOut, nSize, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+Snapshot::Snapshot() :
+    m_bThread(false),
+    m_bResult(false),
+    m_bBusy(false),
+    m_bCancel(false),
+    m_llDone(0),
+    m_llTotal(0),
+    m_llThrottled(0),
+    m_nCloned(0),
+    m_nCopied(0),
+    m_dSeconds(0)
+{
+}
+
+Snapshot::~Snapshot()
+{
+    Cancel();
+    Wait();
+}
+
+bool Snapshot::Start(const std::string& sSource, const std::string& sDest)
+{
+    if(m_bBusy)
+        return false;
+    Wait(); //Release thread of previous copy
+    m_sSource = sSource;
+    m_sDest = sDest;
+    m_bCancel = false;
+    m_llDone = 0;
+    m_llThrottled = 0;
+    m_nCloned = 0;
+    m_nCopied = 0;
+    clock_gettime(CLOCK_MONOTONIC, &m_tsStart);
+
+    //Find files to copy so that progress may be reported
+    struct stat st;
+    m_llTotal = (0 == stat((m_sSource + ".wav").c_str(), &st)) ? st.st_size : 0;
+    m_vTakes.clear();
+    DIR* pDir = opendir((m_sSource + ".takes").c_str());
+    if(pDir)
+    {
+        struct dirent* pEntry;
+        while((pEntry = readdir(pDir)))
+        {
+            std::string sPath = m_sSource + ".takes/" + pEntry->d_name;
+            if(0 == stat(sPath.c_str(), &st) && S_ISREG(st.st_mode))
+            {
+                m_vTakes.push_back(pEntry->d_name);
+                m_llTotal += st.st_size;
+            }
+        }
+        closedir(pDir);
+    }
+
+    m_bBusy = true;
+    if(pthread_create(&m_thread, NULL, CopyThread, this))
+    {
+        m_bBusy = false;
+        return false;
+    }
+    m_bThread = true;
+    return true;
+}
+
+bool Snapshot::Wait()
+{
+    if(m_bThread)
+        pthread_join(m_thread, NULL);
+    m_bThread = false;
+    return m_bResult;
+}
+
+void* Snapshot::CopyThread(void* pArgs)
+{
+    Snapshot* pSnapshot = (Snapshot*)pArgs;
+    TraceThread("snapshot");
+    TraceScope trace("copy");
+    //Copy only uses disk when it is otherwise idle so that it does not compete with streaming
+    ioprio_set(IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    pSnapshot->m_bResult = pSnapshot->Copy();
+    if(!pSnapshot->m_bResult)
+        pSnapshot->RemoveCopy();
+    timespec tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    pSnapshot->m_dSeconds = tsEnd.tv_sec - pSnapshot->m_tsStart.tv_sec + (tsEnd.tv_nsec - pSnapshot->m_tsStart.tv_nsec) / 1e9;
+    pSnapshot->m_bBusy = false;
+    return NULL;
+}
+
+bool Snapshot::Copy()
+{
+    if(!CopyFile(m_sSource + ".wav", m_sDest + ".wav.tmp"))
+        return false;
+    if(!m_vTakes.empty())
+    {
+        mkdir((m_sDest + ".takes.tmp").c_str(), 0755);
+        for(std::vector<std::string>::iterator it = m_vTakes.begin(); it != m_vTakes.end(); ++it)
+            if(!CopyFile(m_sSource + ".takes/" + *it, m_sDest + ".takes.tmp/" + *it))
+                return false;
+    }
+
+    //All data is complete so move files into place, configuration last
+    if(!m_vTakes.empty() && rename((m_sDest + ".takes.tmp").c_str(), (m_sDest + ".takes").c_str()))
+        return false;
+    if(rename((m_sDest + ".wav.tmp").c_str(), (m_sDest + ".wav").c_str()))
+        return false;
+    return 0 == rename((m_sDest + ".cfg.tmp").c_str(), (m_sDest + ".cfg").c_str());
+}
+
+bool Snapshot::CopyFile(const std::string& sSource, const std::string& sDest)
+{
+    int fdIn = open(sSource.c_str(), O_RDONLY);
+    if(fdIn < 0)
+        return false;
+    int fdOut = open(sDest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fdOut < 0)
+    {
+        close(fdIn);
+        return false;
+    }
+    struct stat st;
+    off_t offSize = (0 == fstat(fdIn, &st)) ? st.st_size : 0;
+
+#ifdef FICLONE
+    //Clone shares the source's blocks (copy on write) so takes milliseconds regardless of size
+    if(0 == ioctl(fdOut, FICLONE, fdIn))
+    {
+        m_llDone += offSize;
+        ++m_nCloned;
+        close(fdIn);
+        close(fdOut);
+        return true;
+    }
+#endif
+
+    //Copy in chunks within kernel, falling back to read / write if filesystem or kernel does not support copy_file_range
+    posix_fadvise(fdIn, 0, 0, POSIX_FADV_SEQUENTIAL);
+    bool bKernelCopy = true;
+    bool bResult = true;
+    std::vector<char> vBuffer;
+    off_t offPos = 0;
+    while(offPos < offSize)
+    {
+        if(m_bCancel)
+        {
+            bResult = false;
+            break;
+        }
+        size_t nSize = (offSize - offPos) < (off_t)SNAPSHOT_CHUNK ? offSize - offPos : SNAPSHOT_CHUNK;
+        ssize_t nCopied = -1;
+        if(bKernelCopy)
+        {
+            off_t offIn = offPos;
+            off_t offOut = offPos;
+            nCopied = CopyFileRange(fdIn, &offIn, fdOut, &offOut, nSize);
+            if(nCopied < 0 && (ENOSYS == errno || EXDEV == errno || EINVAL == errno || EOPNOTSUPP == errno))
+                bKernelCopy = false;
+        }
+        if(!bKernelCopy)
+        {
+            vBuffer.resize(SNAPSHOT_CHUNK);
+            nCopied = pread(fdIn, &vBuffer[0], nSize, offPos);
+            if(nCopied > 0 && pwrite(fdOut, &vBuffer[0], nCopied, offPos) != nCopied)
+                nCopied = -1;
+        }
+        if(nCopied <= 0)
+        {
+            bResult = false; //Error or source truncated whilst copying
+            break;
+        }
+        //Write back each chunk and drop it from cache so that a large burst of dirty pages does not stall streaming
+        fdatasync(fdOut);
+        posix_fadvise(fdOut, offPos, nCopied, POSIX_FADV_DONTNEED);
+        offPos += nCopied;
+        m_llDone += nCopied;
+        m_llThrottled += nCopied;
+        Throttle();
+    }
+    if(bResult)
+        ++m_nCopied;
+    close(fdIn);
+    close(fdOut);
+    return bResult;
+}
+
+void Snapshot::Throttle()
+{
+    //Sleep until average rate since start is within limit
+    timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    double dElapsed = tsNow.tv_sec - m_tsStart.tv_sec + (tsNow.tv_nsec - m_tsStart.tv_nsec) / 1e9;
+    double dRequired = double(m_llThrottled) / (SNAPSHOT_RATE * 1024 * 1024);
+    if(dRequired > dElapsed)
+        usleep((dRequired - dElapsed) * 1000000);
+}
+
+void Snapshot::RemoveCopy()
+{
+    //Configuration is moved into place last so files of an incomplete copy are not part of any project
+    unlink((m_sDest + ".cfg.tmp").c_str());
+    unlink((m_sDest + ".wav.tmp").c_str());
+    unlink((m_sDest + ".wav").c_str());
+    const char* asTakes[] = {".takes.tmp", ".takes"};
+    for(unsigned int i = 0; i < 2; ++i)
+    {
+        for(std::vector<std::string>::iterator it = m_vTakes.begin(); it != m_vTakes.end(); ++it)
+            unlink((m_sDest + asTakes[i] + "/" + *it).c_str());
+        rmdir((m_sDest + asTakes[i]).c_str());
+    }
+}
@@ -0,0 +1,88 @@
+/** Class saving a copy of a project under a new name without blocking the user interface or audio thread
+*   Each file is cloned (reflink) where the filesystem supports it, which takes milliseconds regardless of size
+*   Otherwise files are copied within the kernel by a background thread at idle I/O priority, throttled and synchronised in small chunks so that streaming is not starved
+*   Files are copied to temporary names and the copy's configuration is renamed into place last so the copy only appears once complete
+*/
+#pragma once
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+static const size_t SNAPSHOT_CHUNK      = 4 * 1024 * 1024; //Bytes copied at a time when files cannot be cloned
+static const unsigned int SNAPSHOT_RATE = 8; //Maximum megabytes per second copied when files cannot be cloned
+
+class Snapshot
+{
+    public:
+        Snapshot();
+        ~Snapshot();
+
+        /** @brief  Start copying a project in the background
+        *   @param  sSource Path and name of project without extension
+        *   @param  sDest Path and name of copy without extension
+        *   @return <i>bool</i> True if copy started
+        *   @note   Caller writes configuration of copy to sDest.cfg.tmp first - it is renamed to sDest.cfg when all data is copied
+        */
+        bool Start(const std::string& sSource, const std::string& sDest);
+
+        /** @brief  Stop copying, removing incomplete copy
+        */
+        void Cancel() { m_bCancel = true; }
+
+        /** @brief  Wait for copy to finish
+        *   @return <i>bool</i> True if copy is complete
+        */
+        bool Wait();
+
+        /** @brief  Check whether copy is in progress
+        *   @note   Call Wait once finished to release thread
+        */
+        bool IsBusy() { return m_bBusy; }
+
+        /** @brief  Get path and name of last copy without extension
+        */
+        const std::string& GetDest() { return m_sDest; }
+
+        /** @brief  Get progress of current copy
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress() { return m_llTotal ? 100 * m_llDone / m_llTotal : 0; }
+
+        /** @brief  Get quantity of files cloned by last copy
+        */
+        unsigned int GetCloned() { return m_nCloned; }
+
+        /** @brief  Get quantity of files copied (not cloned) by last copy
+        */
+        unsigned int GetCopied() { return m_nCopied; }
+
+        /** @brief  Get duration of last copy
+        *   @return <i>double</i> Seconds taken to copy
+        */
+        double GetSeconds() { return m_dSeconds; }
+
+    private:
+        static void* CopyThread(void* pArgs);
+        bool Copy();
+        bool CopyFile(const std::string& sSource, const std::string& sDest);
+        void Throttle();
+        void RemoveCopy();
+
+        std::string m_sSource; //Path and name of project without extension
+        std::string m_sDest; //Path and name of copy without extension
+        std::vector<std::string> m_vTakes; //Names of take files
+        pthread_t m_thread; //Thread copying files
+        bool m_bThread; //True if thread has not been joined
+        bool m_bResult; //True if last copy completed
+        std::atomic<bool> m_bBusy; //True whilst copying
+        std::atomic<bool> m_bCancel; //True to stop copying
+        std::atomic<long long> m_llDone; //Quantity of bytes copied
+        long long m_llTotal; //Quantity of bytes to copy
+        long long m_llThrottled; //Quantity of bytes copied (not cloned) since start - used to limit rate
+        unsigned int m_nCloned; //Quantity of files cloned
+        unsigned int m_nCopied; //Quantity of files copied
+        double m_dSeconds; //Duration of last copy
+        struct timespec m_tsStart; //Time copy started
+};
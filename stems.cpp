@@ -0,0 +1,214 @@
+#include "stems.h"
+#include "wave.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+StemExport::StemExport() :
+    m_nChannels(0),
+    m_lFrames(0),
+    m_nWriters(0),
+    m_lBlocksRead(0),
+    m_bError(false),
+    m_nProgress(0),
+    m_dSeconds(0),
+    m_nStems(0)
+{
+    for(unsigned int i = 0; i < STEM_BUFFERS; ++i)
+        m_apBlocks[i] = NULL;
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+StemExport::~StemExport()
+{
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+bool StemExport::Run(int fdSource, off_t offStart, unsigned int nChannels, long lFrames, unsigned int nSampleRate,
+    TakeStore* pTakes, const std::string& sPrefix, bool bSkipSilent, bool bTrim)
+{
+    timespec tsStart, tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+    m_nProgress = 0;
+    m_nStems = 0;
+    if(fdSource < 0 || 0 == nChannels)
+        return false;
+    m_nChannels = nChannels;
+    m_lFrames = lFrames;
+    m_lBlocksRead = 0;
+    m_bError = false;
+
+    //Create a stem for each track
+    m_vFiles.assign(nChannels, -1);
+    m_vSound.assign(nChannels, 0);
+    for(unsigned int nTrack = 0; nTrack < nChannels; ++nTrack)
+    {
+        char sSuffix[16];
+        sprintf(sSuffix, "%02u.wav", nTrack + 1);
+        m_vFiles[nTrack] = open((sPrefix + sSuffix).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(m_vFiles[nTrack] < 0)
+            m_bError = true;
+    }
+
+    //Start writers, each handling a subset of tracks
+    m_nWriters = sysconf(_SC_NPROCESSORS_ONLN);
+    if(m_nWriters < 1)
+        m_nWriters = 1;
+    if(m_nWriters > STEM_MAX_WRITERS)
+        m_nWriters = STEM_MAX_WRITERS;
+    if(m_nWriters > nChannels)
+        m_nWriters = nChannels;
+    m_vBlocksWritten.assign(m_nWriters, 0);
+    for(unsigned int i = 0; i < STEM_BUFFERS; ++i)
+        m_apBlocks[i] = new float[STEM_BLOCK_FRAMES * nChannels];
+    std::vector<std::pair<StemExport*, unsigned int> > vArgs;
+    for(unsigned int nWriter = 0; nWriter < m_nWriters; ++nWriter)
+        vArgs.push_back(std::make_pair(this, nWriter));
+    std::vector<pthread_t> vThreads;
+    for(unsigned int nWriter = 0; nWriter < m_nWriters && !m_bError; ++nWriter)
+    {
+        pthread_t thread;
+        if(0 == pthread_create(&thread, NULL, WriterThread, &vArgs[nWriter]))
+            vThreads.push_back(thread);
+        else
+            m_bError = true;
+    }
+
+    //Read project once, sequentially, whilst writers empty previous block
+    size_t nFrameSize = nChannels * sizeof(float);
+    posix_fadvise(fdSource, offStart, lFrames * nFrameSize, POSIX_FADV_SEQUENTIAL);
+    long lBlocks = (lFrames + STEM_BLOCK_FRAMES - 1) / STEM_BLOCK_FRAMES;
+    for(long lBlock = 0; lBlock < lBlocks; ++lBlock)
+    {
+        pthread_mutex_lock(&m_mutex);
+        bool bWait = true;
+        while(bWait && !m_bError)
+        {
+            //Wait for all writers to finish with the block previously held in this buffer
+            bWait = false;
+            for(unsigned int nWriter = 0; nWriter < m_nWriters; ++nWriter)
+                if(m_vBlocksWritten[nWriter] + (long)STEM_BUFFERS <= lBlock)
+                    bWait = true;
+            if(bWait)
+                pthread_cond_wait(&m_cond, &m_mutex);
+        }
+        bool bError = m_bError;
+        pthread_mutex_unlock(&m_mutex);
+        if(bError)
+            break;
+
+        float* pBlock = m_apBlocks[lBlock % STEM_BUFFERS];
+        long lFrame = lBlock * STEM_BLOCK_FRAMES;
+        long lCount = lFrames - lFrame;
+        if(lCount > STEM_BLOCK_FRAMES)
+            lCount = STEM_BLOCK_FRAMES;
+        size_t nSize = lCount * nFrameSize;
+        ssize_t nRead = pread(fdSource, pBlock, nSize, offStart + lFrame * nFrameSize);
+        size_t nValid = nRead > 0 ? nRead : 0;
+        if(nValid < nSize)
+            memset((char*)pBlock + nValid, 0, nSize - nValid);
+        if(pTakes)
+            pTakes->Overlay(pBlock, nChannels, lFrame, lCount);
+
+        pthread_mutex_lock(&m_mutex);
+        m_lBlocksRead = lBlock + 1;
+        pthread_cond_broadcast(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+        m_nProgress = 100 * lBlock / lBlocks;
+    }
+    for(std::vector<pthread_t>::iterator it = vThreads.begin(); it != vThreads.end(); ++it)
+        pthread_join(*it, NULL);
+    for(unsigned int i = 0; i < STEM_BUFFERS; ++i)
+    {
+        delete[] m_apBlocks[i];
+        m_apBlocks[i] = NULL;
+    }
+
+    //Finish each stem with its final length
+    for(unsigned int nTrack = 0; nTrack < nChannels; ++nTrack)
+    {
+        if(m_vFiles[nTrack] < 0)
+            continue;
+        long lLength = bTrim ? m_vSound[nTrack] : lFrames;
+        if(bSkipSilent && 0 == m_vSound[nTrack])
+        {
+            char sSuffix[16];
+            sprintf(sSuffix, "%02u.wav", nTrack + 1);
+            close(m_vFiles[nTrack]);
+            unlink((sPrefix + sSuffix).c_str());
+            continue;
+        }
+        if(ftruncate(m_vFiles[nTrack], 44 + lLength * sizeof(float)))
+            m_bError = true;
+        WriteWaveHeader(m_vFiles[nTrack], lLength * sizeof(float), 1, nSampleRate);
+        fdatasync(m_vFiles[nTrack]);
+        close(m_vFiles[nTrack]);
+        ++m_nStems;
+    }
+    m_vFiles.clear();
+
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+    m_dSeconds = tsEnd.tv_sec - tsStart.tv_sec + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+    m_nProgress = 100;
+    return !m_bError;
+}
+
+void* StemExport::WriterThread(void* pArgs)
+{
+    std::pair<StemExport*, unsigned int>* pWriter = (std::pair<StemExport*, unsigned int>*)pArgs;
+    pWriter->first->Write(pWriter->second);
+    return NULL;
+}
+
+void StemExport::Write(unsigned int nWriter)
+{
+    float* pMono = new float[STEM_BLOCK_FRAMES];
+    long lBlocks = (m_lFrames + STEM_BLOCK_FRAMES - 1) / STEM_BLOCK_FRAMES;
+    for(long lBlock = 0; lBlock < lBlocks; ++lBlock)
+    {
+        pthread_mutex_lock(&m_mutex);
+        while(m_lBlocksRead <= lBlock && !m_bError)
+            pthread_cond_wait(&m_cond, &m_mutex);
+        bool bError = m_bError;
+        pthread_mutex_unlock(&m_mutex);
+        if(bError)
+            break;
+
+        const float* pBlock = m_apBlocks[lBlock % STEM_BUFFERS];
+        long lFrame = lBlock * STEM_BLOCK_FRAMES;
+        long lCount = m_lFrames - lFrame;
+        if(lCount > STEM_BLOCK_FRAMES)
+            lCount = STEM_BLOCK_FRAMES;
+        for(unsigned int nTrack = nWriter; nTrack < m_nChannels && !bError; nTrack += m_nWriters)
+        {
+            //De-interleave with fixed stride so compiler may vectorise
+            const float* pSrc = pBlock + nTrack;
+            unsigned int nChannels = m_nChannels;
+            for(long i = 0; i < lCount; ++i)
+                pMono[i] = pSrc[i * nChannels];
+            for(long i = lCount - 1; i >= 0; --i)
+            {
+                if(0 != pMono[i])
+                {
+                    m_vSound[nTrack] = lFrame + i + 1;
+                    break;
+                }
+            }
+            size_t nSize = lCount * sizeof(float);
+            if(pwrite(m_vFiles[nTrack], pMono, nSize, 44 + lFrame * sizeof(float)) != (ssize_t)nSize)
+                bError = true;
+        }
+
+        pthread_mutex_lock(&m_mutex);
+        if(bError)
+            m_bError = true;
+        m_vBlocksWritten[nWriter] = lBlock + 1;
+        pthread_cond_broadcast(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+    }
+    delete[] pMono;
+}
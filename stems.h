@@ -0,0 +1,71 @@
+/** Class exporting each track of the project to its own mono WAVE file
+*   The interleaved project data is read once in large sequential blocks
+*   A pool of writer threads de-interleaves and writes a subset of the tracks each
+*/
+#pragma once
+
+#include "takestore.h"
+#include <atomic>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+static const unsigned int STEM_BLOCK_FRAMES = 65536; //Quantity of frames read at a time
+static const unsigned int STEM_BUFFERS      = 2; //Quantity of blocks being read or written at a time
+static const unsigned int STEM_MAX_WRITERS  = 4; //Maximum quantity of writer threads
+
+class StemExport
+{
+    public:
+        StemExport();
+        ~StemExport();
+
+        /** @brief  Write each track to a mono WAVE file
+        *   @param  fdSource File descriptor of project WAVE file
+        *   @param  offStart Offset of start of data in project WAVE file
+        *   @param  nChannels Quantity of interleaved channels in project WAVE file
+        *   @param  lFrames Quantity of frames to export
+        *   @param  nSampleRate Samples per second
+        *   @param  pTakes Pointer to take store overlaid on project data
+        *   @param  sPrefix Path and start of filename of each stem - track number and extension are appended
+        *   @param  bSkipSilent True to remove stems of tracks which are silent
+        *   @param  bTrim True to remove trailing silence from each stem
+        *   @return <i>bool</i> True on success
+        *   @note   Blocks until complete - progress is available from GetProgress
+        */
+        bool Run(int fdSource, off_t offStart, unsigned int nChannels, long lFrames, unsigned int nSampleRate,
+            TakeStore* pTakes, const std::string& sPrefix, bool bSkipSilent, bool bTrim);
+
+        /** @brief  Get progress of current export
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress() { return m_nProgress; }
+
+        /** @brief  Get duration of last export
+        *   @return <i>double</i> Seconds taken to export
+        */
+        double GetSeconds() { return m_dSeconds; }
+
+        /** @brief  Get quantity of stems written by last export
+        */
+        unsigned int GetStems() { return m_nStems; }
+
+    private:
+        static void* WriterThread(void* pArgs);
+        void Write(unsigned int nWriter);
+
+        unsigned int m_nChannels; //Quantity of interleaved channels
+        long m_lFrames; //Quantity of frames to export
+        unsigned int m_nWriters; //Quantity of writer threads
+        float* m_apBlocks[STEM_BUFFERS]; //Interleaved blocks shared by reader and writers
+        std::vector<int> m_vFiles; //File descriptor of each stem
+        std::vector<long> m_vSound; //Position after last non-silent frame of each track
+        long m_lBlocksRead; //Quantity of blocks available to writers
+        std::vector<long> m_vBlocksWritten; //Quantity of blocks written by each writer
+        bool m_bError; //True if a write failed
+        pthread_mutex_t m_mutex; //Protects block counts
+        pthread_cond_t m_cond; //Signalled when a block is read or written
+        std::atomic<int> m_nProgress; //Percentage complete
+        double m_dSeconds; //Duration of last export
+        unsigned int m_nStems; //Quantity of stems written by last export
+};
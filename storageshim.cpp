@@ -0,0 +1,90 @@
+#include "storageshim.h"
+#include "ioengine.h"
+#include <string.h>
+#include <unistd.h>
+
+StorageShim::StorageShim(const StorageProfile& profile, double dSpeed) :
+    m_profile(profile),
+    m_dSpeed(dSpeed > 0 ? dSpeed : 1),
+    m_dBusyUntil(0),
+    m_nRandom(0x2545f491),
+    m_lRequests(0),
+    m_lStalls(0),
+    m_lShort(0),
+    m_dWorstLatency(0)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+StorageShim::~StorageShim()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+const StorageProfile* StorageShim::Find(const char* pName)
+{
+    for(unsigned int i = 0; i < STORAGE_PROFILE_COUNT; ++i)
+        if(0 == strcmp(pName, STORAGE_PROFILES[i].pName))
+            return &STORAGE_PROFILES[i];
+    return NULL;
+}
+
+ssize_t StorageShim::Transfer(int nOp, int fd, char* pBuffer, size_t nSize, off_t offPos)
+{
+    pthread_mutex_lock(&m_mutex);
+    ++m_lRequests;
+    //Split request at a sector boundary as a device may when its transfer size is limited
+    if(m_profile.nShortEvery && nSize > STORAGE_SECTOR && 0 == Random() % m_profile.nShortEvery)
+    {
+        nSize = STORAGE_SECTOR * (1 + Random() % ((nSize - 1) / STORAGE_SECTOR));
+        ++m_lShort;
+    }
+    //Device time taken by this request in simulated seconds
+    unsigned int nRate = (IO_WRITE == nOp) ? m_profile.nWriteRate : m_profile.nReadRate;
+    double dService = m_profile.nLatency / 1e6;
+    if(nRate)
+        dService += nSize / (nRate * 1024.0);
+    if(m_profile.nStallEvery && 0 == Random() % m_profile.nStallEvery)
+    {
+        dService += m_profile.nStall / 1e3;
+        ++m_lStalls;
+    }
+    //Requests queue behind each other as on a single device
+    double dNow = Now();
+    double dStart = m_dBusyUntil > dNow ? m_dBusyUntil : dNow;
+    double dEnd = dStart + dService / m_dSpeed;
+    m_dBusyUntil = dEnd;
+    if((dEnd - dNow) * m_dSpeed > m_dWorstLatency)
+        m_dWorstLatency = (dEnd - dNow) * m_dSpeed;
+    pthread_mutex_unlock(&m_mutex);
+
+    ssize_t nResult = (IO_WRITE == nOp) ? pwrite(fd, pBuffer, nSize, offPos) : pread(fd, pBuffer, nSize, offPos);
+    double dWait = dEnd - Now();
+    if(dWait > 0)
+        usleep(dWait * 1e6);
+    return nResult;
+}
+
+double StorageShim::GetWorstLatency()
+{
+    pthread_mutex_lock(&m_mutex);
+    double dLatency = m_dWorstLatency * 1000;
+    pthread_mutex_unlock(&m_mutex);
+    return dLatency;
+}
+
+uint32_t StorageShim::Random()
+{
+    //xorshift32 - caller holds mutex
+    m_nRandom ^= m_nRandom << 13;
+    m_nRandom ^= m_nRandom >> 17;
+    m_nRandom ^= m_nRandom << 5;
+    return m_nRandom;
+}
+
+double StorageShim::Now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,102 @@
+/** Class simulating slow or unreliable storage by delaying and shortening file transfers
+*   Requests are serialised through a model of one device - each waits for the device, then for its latency and transfer time at the profile's bandwidth
+*   Occasional long stalls and short reads / writes are injected as seen on USB flash when it erases blocks or splits requests
+*   Delays are divided by a speed factor so the shim may be driven by a clock running faster than real time
+*/
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/** Structure describing the behaviour of a simulated storage device **/
+struct StorageProfile
+{
+    const char* pName; //Name used on command line
+    unsigned int nReadRate; //Read bandwidth in KB per second or 0 for unlimited
+    unsigned int nWriteRate; //Write bandwidth in KB per second or 0 for unlimited
+    unsigned int nLatency; //Microseconds added to each request
+    unsigned int nStallEvery; //Average quantity of requests between stalls or 0 for none
+    unsigned int nStall; //Milliseconds of each stall
+    unsigned int nShortEvery; //Average quantity of requests between short transfers or 0 for none
+};
+
+//Profiles modelled on measurements of removable flash storage - "none" passes requests unchanged to qualify real storage
+static const StorageProfile STORAGE_PROFILES[] =
+{
+    {"none", 0, 0, 0, 0, 0, 0},
+    {"ssd", 200000, 150000, 100, 5000, 20, 0},
+    {"sd", 20000, 10000, 1000, 500, 100, 100},
+    {"usb", 25000, 8000, 1500, 200, 250, 50},
+    {"usb-slow", 10000, 3000, 3000, 100, 800, 20}
+};
+static const unsigned int STORAGE_PROFILE_COUNT = sizeof(STORAGE_PROFILES) / sizeof(StorageProfile);
+static const size_t STORAGE_SECTOR = 512; //Short transfers are a multiple of this size
+
+class StorageShim
+{
+    public:
+        /** @brief  Construct a shim
+        *   @param  profile Behaviour of simulated device
+        *   @param  dSpeed Quantity of simulated seconds per real second - delays are divided by this
+        */
+        StorageShim(const StorageProfile& profile, double dSpeed = 1);
+        ~StorageShim();
+
+        /** @brief  Find a profile by name
+        *   @param  pName Name of profile
+        *   @return <i>const StorageProfile*</i> Pointer to profile or NULL if not found
+        */
+        static const StorageProfile* Find(const char* pName);
+
+        /** @brief  Read or write a block, blocking for the simulated duration of the transfer
+        *   @param  nOp Operation [IO_READ | IO_WRITE]
+        *   @param  fd File descriptor
+        *   @param  pBuffer Pointer to data
+        *   @param  nSize Quantity of bytes to transfer
+        *   @param  offPos Offset within file
+        *   @return <i>ssize_t</i> Quantity of bytes transferred, which may be less than requested, or -1 on failure with errno set
+        *   @note   Thread safe
+        */
+        ssize_t Transfer(int nOp, int fd, char* pBuffer, size_t nSize, off_t offPos);
+
+        /** @brief  Get profile of simulated device
+        */
+        const StorageProfile& GetProfile() { return m_profile; }
+
+        /** @brief  Get quantity of simulated seconds per real second
+        */
+        double GetSpeed() { return m_dSpeed; }
+
+        /** @brief  Get quantity of requests made
+        */
+        unsigned long GetRequests() { return m_lRequests; }
+
+        /** @brief  Get quantity of stalls injected
+        */
+        unsigned long GetStalls() { return m_lStalls; }
+
+        /** @brief  Get quantity of short transfers injected
+        */
+        unsigned long GetShortTransfers() { return m_lShort; }
+
+        /** @brief  Get longest time a request waited, including time queued behind other requests
+        *   @return <i>double</i> Simulated milliseconds
+        */
+        double GetWorstLatency();
+
+    private:
+        uint32_t Random();
+        double Now();
+
+        StorageProfile m_profile; //Behaviour of simulated device
+        double m_dSpeed; //Simulated seconds per real second
+        pthread_mutex_t m_mutex; //Protects device model and statistics
+        double m_dBusyUntil; //Real time (seconds) at which device completes queued requests
+        uint32_t m_nRandom; //State of pseudo-random generator - fixed seed so runs are repeatable
+        unsigned long m_lRequests; //Quantity of requests
+        unsigned long m_lStalls; //Quantity of stalls injected
+        unsigned long m_lShort; //Quantity of short transfers injected
+        double m_dWorstLatency; //Longest simulated seconds a request waited
+};
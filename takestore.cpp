@@ -0,0 +1,459 @@
+#include "takestore.h"
+#include "ioengine.h"
+#include "storageshim.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+static const unsigned int OVERLAY_FRAMES = 4096; //Quantity of frames read from take file at a time - a whole read-ahead chunk so each take is one request per chunk
+static const unsigned int COMPACT_FRAMES = CHECKSUM_BLOCK_FRAMES; //Quantity of frames merged at a time when compacting - one checksum entry per block
+
+static unsigned long TakeKey(unsigned int nTake, unsigned int nTrack)
+{
+    return ((unsigned long)nTake << 16) | nTrack;
+}
+
+TakeStore::TakeStore() :
+    m_nNextTake(1),
+    m_nFirstNewTake(1),
+    m_nLastMerged(0),
+    m_nProgress(0),
+    m_pShim(NULL)
+{
+    pthread_rwlock_init(&m_lock, NULL);
+    pthread_mutex_init(&m_mutexChecksums, NULL);
+}
+
+TakeStore::~TakeStore()
+{
+    Close();
+    pthread_rwlock_destroy(&m_lock);
+    pthread_mutex_destroy(&m_mutexChecksums);
+}
+
+void TakeStore::Open(const std::string& sDirectory)
+{
+    Close();
+    pthread_rwlock_wrlock(&m_lock);
+    m_sDirectory = sDirectory;
+    m_nNextTake = 1;
+    m_nFirstNewTake = 1;
+    m_nLastMerged = 0;
+    pthread_rwlock_unlock(&m_lock);
+}
+
+void TakeStore::Close()
+{
+    FinishChecksums();
+    pthread_mutex_lock(&m_mutexChecksums);
+    for(std::map<unsigned long, TakeChecksum*>::iterator it = m_mapChecksums.begin(); it != m_mapChecksums.end(); ++it)
+        delete it->second;
+    m_mapChecksums.clear();
+    pthread_mutex_unlock(&m_mutexChecksums);
+    pthread_rwlock_wrlock(&m_lock);
+    for(std::map<unsigned long, int>::iterator it = m_mapFiles.begin(); it != m_mapFiles.end(); ++it)
+        close(it->second);
+    m_mapFiles.clear();
+    m_vExtents.clear();
+    pthread_rwlock_unlock(&m_lock);
+}
+
+unsigned int TakeStore::BeginTake()
+{
+    pthread_rwlock_wrlock(&m_lock);
+    unsigned int nTake = m_nNextTake++;
+    if(nTake < m_nFirstNewTake)
+        m_nFirstNewTake = nTake;
+    mkdir(m_sDirectory.c_str(), 0755); //Directory is removed after compaction
+    pthread_rwlock_unlock(&m_lock);
+    return nTake;
+}
+
+std::string TakeStore::GetFilename(unsigned int nTake, unsigned int nTrack, const char* sExtension)
+{
+    char sName[32];
+    snprintf(sName, sizeof(sName), "take%04u-%02u%s", nTake, nTrack + 1, sExtension);
+    return m_sDirectory + sName;
+}
+
+int TakeStore::OpenFile(unsigned int nTake, unsigned int nTrack, bool bCreate)
+{
+    std::map<unsigned long, int>::iterator it = m_mapFiles.find(TakeKey(nTake, nTrack));
+    if(it != m_mapFiles.end())
+        return it->second;
+    //Takes started this session overwrite any file left by an earlier (unsaved) session
+    int nFlags = bCreate ? O_RDWR | O_CREAT : O_RDWR;
+    if(bCreate && nTake >= m_nFirstNewTake)
+        nFlags |= O_TRUNC;
+    int fd = open(GetFilename(nTake, nTrack).c_str(), nFlags, 0644);
+    if(fd >= 0)
+        m_mapFiles[TakeKey(nTake, nTrack)] = fd;
+    return fd;
+}
+
+int TakeStore::GetFile(unsigned int nTake, unsigned int nTrack)
+{
+    pthread_rwlock_wrlock(&m_lock);
+    int fd = OpenFile(nTake, nTrack, true);
+    pthread_rwlock_unlock(&m_lock);
+    return fd;
+}
+
+void TakeStore::AddChecksum(unsigned int nTake, unsigned int nTrack, long lOffset, const float* pSamples, unsigned int nFrames)
+{
+    pthread_mutex_lock(&m_mutexChecksums);
+    TakeChecksum*& pChecksum = m_mapChecksums[TakeKey(nTake, nTrack)];
+    if(!pChecksum)
+    {
+        //Take is new so any index left by an earlier (unsaved) session is replaced
+        pChecksum = new TakeChecksum();
+        std::string sFilename = GetFilename(nTake, nTrack, ".sums");
+        unlink(sFilename.c_str());
+        pChecksum->index.Open(sFilename, 1, true);
+        pChecksum->lNext = -1;
+    }
+    while(nFrames)
+    {
+        if(lOffset != pChecksum->lNext)
+        {
+            //Frames hashed before gap keep a partial entry
+            if(pChecksum->lNext >= 0 && pChecksum->state.lLength)
+            {
+                uint64_t lHash = BlockChecksums::Digest(pChecksum->state);
+                pChecksum->index.Write(pChecksum->lBlock, pChecksum->state.lLength / sizeof(float), &lHash);
+            }
+            pChecksum->lNext = -1;
+            long lSkip = (CHECKSUM_BLOCK_FRAMES - lOffset % CHECKSUM_BLOCK_FRAMES) % CHECKSUM_BLOCK_FRAMES;
+            if(lSkip >= nFrames)
+                break;
+            //Hashing restarts at next block boundary
+            lOffset += lSkip;
+            pSamples += lSkip;
+            nFrames -= lSkip;
+            pChecksum->lBlock = lOffset / CHECKSUM_BLOCK_FRAMES;
+            pChecksum->lNext = lOffset;
+            BlockChecksums::Begin(pChecksum->state);
+        }
+        unsigned int nCount = std::min(nFrames, (unsigned int)(CHECKSUM_BLOCK_FRAMES - lOffset % CHECKSUM_BLOCK_FRAMES));
+        BlockChecksums::Update(pChecksum->state, pSamples, nCount * sizeof(float));
+        lOffset += nCount;
+        pSamples += nCount;
+        nFrames -= nCount;
+        pChecksum->lNext = lOffset;
+        if(0 == lOffset % CHECKSUM_BLOCK_FRAMES)
+        {
+            uint64_t lHash = BlockChecksums::Digest(pChecksum->state);
+            pChecksum->index.Write(pChecksum->lBlock++, CHECKSUM_BLOCK_FRAMES, &lHash);
+            BlockChecksums::Begin(pChecksum->state);
+        }
+    }
+    pthread_mutex_unlock(&m_mutexChecksums);
+}
+
+void TakeStore::FinishChecksums()
+{
+    pthread_mutex_lock(&m_mutexChecksums);
+    for(std::map<unsigned long, TakeChecksum*>::iterator it = m_mapChecksums.begin(); it != m_mapChecksums.end(); ++it)
+    {
+        TakeChecksum* pChecksum = it->second;
+        if(pChecksum->lNext < 0 || 0 == pChecksum->state.lLength)
+            continue;
+        uint64_t lHash = BlockChecksums::Digest(pChecksum->state);
+        pChecksum->index.Write(pChecksum->lBlock, pChecksum->state.lLength / sizeof(float), &lHash);
+    }
+    pthread_mutex_unlock(&m_mutexChecksums);
+}
+
+bool TakeStore::AddExtent(const TakeExtent& extent)
+{
+    pthread_rwlock_wrlock(&m_lock);
+    if(extent.nTake >= m_nNextTake)
+    {
+        m_nNextTake = extent.nTake + 1;
+        m_nFirstNewTake = m_nNextTake;
+    }
+    //Take of an earlier session is opened without creating it - a missing file (e.g. removed after merge) would overlay silence
+    if(OpenFile(extent.nTake, extent.nTrack, false) < 0)
+    {
+        pthread_rwlock_unlock(&m_lock);
+        return false;
+    }
+    bool bMerged = false;
+    for(std::vector<TakeExtent>::reverse_iterator it = m_vExtents.rbegin(); it != m_vExtents.rend(); ++it)
+    {
+        if(it->nTake != extent.nTake || it->nTrack != extent.nTrack)
+            continue;
+        if(it->lStart + it->lFrames == extent.lStart && it->lOffset + it->lFrames == extent.lOffset)
+        {
+            it->lFrames += extent.lFrames;
+            bMerged = true;
+        }
+        break;
+    }
+    if(!bMerged)
+        m_vExtents.push_back(extent);
+    pthread_rwlock_unlock(&m_lock);
+    return true;
+}
+
+void TakeStore::Overlay(float* pFrames, unsigned int nChannels, long lFrame, unsigned int nFrames)
+{
+    float afTake[OVERLAY_FRAMES];
+    long lEnd = lFrame + nFrames;
+    pthread_rwlock_rdlock(&m_lock);
+    for(std::vector<TakeExtent>::iterator it = m_vExtents.begin(); it != m_vExtents.end(); ++it)
+    {
+        if(it->nTrack >= nChannels)
+            continue;
+        long lStart = std::max(it->lStart, lFrame);
+        long lStop = std::min(it->lStart + it->lFrames, lEnd);
+        if(lStart >= lStop)
+            continue;
+        std::map<unsigned long, int>::iterator itFile = m_mapFiles.find(TakeKey(it->nTake, it->nTrack));
+        if(itFile == m_mapFiles.end())
+            continue;
+        while(lStart < lStop)
+        {
+            long lCount = std::min(lStop - lStart, (long)OVERLAY_FRAMES);
+            ssize_t nRead = ReadTake(itFile->second, afTake, lCount * sizeof(float), (it->lOffset + lStart - it->lStart) * sizeof(float));
+            long lRead = nRead > 0 ? nRead / sizeof(float) : 0;
+            if(lRead < lCount)
+                memset(afTake + lRead, 0, (lCount - lRead) * sizeof(float));
+            float* pDest = pFrames + (lStart - lFrame) * nChannels + it->nTrack;
+            for(long i = 0; i < lCount; ++i)
+                pDest[i * nChannels] = afTake[i];
+            lStart += lCount;
+        }
+    }
+    pthread_rwlock_unlock(&m_lock);
+}
+
+ssize_t TakeStore::ReadTake(int fd, float* pBuffer, size_t nSize, off_t offPos)
+{
+    //Continue short reads so that only end of file or failure leaves silence
+    size_t nDone = 0;
+    while(nDone < nSize)
+    {
+        char* pDest = (char*)pBuffer + nDone;
+        ssize_t nRead = m_pShim ? m_pShim->Transfer(IO_READ, fd, pDest, nSize - nDone, offPos + nDone) : pread(fd, pDest, nSize - nDone, offPos + nDone);
+        if(nRead <= 0)
+            return nDone ? (ssize_t)nDone : nRead;
+        nDone += nRead;
+    }
+    return nDone;
+}
+
+void TakeStore::Prefetch(long lFrame, long lFrames)
+{
+    long lEnd = lFrame + lFrames;
+    pthread_rwlock_rdlock(&m_lock);
+    for(std::vector<TakeExtent>::iterator it = m_vExtents.begin(); it != m_vExtents.end(); ++it)
+    {
+        long lStart = std::max(it->lStart, lFrame);
+        long lStop = std::min(it->lStart + it->lFrames, lEnd);
+        if(lStart >= lStop)
+            continue;
+        std::map<unsigned long, int>::iterator itFile = m_mapFiles.find(TakeKey(it->nTake, it->nTrack));
+        if(itFile != m_mapFiles.end())
+            posix_fadvise(itFile->second, (it->lOffset + lStart - it->lStart) * sizeof(float), (lStop - lStart) * sizeof(float), POSIX_FADV_WILLNEED);
+    }
+    pthread_rwlock_unlock(&m_lock);
+}
+
+bool TakeStore::Undo()
+{
+    pthread_rwlock_rdlock(&m_lock);
+    unsigned int nLast = 0;
+    for(std::vector<TakeExtent>::iterator it = m_vExtents.begin(); it != m_vExtents.end(); ++it)
+        nLast = std::max(nLast, it->nTake);
+    pthread_rwlock_unlock(&m_lock);
+    if(0 == nLast)
+        return false;
+    RemoveTakes(nLast, nLast);
+    pthread_rwlock_wrlock(&m_lock);
+    m_nNextTake = nLast; //Reuse take number
+    if(m_nFirstNewTake > nLast)
+        m_nFirstNewTake = nLast;
+    pthread_rwlock_unlock(&m_lock);
+    return true;
+}
+
+void TakeStore::RemoveTakes(unsigned int nFirst, unsigned int nLast)
+{
+    ForgetTakes(nFirst, nLast);
+    RemoveFiles(nFirst, nLast);
+}
+
+void TakeStore::ForgetTakes(unsigned int nFirst, unsigned int nLast)
+{
+    pthread_rwlock_wrlock(&m_lock);
+    std::vector<TakeExtent>::iterator it = m_vExtents.begin();
+    while(it != m_vExtents.end())
+    {
+        if(it->nTake >= nFirst && it->nTake <= nLast)
+            it = m_vExtents.erase(it);
+        else
+            ++it;
+    }
+    pthread_rwlock_unlock(&m_lock);
+}
+
+void TakeStore::RemoveFiles(unsigned int nFirst, unsigned int nLast)
+{
+    pthread_rwlock_wrlock(&m_lock);
+    std::map<unsigned long, int>::iterator itFile = m_mapFiles.begin();
+    while(itFile != m_mapFiles.end())
+    {
+        unsigned int nTake = itFile->first >> 16;
+        if(nTake >= nFirst && nTake <= nLast)
+        {
+            close(itFile->second);
+            unlink(GetFilename(nTake, itFile->first & 0xFFFF).c_str());
+            unlink(GetFilename(nTake, itFile->first & 0xFFFF, ".sums").c_str());
+            m_mapFiles.erase(itFile++);
+        }
+        else
+            ++itFile;
+    }
+    pthread_mutex_lock(&m_mutexChecksums);
+    std::map<unsigned long, TakeChecksum*>::iterator itChecksum = m_mapChecksums.begin();
+    while(itChecksum != m_mapChecksums.end())
+    {
+        unsigned int nTake = itChecksum->first >> 16;
+        if(nTake >= nFirst && nTake <= nLast)
+        {
+            delete itChecksum->second;
+            m_mapChecksums.erase(itChecksum++);
+        }
+        else
+            ++itChecksum;
+    }
+    pthread_mutex_unlock(&m_mutexChecksums);
+    pthread_rwlock_unlock(&m_lock);
+}
+
+bool TakeStore::Compact(int fd, off_t offStart, unsigned int nChannels, BlockChecksums* pChecksums)
+{
+    m_nProgress = 0;
+    //Find ranges of project covered by takes
+    std::vector<std::pair<long, long> > vRanges;
+    unsigned int nLast = 0;
+    pthread_rwlock_rdlock(&m_lock);
+    for(std::vector<TakeExtent>::iterator it = m_vExtents.begin(); it != m_vExtents.end(); ++it)
+    {
+        vRanges.push_back(std::make_pair(it->lStart, it->lStart + it->lFrames));
+        nLast = std::max(nLast, it->nTake);
+    }
+    pthread_rwlock_unlock(&m_lock);
+    if(0 == nLast)
+    {
+        m_nProgress = 100;
+        return true;
+    }
+    size_t nFrameSize = nChannels * sizeof(float);
+    if(pChecksums)
+    {
+        //Extend ranges to whole blocks, except at end of data, so each block is hashed complete
+        struct stat st;
+        long lFileFrames = fstat(fd, &st) || st.st_size < offStart ? 0 : (st.st_size - offStart) / nFrameSize;
+        for(std::vector<std::pair<long, long> >::iterator it = vRanges.begin(); it != vRanges.end(); ++it)
+        {
+            long lEnd = (it->second + COMPACT_FRAMES - 1) / COMPACT_FRAMES * COMPACT_FRAMES;
+            it->first -= it->first % COMPACT_FRAMES;
+            it->second = std::min(lEnd, std::max(it->second, lFileFrames));
+        }
+    }
+    std::sort(vRanges.begin(), vRanges.end());
+    std::vector<std::pair<long, long> > vMerged;
+    long lTotal = 0;
+    for(std::vector<std::pair<long, long> >::iterator it = vRanges.begin(); it != vRanges.end(); ++it)
+    {
+        if(!vMerged.empty() && it->first <= vMerged.back().second)
+            vMerged.back().second = std::max(vMerged.back().second, it->second);
+        else
+            vMerged.push_back(*it);
+    }
+    for(std::vector<std::pair<long, long> >::iterator it = vMerged.begin(); it != vMerged.end(); ++it)
+        lTotal += it->second - it->first;
+
+    //Merge each range into interleaved data using large sequential blocks
+    std::vector<float> vBlock(COMPACT_FRAMES * nChannels);
+    char* pBlock = (char*)&vBlock[0];
+    long lDone = 0;
+    for(std::vector<std::pair<long, long> >::iterator it = vMerged.begin(); it != vMerged.end(); ++it)
+    {
+        for(long lFrame = it->first; lFrame < it->second; lFrame += COMPACT_FRAMES)
+        {
+            long lCount = std::min(it->second - lFrame, (long)COMPACT_FRAMES);
+            size_t nSize = lCount * nFrameSize;
+            off_t offPos = offStart + lFrame * nFrameSize;
+            ssize_t nRead = pread(fd, pBlock, nSize, offPos);
+            size_t nValid = nRead > 0 ? nRead : 0;
+            if(nValid < nSize)
+                memset(pBlock + nValid, 0, nSize - nValid);
+            Overlay(&vBlock[0], nChannels, lFrame, lCount);
+            if(pwrite(fd, pBlock, nSize, offPos) != (ssize_t)nSize)
+                return false;
+            if(pChecksums)
+                pChecksums->Store(lFrame / COMPACT_FRAMES, &vBlock[0], lCount);
+            lDone += lCount;
+            m_nProgress = 100 * lDone / lTotal;
+        }
+    }
+    fdatasync(fd);
+    if(pChecksums)
+        pChecksums->Sync();
+
+    //Takes are now part of the interleaved data - files are removed by RemoveMerged once configuration no longer refers to them
+    m_nLastMerged = nLast;
+    m_nProgress = 100;
+    return true;
+}
+
+void TakeStore::ForgetMerged()
+{
+    if(m_nLastMerged)
+        ForgetTakes(0, m_nLastMerged);
+}
+
+void TakeStore::RemoveMerged()
+{
+    if(0 == m_nLastMerged)
+        return;
+    RemoveTakes(0, m_nLastMerged);
+    m_nLastMerged = 0;
+    rmdir(m_sDirectory.c_str()); //Fails harmlessly if takes recorded since compaction remain
+}
+
+void TakeStore::Clear()
+{
+    pthread_rwlock_rdlock(&m_lock);
+    unsigned int nLast = 0;
+    for(std::vector<TakeExtent>::iterator it = m_vExtents.begin(); it != m_vExtents.end(); ++it)
+        nLast = std::max(nLast, it->nTake);
+    pthread_rwlock_unlock(&m_lock);
+    RemoveTakes(0, nLast);
+    rmdir(m_sDirectory.c_str());
+}
+
+std::vector<TakeExtent> TakeStore::GetExtents()
+{
+    pthread_rwlock_rdlock(&m_lock);
+    std::vector<TakeExtent> vExtents = m_vExtents;
+    pthread_rwlock_unlock(&m_lock);
+    return vExtents;
+}
+
+unsigned int TakeStore::GetTakeCount()
+{
+    std::vector<unsigned int> vTakes;
+    pthread_rwlock_rdlock(&m_lock);
+    for(std::vector<TakeExtent>::iterator it = m_vExtents.begin(); it != m_vExtents.end(); ++it)
+        if(std::find(vTakes.begin(), vTakes.end(), it->nTake) == vTakes.end())
+            vTakes.push_back(it->nTake);
+    pthread_rwlock_unlock(&m_lock);
+    return vTakes.size();
+}
@@ -0,0 +1,175 @@
+/** Class managing append-only take storage
+*   Captured audio is appended to one mono file per take per track
+*   An extent map records which take supplies which frames of each track, later takes overriding earlier takes
+*   Takes are merged into the interleaved WAVE data by Compact
+*   Each take file has a checksum index, hashed by the disk thread as chunks are written
+*/
+#pragma once
+
+#include "checksums.h"
+#include <sys/types.h>
+#include <pthread.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+class StorageShim;
+
+/** Structure representing a range of frames of a track supplied by a take **/
+struct TakeExtent
+{
+    unsigned int nTake; //Take number
+    unsigned int nTrack; //Index of track
+    long lStart; //Position of first frame in project
+    long lFrames; //Quantity of frames
+    long lOffset; //Position of first frame in take file
+};
+
+/** Structure holding checksum of take file being written **/
+struct TakeChecksum
+{
+    BlockChecksums index; //Checksum index of take file
+    ChecksumState state; //Hash of frames of current block written so far
+    long lBlock; //Index of current block
+    long lNext; //Position in take file of next frame expected or -1 to start at next block
+};
+
+class TakeStore
+{
+    public:
+        TakeStore();
+        ~TakeStore();
+
+        /** @brief  Start using a take directory, creating it if necessary
+        *   @param  sDirectory Path of directory holding take files including trailing slash
+        */
+        void Open(const std::string& sDirectory);
+
+        /** @brief  Close take files and clear extent map
+        */
+        void Close();
+
+        /** @brief  Start a new take
+        *   @return <i>unsigned int</i> Take number
+        */
+        unsigned int BeginTake();
+
+        /** @brief  Get file descriptor of a take file, opening or creating it as required
+        *   @param  nTake Take number
+        *   @param  nTrack Index of track
+        *   @return <i>int</i> File descriptor or -1 on failure
+        */
+        int GetFile(unsigned int nTake, unsigned int nTrack);
+
+        /** @brief  Add frames being written to a take file to its checksum index
+        *   @param  nTake Take number
+        *   @param  nTrack Index of track
+        *   @param  lOffset Position of first frame in take file
+        *   @param  pSamples Pointer to samples
+        *   @param  nFrames Quantity of frames
+        *   @note   Frames are expected in order - a gap leaves frames up to the next block unprotected
+        */
+        void AddChecksum(unsigned int nTake, unsigned int nTrack, long lOffset, const float* pSamples, unsigned int nFrames);
+
+        /** @brief  Write checksums of partly written blocks so every frame written so far is protected
+        *   @note   Takes may continue after this - their blocks are rewritten as they grow
+        */
+        void FinishChecksums();
+
+        /** @brief  Add frames written to a take file to the extent map
+        *   @param  extent Extent to add, merged with previous extent of same take and track if contiguous
+        *   @return <i>bool</i> False if the take file does not exist, in which case the extent is not added
+        */
+        bool AddExtent(const TakeExtent& extent);
+
+        /** @brief  Replace samples in interleaved buffer with samples from takes
+        *   @param  pFrames Interleaved samples
+        *   @param  nChannels Quantity of interleaved channels
+        *   @param  lFrame Position of first frame in project
+        *   @param  nFrames Quantity of frames
+        *   @note   Thread safe
+        */
+        void Overlay(float* pFrames, unsigned int nChannels, long lFrame, unsigned int nFrames);
+
+        /** @brief  Read take data through a simulated storage device, e.g. for soak tests
+        *   @param  pShim Pointer to shim or NULL to access storage directly
+        */
+        void SetShim(StorageShim* pShim) { m_pShim = pShim; }
+
+        /** @brief  Issue asynchronous operating system readahead for take data within a range of the project
+        *   @param  lFrame Position of first frame in project
+        *   @param  lFrames Quantity of frames
+        */
+        void Prefetch(long lFrame, long lFrames);
+
+        /** @brief  Remove most recent take
+        *   @return <i>bool</i> True if a take was removed
+        */
+        bool Undo();
+
+        /** @brief  Merge all takes into interleaved WAVE data
+        *   @param  fd File descriptor of WAVE file
+        *   @param  offStart Offset of start of data in file
+        *   @param  nChannels Quantity of interleaved channels
+        *   @param  pChecksums Pointer to checksum index of WAVE file to update or NULL for none
+        *   @return <i>bool</i> True on success
+        *   @note   Blocks until complete - progress is available from GetProgress
+        *   @note   Whole checksum blocks are merged so each block written has a complete entry
+        *   @note   Merged takes remain until ForgetMerged and RemoveMerged are called
+        */
+        bool Compact(int fd, off_t offStart, unsigned int nChannels, BlockChecksums* pChecksums = NULL);
+
+        /** @brief  Remove takes merged by Compact from extent map, keeping their files
+        *   @note   Save configuration before calling RemoveMerged so that it never refers to removed take files
+        */
+        void ForgetMerged();
+
+        /** @brief  Remove files of takes merged by Compact and the take directory if empty
+        */
+        void RemoveMerged();
+
+        /** @brief  Remove all takes and the take directory, e.g. after takes are merged into a new WAVE file
+        */
+        void Clear();
+
+        /** @brief  Get progress of current compaction
+        *   @return <i>int</i> Percentage complete
+        */
+        int GetProgress() { return m_nProgress; }
+
+        /** @brief  Get copy of extent map
+        */
+        std::vector<TakeExtent> GetExtents();
+
+        /** @brief  Get quantity of takes in extent map
+        */
+        unsigned int GetTakeCount();
+
+        /** @brief  Get path of a take file or of its checksum index
+        *   @param  nTake Take number
+        *   @param  nTrack Index of track
+        *   @param  sExtension Extension of file
+        *   @return <i>std::string</i> Path of file
+        */
+        std::string GetFilename(unsigned int nTake, unsigned int nTrack, const char* sExtension = ".raw");
+
+    private:
+        int OpenFile(unsigned int nTake, unsigned int nTrack, bool bCreate);
+        void RemoveTakes(unsigned int nFirst, unsigned int nLast);
+        void ForgetTakes(unsigned int nFirst, unsigned int nLast);
+        void RemoveFiles(unsigned int nFirst, unsigned int nLast);
+        ssize_t ReadTake(int fd, float* pBuffer, size_t nSize, off_t offPos);
+
+        std::string m_sDirectory; //Path of take directory
+        std::vector<TakeExtent> m_vExtents; //Extent map in order of recording
+        std::map<unsigned long, int> m_mapFiles; //Open take files indexed by take and track
+        std::map<unsigned long, TakeChecksum*> m_mapChecksums; //Checksums of take files written this session indexed by take and track
+        pthread_mutex_t m_mutexChecksums; //Protects checksums - held separately from extent map so hashing never delays overlay
+        unsigned int m_nNextTake; //Number of next take
+        unsigned int m_nFirstNewTake; //Number of first take created this session
+        std::atomic<unsigned int> m_nLastMerged; //Number of last take merged by Compact whose files remain or 0 if none
+        pthread_rwlock_t m_lock; //Protects extent map and files
+        std::atomic<int> m_nProgress; //Percentage progress of compaction
+        StorageShim* m_pShim; //Simulated storage device or NULL for none
+};
@@ -0,0 +1,407 @@
+/** Benchmark of the audio path - times Engine::Render without JACK
+*   mix: time per period against quantity of tracks and mixing workers, showing where the worker pool pays off
+*   inserts: time per period of MAX_TRACKS tracks with each stage of the insert chain, against the share of the period allowed
+*   resample: time per period converting MAX_TRACKS tracks of playback between common sample rates at each quality, per track and against the share of the period allowed
+*   io: syscalls per period and MB/s streaming tracks through DiskStream with io_uring and with the thread pool fallback
+*   Projects are created in a temporary directory and removed afterwards
+*/
+#include "engine.h"
+#include "resampler.h"
+#include "track.h"
+#include "wave.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+static const jack_nframes_t BENCH_PERIOD    = 256; //Frames per period
+static const unsigned int BENCH_RATE        = 48000; //Sample rate of benchmark projects
+static const unsigned int BENCH_PERIODS     = 2000; //Periods timed in each run
+static const unsigned int BENCH_WARMUP      = 50; //Periods rendered before timing starts
+static const double BENCH_BUDGET            = 50; //Percentage of period that Engine::Render may use - the rest is left for JACK, disk and UI, e.g. on a Raspberry Pi
+static const unsigned int BENCH_FRAMES      = (BENCH_PERIODS + BENCH_WARMUP + 100) * BENCH_PERIOD; //Length of mix and inserts projects
+static const unsigned int BENCH_IO_SECONDS  = 30; //Length of io projects
+static const unsigned int BENCH_IO_WAIT     = 100000; //Longest wait in microseconds for read-ahead - only reached at end of project
+//Insert chains timed by inserts benchmark
+static const unsigned int CHAIN_NONE        = 0;
+static const unsigned int CHAIN_HIGHPASS    = 1;
+static const unsigned int CHAIN_EQ          = 2;
+static const unsigned int CHAIN_ALL         = 3;
+static const char* const CHAIN_NAMES[] = {"none", "high-pass", "high-pass+eq", "high-pass+eq+comp"};
+static const char* const QUALITY_NAMES[] = {"fast", "medium", "best"}; //Resampler qualities timed by resample benchmark
+
+/** Structure holding result of a timed run **/
+struct BenchResult
+{
+    double dMean; //Mean time per period in microseconds
+    double dMax; //Longest period in microseconds
+};
+
+/** Structure describing a sample rate conversion timed by resample benchmark **/
+struct RateCase
+{
+    unsigned int nFileRate; //Sample rate of project
+    unsigned int nDeviceRate; //Sample rate of audio interface
+};
+
+/** Structure holding result of a streaming run **/
+struct IoResult
+{
+    bool bUring; //True if io_uring was used
+    double dMbps; //MB read per second
+    double dSyscalls; //Mean system calls per period
+    unsigned int nPeriods; //Quantity of periods streamed
+    unsigned int nUnderruns; //Quantity of periods played with missing data
+};
+
+static double Now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/** Get next sample of noise */
+static float Noise(unsigned int& nSeed)
+{
+    nSeed = nSeed * 1664525 + 1013904223;
+    return ((int)nSeed >> 8) / 16777216.0f;
+}
+
+/** Create a native project of noise */
+static bool CreateProject(const std::string& sPath, const std::string& sName, unsigned int nTracks, unsigned int nFrames)
+{
+    std::string sFilename = sPath + sName + ".wav";
+    int fd = open(sFilename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+    WriteWaveHeader(fd, nFrames * nTracks * sizeof(float), nTracks, BENCH_RATE);
+    std::vector<float> vBlock(BENCH_PERIOD * nTracks);
+    unsigned int nSeed = 1;
+    bool bResult = true;
+    for(unsigned int nFrame = 0; nFrame < nFrames && bResult; nFrame += BENCH_PERIOD)
+    {
+        for(size_t i = 0; i < vBlock.size(); ++i)
+            vBlock[i] = Noise(nSeed);
+        size_t nSize = vBlock.size() * sizeof(float);
+        bResult = pwrite(fd, &vBlock[0], nSize, 44 + (off_t)nFrame * nTracks * sizeof(float)) == (ssize_t)nSize; //Header is written at start of file without moving file offset
+    }
+    close(fd);
+    return bResult;
+}
+
+/** Start playing project from start once read-ahead is primed */
+static bool StartPlayback(Engine& engine, float* const* apOut)
+{
+    //Render stopped periods as JACK would so that read-ahead of load is released when project locates to its playhead
+    for(unsigned int nWait = 0; !engine.GetDiskStream().IsPrimed(); ++nWait)
+    {
+        if(nWait > 5000)
+            return false;
+        engine.Render(BENCH_PERIOD, NULL, NULL, apOut);
+        usleep(1000);
+    }
+    if(!engine.StartTransport())
+        return false;
+    for(unsigned int nWait = 0; !engine.Render(BENCH_PERIOD, NULL, NULL, apOut); ++nWait)
+    {
+        if(nWait > 5000)
+            return false;
+        usleep(1000); //Wait for read-ahead at start position
+    }
+    return true;
+}
+
+/** Play project from start, timing each period once read-ahead is primed */
+static bool TimeRender(Engine& engine, BenchResult* pResult)
+{
+    static float aafOut[MAX_TRACKS][BENCH_PERIOD];
+    float* apOut[MAX_TRACKS];
+    for(unsigned int i = 0; i < MAX_TRACKS; ++i)
+        apOut[i] = aafOut[i];
+    if(!StartPlayback(engine, apOut))
+        return false;
+    for(unsigned int i = 0; i < BENCH_WARMUP; ++i)
+        engine.Render(BENCH_PERIOD, NULL, NULL, apOut);
+    //Pace at real time so disk thread keeps up as it would with JACK
+    double dPeriod = BENCH_PERIOD * 1e6 / BENCH_RATE;
+    double dTotal = 0, dMax = 0;
+    double dNext = Now();
+    for(unsigned int i = 0; i < BENCH_PERIODS; ++i)
+    {
+        double dStart = Now();
+        engine.Render(BENCH_PERIOD, NULL, NULL, apOut);
+        double dTime = Now() - dStart;
+        dTotal += dTime;
+        if(dTime > dMax)
+            dMax = dTime;
+        dNext += dPeriod / 8; //Eight times real time keeps run short whilst leaving disk thread time to read
+        double dWait = dNext - Now();
+        if(dWait > 0)
+            usleep(dWait);
+    }
+    engine.StopTransport();
+    for(unsigned int i = 0; i < 4; ++i)
+        engine.Render(BENCH_PERIOD, NULL, NULL, apOut);
+    pResult->dMean = dTotal / BENCH_PERIODS;
+    pResult->dMax = dMax;
+    return true;
+}
+
+/** Open project, set every track audible with insert chain and time it */
+static bool RunProject(const std::string& sPath, unsigned int nTracks, unsigned int nWorkers, unsigned int nChain, BenchResult* pResult)
+{
+    Engine engine;
+    engine.SetPath(sPath);
+    if(!engine.LoadProject("bench"))
+        return false;
+    engine.SetParallelTracks(nWorkers ? 1 : MAX_TRACKS + 1);
+    if(engine.StartWorkers(nWorkers) != nWorkers)
+        return false;
+    for(unsigned int nTrack = 0; nTrack < nTracks; ++nTrack)
+    {
+        Track* pTrack = engine.GetTrack(nTrack);
+        pTrack->nMonMix = 80;
+        if(nChain >= CHAIN_HIGHPASS)
+            pTrack->fHighPass = 80;
+        if(nChain >= CHAIN_EQ)
+        {
+            pTrack->fEqFrequency = 2000;
+            pTrack->fEqGain = 6;
+            pTrack->fEqQ = 1;
+        }
+        if(nChain >= CHAIN_ALL)
+        {
+            pTrack->fCompThreshold = -12;
+            pTrack->fCompRatio = 4;
+        }
+    }
+    engine.UpdateInserts();
+    bool bResult = TimeRender(engine, pResult);
+    engine.CloseProject();
+    return bResult;
+}
+
+/** Play project to its end, rendering each period as soon as disk thread has read it so that storage path, not real time, sets the pace */
+static bool TimeStream(const std::string& sPath, bool bUring, IoResult* pResult)
+{
+    static float aafOut[MAX_TRACKS][BENCH_PERIOD];
+    float* apOut[MAX_TRACKS];
+    for(unsigned int i = 0; i < MAX_TRACKS; ++i)
+        apOut[i] = aafOut[i];
+    Engine engine;
+    engine.SetPath(sPath);
+    DiskStream& stream = engine.GetDiskStream();
+    stream.SetUring(bUring);
+    if(!engine.LoadProject("bench") || !StartPlayback(engine, apOut))
+        return false;
+    unsigned long lKb = stream.GetKbRead();
+    unsigned long lSyscalls = stream.GetSyscalls();
+    unsigned int nUnderruns = stream.GetUnderruns();
+    unsigned int nPeriods = 0;
+    double dStart = Now();
+    while(TC_STOPPED != engine.GetTransport())
+    {
+        for(unsigned int nWaited = 0; stream.GetReadyFrames() < BENCH_PERIOD && nWaited < BENCH_IO_WAIT; nWaited += 50)
+            usleep(50);
+        engine.Render(BENCH_PERIOD, NULL, NULL, apOut);
+        ++nPeriods;
+    }
+    double dSeconds = (Now() - dStart) / 1e6;
+    pResult->bUring = stream.IsUring();
+    pResult->dMbps = (stream.GetKbRead() - lKb) / 1024.0 / dSeconds;
+    pResult->dSyscalls = nPeriods ? (double)(stream.GetSyscalls() - lSyscalls) / nPeriods : 0;
+    pResult->nPeriods = nPeriods;
+    pResult->nUnderruns = stream.GetUnderruns() - nUnderruns;
+    engine.CloseProject();
+    return true;
+}
+
+static int BenchMix(const std::string& sPath)
+{
+    long lCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int nMaxWorkers = lCpus > 1 ? lCpus - 1 : 1;
+    if(nMaxWorkers > WORKER_MAX)
+        nMaxWorkers = WORKER_MAX;
+    printf("Mix time per %u frame period in microseconds (mean / max) - %ld cores\n", BENCH_PERIOD, lCpus);
+    printf("tracks");
+    for(unsigned int nWorkers = 0; nWorkers <= nMaxWorkers; ++nWorkers)
+        printf("  %u workers    ", nWorkers);
+    printf("\n");
+    static const unsigned int anTracks[] = {1, 2, 4, 8, 12, 16};
+    for(unsigned int nRow = 0; nRow < sizeof(anTracks) / sizeof(anTracks[0]); ++nRow)
+    {
+        unsigned int nTracks = anTracks[nRow];
+        if(!CreateProject(sPath, "bench", nTracks, BENCH_FRAMES))
+        {
+            fprintf(stderr, "Failed to create project\n");
+            return 1;
+        }
+        printf("%6u", nTracks);
+        for(unsigned int nWorkers = 0; nWorkers <= nMaxWorkers; ++nWorkers)
+        {
+            BenchResult result;
+            if(!RunProject(sPath, nTracks, nWorkers, CHAIN_NONE, &result))
+            {
+                fprintf(stderr, "\nFailed to render %u tracks with %u workers\n", nTracks, nWorkers);
+                return 1;
+            }
+            printf("  %6.1f %6.1f", result.dMean, result.dMax);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+static int BenchInserts(const std::string& sPath)
+{
+    if(!CreateProject(sPath, "bench", MAX_TRACKS, BENCH_FRAMES))
+    {
+        fprintf(stderr, "Failed to create project\n");
+        return 1;
+    }
+    double dPeriod = BENCH_PERIOD * 1e6 / BENCH_RATE;
+    printf("Render time of %d tracks per %u frame period (%.0f microseconds) on calling thread - budget %.0f%%\n", MAX_TRACKS, BENCH_PERIOD, dPeriod, BENCH_BUDGET);
+    printf("%-20s %8s %8s %8s\n", "inserts", "mean", "max", "mean %");
+    int nResult = 0;
+    for(unsigned int nChain = CHAIN_NONE; nChain <= CHAIN_ALL; ++nChain)
+    {
+        BenchResult result;
+        if(!RunProject(sPath, MAX_TRACKS, 0, nChain, &result))
+        {
+            fprintf(stderr, "Failed to render with inserts %s\n", CHAIN_NAMES[nChain]);
+            return 1;
+        }
+        double dShare = 100 * result.dMean / dPeriod;
+        printf("%-20s %8.1f %8.1f %7.1f%%\n", CHAIN_NAMES[nChain], result.dMean, result.dMax, dShare);
+        if(dShare > BENCH_BUDGET)
+            nResult = 1;
+    }
+    printf(nResult ? "Over budget\n" : "Within budget\n");
+    return nResult;
+}
+
+/** Time playback conversion of MAX_TRACKS tracks as DiskStream performs it on the audio thread, producing one period per call */
+static bool TimeResample(const RateCase& rates, int nQuality, BenchResult* pResult)
+{
+    Resampler resampler;
+    if(!resampler.Init(rates.nFileRate, rates.nDeviceRate, MAX_TRACKS, nQuality, BENCH_PERIOD))
+        return false;
+    std::vector<float> vIn(resampler.GetMaxInput() * MAX_TRACKS);
+    std::vector<float> vOut(BENCH_PERIOD * MAX_TRACKS);
+    unsigned int nSeed = 1;
+    for(size_t i = 0; i < vIn.size(); ++i)
+        vIn[i] = Noise(nSeed);
+    for(unsigned int i = 0; i < BENCH_WARMUP; ++i)
+        resampler.Process(&vIn[0], resampler.GetInputFrames(BENCH_PERIOD), &vOut[0], BENCH_PERIOD);
+    double dTotal = 0, dMax = 0;
+    for(unsigned int i = 0; i < BENCH_PERIODS; ++i)
+    {
+        double dStart = Now();
+        resampler.Process(&vIn[0], resampler.GetInputFrames(BENCH_PERIOD), &vOut[0], BENCH_PERIOD);
+        double dTime = Now() - dStart;
+        dTotal += dTime;
+        if(dTime > dMax)
+            dMax = dTime;
+    }
+    pResult->dMean = dTotal / BENCH_PERIODS;
+    pResult->dMax = dMax;
+    return true;
+}
+
+static int BenchResample()
+{
+    static const RateCase aRates[] = {{44100, 48000}, {48000, 44100}, {96000, 48000}};
+    printf("Playback conversion of %d tracks per %u frame period in microseconds on calling thread - budget %.0f%%\n", MAX_TRACKS, BENCH_PERIOD, BENCH_BUDGET);
+    printf("%-12s %-8s %8s %8s %10s %8s\n", "rates", "quality", "mean", "max", "per track", "mean %");
+    int nResult = 0;
+    for(unsigned int nCase = 0; nCase < sizeof(aRates) / sizeof(aRates[0]); ++nCase)
+    {
+        double dPeriod = BENCH_PERIOD * 1e6 / aRates[nCase].nDeviceRate;
+        char acRates[32];
+        snprintf(acRates, sizeof(acRates), "%u>%u", aRates[nCase].nFileRate, aRates[nCase].nDeviceRate);
+        for(int nQuality = RESAMPLE_FAST; nQuality <= RESAMPLE_BEST; ++nQuality)
+        {
+            BenchResult result;
+            if(!TimeResample(aRates[nCase], nQuality, &result))
+            {
+                fprintf(stderr, "Failed to convert %s at %s quality\n", acRates, QUALITY_NAMES[nQuality]);
+                return 1;
+            }
+            double dShare = 100 * result.dMean / dPeriod;
+            printf("%-12s %-8s %8.1f %8.1f %10.2f %7.1f%%\n", acRates, QUALITY_NAMES[nQuality], result.dMean, result.dMax, result.dMean / MAX_TRACKS, dShare);
+            if(dShare > BENCH_BUDGET)
+                nResult = 1;
+        }
+    }
+    printf(nResult ? "Over budget\n" : "Within budget\n");
+    return nResult;
+}
+
+static int BenchIo(const std::string& sPath)
+{
+    printf("Streaming %u second projects through DiskStream per %u frame period - project files are in page cache so this measures the I/O path, not the device\n", BENCH_IO_SECONDS, BENCH_PERIOD);
+    printf("%6s %-8s %10s %16s %8s %10s\n", "tracks", "engine", "MB/s", "syscalls/period", "periods", "underruns");
+    static const unsigned int anTracks[] = {2, 8, 16};
+    for(unsigned int nRow = 0; nRow < sizeof(anTracks) / sizeof(anTracks[0]); ++nRow)
+    {
+        unsigned int nTracks = anTracks[nRow];
+        if(!CreateProject(sPath, "bench", nTracks, BENCH_IO_SECONDS * BENCH_RATE))
+        {
+            fprintf(stderr, "Failed to create project\n");
+            return 1;
+        }
+        for(int nUring = 1; nUring >= 0; --nUring)
+        {
+            IoResult result;
+            if(!TimeStream(sPath, nUring, &result))
+            {
+                fprintf(stderr, "Failed to stream %u tracks\n", nTracks);
+                return 1;
+            }
+            if(nUring && !result.bUring)
+            {
+                printf("%6u %-8s %10s %16s %8s %10s\n", nTracks, "io_uring", "-", "-", "-", "-"); //Kernel does not support io_uring
+                continue;
+            }
+            printf("%6u %-8s %10.1f %16.3f %8u %10u\n", nTracks, result.bUring ? "io_uring" : "pool", result.dMbps, result.dSyscalls, result.nPeriods, result.nUnderruns);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string sMode = argc > 1 ? argv[1] : "mix";
+    char acPath[] = "/tmp/multijack-bench-XXXXXX";
+    if(!mkdtemp(acPath))
+    {
+        fprintf(stderr, "Failed to create temporary directory\n");
+        return 1;
+    }
+    std::string sPath = std::string(acPath) + "/";
+    int nResult;
+    if("mix" == sMode)
+        nResult = BenchMix(sPath);
+    else if("inserts" == sMode)
+        nResult = BenchInserts(sPath);
+    else if("resample" == sMode)
+        nResult = BenchResample();
+    else if("io" == sMode)
+        nResult = BenchIo(sPath);
+    else
+    {
+        fprintf(stderr, "Usage: %s [mix|inserts|resample|io]\n", argv[0]);
+        nResult = 1;
+    }
+    std::string sRemove = "rm -rf " + std::string(acPath);
+    if(system(sRemove.c_str()))
+        fprintf(stderr, "Failed to remove %s\n", acPath);
+    return nResult;
+}
@@ -0,0 +1,115 @@
+/** Test of latency calibration - loops track output back to an input through Engine::Render without JACK
+*   A known delay (and polarity) is injected in the loopback and the measured round trip must equal it
+*   Project is created in a temporary directory and removed afterwards
+*/
+#include "engine.h"
+#include "track.h"
+#include "wave.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+
+static const jack_nframes_t TEST_PERIOD = 256; //Frames per period
+static const unsigned int TEST_RATE     = 48000; //Sample rate of test project
+static const unsigned int TEST_TRACKS   = 2; //Quantity of tracks in test project
+static const float TEST_NOISE           = 0.01f; //Amplitude of noise added to loopback (-40dBFS)
+static const unsigned int TEST_TIMEOUT  = 20000; //Maximum periods rendered whilst calibrating
+
+/** Structure describing an injected loopback **/
+struct Loopback
+{
+    jack_nframes_t nDelay; //Frames from track output to input - at least one period so each period's input was played earlier
+    unsigned int nInput; //Input fed by loopback - 0 for A, 1 for B
+    bool bInvert; //True to invert polarity
+};
+
+/** Create a silent native project */
+static bool CreateProject(const std::string& sPath, const std::string& sName)
+{
+    std::string sFilename = sPath + sName + ".wav";
+    int fd = open(sFilename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+    unsigned int nSize = TEST_RATE * TEST_TRACKS * sizeof(float);
+    WriteWaveHeader(fd, nSize, TEST_TRACKS, TEST_RATE);
+    bool bResult = (0 == ftruncate(fd, 44 + nSize));
+    close(fd);
+    return bResult;
+}
+
+/** Calibrate whilst rendering periods with output of first track looped back to an input */
+static bool RunLoopback(Engine& engine, const Loopback& loopback)
+{
+    static float aafOut[TEST_TRACKS][TEST_PERIOD];
+    float* apOut[TEST_TRACKS] = {aafOut[0], aafOut[1]};
+    float afIn[TEST_PERIOD];
+    std::vector<float> vPlayed; //Every frame played by first track
+    unsigned int nSeed = 1;
+    if(!engine.StartJob(JOB_CALIBRATE))
+    {
+        printf("FAIL delay %u: calibration did not start\n", loopback.nDelay);
+        return false;
+    }
+    for(unsigned int nPeriod = 0; JOB_NONE != engine.GetJob() && nPeriod < TEST_TIMEOUT; ++nPeriod)
+    {
+        long lStart = vPlayed.size();
+        for(jack_nframes_t nFrame = 0; nFrame < TEST_PERIOD; ++nFrame)
+        {
+            long lPlayed = lStart + nFrame - loopback.nDelay;
+            float fValue = lPlayed >= 0 ? vPlayed[lPlayed] : 0;
+            nSeed = nSeed * 1664525 + 1013904223;
+            afIn[nFrame] = (loopback.bInvert ? -fValue : fValue) + TEST_NOISE * ((int)nSeed >> 8) / 8388608.0f;
+        }
+        engine.Render(TEST_PERIOD, 0 == loopback.nInput ? afIn : NULL, 1 == loopback.nInput ? afIn : NULL, apOut);
+        vPlayed.insert(vPlayed.end(), aafOut[0], aafOut[0] + TEST_PERIOD);
+        usleep(100); //Let calibration job check for completion
+    }
+    while(JOB_NONE != engine.GetJob())
+        usleep(1000); //Job gives up once audio stops
+    bool bResult = engine.EndJob(JOB_CALIBRATE);
+    LatencyProbe& probe = engine.GetLatencyProbe();
+    bool bPass = bResult && probe.GetLatency() == (long)loopback.nDelay && probe.GetInput() == loopback.nInput
+        && probe.IsInverted() == loopback.bInvert && engine.GetRecordLatency() == loopback.nDelay;
+    printf("%s delay %u input %c%s: measured %ld input %c%s ratio %.1f record offset %u\n", bPass ? "ok  " : "FAIL",
+        loopback.nDelay, 'A' + loopback.nInput, loopback.bInvert ? " inverted" : "",
+        probe.GetLatency(), 'A' + probe.GetInput(), probe.IsInverted() ? " inverted" : "", probe.GetRatio(), engine.GetRecordLatency());
+    return bPass;
+}
+
+static int RunTest(const std::string& sPath)
+{
+    static const Loopback aLoopbacks[] = {{TEST_PERIOD, 0, false}, {1234, 0, false}, {7000, 1, false}, {2 * TEST_PERIOD + 17, 1, true}};
+    Engine engine;
+    engine.SetPath(sPath);
+    if(!CreateProject(sPath, "calibrate") || !engine.LoadProject("calibrate"))
+    {
+        fprintf(stderr, "Failed to create project\n");
+        return 1;
+    }
+    unsigned int nFailures = 0;
+    for(unsigned int i = 0; i < sizeof(aLoopbacks) / sizeof(aLoopbacks[0]); ++i)
+        if(!RunLoopback(engine, aLoopbacks[i]))
+            ++nFailures;
+    engine.CloseProject();
+    printf("%u failures\n", nFailures);
+    return nFailures ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    char acPath[] = "/tmp/multijack-test-XXXXXX";
+    if(!mkdtemp(acPath))
+    {
+        fprintf(stderr, "Failed to create temporary directory\n");
+        return 1;
+    }
+    int nResult = RunTest(std::string(acPath) + "/");
+    std::string sRemove = "rm -rf " + std::string(acPath);
+    if(system(sRemove.c_str()))
+        fprintf(stderr, "Failed to remove %s\n", acPath);
+    return nResult;
+}
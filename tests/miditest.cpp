@@ -0,0 +1,151 @@
+/** Test of MIDI control timing - feeds MIDI events through Engine::Render without JACK
+*   Checks that transport, arm and gain changes take effect at the frame of their event, as Engine::Process applies them
+*   Project is created in a temporary directory and removed afterwards
+*/
+#include "engine.h"
+#include "track.h"
+#include "wave.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+
+static const jack_nframes_t TEST_PERIOD = 256; //Frames per period
+static const unsigned int TEST_RATE     = 48000; //Sample rate of test project
+static const unsigned int TEST_TRACKS   = 2; //Quantity of tracks in test project
+static const float TEST_LEVEL           = 0.5; //Value of every sample in test project
+static const float TEST_TOLERANCE       = 1e-6; //Maximum error of compared samples
+
+static unsigned int g_nFailures = 0; //Quantity of failed checks
+
+/** Create a native project of constant level with monitor level of each track and MIDI bindings */
+static bool CreateProject(const std::string& sPath, const std::string& sName)
+{
+    std::string sFilename = sPath + sName + ".wav";
+    int fd = open(sFilename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+    unsigned int nFrames = TEST_RATE * 4;
+    WriteWaveHeader(fd, nFrames * TEST_TRACKS * sizeof(float), TEST_TRACKS, TEST_RATE);
+    std::vector<float> vData(nFrames * TEST_TRACKS, TEST_LEVEL);
+    size_t nSize = vData.size() * sizeof(float);
+    bool bResult = pwrite(fd, &vData[0], nSize, 44) == (ssize_t)nSize;
+    close(fd);
+    FILE* pFile = fopen((sPath + sName + ".cfg").c_str(), "w");
+    if(!pFile)
+        return false;
+    fprintf(pFile, "00V=80\n01V=80\n");
+    fprintf(pFile, "Midi=cc,1,64,playstop\n");
+    fprintf(pFile, "Midi=cc,1,7,gain,1\n");
+    fprintf(pFile, "Midi=cc,1,20,arma,2\n");
+    fclose(pFile);
+    return bResult;
+}
+
+/** Report whether a sample has its expected value */
+static void Check(const char* pName, const float* pBuffer, jack_nframes_t nFrame, float fExpected)
+{
+    bool bPass = fabsf(pBuffer[nFrame] - fExpected) <= TEST_TOLERANCE;
+    printf("%s %s: frame %u is %f (expect %f)\n", bPass ? "ok  " : "FAIL", pName, nFrame, pBuffer[nFrame], fExpected);
+    if(!bPass)
+        ++g_nFailures;
+}
+
+/** Populate a MIDI control change event on channel 1 */
+static void SetEvent(jack_midi_event_t* pEvent, unsigned char* pMessage, jack_nframes_t nFrame, unsigned char nController, unsigned char nValue)
+{
+    pMessage[0] = 0xB0;
+    pMessage[1] = nController;
+    pMessage[2] = nValue;
+    pEvent->time = nFrame;
+    pEvent->size = 3;
+    pEvent->buffer = pMessage;
+}
+
+static int RunTest(const std::string& sPath)
+{
+    static float aafOut[TEST_TRACKS][TEST_PERIOD];
+    float* apOut[TEST_TRACKS] = {aafOut[0], aafOut[1]};
+    unsigned char aMessages[2][3];
+    jack_midi_event_t aEvents[2];
+    float fLevel = TEST_LEVEL * 80 / 100;
+
+    Engine engine;
+    engine.SetPath(sPath);
+    if(!CreateProject(sPath, "midi") || !engine.LoadProject("midi"))
+    {
+        fprintf(stderr, "Failed to create project\n");
+        return 1;
+    }
+    //Render stopped periods as JACK would so that read-ahead of load is released when project locates to its playhead
+    for(unsigned int nWait = 0; !engine.GetDiskStream().IsPrimed(); ++nWait)
+    {
+        if(nWait > 5000)
+        {
+            fprintf(stderr, "Read-ahead not primed\n");
+            return 1;
+        }
+        engine.Render(TEST_PERIOD, NULL, NULL, apOut);
+        usleep(1000);
+    }
+
+    //Play pressed at frame 100 - stopped before it then fade in over rest of period
+    SetEvent(&aEvents[0], aMessages[0], 100, 64, 127);
+    engine.Render(TEST_PERIOD, NULL, NULL, apOut, aEvents, 1);
+    Check("transport stopped before play", aafOut[0], 99, 0);
+    Check("transport fade in starts at play", aafOut[0], 100, 0);
+    Check("transport fade in", aafOut[0], 101, fLevel / (TEST_PERIOD - 100));
+    Check("transport fade in", aafOut[0], 228, fLevel * 128 / (TEST_PERIOD - 100));
+
+    //Gain of track 1 to zero at frame 50 and arm track 2 (silencing its playback) at frame 200
+    SetEvent(&aEvents[0], aMessages[0], 50, 7, 0);
+    SetEvent(&aEvents[1], aMessages[1], 200, 20, 127);
+    engine.Render(TEST_PERIOD, NULL, NULL, apOut, aEvents, 2);
+    Check("gain before event", aafOut[0], 49, fLevel);
+    Check("gain at event", aafOut[0], 50, 0);
+    Check("arm before event", aafOut[1], 199, fLevel);
+    Check("arm at event", aafOut[1], 200, 0);
+    if(engine.GetArmedTrack(PORT_A) != 1)
+    {
+        printf("FAIL arm: track %d armed (expect 1)\n", engine.GetArmedTrack(PORT_A));
+        ++g_nFailures;
+    }
+
+    //Full gain of track 1 at frame 0 and stop pressed at frame 128 - fade out over rest of period then silence
+    SetEvent(&aEvents[0], aMessages[0], 0, 7, 127);
+    SetEvent(&aEvents[1], aMessages[1], 128, 64, 127);
+    engine.Render(TEST_PERIOD, NULL, NULL, apOut, aEvents, 2);
+    Check("gain at first frame", aafOut[0], 0, TEST_LEVEL);
+    Check("transport rolling before stop", aafOut[0], 127, TEST_LEVEL);
+    Check("transport fade out starts at stop", aafOut[0], 128, TEST_LEVEL);
+    Check("transport fade out", aafOut[0], 192, TEST_LEVEL * 64 / (TEST_PERIOD - 128));
+    engine.Render(TEST_PERIOD, NULL, NULL, apOut);
+    Check("transport stopped", aafOut[0], 0, 0);
+    if(engine.GetTransport() == TC_ROLLING)
+    {
+        printf("FAIL transport still rolling\n");
+        ++g_nFailures;
+    }
+    engine.CloseProject();
+    printf("%u failures\n", g_nFailures);
+    return g_nFailures ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    char acPath[] = "/tmp/multijack-test-XXXXXX";
+    if(!mkdtemp(acPath))
+    {
+        fprintf(stderr, "Failed to create temporary directory\n");
+        return 1;
+    }
+    int nResult = RunTest(std::string(acPath) + "/");
+    std::string sRemove = "rm -rf " + std::string(acPath);
+    if(system(sRemove.c_str()))
+        fprintf(stderr, "Failed to remove %s\n", acPath);
+    return nResult;
+}
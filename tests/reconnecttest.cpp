@@ -0,0 +1,274 @@
+/** Test of rejoining a restarted JACK server - kills and restarts a local jackd with the dummy backend
+*   A probe client plays a constant level into input A, which is armed and monitored on track 1, and listens to track 1
+*   Once the server restarts the engine must rejoin with its project unchanged and audio must reach the probe within one period
+*   Runs its own server (named by JACK_DEFAULT_SERVER) so a server already running is not disturbed - skipped if jackd cannot be started
+*/
+#include "engine.h"
+#include "track.h"
+#include "wave.h"
+#include <jack/jack.h>
+#include <atomic>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <string>
+
+static const char* const TEST_SERVER    = "multijack-test"; //Name of JACK server run by test
+static const char* const TEST_CLIENT    = "multijack-test"; //Name of engine client
+static const char* const PROBE_CLIENT   = "multijack-probe"; //Name of probe client
+static const char* const TEST_PERIOD    = "256"; //Frames per period of dummy backend
+static const char* const TEST_RATE      = "48000"; //Sample rate of dummy backend
+static const float TEST_LEVEL           = 0.5; //Level played by probe
+static const long TEST_HEAD             = 24000; //Playhead position which must survive restart
+static const unsigned int TEST_WAIT_MS  = 5000; //Longest wait for server, client or audio
+
+/** Structure representing probe client which feeds and listens to the engine **/
+struct Probe
+{
+    jack_client_t* pClient; //Probe client or NULL if not connected
+    jack_port_t* pOut; //Port playing constant level
+    jack_port_t* pIn; //Port listening to track 1
+    std::atomic<bool> bShutdown; //True once server has shut down
+    std::atomic<long> lCycles; //Quantity of process cycles since probe connected
+    std::atomic<long> lAudible; //First cycle in which track 1 was heard or -1 if not yet heard
+};
+
+static int OnProbeProcess(jack_nframes_t nFrames, void* pArgs)
+{
+    Probe* pProbe = (Probe*)pArgs;
+    long lCycle = ++pProbe->lCycles;
+    float* pOut = (float*)jack_port_get_buffer(pProbe->pOut, nFrames);
+    const float* pIn = (const float*)jack_port_get_buffer(pProbe->pIn, nFrames);
+    for(jack_nframes_t nFrame = 0; nFrame < nFrames; ++nFrame)
+        pOut[nFrame] = TEST_LEVEL;
+    for(jack_nframes_t nFrame = 0; nFrame < nFrames; ++nFrame)
+    {
+        if(pIn[nFrame] != 0)
+        {
+            long lSilent = -1;
+            pProbe->lAudible.compare_exchange_strong(lSilent, lCycle);
+            break;
+        }
+    }
+    return 0;
+}
+
+static void OnProbeShutdown(void* pArgs)
+{
+    ((Probe*)pArgs)->bShutdown = true;
+}
+
+/** Start jackd with dummy backend - returns process id or -1 on failure */
+static pid_t StartServer()
+{
+    pid_t pid = fork();
+    if(0 == pid)
+    {
+        int fd = open("/dev/null", O_WRONLY);
+        if(fd >= 0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+        execlp("jackd", "jackd", "-n", TEST_SERVER, "-d", "dummy", "-r", TEST_RATE, "-p", TEST_PERIOD, (char*)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+/** Kill server as if it crashed and wait for it to exit */
+static void KillServer(pid_t pid)
+{
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+/** Open probe client once server accepts clients, ports unconnected */
+static bool OpenProbe(Probe* pProbe)
+{
+    pProbe->pClient = NULL;
+    pProbe->bShutdown = false;
+    pProbe->lCycles = 0;
+    pProbe->lAudible = -1;
+    for(unsigned int nWaited = 0; !pProbe->pClient && nWaited < TEST_WAIT_MS; nWaited += 10)
+    {
+        jack_status_t nStatus;
+        pProbe->pClient = jack_client_open(PROBE_CLIENT, JackNoStartServer, &nStatus, NULL);
+        if(!pProbe->pClient)
+            usleep(10000);
+    }
+    if(!pProbe->pClient)
+        return false;
+    jack_set_process_callback(pProbe->pClient, OnProbeProcess, pProbe);
+    jack_on_shutdown(pProbe->pClient, OnProbeShutdown, pProbe);
+    pProbe->pOut = jack_port_register(pProbe->pClient, "out", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+    pProbe->pIn = jack_port_register(pProbe->pClient, "in", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+    return pProbe->pOut && pProbe->pIn && 0 == jack_activate(pProbe->pClient);
+}
+
+static void CloseProbe(Probe* pProbe)
+{
+    if(pProbe->pClient)
+        jack_client_close(pProbe->pClient);
+    pProbe->pClient = NULL;
+}
+
+/** Connect engine as multijack does - releasing a partially configured client before each attempt */
+static bool ConnectEngine(Engine& engine)
+{
+    for(unsigned int nWaited = 0; nWaited < TEST_WAIT_MS; ++nWaited)
+    {
+        if(engine.Connect(TEST_CLIENT))
+            return true;
+        engine.Disconnect();
+        usleep(1000);
+    }
+    return false;
+}
+
+/** Wait until engine's process callback runs - a connected engine that never processes is a failure, not a skip */
+static bool WaitProcess(Engine& engine, const char* pWhen)
+{
+    for(unsigned int nWaited = 0; 0 == engine.GetProcessCount() && nWaited < TEST_WAIT_MS; ++nWaited)
+        usleep(1000);
+    bool bPass = engine.IsConnected() && engine.GetProcessCount() > 0;
+    printf("%s engine processing %s: connected %d callbacks %lu\n", bPass ? "ok  " : "FAIL", pWhen, engine.IsConnected(), engine.GetProcessCount());
+    return bPass;
+}
+
+/** Wait until probe hears track 1 - returns cycle in which it was heard or -1 on timeout */
+static long WaitAudible(Probe* pProbe)
+{
+    for(unsigned int nWaited = 0; pProbe->lAudible < 0 && nWaited < TEST_WAIT_MS; ++nWaited)
+        usleep(1000);
+    return pProbe->lAudible;
+}
+
+/** Create a silent native project */
+static bool CreateProject(const std::string& sPath, const std::string& sName)
+{
+    int fd = open((sPath + sName + ".wav").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+    unsigned int nSize = 48000 * 2 * sizeof(float);
+    WriteWaveHeader(fd, nSize, 2, 48000);
+    bool bResult = (0 == ftruncate(fd, 44 + nSize));
+    close(fd);
+    return bResult;
+}
+
+static int RunTest(const std::string& sPath)
+{
+    unsigned int nFailures = 0;
+    Probe probe;
+    probe.pClient = NULL;
+    pid_t pidServer = StartServer();
+    if(pidServer < 0 || !OpenProbe(&probe))
+    {
+        printf("SKIP: unable to start jackd with dummy backend\n");
+        CloseProbe(&probe);
+        if(pidServer > 0)
+            KillServer(pidServer);
+        return 0;
+    }
+
+    //Engine monitors input A on track 1 so probe hears what it plays once engine is running
+    Engine engine;
+    engine.SetPath(sPath);
+    if(!ConnectEngine(engine) || !CreateProject(sPath, "reconnect") || !engine.LoadProject("reconnect"))
+    {
+        fprintf(stderr, "Failed to start engine\n");
+        CloseProbe(&probe);
+        KillServer(pidServer);
+        return 1;
+    }
+    if(!WaitProcess(engine, "before restart"))
+    {
+        CloseProbe(&probe);
+        KillServer(pidServer);
+        return 1;
+    }
+    engine.GetTrack(0)->nMonMix = 100;
+    engine.SetInputMonitor(MONITOR_INPUT);
+    engine.ArmTrack(PORT_A, 0);
+    engine.SetPlayHead(TEST_HEAD);
+    std::string sInput = std::string(TEST_CLIENT) + ":Input A";
+    std::string sTrack = std::string(TEST_CLIENT) + ":Track 01";
+    jack_connect(probe.pClient, jack_port_name(probe.pOut), sInput.c_str());
+    jack_connect(probe.pClient, sTrack.c_str(), jack_port_name(probe.pIn));
+    if(WaitAudible(&probe) < 0)
+    {
+        printf("FAIL no audio before restart\n");
+        ++nFailures;
+    }
+    else
+        printf("ok   audio before restart\n");
+    usleep(100000); //Let connection notifications arrive before engine remembers them as main loop does
+    engine.UpdateConnections();
+
+    //Kill server and wait for engine and probe to see it go
+    KillServer(pidServer);
+    for(unsigned int nWaited = 0; (engine.IsConnected() || !probe.bShutdown) && nWaited < TEST_WAIT_MS; ++nWaited)
+        usleep(1000);
+    if(engine.IsConnected())
+    {
+        printf("FAIL engine did not see server shut down\n");
+        ++nFailures;
+    }
+    CloseProbe(&probe);
+
+    //Restart server - probe rejoins first so engine restores connections to it
+    pidServer = StartServer();
+    if(pidServer < 0 || !OpenProbe(&probe))
+    {
+        fprintf(stderr, "Failed to restart server\n");
+        if(pidServer > 0)
+            KillServer(pidServer);
+        return 1;
+    }
+    if(!ConnectEngine(engine) || !WaitProcess(engine, "after restart"))
+    {
+        printf("FAIL engine did not rejoin server\n");
+        CloseProbe(&probe);
+        KillServer(pidServer);
+        return 1;
+    }
+    long lRejoined = probe.lCycles;
+    long lAudible = WaitAudible(&probe);
+    //Cycle running when engine rejoined may complete without it - audio must be heard in the following cycle
+    bool bPass = lAudible >= 0 && lAudible - lRejoined <= 2;
+    printf("%s audio after restart: heard %ld cycles after engine rejoined (expect at most 2)\n", bPass ? "ok  " : "FAIL", lAudible < 0 ? -1 : lAudible - lRejoined);
+    if(!bPass)
+        ++nFailures;
+    bPass = engine.IsOpen() && TEST_HEAD == engine.GetPlayHead() && 0 == engine.GetArmedTrack(PORT_A);
+    printf("%s project kept: open %d playhead %ld armed track %d\n", bPass ? "ok  " : "FAIL", engine.IsOpen(), engine.GetPlayHead(), engine.GetArmedTrack(PORT_A));
+    if(!bPass)
+        ++nFailures;
+
+    engine.Shutdown();
+    CloseProbe(&probe);
+    KillServer(pidServer);
+    printf("%u failures\n", nFailures);
+    return nFailures ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    char acPath[] = "/tmp/multijack-test-XXXXXX";
+    if(!mkdtemp(acPath))
+    {
+        fprintf(stderr, "Failed to create temporary directory\n");
+        return 1;
+    }
+    setenv("JACK_DEFAULT_SERVER", TEST_SERVER, 1);
+    signal(SIGPIPE, SIG_IGN); //Server socket closes when server is killed
+    int nResult = RunTest(std::string(acPath) + "/");
+    std::string sRemove = "rm -rf " + std::string(acPath);
+    if(system(sRemove.c_str()))
+        fprintf(stderr, "Failed to remove %s\n", acPath);
+    return nResult;
+}
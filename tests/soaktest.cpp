@@ -0,0 +1,359 @@
+/** Soak test of disk streaming - records and replays a session through each simulated storage device to find disk-induced dropouts
+*   Periods are rendered through Engine::Render without JACK by a simulated clock running faster than real time - storage delays are scaled to match
+*   Two inputs of deterministic noise are recorded to two tracks then replayed and compared bit for bit with the noise
+*   Reports least read-ahead and write-behind margins and the simulated time of the first underrun, overrun or corrupted frame
+*   Project is created in a temporary directory and removed afterwards - give a directory to qualify the storage it is on with profile none
+*   Usage: soaktest [profile|all] [hours] [directory]
+*/
+#include "engine.h"
+#include "storageshim.h"
+#include "track.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+static const double SOAK_HOURS          = 0.01; //Default simulated hours recorded (the same is replayed) - short enough for make test
+static const double SOAK_SPEED          = 20; //Quantity of simulated seconds per real second
+static const unsigned int SOAK_PERIOD   = 256; //Quantity of frames in each simulated JACK period
+static const char* const SOAK_PROJECT   = "soak-"; //Prefix of name of project recorded
+
+/** Structure describing a storage profile the streaming buffers are known not to cover **/
+struct SoakExpectedFailure
+{
+    const char* pName; //Name of storage profile
+    const char* pReason; //Why the profile fails
+};
+
+static const SoakExpectedFailure SOAK_EXPECTED_FAILURES[] =
+{
+    {"usb-slow", "800ms stalls every 100 requests at 10MB/s leave too little headroom to replay 16 tracks within the default 16MB of buffers"}
+};
+
+/** Structure holding the outcome of a soak run **/
+struct SoakResult
+{
+    double dRecorded; //Simulated seconds recorded
+    double dReplayed; //Simulated seconds replayed
+    double dFailure; //Simulated seconds into session of first failure or -1 if none
+    std::string sFailure; //Description of first failure
+    unsigned int nUnderruns; //Quantity of periods played with missing data
+    unsigned int nOverruns; //Quantity of periods of captured audio lost
+    unsigned long lMismatches; //Quantity of replayed samples that differ from those recorded
+    double dReadMargin; //Least read-ahead in milliseconds
+    double dCaptureMargin; //Least write-behind space in milliseconds
+    double dWorstLatency; //Longest simulated storage request in milliseconds
+    unsigned long lStalls; //Quantity of storage stalls injected
+    unsigned long lShort; //Quantity of short transfers injected
+};
+
+class Soak
+{
+    public:
+        Soak();
+
+        /** @brief  Record then replay a session through a simulated storage device
+        *   @param  engine Engine to run, which must not be connected to JACK - its current project is closed
+        *   @param  profile Behaviour of simulated storage
+        *   @param  dHours Simulated hours to record
+        *   @param  result Populated with outcome
+        *   @return <i>bool</i> True if session completed without failure
+        *   @note   Project is created in engine's path, i.e. on the storage being qualified
+        */
+        bool Run(Engine& engine, const StorageProfile& profile, double dHours, SoakResult& result);
+
+    private:
+        static float GetSample(long lFrame, unsigned int nInput);
+        void WaitPrimed(Engine& engine);
+        bool Record(Engine& engine, long lFrames, SoakResult& result);
+        bool Replay(Engine& engine, long lFrames, SoakResult& result);
+        void Fail(SoakResult& result, double dSeconds, const std::string& sReason);
+        void Tick();
+
+        unsigned int m_nSampleRate; //Samples per second of project
+        struct timespec m_tsNext; //Real time at which next period is due
+};
+
+Soak::Soak() :
+    m_nSampleRate(0)
+{
+}
+
+bool Soak::Run(Engine& engine, const StorageProfile& profile, double dHours, SoakResult& result)
+{
+    result = SoakResult();
+    result.dFailure = -1;
+    result.dReadMargin = -1;
+    result.dCaptureMargin = -1;
+    if(engine.IsConnected())
+    {
+        Fail(result, 0, "engine is connected to JACK");
+        return false;
+    }
+
+    //Project is created on storage being qualified with all its I/O passing through shim
+    std::string sName = std::string(SOAK_PROJECT) + profile.pName;
+    StorageShim shim(profile, SOAK_SPEED);
+    DiskStream& diskStream = engine.GetDiskStream();
+    engine.CloseProject();
+    diskStream.SetShim(&shim);
+    if(!engine.LoadProject(sName) || engine.GetTrackCount() < 2)
+    {
+        Fail(result, 0, "failed to create project " + engine.GetPath() + sName);
+        engine.CloseProject();
+        diskStream.SetShim(NULL);
+        return false;
+    }
+    m_nSampleRate = engine.GetSampleRate();
+    engine.SetInputMonitor(MONITOR_OFF);
+    engine.SetPlayHead(0); //Position is kept from previous project
+    for(unsigned int nTrack = 0; nTrack < 2; ++nTrack)
+    {
+        Track* pTrack = engine.GetTrack(nTrack);
+        pTrack->nMonMix = 100;
+        pTrack->bMuteA = false;
+        pTrack->bMuteB = false;
+    }
+
+    long lFrames = dHours * 3600 * m_nSampleRate;
+    if(Record(engine, lFrames, result))
+        Replay(engine, lFrames, result);
+
+    result.dWorstLatency = shim.GetWorstLatency();
+    result.lStalls = shim.GetStalls();
+    result.lShort = shim.GetShortTransfers();
+    engine.CloseProject();
+    diskStream.SetShim(NULL);
+    return result.dFailure < 0;
+}
+
+float Soak::GetSample(long lFrame, unsigned int nInput)
+{
+    //Hash of position gives noise that can be regenerated to check replay - 24-bit values are exact as float
+    uint32_t nHash = lFrame * 2 + nInput;
+    nHash ^= nHash >> 16;
+    nHash *= 0x7feb352d;
+    nHash ^= nHash >> 15;
+    nHash *= 0x846ca68b;
+    nHash ^= nHash >> 16;
+    return (int32_t)(nHash & 0xffffff00) / 2147483648.0f;
+}
+
+void Soak::WaitPrimed(Engine& engine)
+{
+    //Wait for read-ahead to fill as a user waits for the ready status before playing or recording
+    float* apOut[MAX_TRACKS] = {NULL};
+    clock_gettime(CLOCK_MONOTONIC, &m_tsNext);
+    while(!engine.GetDiskStream().IsPrimed())
+    {
+        engine.Render(SOAK_PERIOD, NULL, NULL, apOut);
+        Tick();
+    }
+}
+
+bool Soak::Record(Engine& engine, long lFrames, SoakResult& result)
+{
+    DiskStream& diskStream = engine.GetDiskStream();
+    float afIn[2][SOAK_PERIOD];
+    float* apOut[MAX_TRACKS] = {NULL};
+    engine.ArmTrack(PORT_A, 0);
+    engine.ArmTrack(PORT_B, 1);
+    engine.SetRecordEnable(true);
+    WaitPrimed(engine);
+    if(!engine.StartTransport())
+    {
+        Fail(result, 0, "failed to start recording");
+        return false;
+    }
+    diskStream.ClearErrors();
+    clock_gettime(CLOCK_MONOTONIC, &m_tsNext);
+    long lFrame = engine.GetPlayHead();
+    while(lFrame < lFrames || TC_STOPPED != engine.GetTransport())
+    {
+        if(lFrame >= lFrames)
+            engine.StopTransport(); //Ends recording - remaining periods fade out playback
+        for(unsigned int i = 0; i < SOAK_PERIOD; ++i)
+        {
+            afIn[0][i] = GetSample(lFrame + i, 0);
+            afIn[1][i] = GetSample(lFrame + i, 1);
+        }
+        unsigned int nUnderruns = diskStream.GetUnderruns();
+        unsigned int nOverruns = diskStream.GetOverruns();
+        engine.Render(SOAK_PERIOD, afIn[0], afIn[1], apOut);
+        if(diskStream.GetOverruns() > nOverruns)
+            Fail(result, double(lFrame) / m_nSampleRate, "write-behind overrun whilst recording");
+        if(diskStream.GetUnderruns() > nUnderruns)
+            Fail(result, double(lFrame) / m_nSampleRate, "read-ahead underrun whilst recording");
+        lFrame = engine.GetPlayHead();
+        Tick();
+    }
+    engine.ArmTrack(PORT_A, -1);
+    engine.ArmTrack(PORT_B, -1);
+    diskStream.Sync(); //Wait for write-behind to reach take files
+    result.dRecorded = double(lFrame) / m_nSampleRate;
+    result.nUnderruns = diskStream.GetUnderruns();
+    result.nOverruns = diskStream.GetOverruns();
+    if(~0u != diskStream.GetCaptureMargin())
+        result.dCaptureMargin = 1000.0 * diskStream.GetCaptureMargin() / m_nSampleRate;
+    return true;
+}
+
+bool Soak::Replay(Engine& engine, long lFrames, SoakResult& result)
+{
+    DiskStream& diskStream = engine.GetDiskStream();
+    float afOut[2][SOAK_PERIOD];
+    float* apOut[MAX_TRACKS] = {afOut[0], afOut[1]};
+    engine.SetPlayHead(0);
+    WaitPrimed(engine);
+    diskStream.ClearErrors();
+    if(!engine.StartTransport())
+    {
+        Fail(result, result.dRecorded, "failed to start replay");
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &m_tsNext);
+    bool bStarted = false;
+    while(true)
+    {
+        long lFrame = engine.GetPlayHead();
+        int nTransport = engine.GetTransport();
+        unsigned int nUnderruns = diskStream.GetUnderruns();
+        bool bPlayed = engine.Render(SOAK_PERIOD, NULL, NULL, apOut);
+        Tick();
+        if(!bPlayed)
+        {
+            if(bStarted)
+                break; //Stopped at end
+            continue; //Waiting for read-ahead
+        }
+        bStarted = true;
+        double dTime = result.dRecorded + double(lFrame) / m_nSampleRate;
+        if(diskStream.GetUnderruns() > nUnderruns)
+            Fail(result, dTime, "read-ahead underrun whilst replaying");
+        //Compare periods played at full level - first and last periods are faded
+        if(TC_ROLLING != nTransport || lFrame + (long)SOAK_PERIOD > lFrames || lFrame > engine.GetLength() - 2 * (long)SOAK_PERIOD)
+            continue;
+        for(unsigned int nTrack = 0; nTrack < 2; ++nTrack)
+        {
+            Track* pTrack = engine.GetTrack(nTrack);
+            for(unsigned int i = 0; i < SOAK_PERIOD; ++i)
+            {
+                if(afOut[nTrack][i] == pTrack->Gain(GetSample(lFrame + i, nTrack)))
+                    continue;
+                if(0 == result.lMismatches++)
+                {
+                    char acReason[64];
+                    snprintf(acReason, sizeof(acReason), "replayed audio differs at frame %ld of track %u", lFrame + i, nTrack + 1);
+                    Fail(result, result.dRecorded + double(lFrame + i) / m_nSampleRate, acReason);
+                }
+            }
+        }
+        result.dReplayed = double(lFrame + SOAK_PERIOD) / m_nSampleRate;
+    }
+    result.nUnderruns += diskStream.GetUnderruns();
+    if(~0u != diskStream.GetReadMargin())
+        result.dReadMargin = 1000.0 * diskStream.GetReadMargin() / m_nSampleRate;
+    return true;
+}
+
+void Soak::Fail(SoakResult& result, double dSeconds, const std::string& sReason)
+{
+    if(result.dFailure >= 0)
+        return; //Only first failure is reported
+    result.dFailure = dSeconds;
+    result.sFailure = sReason;
+}
+
+void Soak::Tick()
+{
+    //Wait until next period is due on simulated clock
+    long lPeriod = 1e9 * SOAK_PERIOD / (m_nSampleRate * SOAK_SPEED);
+    m_tsNext.tv_nsec += lPeriod;
+    while(m_tsNext.tv_nsec >= 1000000000)
+    {
+        m_tsNext.tv_nsec -= 1000000000;
+        ++m_tsNext.tv_sec;
+    }
+    timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+    long lLate = (tsNow.tv_sec - m_tsNext.tv_sec) * 1000000000 + tsNow.tv_nsec - m_tsNext.tv_nsec;
+    if(lLate > lPeriod)
+        m_tsNext = tsNow; //Processing fell behind so resume from now rather than rendering a burst of periods
+    else
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &m_tsNext, NULL);
+}
+
+/** Get reason a profile is expected to fail or NULL if it must pass */
+static const char* GetExpectedFailure(const char* pName)
+{
+    for(unsigned int i = 0; i < sizeof(SOAK_EXPECTED_FAILURES) / sizeof(SoakExpectedFailure); ++i)
+        if(0 == strcmp(pName, SOAK_EXPECTED_FAILURES[i].pName))
+            return SOAK_EXPECTED_FAILURES[i].pReason;
+    return NULL;
+}
+
+static int RunTest(const std::string& sPath, const std::string& sProfile, double dHours)
+{
+    unsigned int nFailures = 0;
+    unsigned int nRuns = 0;
+    Engine engine;
+    engine.SetPath(sPath);
+    Soak soak;
+    for(unsigned int i = 0; i < STORAGE_PROFILE_COUNT; ++i)
+    {
+        const StorageProfile& profile = STORAGE_PROFILES[i];
+        if("all" != sProfile && sProfile != profile.pName)
+            continue;
+        ++nRuns;
+        printf("Soak %s: recording %.2f hours in %s at %.0fx real time\n", profile.pName, dHours, sPath.c_str(), SOAK_SPEED);
+        fflush(stdout);
+        SoakResult result;
+        bool bPass = soak.Run(engine, profile, dHours, result);
+        printf("  recorded %.0fs replayed %.0fs underruns %u overruns %u differing samples %lu\n",
+            result.dRecorded, result.dReplayed, result.nUnderruns, result.nOverruns, result.lMismatches);
+        printf("  least read-ahead %.0fms least write-behind space %.0fms\n", result.dReadMargin, result.dCaptureMargin);
+        printf("  longest storage request %.0fms stalls %lu short transfers %lu\n", result.dWorstLatency, result.lStalls, result.lShort);
+        const char* pExpected = GetExpectedFailure(profile.pName);
+        if(!bPass)
+            printf("%s %s at %02d:%02d:%06.3f %s\n", pExpected ? "ok  " : "FAIL", profile.pName,
+                int(result.dFailure / 3600), int(result.dFailure / 60) % 60, fmod(result.dFailure, 60), result.sFailure.c_str());
+        else
+            printf("ok   %s\n", profile.pName);
+        if(pExpected)
+            printf("     expected to fail: %s\n", pExpected);
+        else if(!bPass)
+            ++nFailures;
+        fflush(stdout);
+    }
+    if(0 == nRuns)
+    {
+        fprintf(stderr, "Unknown storage profile %s\n", sProfile.c_str());
+        return 1;
+    }
+    printf("%u failures\n", nFailures);
+    return nFailures ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string sProfile = argc > 1 ? argv[1] : "all";
+    double dHours = argc > 2 ? atof(argv[2]) : SOAK_HOURS;
+    std::string sPath = std::string(argc > 3 ? argv[3] : "/tmp") + "/multijack-test-XXXXXX";
+    if(dHours <= 0)
+    {
+        fprintf(stderr, "Usage: %s [profile|all] [hours] [directory]\n", argv[0]);
+        return 1;
+    }
+    if(!mkdtemp(&sPath[0]))
+    {
+        fprintf(stderr, "Failed to create temporary directory\n");
+        return 1;
+    }
+    int nResult = RunTest(sPath + "/", sProfile, dHours);
+    std::string sRemove = "rm -rf " + sPath;
+    if(system(sRemove.c_str()))
+        fprintf(stderr, "Failed to remove %s\n", sPath.c_str());
+    return nResult;
+}
@@ -0,0 +1,136 @@
+#include "trace.h"
+
+#ifdef TRACE
+#include <sys/syscall.h>
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const unsigned int TRACE_SKIP = TRACE_EVENTS / 16; //Oldest events not written as they may be overwritten whilst dumping
+
+/** Structure representing one begin or end event **/
+struct TraceEvent
+{
+    uint64_t lTime; //Nanoseconds since boot (CLOCK_MONOTONIC)
+    const char* pName; //Name of operation
+    char cPhase; //'B' for begin, 'E' for end
+};
+
+/** Structure holding events of one thread - written only by that thread **/
+struct TraceRing
+{
+    std::atomic<bool> bBusy; //True whilst a thread owns ring
+    std::atomic<uint32_t> nWrite; //Quantity of events written
+    const char* pThread; //Name of thread or NULL if not named
+    int nTid; //Kernel thread id of last owner
+    TraceEvent aEvents[TRACE_EVENTS]; //Most recent events
+};
+
+/** Structure releasing ring of thread when thread ends so that threads started for each project or job reuse rings **/
+struct TraceOwner
+{
+    TraceRing* pRing = NULL; //Ring owned by thread
+    ~TraceOwner() { if(pRing) pRing->bBusy = false; }
+};
+
+static TraceRing s_aRings[TRACE_THREADS]; //One ring per thread
+static std::atomic<unsigned int> s_nRings(0); //Quantity of rings used
+static thread_local TraceOwner t_owner; //Ring of calling thread
+
+static TraceRing* GetRing(const char* pName)
+{
+    if(t_owner.pRing)
+        return t_owner.pRing;
+    //Prefer a free ring last used by a thread of same name so that its history continues
+    TraceRing* pRing = NULL;
+    unsigned int nRings = s_nRings;
+    for(unsigned int nRing = 0; nRing < nRings && nRing < TRACE_THREADS && !pRing; ++nRing)
+    {
+        bool bBusy = false;
+        if(pName && s_aRings[nRing].pThread && 0 == strcmp(pName, s_aRings[nRing].pThread) && s_aRings[nRing].bBusy.compare_exchange_strong(bBusy, true))
+            pRing = &s_aRings[nRing];
+    }
+    if(!pRing)
+    {
+        unsigned int nRing = s_nRings++;
+        if(nRing >= TRACE_THREADS)
+            return NULL;
+        pRing = &s_aRings[nRing];
+        pRing->bBusy = true;
+        memset(pRing->aEvents, 0, sizeof(pRing->aEvents)); //Fault in pages now rather than whilst tracing
+    }
+    pRing->nTid = syscall(SYS_gettid);
+    pRing->pThread = pName;
+    t_owner.pRing = pRing;
+    return pRing;
+}
+
+static void TraceEvent(const char* pName, char cPhase)
+{
+    TraceRing* pRing = GetRing(NULL);
+    if(!pRing)
+        return;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint32_t nWrite = pRing->nWrite.load(std::memory_order_relaxed);
+    struct TraceEvent& event = pRing->aEvents[nWrite & (TRACE_EVENTS - 1)];
+    event.lTime = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    event.pName = pName;
+    event.cPhase = cPhase;
+    pRing->nWrite.store(nWrite + 1, std::memory_order_release);
+}
+
+void TraceThread(const char* pName)
+{
+    TraceRing* pRing = GetRing(pName);
+    if(pRing)
+        pRing->pThread = pName;
+}
+
+void TraceBegin(const char* pName)
+{
+    TraceEvent(pName, 'B');
+}
+
+void TraceEnd(const char* pName)
+{
+    TraceEvent(pName, 'E');
+}
+
+bool TraceDump(const std::string& sFilename)
+{
+    FILE* pFile = fopen(sFilename.c_str(), "w");
+    if(!pFile)
+        return false;
+    int nPid = getpid();
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"multijack\"}}", nPid);
+    unsigned int nRings = s_nRings < TRACE_THREADS ? (unsigned int)s_nRings : TRACE_THREADS;
+    for(unsigned int nRing = 0; nRing < nRings; ++nRing)
+    {
+        TraceRing* pRing = &s_aRings[nRing];
+        if(pRing->pThread)
+            fprintf(pFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", nPid, pRing->nTid, pRing->pThread);
+        uint32_t nEnd = pRing->nWrite.load(std::memory_order_acquire);
+        uint32_t nStart = nEnd > TRACE_EVENTS - TRACE_SKIP ? nEnd - (TRACE_EVENTS - TRACE_SKIP) : 0;
+        unsigned int nDepth = 0;
+        for(uint32_t nEvent = nStart; nEvent != nEnd; ++nEvent)
+        {
+            const struct TraceEvent& event = pRing->aEvents[nEvent & (TRACE_EVENTS - 1)];
+            if('B' == event.cPhase)
+                ++nDepth;
+            else if(0 == nDepth)
+                continue; //Operation began before oldest event kept
+            else
+                --nDepth;
+            fprintf(pFile, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d}", event.pName, event.cPhase,
+                (unsigned long long)(event.lTime / 1000), (unsigned long long)(event.lTime % 1000), nPid, pRing->nTid);
+        }
+    }
+    fprintf(pFile, "\n]}\n");
+    return 0 == fclose(pFile);
+}
+#endif
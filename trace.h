@@ -0,0 +1,54 @@
+/** Timeline tracing of audio, disk, worker and user interface threads
+*   Each thread writes timestamped begin and end events to its own ring so tracing does not lock, block or allocate
+*   TraceDump writes the most recent events of every thread as Chrome trace-event JSON which opens in Perfetto or chrome://tracing
+*   Build with TRACE defined to enable tracing - otherwise the functions are empty and compile to nothing
+*/
+#pragma once
+
+#include <string>
+
+static const unsigned int TRACE_THREADS = 16; //Maximum quantity of threads traced - further threads are ignored
+static const unsigned int TRACE_EVENTS  = 16384; //Quantity of most recent events kept for each thread (power of 2)
+
+#ifdef TRACE
+/** @brief  Name calling thread in trace and reserve its ring
+*   @param  pName Name of thread - must remain valid, e.g. string literal
+*   @note   Call from each thread before it is traced, outside realtime code if possible (touches ring memory)
+*/
+void TraceThread(const char* pName);
+
+/** @brief  Record start of an operation on calling thread
+*   @param  pName Name of operation - must remain valid, e.g. string literal
+*   @note   Realtime safe
+*/
+void TraceBegin(const char* pName);
+
+/** @brief  Record end of operation started by TraceBegin
+*   @param  pName Name of operation
+*   @note   Realtime safe
+*/
+void TraceEnd(const char* pName);
+
+/** @brief  Write recent events of all threads to a file as Chrome trace-event JSON
+*   @param  sFilename Path and name of file
+*   @return <i>bool</i> True on success
+*   @note   Threads continue tracing whilst events are written - the oldest events of a busy thread may be skipped
+*/
+bool TraceDump(const std::string& sFilename);
+#else
+inline void TraceThread(const char* pName) {}
+inline void TraceBegin(const char* pName) {}
+inline void TraceEnd(const char* pName) {}
+inline bool TraceDump(const std::string& sFilename) { return false; }
+#endif
+
+/** Class tracing a scope - begins operation when constructed and ends it when destroyed **/
+class TraceScope
+{
+    public:
+        TraceScope(const char* pName) : m_pName(pName) { TraceBegin(pName); }
+        ~TraceScope() { TraceEnd(m_pName); }
+
+    private:
+        const char* m_pName; //Name of operation
+};
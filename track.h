@@ -2,6 +2,37 @@
 #pragma once
 
 #include <jack/jack.h>
+#include <atomic>
+
+/** Class holding a peak level raised by the audio thread and taken by the main thread without losing peaks
+*   Copies, e.g. of track settings, start at silence
+*/
+class PeakLevel
+{
+    public:
+        PeakLevel() : m_fLevel(0) {}
+        PeakLevel(const PeakLevel&) : m_fLevel(0) {}
+        PeakLevel& operator=(const PeakLevel&) { return *this; }
+
+        /** Raise level if a period's peak exceeds it
+        *   @param  fLevel Peak absolute level of period
+        *   @note   Realtime safe - called by audio thread and mix workers
+        */
+        void Raise(float fLevel)
+        {
+            float fOld = m_fLevel.load(std::memory_order_relaxed);
+            while(fLevel > fOld && !m_fLevel.compare_exchange_weak(fOld, fLevel, std::memory_order_relaxed))
+                ;
+        }
+
+        /** Get level since last call and reset it
+        *   @return <i>float</i> Peak absolute level
+        */
+        float Take() { return m_fLevel.exchange(0, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<float> m_fLevel;
+};
 
 class Track
 {
@@ -11,6 +42,14 @@ class Track
         bool bMuteB; //True if B-Leg is muted
         bool bRecording; //True if recording - mute output
         jack_port_t* pSourcePort = NULL; //Pointer to Jack source port
+        PeakLevel peak; //Peak output level since last meter event
+        //Insert effects applied to monitor mix - call Engine::UpdateInserts after changing
+        float fHighPass = 0; //High-pass filter cut-off frequency in Hz or 0 for none
+        float fEqFrequency = 1000; //Centre frequency of peaking EQ in Hz
+        float fEqGain = 0; //Gain of peaking EQ in dB or 0 for none
+        float fEqQ = 1; //Bandwidth of peaking EQ (Q)
+        float fCompThreshold = -20; //Compressor threshold in dBFS
+        float fCompRatio = 1; //Compressor ratio or 1 for none
 
         /** Get the channel A mix down value of sample for this channel
         *   @param  fValue Sample value
@@ -18,7 +57,18 @@ class Track
         */
         float Mix(float fValue)
         {
-            if((bMuteA && bMuteB) || bRecording || 0 == nMonMix)
+            if(bRecording)
+                return 0;
+            return Gain(fValue);
+        }
+
+        /** Get the monitor level adjusted value of sample regardless of record state, e.g. for input monitoring
+        *   @param  fValue Sample value
+        *   @return <i>float</i> Antenuated value
+        */
+        float Gain(float fValue)
+        {
+            if((bMuteA && bMuteB) || 0 == nMonMix)
                 return 0;
             else
                 return nMonMix * fValue / 100;
@@ -0,0 +1,248 @@
+#include "wave.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static const uint16_t WAVE_TAG_PCM          = 1;
+static const uint16_t WAVE_TAG_FLOAT        = 3;
+static const uint16_t WAVE_TAG_EXTENSIBLE   = 0xFFFE;
+
+static uint16_t GetLE16(const char* pBuffer)
+{
+    const unsigned char* p = (const unsigned char*)pBuffer;
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t GetLE32(const char* pBuffer)
+{
+    const unsigned char* p = (const unsigned char*)pBuffer;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//Copy bytes from mapped region if present otherwise read from file
+static bool GetBytes(int fd, const char* pMap, off_t offMapped, off_t offPos, char* pBuffer, size_t nSize)
+{
+    if(offPos + (off_t)nSize <= offMapped)
+    {
+        memcpy(pBuffer, pMap + offPos, nSize);
+        return true;
+    }
+    return pread(fd, pBuffer, nSize, offPos) == (ssize_t)nSize;
+}
+
+//Get sample encoding from format chunk content
+static int GetEncoding(const char* pFormat, uint32_t nSize)
+{
+    if(nSize < 16)
+        return WAVE_UNSUPPORTED;
+    uint16_t nTag = GetLE16(pFormat);
+    uint16_t nChannels = GetLE16(pFormat + 2);
+    uint16_t nBlockAlign = GetLE16(pFormat + 12);
+    uint16_t nBits = GetLE16(pFormat + 14);
+    if(WAVE_TAG_EXTENSIBLE == nTag && nSize >= 40)
+        nTag = GetLE16(pFormat + 24); //SubFormat GUID starts with format tag
+    int nEncoding = WAVE_UNSUPPORTED;
+    if(WAVE_TAG_FLOAT == nTag && 32 == nBits)
+        nEncoding = WAVE_FLOAT;
+    else if(WAVE_TAG_PCM == nTag && 16 == nBits)
+        nEncoding = WAVE_PCM16;
+    else if(WAVE_TAG_PCM == nTag && 24 == nBits)
+        nEncoding = WAVE_PCM24;
+    else if(WAVE_TAG_PCM == nTag && 32 == nBits)
+        nEncoding = WAVE_PCM32; //Includes 24-bit samples in 32-bit containers which EXTENSIBLE describes by valid bits
+    if(WAVE_UNSUPPORTED == nEncoding || 0 == nChannels || nBlockAlign != nChannels * WAVE_SAMPLE_BYTES[nEncoding])
+        return WAVE_UNSUPPORTED;
+    return nEncoding;
+}
+
+bool ReadWaveLayout(int fd, WaveLayout* pLayout)
+{
+    memset(pLayout, 0, sizeof(WaveLayout));
+    pLayout->nEncoding = WAVE_UNSUPPORTED;
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) || fileStat.st_size < 12)
+        return false;
+    off_t offMapped = fileStat.st_size < WAVE_MAP_SIZE ? fileStat.st_size : WAVE_MAP_SIZE;
+    char* pMap = (char*)mmap(NULL, offMapped, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if(MAP_FAILED == pMap)
+        return false;
+    bool bFound = false;
+    pLayout->bRiff = (0 == memcmp(pMap, "RIFF", 4) && 0 == memcmp(pMap + 8, "WAVE", 4));
+    if(pLayout->bRiff)
+    {
+        char pChunk[8]; //ckID and cksize
+        off_t offPos = 12;
+        while(offPos + 8 <= fileStat.st_size && GetBytes(fd, pMap, offMapped, offPos, pChunk, 8))
+        {
+            uint32_t nSize = GetLE32(pChunk + 4);
+            if(0 == memcmp(pChunk, "fmt ", 4))
+            {
+                size_t nCopy = nSize < sizeof(pLayout->acFormat) ? nSize : sizeof(pLayout->acFormat);
+                pLayout->bFormat = GetBytes(fd, pMap, offMapped, offPos + 8, pLayout->acFormat, nCopy);
+                pLayout->nEncoding = pLayout->bFormat ? GetEncoding(pLayout->acFormat, nCopy) : WAVE_UNSUPPORTED;
+            }
+            else if(0 == memcmp(pChunk, "data", 4))
+            {
+                pLayout->offData = offPos + 8;
+                pLayout->nDataSize = nSize;
+                bFound = true;
+                break;
+            }
+            offPos += 8 + nSize + (nSize & 1); //Chunks are word aligned
+        }
+    }
+    munmap(pMap, offMapped);
+    return bFound;
+}
+
+void WriteWaveHeader(int fd, unsigned int nWaveSize, unsigned int nChannels, unsigned int nSampleRate)
+{
+    //Use minimal RIFF header
+    char pHeader[36];
+    memcpy(pHeader, "RIFF", 4);
+    SetLE32(pHeader + 4, nWaveSize + 36); //size of RIFF chunck
+    memcpy(pHeader + 8, "WAVE", 4);
+    memcpy(pHeader + 12, "fmt ", 4); //start of format chunk
+    SetLE32(pHeader + 16, 16); //size of format chunck
+    SetLE16(pHeader + 20, 3); //Audio format = IEEE float
+    SetLE16(pHeader + 22, nChannels); //Number of channels
+    SetLE32(pHeader + 24, nSampleRate); //Sample rate
+    SetLE32(pHeader + 28, nSampleRate * nChannels * sizeof(float)); //Byte rate
+    SetLE16(pHeader + 32, nChannels * sizeof(float)); //Block align == frame size
+    SetLE16(pHeader + 34, sizeof(float) * 8); //Bits per sample
+    pwrite(fd, pHeader, sizeof(pHeader), 0);
+    memcpy(pHeader, "data", 4);
+    SetLE32(pHeader + 4, nWaveSize);
+    pwrite(fd, pHeader, 8, 36);
+}
+
+//Each conversion reads a block before writing it so a destination starting before the source may share its buffer
+static void ConvertPcm16(const char* pSource, float* pDest, size_t nSamples)
+{
+    size_t nSample = 0;
+#if defined(__SSE2__)
+    const __m128 vScale = _mm_set1_ps(1.0f / 32768);
+    for(; nSample + 8 <= nSamples; nSample += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pSource + nSample * 2));
+        __m128i vLow = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16); //Sign extend
+        __m128i vHigh = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(pDest + nSample, _mm_mul_ps(_mm_cvtepi32_ps(vLow), vScale));
+        _mm_storeu_ps(pDest + nSample + 4, _mm_mul_ps(_mm_cvtepi32_ps(vHigh), vScale));
+    }
+#elif defined(__ARM_NEON)
+    for(; nSample + 8 <= nSamples; nSample += 8)
+    {
+        int16x8_t v = vreinterpretq_s16_u8(vld1q_u8((const uint8_t*)(pSource + nSample * 2)));
+        float32x4_t vLow = vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(v)), 15);
+        float32x4_t vHigh = vcvtq_n_f32_s32(vmovl_s16(vget_high_s16(v)), 15);
+        vst1q_f32(pDest + nSample, vLow);
+        vst1q_f32(pDest + nSample + 4, vHigh);
+    }
+#endif
+    for(; nSample < nSamples; ++nSample)
+        pDest[nSample] = (int16_t)GetLE16(pSource + nSample * 2) * (1.0f / 32768);
+}
+
+static void ConvertPcm24(const char* pSource, float* pDest, size_t nSamples)
+{
+    size_t nSample = 0;
+#if defined(__SSE2__)
+    //Each 4 byte load holds one sample in its low 3 bytes - stop before last sample so loads stay within source
+    const __m128 vScale = _mm_set1_ps(1.0f / 2147483648.0f);
+    for(; nSample + 5 <= nSamples; nSample += 4)
+    {
+        const char* p = pSource + nSample * 3;
+        uint32_t a[4];
+        memcpy(&a[0], p, 4);
+        memcpy(&a[1], p + 3, 4);
+        memcpy(&a[2], p + 6, 4);
+        memcpy(&a[3], p + 9, 4);
+        __m128i v = _mm_slli_epi32(_mm_loadu_si128((const __m128i*)a), 8); //Sample in high bytes keeps its sign
+        _mm_storeu_ps(pDest + nSample, _mm_mul_ps(_mm_cvtepi32_ps(v), vScale));
+    }
+#elif defined(__ARM_NEON)
+    //De-interleave bytes of 16 samples then widen each into high bytes of 32-bit lanes
+    for(; nSample + 16 <= nSamples; nSample += 16)
+    {
+        uint8x16x3_t v = vld3q_u8((const uint8_t*)(pSource + nSample * 3));
+        uint8x16_t vZero = vdupq_n_u8(0);
+        uint8x16x2_t vLow = vzipq_u8(vZero, v.val[0]);
+        uint8x16x2_t vHigh = vzipq_u8(v.val[1], v.val[2]);
+        for(unsigned int nHalf = 0; nHalf < 2; ++nHalf)
+        {
+            uint16x8x2_t vWords = vzipq_u16(vreinterpretq_u16_u8(vLow.val[nHalf]), vreinterpretq_u16_u8(vHigh.val[nHalf]));
+            vst1q_f32(pDest + nSample + nHalf * 8, vcvtq_n_f32_s32(vreinterpretq_s32_u16(vWords.val[0]), 31));
+            vst1q_f32(pDest + nSample + nHalf * 8 + 4, vcvtq_n_f32_s32(vreinterpretq_s32_u16(vWords.val[1]), 31));
+        }
+    }
+#endif
+    for(; nSample < nSamples; ++nSample)
+    {
+        const unsigned char* p = (const unsigned char*)pSource + nSample * 3;
+        int32_t nValue = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24));
+        pDest[nSample] = nValue * (1.0f / 2147483648.0f);
+    }
+}
+
+static void ConvertPcm32(const char* pSource, float* pDest, size_t nSamples)
+{
+    size_t nSample = 0;
+#if defined(__SSE2__)
+    const __m128 vScale = _mm_set1_ps(1.0f / 2147483648.0f);
+    for(; nSample + 4 <= nSamples; nSample += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pSource + nSample * 4));
+        _mm_storeu_ps(pDest + nSample, _mm_mul_ps(_mm_cvtepi32_ps(v), vScale));
+    }
+#elif defined(__ARM_NEON)
+    for(; nSample + 4 <= nSamples; nSample += 4)
+    {
+        int32x4_t v = vreinterpretq_s32_u8(vld1q_u8((const uint8_t*)(pSource + nSample * 4)));
+        vst1q_f32(pDest + nSample, vcvtq_n_f32_s32(v, 31));
+    }
+#endif
+    for(; nSample < nSamples; ++nSample)
+        pDest[nSample] = (int32_t)GetLE32(pSource + nSample * 4) * (1.0f / 2147483648.0f);
+}
+
+void ConvertToFloat(const char* pSource, float* pDest, size_t nSamples, int nEncoding)
+{
+    switch(nEncoding)
+    {
+        case WAVE_FLOAT:
+            memmove(pDest, pSource, nSamples * sizeof(float));
+            break;
+        case WAVE_PCM16:
+            ConvertPcm16(pSource, pDest, nSamples);
+            break;
+        case WAVE_PCM24:
+            ConvertPcm24(pSource, pDest, nSamples);
+            break;
+        case WAVE_PCM32:
+            ConvertPcm32(pSource, pDest, nSamples);
+            break;
+    }
+}
+
+/** Write a 16-bit, little-endian word to a char buffer */
+void SetLE16(char* pBuffer, uint16_t nWord)
+{
+    *pBuffer = char(nWord & 0xFF);
+    *(pBuffer + 1) = char((nWord >> 8) & 0xFF);
+}
+
+/** Write a 32-bit, little-endian word to a char buffer */
+void SetLE32(char* pBuffer, uint32_t nWord)
+{
+    *pBuffer = char(nWord & 0xFF);
+    *(pBuffer + 1) = char((nWord >> 8) & 0xFF);
+    *(pBuffer + 2) = char((nWord >> 16) & 0xFF);
+    *(pBuffer + 3) = char((nWord >> 24) & 0xFF);
+}
@@ -0,0 +1,66 @@
+/** Functions for reading and writing RIFF WAVE files and converting their samples to 32-bit float
+*   Reads PCM and IEEE float formats including WAVE_FORMAT_EXTENSIBLE - BWF files are WAVE files whose extra chunks are skipped
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+static const unsigned int WAVE_MAP_SIZE = 65536; //Quantity of bytes mapped from start of file when reading chunks
+//Sample encodings of WAVE data
+static const int WAVE_UNSUPPORTED   = -1;
+static const int WAVE_FLOAT         = 0; //32-bit IEEE float - native encoding
+static const int WAVE_PCM16         = 1; //16-bit signed integer
+static const int WAVE_PCM24         = 2; //24-bit signed integer, packed
+static const int WAVE_PCM32         = 3; //32-bit signed integer
+static const unsigned int WAVE_SAMPLE_BYTES[] = {4, 2, 3, 4}; //Quantity of bytes in each sample of each encoding
+static const char* const WAVE_ENCODING_NAMES[] = {"float", "16-bit", "24-bit", "32-bit"}; //Names of encodings
+
+/** Structure describing location of chunks within a RIFF WAVE file **/
+struct WaveLayout
+{
+    bool bRiff; //True if file starts with RIFF WAVE header
+    char acFormat[40]; //Start of format chunk content - long enough for WAVE_FORMAT_EXTENSIBLE
+    bool bFormat; //True if format chunk found
+    int nEncoding; //Sample encoding [WAVE_FLOAT | WAVE_PCM16 | WAVE_PCM24 | WAVE_PCM32 | WAVE_UNSUPPORTED]
+    off_t offData; //Offset of data chunk content
+    uint32_t nDataSize; //Size of data chunk from its header
+};
+
+/** @brief  Find format and data chunks using a single mapped read of the start of the file
+*   @param  fd File descriptor of WAVE file
+*   @param  pLayout Pointer to structure to populate
+*   @return <i>bool</i> True if file is RIFF WAVE with a data chunk
+*   @note   Chunks beyond the mapped region are found with individual reads
+*/
+bool ReadWaveLayout(int fd, WaveLayout* pLayout);
+
+/** @brief  Convert samples to 32-bit float in range [-1, 1)
+*   @param  pSource Samples in file encoding
+*   @param  pDest Buffer to populate - may overlap source if it does not start after it, e.g. to expand samples in place
+*   @param  nSamples Quantity of samples
+*   @param  nEncoding Sample encoding [WAVE_FLOAT | WAVE_PCM16 | WAVE_PCM24 | WAVE_PCM32]
+*   @note   Uses SSE2 or NEON where available - realtime safe
+*/
+void ConvertToFloat(const char* pSource, float* pDest, size_t nSamples, int nEncoding);
+
+/** @brief  Writes a minimal 44 byte RIFF header for 32-bit float data
+*   @param  fd File descriptor of WAVE file
+*   @param  nWaveSize Quantity of bytes in wave data
+*   @param  nChannels Quantity of channels
+*   @param  nSampleRate Samples per second
+*/
+void WriteWaveHeader(int fd, unsigned int nWaveSize, unsigned int nChannels, unsigned int nSampleRate);
+
+/** @brief  Write a 16-bit, little-endian word to a char buffer
+*   @param  pBuffer Buffer to write to
+*   @param  nWord 16-bit word to write
+*/
+void SetLE16(char* pBuffer, uint16_t nWord);
+
+/** @brief  Write a 32-bit, little-endian word to a char buffer
+*   @param  pBuffer Buffer to write to
+*   @param  nWord 32-bit word to write
+*/
+void SetLE32(char* pBuffer, uint32_t nWord);
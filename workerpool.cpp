@@ -0,0 +1,168 @@
+#include "workerpool.h"
+#include "rtarena.h"
+#include "trace.h"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sched.h>
+
+static void FutexWait(std::atomic<int>* pWord, int nValue)
+{
+    syscall(SYS_futex, (int*)pWord, FUTEX_WAIT_PRIVATE, nValue, NULL, NULL, 0);
+}
+
+static void FutexWake(std::atomic<int>* pWord)
+{
+    syscall(SYS_futex, (int*)pWord, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline void CpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+WorkerPool::WorkerPool() :
+    m_nWorkers(0),
+    m_nGeneration(0),
+    m_nSleepers(0),
+    m_nPending(0),
+    m_bRunning(false),
+    m_nStarted(0),
+    m_pFunction(NULL),
+    m_pContext(NULL),
+    m_nItems(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+}
+
+unsigned int WorkerPool::Start(unsigned int nWorkers, int nPriority)
+{
+    Stop();
+    if(nWorkers > WORKER_MAX)
+        nWorkers = WORKER_MAX;
+    m_bRunning = true;
+    m_nStarted = 0;
+    for(unsigned int i = 0; i < nWorkers; ++i)
+    {
+        //Worker waits for generation after current so work dispatched before it is scheduled is not missed
+        m_aArgs[i].pPool = this;
+        m_aArgs[i].nWorker = i;
+        m_aArgs[i].nGeneration = m_nGeneration;
+        pthread_t thread;
+        bool bCreated = false;
+        if(nPriority > 0)
+        {
+            pthread_attr_t attr;
+            sched_param param;
+            param.sched_priority = nPriority;
+            pthread_attr_init(&attr);
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+            pthread_attr_setschedparam(&attr, &param);
+            bCreated = (0 == pthread_create(&thread, &attr, ThreadProc, &m_aArgs[i]));
+            pthread_attr_destroy(&attr);
+        }
+        if(!bCreated)
+            bCreated = (0 == pthread_create(&thread, NULL, ThreadProc, &m_aArgs[i])); //Realtime scheduling not permitted
+        if(!bCreated)
+            break;
+        m_vThreads.push_back(thread);
+    }
+    //Wait until every worker is ready so work is only shared between workers that will see it
+    while(m_nStarted < m_vThreads.size())
+        sched_yield();
+    m_nWorkers = m_vThreads.size();
+    return m_nWorkers;
+}
+
+void WorkerPool::Stop()
+{
+    if(m_vThreads.empty())
+        return;
+    m_nWorkers = 0;
+    m_bRunning = false;
+    ++m_nGeneration;
+    FutexWake(&m_nGeneration);
+    for(std::vector<pthread_t>::iterator it = m_vThreads.begin(); it != m_vThreads.end(); ++it)
+        pthread_join(*it, NULL);
+    m_vThreads.clear();
+}
+
+void* WorkerPool::ThreadProc(void* pArgs)
+{
+    WorkerArgs* pWorkerArgs = (WorkerArgs*)pArgs;
+    pWorkerArgs->pPool->Work(pWorkerArgs->nWorker, pWorkerArgs->nGeneration);
+    return NULL;
+}
+
+void WorkerPool::Work(unsigned int nWorker, int nSeen)
+{
+    PrefaultStack();
+    TraceThread("mix worker");
+    ++m_nStarted;
+    while(true)
+    {
+        for(unsigned int nSpin = 0; nSpin < WORKER_SPIN && m_nGeneration == nSeen; ++nSpin)
+            CpuRelax();
+        if(m_nGeneration == nSeen)
+        {
+            //Sleeper count is checked by dispatcher after advancing generation so wake cannot be missed
+            ++m_nSleepers;
+            if(m_nGeneration == nSeen)
+                FutexWait(&m_nGeneration, nSeen);
+            --m_nSleepers;
+            continue;
+        }
+        nSeen = m_nGeneration;
+        if(!m_bRunning)
+            break;
+        RtEnter();
+        TraceBegin("mix");
+        Execute(nWorker + 1);
+        TraceEnd("mix");
+        RtLeave();
+        m_nPending.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void WorkerPool::Execute(unsigned int nPart)
+{
+    unsigned int nParts = m_nWorkers + 1;
+    unsigned int nFirst = (unsigned long)m_nItems * nPart / nParts;
+    unsigned int nEnd = (unsigned long)m_nItems * (nPart + 1) / nParts;
+    if(nFirst < nEnd)
+        m_pFunction(m_pContext, nFirst, nEnd);
+}
+
+void WorkerPool::Run(WorkFunction pFunction, void* pContext, unsigned int nItems)
+{
+    if(0 == m_nWorkers)
+    {
+        pFunction(pContext, 0, nItems);
+        return;
+    }
+    m_pFunction = pFunction;
+    m_pContext = pContext;
+    m_nItems = nItems;
+    m_nPending = m_nWorkers;
+    ++m_nGeneration;
+    if(m_nSleepers)
+        FutexWake(&m_nGeneration);
+    Execute(0);
+    for(unsigned int nSpin = 0; m_nPending.load(std::memory_order_acquire); ++nSpin)
+    {
+        if(nSpin < WORKER_SPIN)
+            CpuRelax();
+        else
+            sched_yield(); //Worker may be waiting for this core
+    }
+}
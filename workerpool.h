@@ -0,0 +1,76 @@
+/** Class providing a fork-join pool of realtime worker threads
+*   Workers are created in advance and wait for work by spinning briefly then sleeping on a futex
+*   Work is split into contiguous ranges of items, one range per thread including the caller
+*   Dispatching and joining do not allocate or take locks so may be used from the audio thread
+*/
+#pragma once
+
+#include <atomic>
+#include <pthread.h>
+#include <vector>
+
+static const unsigned int WORKER_MAX    = 8; //Maximum quantity of worker threads
+static const unsigned int WORKER_SPIN   = 4000; //Quantity of polls before worker sleeps
+
+/** @brief  Function performing work on a range of items
+*   @param  pContext Pointer to data shared by all ranges
+*   @param  nFirst Index of first item
+*   @param  nEnd Index after last item
+*/
+typedef void (*WorkFunction)(void* pContext, unsigned int nFirst, unsigned int nEnd);
+
+class WorkerPool
+{
+    public:
+        WorkerPool();
+        ~WorkerPool();
+
+        /** @brief  Create worker threads
+        *   @param  nWorkers Quantity of threads in addition to caller
+        *   @param  nPriority SCHED_FIFO priority of workers or 0 for default scheduling
+        *   @return <i>unsigned int</i> Quantity of workers created
+        *   @note   Workers use default scheduling if realtime scheduling is not permitted
+        */
+        unsigned int Start(unsigned int nWorkers, int nPriority);
+
+        /** @brief  Stop and join worker threads
+        */
+        void Stop();
+
+        /** @brief  Split work between caller and workers and wait for all to complete
+        *   @param  pFunction Function to call for each range of items
+        *   @param  pContext Pointer passed to function
+        *   @param  nItems Quantity of items
+        *   @note   Realtime safe - call from one thread only
+        */
+        void Run(WorkFunction pFunction, void* pContext, unsigned int nItems);
+
+        /** @brief  Get quantity of worker threads
+        */
+        unsigned int GetWorkers() { return m_nWorkers; }
+
+    private:
+        /** Structure passed to each worker thread - filled before thread is created so worker need not read shared state to start */
+        struct WorkerArgs
+        {
+            WorkerPool* pPool; //Pool owning worker
+            unsigned int nWorker; //Index of worker
+            int nGeneration; //Generation at which worker starts waiting for work
+        };
+
+        static void* ThreadProc(void* pArgs);
+        void Work(unsigned int nWorker, int nSeen);
+        void Execute(unsigned int nPart);
+
+        std::vector<pthread_t> m_vThreads; //Worker threads - only accessed by thread calling Start and Stop
+        WorkerArgs m_aArgs[WORKER_MAX]; //Arguments of each worker thread
+        unsigned int m_nWorkers; //Quantity of workers sharing work - set once all have started
+        std::atomic<int> m_nGeneration; //Incremented to dispatch work (futex word)
+        std::atomic<int> m_nSleepers; //Quantity of workers sleeping on futex
+        std::atomic<unsigned int> m_nPending; //Quantity of workers yet to complete current work
+        std::atomic<bool> m_bRunning; //True whilst workers should run
+        std::atomic<unsigned int> m_nStarted; //Quantity of workers ready to wait for work
+        WorkFunction m_pFunction; //Current work
+        void* m_pContext; //Current work context
+        unsigned int m_nItems; //Quantity of items in current work
+};